@@ -5,6 +5,7 @@ import subprocess
 import json
 import os
 import socket
+import struct
 import time
 from github import Github
 
@@ -54,12 +55,14 @@ except Exception as e:
     print(f"Warning: Could not initialize GitHub client: {e}")
     g = None
 
-def query_cpp_server(query: str) -> dict:
+def query_cpp_server(query: str, limit: int = 100, snippets: bool = False) -> dict:
     """
     Send a search query to the C++ server via socket connection.
 
     Args:
         query: The search query term
+        limit: Maximum number of ranked results to return
+        snippets: Also return the top results' matching lines, highlighted
 
     Returns:
         Dictionary with search results
@@ -76,21 +79,19 @@ def query_cpp_server(query: str) -> dict:
         sock.connect((CPP_SERVER_HOST, CPP_SERVER_PORT))
 
         # Prepare JSON request
-        request = json.dumps({"query": query})
+        request = json.dumps({"query": query, "limit": limit, "snippets": snippets})
 
         # Send request to server
         sock.sendall(request.encode() + b'\n')
 
-        # Receive response
+        # Receive response; the server keeps the connection open, so
+        # read up to the newline that ends it
         response = b''
-        while True:
-            try:
-                chunk = sock.recv(4096)
-                if not chunk:
-                    break
-                response += chunk
-            except socket.timeout:
+        while not response.endswith(b'\n'):
+            chunk = sock.recv(4096)
+            if not chunk:
                 break
+            response += chunk
 
         sock.close()
 
@@ -128,13 +129,99 @@ def query_cpp_server(query: str) -> dict:
             detail=f"Invalid JSON response from C++ server: {str(e)}"
         )
 
+def _recv_exactly(sock: socket.socket, size: int) -> bytes:
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise socket.error("C++ server closed the connection")
+        data += chunk
+    return data
+
+def query_cpp_server_batch(queries: List[str], offset: int = 0, limit: int = 100) -> List[dict]:
+    """
+    Run several ranked queries in one round trip, using the C++ server's
+    length-prefixed binary protocol (see search-engine/src/binary_protocol.h).
+
+    Args:
+        queries: The search queries
+        offset: Results to skip in each query's ranking (for paging)
+        limit: Maximum number of results per query
+
+    Returns:
+        One dictionary per query, in order: query, count, results and
+        scores, or query and error
+
+    Raises:
+        HTTPException: If connection fails or server is unavailable
+    """
+    # u8 version, u16 count, then per query: u8 kind (0 = ranked),
+    # i8 fuzzy (-1 = fall back to fuzzy), u32 offset, u32 limit, text
+    body = struct.pack(">BH", 1, len(queries))
+    for query in queries:
+        text = query.encode()
+        body += struct.pack(">BbIII", 0, -1, offset, limit, len(text)) + text
+
+    answers = [{"query": query} for query in queries]
+    try:
+        with socket.create_connection((CPP_SERVER_HOST, CPP_SERVER_PORT), timeout=CPP_SERVER_TIMEOUT) as sock:
+            sock.sendall(struct.pack(">I", len(body)) + body)
+
+            # Frames until END: BEGIN, RESULTS (one or more) or ERROR per query
+            while True:
+                (length,) = struct.unpack(">I", _recv_exactly(sock, 4))
+                frame = _recv_exactly(sock, length)
+                frame_type, index = struct.unpack(">BH", frame[:3])
+                if frame_type == 1:
+                    flags, count = struct.unpack(">BI", frame[3:8])
+                    answers[index].update(count=count, results=[], scores=[])
+                    if flags & 1:
+                        answers[index]["fuzzy"] = True
+                elif frame_type == 2:
+                    (count,) = struct.unpack(">H", frame[3:5])
+                    position = 5
+                    for _ in range(count):
+                        score, name_length = struct.unpack(">fH", frame[position:position + 6])
+                        position += 6
+                        answers[index]["results"].append(frame[position:position + name_length].decode())
+                        answers[index]["scores"].append(score)
+                        position += name_length
+                elif frame_type == 3:
+                    (message_length,) = struct.unpack(">H", frame[3:5])
+                    message = frame[5:5 + message_length].decode()
+                    if index == 0xFFFF:
+                        raise HTTPException(status_code=400, detail=message)
+                    answers[index]["error"] = message
+                elif frame_type == 4:
+                    return answers
+
+    except socket.timeout:
+        raise HTTPException(
+            status_code=504,
+            detail="C++ server connection timed out"
+        )
+    except ConnectionRefusedError:
+        raise HTTPException(
+            status_code=503,
+            detail="C++ server is not running. Start it with: ./search-engine/build/search_engine --server"
+        )
+    except socket.error as e:
+        raise HTTPException(
+            status_code=500,
+            detail=f"Connection error with C++ server: {str(e)}"
+        )
+
 @app.get("/")
 async def root():
     """Root endpoint"""
     return {"message": "Search Engine API", "status": "running"}
 
 @app.get("/search", response_model=dict)
-async def search(q: str = Query(..., description="Search query term")):
+async def search(
+    q: str = Query(..., description="Search query term"),
+    limit: int = Query(100, ge=0, le=10000, description="Maximum number of results"),
+    snippets: bool = Query(False, description="Include highlighted matching lines for the top results")
+):
     """
     Search endpoint that connects to the C++ server
 
@@ -143,21 +230,48 @@ async def search(q: str = Query(..., description="Search query term")):
 
     Args:
         q: The search query term
+        limit: Maximum number of results, best BM25 match first
+        snippets: Include the top results' matching lines
 
     Returns:
         Dictionary with search results containing:
         - query: The search term
-        - results: List of file paths matching the query
+        - results: List of file paths matching the query, best match first
         - count: Number of results
+        - snippets: With snippets=true, each top result's lines with
+          highlight byte ranges
     """
     if not q or not q.strip():
         raise HTTPException(status_code=400, detail="Query parameter 'q' cannot be empty")
 
     # Query the C++ server
-    search_results = query_cpp_server(q)
+    search_results = query_cpp_server(q, limit, snippets)
 
     return search_results
 
+@app.get("/search/batch", response_model=dict)
+async def search_batch(
+    q: List[str] = Query(..., description="Search queries; repeat the parameter for each"),
+    offset: int = Query(0, ge=0, le=990000, description="Results to skip in each ranking"),
+    limit: int = Query(100, ge=0, le=10000, description="Maximum number of results per query")
+):
+    """
+    Batch search endpoint: runs every query in one request to the C++ server
+
+    Args:
+        q: The search queries
+        offset: Results to skip, for paging through a ranking
+        limit: Maximum number of results per query, best BM25 match first
+
+    Returns:
+        Dictionary with a "searches" list, one entry per query, each with
+        query, count, results and scores, or query and error
+    """
+    if len(q) > 1000 or any(not query.strip() for query in q):
+        raise HTTPException(status_code=400, detail="Give 1 to 1000 non-empty 'q' parameters")
+
+    return {"searches": query_cpp_server_batch(q, offset, limit)}
+
 @app.get("/build", response_model=dict)
 async def build_index():
     """
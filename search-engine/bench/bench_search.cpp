@@ -0,0 +1,373 @@
+// Benchmarks building, loading and querying an index of a corpus directory
+// (for a reproducible one, see gen_corpus.cpp) and prints the numbers as
+// one JSON object, for tracking regressions:
+//
+//   bench_search CORPUS [--work-dir DIR] [--threads N] [--iterations N] [--output FILE]
+//
+//   build    seconds to index and to write the files, MB/s and files/s of
+//            the whole build, peak RSS
+//   load     seconds for IndexSnapshot::load() and peak RSS, i.e. what a
+//            server needs before its first query
+//   queries  latency percentiles of single searches (parse and search, top
+//            DEFAULT_RESULT_LIMIT) for rare terms, common terms and
+//            two-term ANDs, each class cycling through 16 queries picked
+//            from the index's own term table
+//
+// Each phase runs in a child process, so its peak RSS is its own and the
+// load starts cold in the page cache's sense of "not yet mapped". The
+// index files are written to the work directory (default: bench-index).
+
+#include "index_snapshot.h"
+#include "indexer.h"
+#include "json_util.h"
+#include "mapped_index.h"
+#include "query.h"
+#include "segments.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX process headers
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t QUERIES_PER_CLASS = 16;
+
+struct BenchOptions {
+    std::string corpus;
+    std::string workDir = "bench-index";
+    unsigned threads = 0;     // Build threads, 0 = all cores
+    size_t iterations = 2000; // Timed searches per query class
+    std::string output;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+// Runs `phase` in a child process with its stdout silenced (the engine
+// logs progress there). Returns the JSON members the phase produced, with
+// its peak RSS added, or an empty string if it failed.
+std::string runPhase(const std::function<std::string()>& phase) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << "Error: pipe failed" << std::endl;
+        return "";
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Error: fork failed" << std::endl;
+        return "";
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        std::string result = phase();
+        ssize_t ignored = write(fds[1], result.data(), result.size());
+        (void)ignored;
+        _exit(result.empty() ? 1 : 0);
+    }
+
+    close(fds[1]);
+    std::string result;
+    char buffer[4096];
+    for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+        result.append(buffer, static_cast<size_t>(n));
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return "";
+    }
+    // ru_maxrss is in KiB on Linux
+    return result + ",\"peak_rss_mb\":" + number(static_cast<double>(usage.ru_maxrss) / 1024.0);
+}
+
+std::string buildPhase(const BenchOptions& options) {
+    BuildOptions build;
+    build.numThreads = options.threads;
+
+    auto start = std::chrono::steady_clock::now();
+    Indexer indexer;
+    indexer.buildIndex(options.corpus, build);
+    double indexSeconds = secondsSince(start);
+
+    auto saveStart = std::chrono::steady_clock::now();
+    indexer.saveIndexToFile("index.bin");
+    indexer.saveManifestToFile("manifest.bin");
+    bool positions = indexer.savePositionsToFile("positions.bin");
+    bool trigrams = indexer.saveTrigramsToFile("trigrams.bin");
+    double saveSeconds = secondsSince(saveStart);
+    double totalSeconds = secondsSince(start);
+    if (!positions) {
+        std::remove("positions.bin");
+    }
+    if (!trigrams) {
+        std::remove("trigrams.bin");
+    }
+
+    uint64_t bytes = 0;
+    const DocumentTable& documents = indexer.getDocuments();
+    for (uint32_t docId = 0; docId < documents.size(); ++docId) {
+        bytes += documents.fileInfo(docId).size;
+    }
+    size_t files = documents.size();
+    if (files == 0) {
+        std::cerr << "Error: No files indexed under " << options.corpus << std::endl;
+        return "";
+    }
+
+    std::ostringstream json;
+    json << "\"files\":" << files << ",\"bytes\":" << bytes << ",\"index_seconds\":" << number(indexSeconds)
+         << ",\"save_seconds\":" << number(saveSeconds) << ",\"total_seconds\":" << number(totalSeconds)
+         << ",\"mb_per_s\":" << number(static_cast<double>(bytes) / (1 << 20) / totalSeconds)
+         << ",\"files_per_s\":" << number(static_cast<double>(files) / totalSeconds);
+    return json.str();
+}
+
+std::string loadPhase() {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<const IndexSnapshot> snapshot = IndexSnapshot::load();
+    double seconds = secondsSince(start);
+    if (!snapshot) {
+        return "";
+    }
+
+    uint64_t fileBytes = 0;
+    for (const char* name : {"index.bin", "manifest.bin", "positions.bin", "trigrams.bin"}) {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(name, error);
+        fileBytes += error ? 0 : size;
+    }
+
+    std::ostringstream json;
+    json << "\"seconds\":" << number(seconds) << ",\"terms\":" << snapshot->numTerms()
+         << ",\"index_file_mb\":" << number(static_cast<double>(fileBytes) / (1 << 20));
+    return json.str();
+}
+
+// Queries of each class, chosen from the term table so any corpus works.
+// Terms are ranked by document count (ties by term), and each class takes
+// QUERIES_PER_CLASS evenly spaced from its band.
+struct QuerySet {
+    std::vector<std::string> rare;    // In at most max(2, 0.1%) of the documents
+    std::vector<std::string> common;  // The most frequent terms
+    std::vector<std::string> multi;   // Two terms each from 1% to 10%
+};
+
+QuerySet pickQueries(const MappedIndex& index) {
+    struct Term {
+        uint32_t docCount;
+        std::string_view text;
+    };
+    std::vector<Term> terms;
+    for (uint32_t id = 0; id < index.numTerms(); ++id) {
+        const auto& entry = index.termAt(id);
+        std::string_view text = index.termString(entry);
+        // Plain words only, so every query parses back to the same term
+        bool plain = text.size() >= 3 && std::all_of(text.begin(), text.end(), [](char c) {
+            return (c >= 'a' && c <= 'z') || c == '_';
+        });
+        if (plain) {
+            terms.push_back({entry.docCount, text});
+        }
+    }
+    std::sort(terms.begin(), terms.end(), [](const Term& a, const Term& b) {
+        return a.docCount != b.docCount ? a.docCount > b.docCount : a.text < b.text;
+    });
+
+    auto spaced = [&](size_t first, size_t last, size_t count) {
+        std::vector<std::string> picked;
+        for (size_t i = 0; i < count && first < last; ++i) {
+            picked.emplace_back(terms[first + (last - first) * i / count].text);
+        }
+        return picked;
+    };
+    auto band = [&](uint32_t maxDocs) {
+        return static_cast<size_t>(std::partition_point(terms.begin(), terms.end(), [&](const Term& term) {
+                                       return term.docCount > maxDocs;
+                                   }) - terms.begin());
+    };
+
+    QuerySet queries;
+    uint32_t numDocs = index.numDocs();
+    queries.common = spaced(0, std::min(terms.size(), QUERIES_PER_CLASS), QUERIES_PER_CLASS);
+    queries.rare = spaced(band(std::max<uint32_t>(2, numDocs / 1000)), terms.size(), QUERIES_PER_CLASS);
+
+    size_t first = band(numDocs / 10);
+    size_t last = std::max(first, band(numDocs / 100));
+    std::vector<std::string> mid = spaced(first, last, QUERIES_PER_CLASS * 2);
+    for (size_t i = 0; i + 1 < mid.size(); i += 2) {
+        queries.multi.push_back(mid[i] + " " + mid[i + 1]);
+    }
+    return queries;
+}
+
+// Latency percentiles in microseconds over `iterations` searches
+std::string timeQueries(const IndexSnapshot& snapshot, const std::vector<std::string>& queries,
+                        size_t iterations) {
+    if (queries.empty()) {
+        return "null";
+    }
+
+    std::vector<QueryNode> parsed(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        std::string error;
+        parseQuery(queries[i], snapshot.tokenizer(), parsed[i], error);
+        snapshot.search(parsed[i], DEFAULT_RESULT_LIMIT);  // Warm up the pages it touches
+    }
+
+    std::vector<double> micros;
+    micros.reserve(iterations);
+    size_t results = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        const std::string& text = queries[i % queries.size()];
+        auto start = std::chrono::steady_clock::now();
+        QueryNode query;
+        std::string error;
+        parseQuery(text, snapshot.tokenizer(), query, error);
+        results += snapshot.search(query, DEFAULT_RESULT_LIMIT).size();
+        micros.push_back(secondsSince(start) * 1e6);
+    }
+    std::sort(micros.begin(), micros.end());
+
+    double total = 0.0;
+    for (double value : micros) {
+        total += value;
+    }
+    auto percentile = [&](double p) {
+        return micros[std::min(micros.size() - 1, static_cast<size_t>(p * static_cast<double>(micros.size())))];
+    };
+
+    std::ostringstream json;
+    json << "{\"queries\":" << queries.size() << ",\"example\":\"" << jsonEscape(queries[0]) << "\""
+         << ",\"mean_results\":" << number(static_cast<double>(results) / iterations)
+         << ",\"mean_us\":" << number(total / iterations) << ",\"p50_us\":" << number(percentile(0.50))
+         << ",\"p90_us\":" << number(percentile(0.90)) << ",\"p99_us\":" << number(percentile(0.99))
+         << ",\"max_us\":" << number(micros.back()) << "}";
+    return json.str();
+}
+
+std::string queryPhase(const BenchOptions& options) {
+    std::shared_ptr<const IndexSnapshot> snapshot = IndexSnapshot::load();
+    MappedIndex index;
+    if (!snapshot || !index.open("index.bin")) {
+        return "";
+    }
+    QuerySet queries = pickQueries(index);
+
+    std::ostringstream json;
+    json << "\"rare\":" << timeQueries(*snapshot, queries.rare, options.iterations)
+         << ",\"common\":" << timeQueries(*snapshot, queries.common, options.iterations)
+         << ",\"multi_term\":" << timeQueries(*snapshot, queries.multi, options.iterations);
+    return json.str();
+}
+
+bool parseCount(const char* text, long long& value) {
+    try {
+        value = std::stoll(text);
+        return value >= 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "Usage: " << programName
+              << " CORPUS [--work-dir DIR] [--threads N] [--iterations N] [--output FILE]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool ok = true;
+        long long value = 0;
+        if (arg == "--work-dir" && i + 1 < argc) {
+            options.workDir = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            ok = parseCount(argv[++i], value);
+            options.threads = static_cast<unsigned>(value);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            ok = parseCount(argv[++i], value) && value > 0;
+            options.iterations = static_cast<size_t>(value);
+        } else if (options.corpus.empty() && arg.rfind("--", 0) != 0) {
+            options.corpus = arg;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Error: Invalid option '" << arg << "'" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.corpus.empty() || !std::filesystem::is_directory(options.corpus)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // The engine reads and writes its files in the current directory
+    std::error_code error;
+    options.corpus = std::filesystem::absolute(options.corpus).string();
+    std::filesystem::path output = options.output.empty() ? std::filesystem::path()
+                                                           : std::filesystem::absolute(options.output);
+    std::filesystem::create_directories(options.workDir, error);
+    std::filesystem::current_path(options.workDir, error);
+    if (error) {
+        std::cerr << "Error: Can't use work directory " << options.workDir << ": " << error.message() << std::endl;
+        return 1;
+    }
+    std::filesystem::remove(CATALOG_FILE, error);
+
+    std::string build = runPhase([&] { return buildPhase(options); });
+    std::string load = build.empty() ? "" : runPhase(loadPhase);
+    std::string queries = load.empty() ? "" : runPhase([&] { return queryPhase(options); });
+    if (queries.empty()) {
+        std::cerr << "Error: Benchmark failed" << std::endl;
+        return 1;
+    }
+
+    unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::ostringstream json;
+    json << "{\"benchmark\":\"search_engine\",\"corpus\":\"" << jsonEscape(options.corpus) << "\",\"threads\":" << threads
+         << ",\n \"build\":{" << build << "},\n \"load\":{" << load << "},\n \"queries\":{" << queries << "}}\n";
+
+    std::cout << json.str();
+    if (!output.empty()) {
+        std::ofstream file(output);
+        file << json.str();
+        if (!file) {
+            std::cerr << "Error writing " << output.string() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,366 @@
+// Writes a synthetic, Python-like corpus for benchmarks. The output depends
+// only on the options: the random numbers and the Zipf sampling are
+// computed here rather than with <random>'s distributions, whose output
+// differs between standard libraries.
+//
+//   gen_corpus --out DIR [--files N] [--kb N] [--vocab N] [--zipf S] [--seed N]
+//
+// Files go to DIR/pkg_NNN/mod_NNNNN.py, 100 per directory. Identifiers are
+// drawn from a vocabulary of `vocab` words with Zipf exponent `zipf`, so a
+// few terms are in nearly every file and most are rare. File sizes vary
+// uniformly between a quarter and 1.75 times `kb`.
+//
+// DIR.params records the options. A second run with the same options
+// leaves DIR alone; with other options it replaces DIR, but only if the
+// params file shows gen_corpus wrote it.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct CorpusOptions {
+    std::string out;
+    uint64_t files = 2000;
+    uint64_t kb = 8;        // Mean file size in KiB
+    uint64_t vocab = 50000;
+    double zipf = 1.1;
+    uint64_t seed = 1;
+
+    std::string params() const {
+        std::ostringstream text;
+        text << "files=" << files << " kb=" << kb << " vocab=" << vocab << " zipf=" << zipf << " seed=" << seed
+             << "\n";
+        return text.str();
+    }
+};
+
+// SplitMix64: small, fast and fully specified
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, 1)
+    double unit() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    // Uniform in [0, n)
+    uint64_t below(uint64_t n) { return static_cast<uint64_t>(unit() * static_cast<double>(n)); }
+
+private:
+    uint64_t state_;
+};
+
+// The most frequent words, so the common terms look like code
+const char* const COMMON_WORDS[] = {
+    "data", "value", "name", "result", "item", "index", "key", "path", "config", "request",
+    "response", "user", "error", "node", "list", "count", "size", "type", "text", "file",
+    "model", "state", "event", "message", "buffer", "context", "handler", "parser", "token", "query",
+    "client", "server", "cache", "table", "field", "record", "stream", "option", "target", "source",
+    "array", "frame", "layer", "batch", "score", "weight", "image", "channel",
+};
+
+const char* const SYLLABLES[] = {
+    "ka", "lo", "mi", "ne", "ru", "ta", "vi", "so", "pe", "da", "ri", "fu", "ge", "ho", "ja", "ze",
+};
+
+// Word of a vocabulary rank: a common word, then two or more syllables
+// spelling the rank in base 16
+std::string wordAt(uint64_t rank) {
+    const size_t common = sizeof(COMMON_WORDS) / sizeof(COMMON_WORDS[0]);
+    if (rank < common) {
+        return COMMON_WORDS[rank];
+    }
+    std::string word;
+    for (uint64_t n = rank - common + 16; n > 0; n /= 16) {
+        word += SYLLABLES[n % 16];
+    }
+    return word;
+}
+
+class Vocabulary {
+public:
+    Vocabulary(uint64_t size, double exponent) {
+        words_.reserve(size);
+        cumulative_.reserve(size);
+        double total = 0.0;
+        for (uint64_t rank = 0; rank < size; ++rank) {
+            words_.push_back(wordAt(rank));
+            total += 1.0 / std::pow(static_cast<double>(rank + 1), exponent);
+            cumulative_.push_back(total);
+        }
+        for (double& c : cumulative_) {
+            c /= total;
+        }
+    }
+
+    const std::string& sample(Random& random) const {
+        auto it = std::upper_bound(cumulative_.begin(), cumulative_.end(), random.unit());
+        size_t rank = std::min(static_cast<size_t>(it - cumulative_.begin()), words_.size() - 1);
+        return words_[rank];
+    }
+
+private:
+    std::vector<std::string> words_;
+    std::vector<double> cumulative_;
+};
+
+// Module text from templates. Placeholders are filled left to right, so
+// the random draws happen in a fixed order:
+//
+//   {w} word   {s} snake_case name   {c} CamelCase name
+//   {t} a few words of text   {n} a number below 1000
+class ModuleWriter {
+public:
+    ModuleWriter(const Vocabulary& vocabulary, Random& random) : vocabulary_(vocabulary), random_(random) {}
+
+    std::string module(size_t targetBytes) {
+        out_.clear();
+        for (size_t imports = 1 + random_.below(4); imports > 0; --imports) {
+            line(0, random_.below(2) == 0 ? "import {w}" : "from {w}.{w} import {s}, {c}");
+        }
+        out_ += "\n";
+
+        while (out_.size() < targetBytes) {
+            if (random_.below(3) == 0) {
+                classDef();
+            } else {
+                functionDef(0, false);
+            }
+        }
+        return out_;
+    }
+
+private:
+    const std::string& word() { return vocabulary_.sample(random_); }
+
+    void append(const std::string& pattern) {
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            if (pattern[i] != '{' || i + 2 >= pattern.size() || pattern[i + 2] != '}') {
+                out_ += pattern[i];
+                continue;
+            }
+            switch (pattern[i + 1]) {
+            case 'w':
+                out_ += word();
+                break;
+            case 's':
+                out_ += word();
+                if (random_.below(2) == 0) {
+                    out_ += '_';
+                    out_ += word();
+                }
+                break;
+            case 'c':
+                for (size_t parts = 2 + random_.below(2); parts > 0; --parts) {
+                    size_t start = out_.size();
+                    out_ += word();
+                    out_[start] = static_cast<char>(out_[start] - 'a' + 'A');
+                }
+                break;
+            case 't':
+                out_ += word();
+                for (size_t words = 2 + random_.below(8); words > 0; --words) {
+                    out_ += ' ';
+                    out_ += word();
+                }
+                break;
+            case 'n':
+                out_ += std::to_string(random_.below(1000));
+                break;
+            }
+            i += 2;
+        }
+    }
+
+    void line(size_t depth, const std::string& pattern) {
+        out_.append(depth * 4, ' ');
+        append(pattern);
+        out_ += '\n';
+    }
+
+    void classDef() {
+        line(0, "class {c}({c}):");
+        line(1, "\"\"\"{t}.\"\"\"");
+        out_ += "\n";
+        line(1, "def __init__(self, {s}, {s}=None):");
+        for (size_t fields = 1 + random_.below(4); fields > 0; --fields) {
+            line(2, "self.{s} = {s}");
+        }
+        for (size_t methods = 1 + random_.below(4); methods > 0; --methods) {
+            out_ += "\n";
+            functionDef(1, true);
+        }
+        out_ += "\n\n";
+    }
+
+    void functionDef(size_t depth, bool method) {
+        static const char* const SIGNATURES[] = {"()", "({s})", "({s}, {s})", "({s}, {s}, {s}={n})"};
+        static const char* const METHOD_SIGNATURES[] = {"(self)", "(self, {s})", "(self, {s}, {s})",
+                                                        "(self, {s}, {s}={n})"};
+        size_t params = random_.below(4);
+        line(depth, std::string("def {s}") + (method ? METHOD_SIGNATURES[params] : SIGNATURES[params]) + ":");
+        if (random_.below(2) == 0) {
+            line(depth + 1, "\"\"\"{t}.\"\"\"");
+        }
+        for (size_t statements = 2 + random_.below(8); statements > 0; --statements) {
+            statement(depth + 1, 2);
+        }
+        line(depth + 1, "return {s}");
+        if (depth == 0) {
+            out_ += "\n\n";
+        }
+    }
+
+    void statement(size_t depth, size_t nesting) {
+        static const char* const SIMPLE[] = {
+            "{s} = {s}({s}, {s})",
+            "self.{s} = {s}.{w}",
+            "# {t}",
+            "{s}.append({s}[{n}])",
+            "raise {c}Error(\"{t}\")",
+            "logger.info(\"{t}: %s\", {s})",
+            "{s} += {n}",
+        };
+        const size_t simple = sizeof(SIMPLE) / sizeof(SIMPLE[0]);
+        size_t kind = random_.below(nesting > 0 ? simple + 2 : simple);
+        if (kind < simple) {
+            line(depth, SIMPLE[kind]);
+        } else if (kind == simple) {
+            line(depth, "if {s} is not None and {s} > {n}:");
+            statement(depth + 1, nesting - 1);
+        } else {
+            line(depth, "for {w} in {s}.{w}():");
+            statement(depth + 1, nesting - 1);
+            statement(depth + 1, nesting - 1);
+        }
+    }
+
+    const Vocabulary& vocabulary_;
+    Random& random_;
+    std::string out_;
+};
+
+bool parseUnsigned(const char* text, uint64_t& value) {
+    try {
+        long long parsed = std::stoll(text);
+        if (parsed < 0) {
+            return false;
+        }
+        value = static_cast<uint64_t>(parsed);
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "Usage: " << programName
+              << " --out DIR [--files N] [--kb N] [--vocab N] [--zipf S] [--seed N]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CorpusOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool ok = i + 1 < argc;
+        if (arg == "--out" && ok) {
+            options.out = argv[++i];
+        } else if (arg == "--files" && ok) {
+            ok = parseUnsigned(argv[++i], options.files);
+        } else if (arg == "--kb" && ok) {
+            ok = parseUnsigned(argv[++i], options.kb) && options.kb > 0;
+        } else if (arg == "--vocab" && ok) {
+            ok = parseUnsigned(argv[++i], options.vocab) && options.vocab > 0;
+        } else if (arg == "--zipf" && ok) {
+            try {
+                options.zipf = std::stod(argv[++i]);
+                ok = options.zipf > 0.0;
+            } catch (const std::exception&) {
+                ok = false;
+            }
+        } else if (arg == "--seed" && ok) {
+            ok = parseUnsigned(argv[++i], options.seed);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Error: Invalid option '" << arg << "'" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.out.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Regenerate only when the options change, and never over a directory
+    // gen_corpus didn't write
+    std::filesystem::path out(options.out);
+    std::string paramsFile = out.string() + ".params";
+    std::error_code error;
+    if (std::filesystem::exists(out)) {
+        std::ifstream stamp(paramsFile);
+        std::string previous((std::istreambuf_iterator<char>(stamp)), std::istreambuf_iterator<char>());
+        if (!stamp.is_open()) {
+            std::cerr << "Error: " << out.string() << " exists and was not written by gen_corpus" << std::endl;
+            return 1;
+        }
+        if (previous == options.params()) {
+            std::cout << "Corpus " << out.string() << " is up to date" << std::endl;
+            return 0;
+        }
+        std::filesystem::remove_all(out, error);
+    }
+    std::filesystem::remove(paramsFile, error);
+
+    Random random(options.seed);
+    Vocabulary vocabulary(options.vocab, options.zipf);
+    ModuleWriter writer(vocabulary, random);
+
+    uint64_t totalBytes = 0;
+    for (uint64_t i = 0; i < options.files; ++i) {
+        char directory[32];
+        char name[32];
+        std::snprintf(directory, sizeof(directory), "pkg_%03llu", static_cast<unsigned long long>(i / 100));
+        std::snprintf(name, sizeof(name), "mod_%05llu.py", static_cast<unsigned long long>(i));
+        std::filesystem::create_directories(out / directory, error);
+        if (error) {
+            std::cerr << "Error creating " << (out / directory).string() << ": " << error.message() << std::endl;
+            return 1;
+        }
+
+        size_t target = static_cast<size_t>(static_cast<double>(options.kb * 1024) * (0.25 + 1.5 * random.unit()));
+        std::string content = writer.module(target);
+        std::ofstream file(out / directory / name, std::ios::binary);
+        file.write(content.data(), static_cast<std::streamsize>(content.size()));
+        if (!file) {
+            std::cerr << "Error writing " << (out / directory / name).string() << std::endl;
+            return 1;
+        }
+        totalBytes += content.size();
+    }
+
+    std::ofstream stamp(paramsFile);
+    stamp << options.params();
+
+    std::cout << "Wrote " << options.files << " files, " << totalBytes << " bytes to " << out.string() << std::endl;
+    return 0;
+}
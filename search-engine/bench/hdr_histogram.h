@@ -0,0 +1,110 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// High dynamic range histogram (after Gil Tene's HdrHistogram): counts
+// values from 0 to `highest` with `significantDigits` decimal digits of
+// precision everywhere in that range, in a fixed number of counters.
+//
+// Values below 2 * 10^digits (rounded up to a power of two) are counted
+// exactly. Above that, each power-of-two range is split into the same
+// number of equal sub-buckets, so the bucket width grows with the value
+// and the relative error stays below 10^-digits.
+class HdrHistogram {
+public:
+    explicit HdrHistogram(uint64_t highest = 3600ull * 1000 * 1000 * 1000, int significantDigits = 3)
+        : highest_(highest) {
+        uint64_t needed = 2;
+        for (int i = 0; i < significantDigits; ++i) {
+            needed *= 10;
+        }
+        subBits_ = 1;
+        while ((uint64_t(1) << subBits_) < needed) {
+            ++subBits_;
+        }
+        counts_.assign(indexOf(highest_) + 1, 0);
+    }
+
+    // Values above `highest` are counted as `highest`
+    void record(uint64_t value) {
+        value = std::min(value, highest_);
+        ++counts_[indexOf(value)];
+        ++count_;
+        sum_ += static_cast<double>(value);
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    // Adds another histogram's counts; both must have the same shape
+    void add(const HdrHistogram& other) {
+        for (size_t i = 0; i < counts_.size() && i < other.counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? sum_ / static_cast<double>(count_) : 0.0; }
+
+    // Smallest value that `percentile` percent of the recorded values are
+    // at or below, as the top of its bucket (never above max())
+    uint64_t valueAtPercentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        double fraction = std::min(std::max(percentile, 0.0), 100.0) / 100.0;
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * count_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highestEquivalent(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    uint64_t highest_;
+    unsigned subBits_;  // log2 of the counters per power-of-two range, doubled
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    double sum_ = 0.0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+
+    // Counters [0, 2^subBits) hold exact values; after them, each range
+    // [2^(subBits+b-1), 2^(subBits+b)) for b >= 1 has 2^(subBits-1)
+    // counters of width 2^b
+    size_t indexOf(uint64_t value) const {
+        if (value < (uint64_t(1) << subBits_)) {
+            return static_cast<size_t>(value);
+        }
+        unsigned bits = 64 - static_cast<unsigned>(__builtin_clzll(value));
+        unsigned shift = bits - subBits_;
+        uint64_t half = uint64_t(1) << (subBits_ - 1);
+        return static_cast<size_t>((uint64_t(1) << subBits_) + (shift - 1) * half + ((value >> shift) - half));
+    }
+
+    uint64_t highestEquivalent(size_t index) const {
+        uint64_t exact = uint64_t(1) << subBits_;
+        if (index < exact) {
+            return index;
+        }
+        uint64_t half = exact >> 1;
+        unsigned shift = static_cast<unsigned>((index - exact) / half) + 1;
+        uint64_t lowest = (half + (index - exact) % half) << shift;
+        return lowest + (uint64_t(1) << shift) - 1;
+    }
+};
+
+#endif // HDR_HISTOGRAM_H
@@ -0,0 +1,711 @@
+// Load generator for the search server: sends newline-delimited JSON
+// requests over persistent TCP connections and reports throughput and
+// latency percentiles, to compare server configurations and find the
+// load where latency falls apart.
+//
+//   load_gen (--log FILE | --index index.bin) (--qps R[,R...] | --concurrency N[,N...])
+//            [--port 9000] [--host 127.0.0.1] [--connections 16] [--threads 1]
+//            [--duration 10] [--warmup 2] [--timeout 10] [--zipf 1.0] [--max-terms 2]
+//            [--limit N] [--seed 1] [--output FILE]
+//
+// Requests come from a query log, one per line (JSON requests are sent
+// as they are, anything else as {"query":"<line>"}), replayed in order
+// and from the start again when it runs out. Or they're sampled from an
+// index's term table: terms ranked by document count, drawn with a Zipf
+// distribution over the ranks, one to --max-terms per query.
+//
+// --qps is open loop: requests are sent on a fixed schedule, pipelined
+// over --connections, whether or not earlier ones were answered. Latency
+// is measured from when a request was due, not when it went out, so a
+// stalled server is charged for the requests it held up (no coordinated
+// omission). --concurrency is closed loop: N connections each send their
+// next request as soon as the previous one is answered.
+//
+// Several comma-separated rates or concurrencies run one after another,
+// e.g. --qps 1000,2000,4000,8000 to find the saturation point. Each step
+// discards its first --warmup seconds, measures for --duration seconds,
+// then waits up to --timeout seconds for the stragglers; requests still
+// unanswered then are counted with the latency they had reached.
+
+#include "hdr_histogram.h"
+#include "json_util.h"
+#include "mapped_index.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX networking headers
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t SAMPLED_REQUESTS = 1 << 16;  // Pool drawn once from --index and cycled
+constexpr const char* ERROR_PREFIX = "{\"error\"";
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    int port = 9000;
+    std::string log;
+    std::string index;
+    std::vector<double> steps;  // Requests per second (open loop) or connections (closed loop)
+    bool openLoop = true;
+    unsigned connections = 16;  // Open loop
+    unsigned threads = 1;
+    double duration = 10.0;
+    double warmup = 2.0;
+    double timeout = 10.0;
+    double zipf = 1.0;
+    unsigned maxTerms = 2;
+    long long limit = -1;  // Sampled requests: the server's default
+    uint64_t seed = 1;
+    std::string output;
+};
+
+uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+std::string number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+// SplitMix64, so a seed gives the same requests everywhere
+struct Random {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+};
+
+bool loadLog(const std::string& filename, std::vector<std::string>& requests) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Error: Can't open " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '{') {
+            requests.push_back(line + '\n');
+        } else {
+            requests.push_back("{\"query\":\"" + jsonEscape(line) + "\"}\n");
+        }
+    }
+    if (requests.empty()) {
+        std::cerr << "Error: " << filename << " has no requests" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool sampleIndex(const LoadOptions& options, std::vector<std::string>& requests) {
+    MappedIndex index;
+    if (!index.open(options.index)) {
+        return false;
+    }
+
+    struct Term {
+        uint32_t docCount;
+        std::string_view text;
+    };
+    std::vector<Term> terms;
+    terms.reserve(index.numTerms());
+    for (uint32_t id = 0; id < index.numTerms(); ++id) {
+        const auto& entry = index.termAt(id);
+        terms.push_back({entry.docCount, index.termString(entry)});
+    }
+    if (terms.empty()) {
+        std::cerr << "Error: " << options.index << " has no terms" << std::endl;
+        return false;
+    }
+    std::sort(terms.begin(), terms.end(), [](const Term& a, const Term& b) {
+        return a.docCount != b.docCount ? a.docCount > b.docCount : a.text < b.text;
+    });
+
+    std::vector<double> cdf(terms.size());
+    double total = 0.0;
+    for (size_t rank = 0; rank < terms.size(); ++rank) {
+        total += 1.0 / std::pow(static_cast<double>(rank + 1), options.zipf);
+        cdf[rank] = total;
+    }
+
+    Random random{options.seed};
+    std::string limit = options.limit >= 0 ? ",\"limit\":" + std::to_string(options.limit) : "";
+    for (size_t i = 0; i < SAMPLED_REQUESTS; ++i) {
+        unsigned count = 1 + static_cast<unsigned>(random.next() % options.maxTerms);
+        std::string query;
+        for (unsigned t = 0; t < count; ++t) {
+            size_t rank = static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), random.unit() * total) -
+                                              cdf.begin());
+            query += (t ? " " : "") + std::string(terms[std::min(rank, terms.size() - 1)].text);
+        }
+        requests.push_back("{\"query\":\"" + jsonEscape(query) + "\"" + limit + "}\n");
+    }
+    return true;
+}
+
+int connectTo(const LoadOptions& options) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &addresses) != 0) {
+        std::cerr << "Error: Can't resolve " << options.host << std::endl;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // Connect blocking-style: wait for the handshake to finish
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        struct pollfd writable = {fd, POLLOUT, 0};
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (poll(&writable, 1, -1) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        std::cerr << "Error: Can't connect to " << options.host << ":" << options.port << std::endl;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// What one step measured, summed over its threads
+struct StepResult {
+    HdrHistogram latency;     // Nanoseconds, requests due inside the measured window
+    uint64_t sent = 0;        // Due inside the window
+    uint64_t completed = 0;   // Responses received inside the window, any request
+    uint64_t errors = 0;      // Answered with {"error":...}, e.g. "Server busy"
+    uint64_t unanswered = 0;  // Still waiting at the timeout
+    bool failed = false;
+
+    void add(const StepResult& other) {
+        latency.add(other.latency);
+        sent += other.sent;
+        completed += other.completed;
+        errors += other.errors;
+        unanswered += other.unanswered;
+        failed = failed || other.failed;
+    }
+};
+
+// Schedule shared by a step's threads, in steady-clock nanoseconds
+struct StepClock {
+    uint64_t start;
+    uint64_t measureFrom;  // After the warmup
+    uint64_t end;          // No requests are due at or after this
+    uint64_t deadline;     // Give up on unanswered requests
+};
+
+// One thread's connections, driven by its own epoll loop
+class LoadWorker {
+public:
+    LoadWorker(const LoadOptions& options, const std::vector<std::string>& requests,
+               std::atomic<uint64_t>& nextRequest)
+        : options_(options), requests_(requests), nextRequest_(nextRequest) {}
+
+    ~LoadWorker() {
+        for (Connection& conn : connections_) {
+            if (conn.fd >= 0) {
+                close(conn.fd);
+            }
+        }
+        if (timerFd_ >= 0) {
+            close(timerFd_);
+        }
+        if (epollFd_ >= 0) {
+            close(epollFd_);
+        }
+    }
+
+    bool connect(unsigned count) {
+        epollFd_ = epoll_create1(0);
+        if (epollFd_ < 0) {
+            std::cerr << "Error: epoll_create1 failed" << std::endl;
+            return false;
+        }
+        connections_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            connections_[i].fd = connectTo(options_);
+            if (connections_[i].fd < 0) {
+                return false;
+            }
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, connections_[i].fd, &event);
+        }
+        return true;
+    }
+
+    // Open loop: requests due at first, first + interval, ... before
+    // clock.end. Closed loop (interval 0): one outstanding per connection.
+    void run(const StepClock& clock, uint64_t first, uint64_t interval) {
+        clock_ = clock;
+        bool openLoop = interval > 0;
+        uint64_t due = first;
+        if (openLoop) {
+            timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = TIMER;
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &event);
+        } else {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(clock_.start - std::min(clock_.start, nowNs())));
+            uint64_t now = nowNs();
+            for (Connection& conn : connections_) {
+                send(conn, now);
+            }
+        }
+
+        std::vector<struct epoll_event> events(connections_.size() + 1);
+        while (!result_.failed) {
+            uint64_t now = nowNs();
+            if (openLoop) {
+                while (due < clock_.end && due <= now) {
+                    send(leastLoaded(), due);
+                    due += interval;
+                }
+                if (due < clock_.end) {
+                    armTimer(due);
+                }
+            }
+
+            bool sending = openLoop ? due < clock_.end : now < clock_.end;
+            if (!sending && outstanding_ == 0) {
+                break;
+            }
+            if (now >= clock_.deadline) {
+                giveUp(now);
+                break;
+            }
+
+            // The timer wakes the open loop; the closed loop only needs to
+            // notice the end of the step
+            uint64_t wakeAt = sending ? clock_.end : clock_.deadline;
+            int timeoutMs = openLoop && sending ? -1 : static_cast<int>((wakeAt - std::min(wakeAt, now)) / 1000000 + 1);
+            int n = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), timeoutMs);
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.u64 == TIMER) {
+                    uint64_t expirations;
+                    ssize_t ignored = read(timerFd_, &expirations, sizeof(expirations));
+                    (void)ignored;
+                    continue;
+                }
+                Connection& conn = connections_[events[i].data.u64];
+                if (events[i].events & EPOLLOUT) {
+                    flush(conn);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive(conn, openLoop);
+                }
+            }
+        }
+    }
+
+    const StepResult& result() const { return result_; }
+
+private:
+    static constexpr uint64_t TIMER = UINT64_MAX;
+
+    struct Connection {
+        int fd = -1;
+        std::string output;
+        size_t written = 0;
+        bool wantWrite = false;
+        std::string input;
+        std::deque<uint64_t> due;  // When each unanswered request was due, oldest first
+    };
+
+    const LoadOptions& options_;
+    const std::vector<std::string>& requests_;
+    std::atomic<uint64_t>& nextRequest_;
+    std::vector<Connection> connections_;
+    int epollFd_ = -1;
+    int timerFd_ = -1;
+    StepClock clock_{};
+    uint64_t outstanding_ = 0;
+    StepResult result_;
+
+    bool measured(uint64_t due) const { return due >= clock_.measureFrom && due < clock_.end; }
+
+    Connection& leastLoaded() {
+        Connection* best = &connections_[0];
+        for (Connection& conn : connections_) {
+            if (conn.due.size() < best->due.size()) {
+                best = &conn;
+            }
+        }
+        return *best;
+    }
+
+    void send(Connection& conn, uint64_t due) {
+        uint64_t index = nextRequest_.fetch_add(1, std::memory_order_relaxed);
+        conn.output += requests_[index % requests_.size()];
+        conn.due.push_back(due);
+        ++outstanding_;
+        if (measured(due)) {
+            ++result_.sent;
+        }
+        flush(conn);
+    }
+
+    void flush(Connection& conn) {
+        while (conn.written < conn.output.size()) {
+            ssize_t n = ::send(conn.fd, conn.output.data() + conn.written, conn.output.size() - conn.written,
+                               MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fail("send failed");
+                    return;
+                }
+                break;
+            }
+            conn.written += static_cast<size_t>(n);
+        }
+        if (conn.written == conn.output.size()) {
+            conn.output.clear();
+            conn.written = 0;
+        }
+
+        bool wantWrite = !conn.output.empty();
+        if (wantWrite != conn.wantWrite) {
+            conn.wantWrite = wantWrite;
+            struct epoll_event event;
+            event.events = static_cast<uint32_t>(EPOLLIN) | (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            event.data.u64 = static_cast<uint64_t>(&conn - connections_.data());
+            epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &event);
+        }
+    }
+
+    void receive(Connection& conn, bool openLoop) {
+        char buffer[65536];
+        while (true) {
+            ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n == 0) {
+                fail("the server closed a connection");
+                return;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fail("recv failed");
+                }
+                break;
+            }
+
+            // Only the new bytes can finish a response
+            size_t scanFrom = conn.input.size();
+            conn.input.append(buffer, static_cast<size_t>(n));
+            size_t lineStart = 0;
+            uint64_t now = nowNs();
+            for (size_t newline; (newline = conn.input.find('\n', scanFrom)) != std::string::npos;) {
+                if (conn.due.empty()) {
+                    fail("response without a request");
+                    return;
+                }
+                uint64_t due = conn.due.front();
+                conn.due.pop_front();
+                --outstanding_;
+                if (now >= clock_.measureFrom && now < clock_.end) {
+                    ++result_.completed;
+                }
+                if (measured(due)) {
+                    result_.latency.record(now - std::min(now, due));
+                    if (conn.input.compare(lineStart, std::strlen(ERROR_PREFIX), ERROR_PREFIX) == 0) {
+                        ++result_.errors;
+                    }
+                }
+                lineStart = scanFrom = newline + 1;
+                if (!openLoop && now < clock_.end) {
+                    send(conn, now);
+                }
+            }
+            conn.input.erase(0, lineStart);
+        }
+    }
+
+    void giveUp(uint64_t now) {
+        for (Connection& conn : connections_) {
+            for (uint64_t due : conn.due) {
+                if (measured(due)) {
+                    result_.latency.record(now - std::min(now, due));
+                    ++result_.unanswered;
+                }
+            }
+        }
+    }
+
+    void armTimer(uint64_t due) {
+        struct itimerspec spec;
+        std::memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = static_cast<time_t>(due / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(due % 1000000000);
+        timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void fail(const char* what) {
+        if (!result_.failed) {
+            std::cerr << "Error: " << what << std::endl;
+        }
+        result_.failed = true;
+    }
+};
+
+// Runs one rate (open loop) or concurrency (closed loop)
+StepResult runStep(const LoadOptions& options, const std::vector<std::string>& requests,
+                   std::atomic<uint64_t>& nextRequest, double step) {
+    unsigned connections = options.openLoop ? options.connections : static_cast<unsigned>(step);
+    unsigned threads = std::max(1u, std::min(options.threads, connections));
+
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+    StepResult total;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.push_back(std::make_unique<LoadWorker>(options, requests, nextRequest));
+        unsigned share = connections / threads + (t < connections % threads ? 1 : 0);
+        if (!workers.back()->connect(share)) {
+            total.failed = true;
+            return total;
+        }
+    }
+
+    // steady_clock and CLOCK_MONOTONIC are the same clock on Linux, which
+    // the open loop's timerfd relies on
+    StepClock clock;
+    clock.start = nowNs() + 10000000;
+    clock.measureFrom = clock.start + static_cast<uint64_t>(options.warmup * 1e9);
+    clock.end = clock.measureFrom + static_cast<uint64_t>(options.duration * 1e9);
+    clock.deadline = clock.end + static_cast<uint64_t>(options.timeout * 1e9);
+
+    // Thread t sends the global schedule's requests t, t + threads, ...
+    std::vector<std::thread> running;
+    for (unsigned t = 0; t < threads; ++t) {
+        uint64_t first = clock.start;
+        uint64_t interval = 0;
+        if (options.openLoop) {
+            first += static_cast<uint64_t>(t * 1e9 / step);
+            interval = std::max<uint64_t>(1, static_cast<uint64_t>(threads * 1e9 / step));
+        }
+        running.emplace_back([&, t, first, interval] { workers[t]->run(clock, first, interval); });
+    }
+    for (std::thread& thread : running) {
+        thread.join();
+    }
+    for (const auto& worker : workers) {
+        total.add(worker->result());
+    }
+    return total;
+}
+
+bool parseList(const std::string& text, std::vector<double>& values) {
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        try {
+            size_t used = 0;
+            double value = std::stod(item, &used);
+            if (used != item.size() || !(value > 0)) {
+                return false;
+            }
+            values.push_back(value);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return !values.empty();
+}
+
+bool parseNumber(const char* text, double& value) {
+    try {
+        size_t used = 0;
+        value = std::stod(text, &used);
+        return used == std::strlen(text) && value >= 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "Usage: " << programName << " (--log FILE | --index index.bin) (--qps R[,R...] | --concurrency N[,N...])\n"
+              << "       [--port 9000] [--host 127.0.0.1] [--connections 16] [--threads 1]\n"
+              << "       [--duration 10] [--warmup 2] [--timeout 10] [--zipf 1.0] [--max-terms 2]\n"
+              << "       [--limit N] [--seed 1] [--output FILE]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    bool haveSteps = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Invalid option '" << arg << "'" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        double parsed = 0.0;
+        bool ok = true;
+        if (arg == "--qps" || arg == "--concurrency") {
+            ok = !haveSteps && parseList(value, options.steps);
+            options.openLoop = arg == "--qps";
+            haveSteps = true;
+        } else if (arg == "--log") {
+            options.log = value;
+        } else if (arg == "--index") {
+            options.index = value;
+        } else if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (!parseNumber(value, parsed)) {
+            ok = false;
+        } else if (arg == "--port") {
+            options.port = static_cast<int>(parsed);
+        } else if (arg == "--connections") {
+            options.connections = static_cast<unsigned>(parsed);
+            ok = options.connections > 0;
+        } else if (arg == "--threads") {
+            options.threads = static_cast<unsigned>(parsed);
+            ok = options.threads > 0;
+        } else if (arg == "--duration") {
+            options.duration = parsed;
+            ok = parsed > 0;
+        } else if (arg == "--warmup") {
+            options.warmup = parsed;
+        } else if (arg == "--timeout") {
+            options.timeout = parsed;
+        } else if (arg == "--zipf") {
+            options.zipf = parsed;
+        } else if (arg == "--max-terms") {
+            options.maxTerms = static_cast<unsigned>(parsed);
+            ok = options.maxTerms > 0;
+        } else if (arg == "--limit") {
+            options.limit = static_cast<long long>(parsed);
+        } else if (arg == "--seed") {
+            options.seed = static_cast<uint64_t>(parsed);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Error: Invalid option '" << arg << " " << value << "'" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!haveSteps || options.log.empty() == options.index.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> requests;
+    if (!(options.log.empty() ? sampleIndex(options, requests) : loadLog(options.log, requests))) {
+        return 1;
+    }
+
+    std::ostringstream json;
+    json << "{\"mode\":\"" << (options.openLoop ? "open" : "closed") << "\",\"host\":\"" << jsonEscape(options.host)
+         << "\",\"port\":" << options.port << ",\"connections\":" << options.connections
+         << ",\"threads\":" << options.threads << ",\"duration_s\":" << number(options.duration)
+         << ",\"warmup_s\":" << number(options.warmup) << ",\"steps\":[";
+
+    std::atomic<uint64_t> nextRequest(0);
+    for (size_t i = 0; i < options.steps.size(); ++i) {
+        StepResult result = runStep(options, requests, nextRequest, options.steps[i]);
+        if (result.failed) {
+            return 1;
+        }
+
+        const HdrHistogram& latency = result.latency;
+        auto ms = [&](double percentile) { return static_cast<double>(latency.valueAtPercentile(percentile)) / 1e6; };
+        double achieved = static_cast<double>(result.completed) / options.duration;
+        if (i == 0) {
+            std::cout << (options.openLoop ? "target_qps" : "concurrency")
+                      << "  achieved_qps   p50_ms   p90_ms   p99_ms  p99.9_ms    max_ms   errors  unanswered" << std::endl;
+        }
+        char line[160];
+        std::snprintf(line, sizeof(line), "%10.0f  %12.1f %8.3f %8.3f %8.3f %9.3f %9.3f %8llu  %10llu",
+                      options.steps[i], achieved, ms(50), ms(90), ms(99), ms(99.9),
+                      static_cast<double>(latency.max()) / 1e6, static_cast<unsigned long long>(result.errors),
+                      static_cast<unsigned long long>(result.unanswered));
+        std::cout << line << std::endl;
+
+        json << (i ? "," : "") << "\n {\"" << (options.openLoop ? "target_qps" : "concurrency")
+             << "\":" << number(options.steps[i]) << ",\"sent\":" << result.sent
+             << ",\"achieved_qps\":" << number(achieved)
+             << ",\"errors\":" << result.errors << ",\"unanswered\":" << result.unanswered
+             << ",\"mean_ms\":" << number(latency.mean() / 1e6) << ",\"p50_ms\":" << number(ms(50))
+             << ",\"p90_ms\":" << number(ms(90)) << ",\"p99_ms\":" << number(ms(99))
+             << ",\"p999_ms\":" << number(ms(99.9)) << ",\"max_ms\":" << number(latency.max() / 1e6) << "}";
+    }
+    json << "]}\n";
+
+    if (!options.output.empty()) {
+        std::ofstream file(options.output);
+        file << json.str();
+        if (!file) {
+            std::cerr << "Error writing " << options.output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "binary_protocol.h"
+#include <algorithm>
+#include <cstring>
+
+namespace binary_protocol {
+
+namespace {
+
+void put8(std::string& out, uint8_t value) {
+    out.push_back(static_cast<char>(value));
+}
+
+void put16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void put32(std::string& out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value >> 16));
+    put16(out, static_cast<uint16_t>(value));
+}
+
+void set32(std::string& out, size_t at, uint32_t value) {
+    for (int i = 3; i >= 0; --i, value >>= 8) {
+        out[at + i] = static_cast<char>(value);
+    }
+}
+
+// Sequential reads that fail once the payload runs out
+class Reader {
+public:
+    explicit Reader(const std::string& data) : data_(data) {}
+
+    bool get8(uint8_t& value) {
+        if (!has(1)) {
+            return false;
+        }
+        value = byte(0);
+        pos_ += 1;
+        return true;
+    }
+
+    bool get16(uint16_t& value) {
+        if (!has(2)) {
+            return false;
+        }
+        value = static_cast<uint16_t>(byte(0) << 8 | byte(1));
+        pos_ += 2;
+        return true;
+    }
+
+    bool get32(uint32_t& value) {
+        if (!has(4)) {
+            return false;
+        }
+        value = static_cast<uint32_t>(byte(0)) << 24 | static_cast<uint32_t>(byte(1)) << 16 |
+                static_cast<uint32_t>(byte(2)) << 8 | byte(3);
+        pos_ += 4;
+        return true;
+    }
+
+    bool getString(std::string& value) {
+        uint32_t length;
+        if (!get32(length) || !has(length)) {
+            return false;
+        }
+        value.assign(data_, pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    bool atEnd() const { return pos_ == data_.size(); }
+
+private:
+    bool has(size_t bytes) const { return data_.size() - pos_ >= bytes; }
+    uint8_t byte(size_t i) const { return static_cast<uint8_t>(data_[pos_ + i]); }
+
+    const std::string& data_;
+    size_t pos_ = 0;
+};
+
+// Starts a frame; its length is filled in by endFrame
+size_t beginFrame(std::string& out, FrameType type, uint16_t index) {
+    size_t start = out.size();
+    put32(out, 0);
+    put8(out, static_cast<uint8_t>(type));
+    put16(out, index);
+    return start;
+}
+
+void endFrame(std::string& out, size_t start) {
+    set32(out, start, static_cast<uint32_t>(out.size() - start - 4));
+}
+
+} // namespace
+
+bool decodeBatch(const std::string& payload, std::vector<Query>& queries, std::string& error) {
+    Reader reader(payload);
+    uint8_t version;
+    uint16_t count;
+    if (!reader.get8(version) || !reader.get16(count)) {
+        error = "Truncated frame";
+        return false;
+    }
+    if (version != VERSION) {
+        error = "Unsupported protocol version " + std::to_string(version);
+        return false;
+    }
+
+    queries.clear();
+    queries.reserve(count);
+    for (uint16_t i = 0; i < count; ++i) {
+        Query query;
+        uint8_t kind;
+        uint8_t fuzzy;
+        if (!reader.get8(kind) || !reader.get8(fuzzy) || !reader.get32(query.offset) ||
+            !reader.get32(query.limit) || !reader.getString(query.text)) {
+            error = "Truncated frame";
+            return false;
+        }
+        if (kind > static_cast<uint8_t>(Kind::Regex)) {
+            error = "Unknown query kind " + std::to_string(kind);
+            return false;
+        }
+        query.kind = static_cast<Kind>(kind);
+        query.fuzzy = static_cast<int8_t>(fuzzy);
+        if (query.fuzzy < -1 || query.fuzzy > 2) {
+            error = "Invalid fuzzy edits " + std::to_string(query.fuzzy);
+            return false;
+        }
+        queries.push_back(std::move(query));
+    }
+    if (!reader.atEnd()) {
+        error = "Trailing bytes after the last query";
+        return false;
+    }
+    return true;
+}
+
+void appendBegin(std::string& out, uint16_t index, uint8_t flags, uint32_t count) {
+    size_t start = beginFrame(out, FrameType::Begin, index);
+    put8(out, flags);
+    put32(out, count);
+    endFrame(out, start);
+}
+
+void appendError(std::string& out, uint16_t index, const std::string& message) {
+    size_t start = beginFrame(out, FrameType::Error, index);
+    uint16_t length = static_cast<uint16_t>(std::min<size_t>(message.size(), 0xFFFF));
+    put16(out, length);
+    out.append(message, 0, length);
+    endFrame(out, start);
+}
+
+void appendEnd(std::string& out, uint16_t count) {
+    size_t start = beginFrame(out, FrameType::End, count);
+    endFrame(out, start);
+}
+
+void ResultsFrame::begin(std::string& out, uint16_t index) {
+    start_ = beginFrame(out, FrameType::Results, index);
+    count_ = 0;
+    put16(out, 0);
+}
+
+void ResultsFrame::add(std::string& out, float score, std::string_view name) {
+    uint32_t bits;
+    std::memcpy(&bits, &score, sizeof(bits));
+    put32(out, bits);
+    uint16_t length = static_cast<uint16_t>(std::min<size_t>(name.size(), 0xFFFF));
+    put16(out, length);
+    out.append(name.data(), length);
+    ++count_;
+}
+
+void ResultsFrame::finish(std::string& out) {
+    // The count follows the length, type and index
+    size_t at = start_ + 7;
+    out[at] = static_cast<char>(count_ >> 8);
+    out[at + 1] = static_cast<char>(count_);
+    endFrame(out, start_);
+}
+
+} // namespace binary_protocol
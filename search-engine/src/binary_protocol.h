@@ -0,0 +1,79 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Length-prefixed binary protocol, served on the same port as the JSON
+// one. A connection whose first byte is 0 speaks it (a frame's length is
+// under 16 MiB, so its first byte always is; JSON lines never start so).
+//
+// Every frame is a uint32 length followed by that many bytes. Integers are
+// big-endian, strings are a length and UTF-8 bytes without a terminator.
+//
+// Request frame: a batch of queries, answered in order
+//   u8 version (1), u16 count, then per query:
+//   u8 kind, i8 fuzzy, u32 offset, u32 limit, u32 length, text
+//     kind   0 ranked query, 1 substring, 2 regex
+//     fuzzy  ranked queries: -1 exact with a fuzzy fallback, 0-2 edits
+//     offset/limit  the page of results wanted, best (or first) first;
+//                   a query whose offset + limit is over MAX_RESULT_LIMIT
+//                   gets an ERROR frame
+//
+// Response frames, each starting with u8 type and u16 query index:
+//   BEGIN    u8 flags (1 = fuzzy matches), u32 results in the page
+//   RESULTS  u16 n, then n times: f32 score, u16 length, filename
+//            (as many as that count, spread over one or more frames)
+//   ERROR    u16 length, message; in place of BEGIN and RESULTS
+//   END      after the batch; the index is the number of queries
+// Large pages are sent a few RESULTS frames at a time as the client reads
+// them, so a response never sits in server memory as a whole. An ERROR
+// with index 0xFFFF is about the frame itself and ends the batch.
+namespace binary_protocol {
+
+constexpr uint8_t VERSION = 1;
+constexpr uint16_t FRAME_ERROR_INDEX = 0xFFFF;
+
+// Cut RESULTS frames once they hold about this much
+constexpr size_t RESULTS_FRAME_BYTES = 32 * 1024;
+
+enum class Kind : uint8_t { Query = 0, Substring = 1, Regex = 2 };
+enum class FrameType : uint8_t { Begin = 1, Results = 2, Error = 3, End = 4 };
+
+constexpr uint8_t FLAG_FUZZY = 1;
+
+struct Query {
+    Kind kind = Kind::Query;
+    int fuzzy = -1;
+    uint32_t offset = 0;
+    uint32_t limit = 0;
+    std::string text;
+};
+
+// Reads a request frame's payload (without the length). Returns false and
+// sets `error` if it is malformed.
+bool decodeBatch(const std::string& payload, std::vector<Query>& queries, std::string& error);
+
+// Whole frames, length included
+void appendBegin(std::string& out, uint16_t index, uint8_t flags, uint32_t count);
+void appendError(std::string& out, uint16_t index, const std::string& message);
+void appendEnd(std::string& out, uint16_t count);
+
+// Builds one RESULTS frame: begin(), add() per result, then finish()
+class ResultsFrame {
+public:
+    void begin(std::string& out, uint16_t index);
+    void add(std::string& out, float score, std::string_view name);
+    void finish(std::string& out);
+
+private:
+    size_t start_ = 0;
+    uint16_t count_ = 0;
+};
+
+} // namespace binary_protocol
+
+#endif // BINARY_PROTOCOL_H
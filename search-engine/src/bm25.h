@@ -0,0 +1,40 @@
+#ifndef BM25_H
+#define BM25_H
+
+#include <cmath>
+#include <cstdint>
+
+// Okapi BM25 with fixed parameters. A term's score in a document is
+//
+//   idf(df) * (K1 + 1) * tfNorm(tf, lengthNorm(docLength))
+//
+// The index stores per-block maxima of tfNorm, so these functions must
+// stay in sync between the writer (Indexer) and the reader (Searcher).
+namespace bm25 {
+
+constexpr float K1 = 1.2f;
+constexpr float B = 0.75f;
+
+// K1 * (1 - B + B * dl / avgdl); without length data every doc is average
+inline float lengthNorm(uint32_t docLength, float avgDocLength) {
+    if (avgDocLength <= 0.0f) {
+        return K1;
+    }
+    return K1 * (1.0f - B + B * static_cast<float>(docLength) / avgDocLength);
+}
+
+inline float tfNorm(uint32_t frequency, float lengthNorm) {
+    float tf = static_cast<float>(frequency);
+    return tf / (tf + lengthNorm);
+}
+
+// Multiplier applied to tfNorm; includes the (K1 + 1) factor
+inline float termWeight(uint32_t docCount, uint32_t numDocs) {
+    float df = static_cast<float>(docCount);
+    float n = static_cast<float>(numDocs > docCount ? numDocs : docCount);
+    return std::log(1.0f + (n - df + 0.5f) / (df + 0.5f)) * (K1 + 1.0f);
+}
+
+} // namespace bm25
+
+#endif // BM25_H
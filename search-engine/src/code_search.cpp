@@ -0,0 +1,750 @@
+#include "code_search.h"
+#include "intersect.h"
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <iterator>
+
+// POSIX file headers
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// A regex piece is tracked as the set of strings it matches exactly while
+// that set stays this small; past it only the trigrams it needs are kept
+constexpr size_t MAX_EXACT_STRINGS = 16;
+
+// Character classes with more members than this match too much to help
+constexpr size_t MAX_CLASS_SIZE = 8;
+
+// Regex steps between looks at the clock
+constexpr uint32_t DEADLINE_CHECK_STEPS = 4096;
+
+// Thrown out of std::regex_search when the deadline passes
+struct DeadlinePassed {};
+
+// A line's bytes as std::regex_search reads them, checking the deadline
+// every DEADLINE_CHECK_STEPS moves forward. The backtracking matcher moves
+// forward for each byte it matches or each start it tries, so however a
+// pattern backtracks it is stopped.
+class TimedIterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char*;
+    using reference = const char&;
+
+    // Shared by the copies of one line's iterators
+    struct Clock {
+        const MatchDeadline& deadline;
+        uint32_t steps = 0;
+    };
+
+    TimedIterator() = default;
+    TimedIterator(const char* p, Clock* clock) : p_(p), clock_(clock) {}
+
+    reference operator*() const { return *p_; }
+
+    TimedIterator& operator++() {
+        step();
+        ++p_;
+        return *this;
+    }
+    TimedIterator operator++(int) {
+        TimedIterator old = *this;
+        ++*this;
+        return old;
+    }
+    TimedIterator& operator--() {
+        --p_;
+        return *this;
+    }
+    TimedIterator operator--(int) {
+        TimedIterator old = *this;
+        --p_;
+        return old;
+    }
+
+    bool operator==(const TimedIterator& other) const { return p_ == other.p_; }
+    bool operator!=(const TimedIterator& other) const { return p_ != other.p_; }
+
+private:
+    void step() {
+        if (++clock_->steps == DEADLINE_CHECK_STEPS) {
+            clock_->steps = 0;
+            if (!clock_->deadline.check()) {
+                throw DeadlinePassed();
+            }
+        }
+    }
+
+    const char* p_ = nullptr;
+    Clock* clock_ = nullptr;
+};
+
+TrigramQuery matchAll() {
+    return TrigramQuery();
+}
+
+TrigramQuery matchTrigram(uint32_t key) {
+    TrigramQuery query;
+    query.type = TrigramQuery::Type::Trigram;
+    query.trigram = key;
+    return query;
+}
+
+// AND or OR of two queries, simplified and flattened
+TrigramQuery combine(TrigramQuery::Type type, TrigramQuery a, TrigramQuery b) {
+    using Type = TrigramQuery::Type;
+    Type absorbing = type == Type::And ? Type::None : Type::All;
+    Type neutral = type == Type::And ? Type::All : Type::None;
+    if (a.type == absorbing || b.type == neutral) {
+        return a;
+    }
+    if (b.type == absorbing || a.type == neutral) {
+        return b;
+    }
+
+    TrigramQuery result;
+    result.type = type;
+    for (TrigramQuery* side : {&a, &b}) {
+        if (side->type == type) {
+            for (auto& child : side->children) {
+                result.children.push_back(std::move(child));
+            }
+        } else {
+            result.children.push_back(std::move(*side));
+        }
+    }
+    return result;
+}
+
+// Every trigram of the string; anything if it is shorter than three bytes
+TrigramQuery matchString(const std::string& text) {
+    std::vector<uint32_t> keys;
+    for (size_t i = 0; i + 3 <= text.size(); ++i) {
+        keys.push_back(trigramKey(text.data() + i));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    TrigramQuery query = matchAll();
+    for (uint32_t key : keys) {
+        query = combine(TrigramQuery::Type::And, std::move(query), matchTrigram(key));
+    }
+    return query;
+}
+
+TrigramQuery matchAny(const std::vector<std::string>& strings) {
+    TrigramQuery query;
+    query.type = TrigramQuery::Type::None;
+    for (const auto& text : strings) {
+        query = combine(TrigramQuery::Type::Or, std::move(query), matchString(text));
+    }
+    return query;
+}
+
+char foldByte(char c) {
+    return static_cast<char>(foldTrigramByte(static_cast<unsigned char>(c)));
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// What a piece of a regex can match: exactly one of `strings` (lower-
+// cased, as trigram keys are), or else text satisfying `query`
+struct PieceInfo {
+    bool exact = true;
+    std::vector<std::string> strings{std::string()};
+    TrigramQuery query;
+
+    static PieceInfo anything() {
+        PieceInfo info;
+        info.exact = false;
+        return info;
+    }
+
+    static PieceInfo byte(char c) {
+        PieceInfo info;
+        info.strings[0] = std::string(1, foldByte(c));
+        return info;
+    }
+
+    TrigramQuery toQuery() const { return exact ? matchAny(strings) : query; }
+};
+
+// Derives the trigram query of an ECMAScript regex, after Russ Cox's
+// "Regular Expression Matching with a Trigram Index", simplified: exact
+// string sets are concatenated and alternated while small, and anything
+// the analysis doesn't follow is treated as matching any text. The regex
+// has already compiled, so the syntax is known to be valid.
+class RegexAnalyzer {
+public:
+    explicit RegexAnalyzer(std::string_view pattern) : pattern_(pattern) {}
+
+    // The query, and in `literals` strings as written of which every
+    // match contains one: the longest run of plain characters of each
+    // top-level alternative. Empty if some alternative has none.
+    TrigramQuery analyze(std::vector<std::string>& literals) {
+        PieceInfo info = alternation(0);
+        literals = literals_;
+        for (const auto& literal : literals) {
+            if (literal.empty()) {
+                literals.clear();
+                break;
+            }
+        }
+        return pos_ == pattern_.size() ? info.toQuery() : matchAll();
+    }
+
+private:
+    bool atEnd() const { return pos_ >= pattern_.size(); }
+    char peek() const { return pattern_[pos_]; }
+
+    PieceInfo alternation(int depth) {
+        std::vector<PieceInfo> branches;
+        do {
+            if (!branches.empty()) {
+                ++pos_;  // '|'
+            }
+            if (depth == 0) {
+                literals_.emplace_back();
+            }
+            branches.push_back(concatenation(depth));
+        } while (!atEnd() && peek() == '|');
+        if (branches.size() == 1) {
+            return std::move(branches[0]);
+        }
+
+        size_t total = 0;
+        bool exact = true;
+        for (const auto& branch : branches) {
+            exact = exact && branch.exact;
+            total += branch.strings.size();
+        }
+        PieceInfo result;
+        if (exact && total <= MAX_EXACT_STRINGS) {
+            result.strings.clear();
+            for (const auto& branch : branches) {
+                result.strings.insert(result.strings.end(), branch.strings.begin(), branch.strings.end());
+            }
+            std::sort(result.strings.begin(), result.strings.end());
+            result.strings.erase(std::unique(result.strings.begin(), result.strings.end()), result.strings.end());
+            return result;
+        }
+        result.exact = false;
+        result.query.type = TrigramQuery::Type::None;
+        for (const auto& branch : branches) {
+            result.query = combine(TrigramQuery::Type::Or, std::move(result.query), branch.toQuery());
+        }
+        return result;
+    }
+
+    PieceInfo concatenation(int depth) {
+        // Exact pieces are multiplied out into `tail`; once that grows too
+        // big, or a piece isn't exact, the tail's trigrams join `query`
+        TrigramQuery query = matchAll();
+        bool exact = true;
+        std::vector<std::string> tail{std::string()};
+        std::string run;  // Plain characters since the last other piece, for literals_
+
+        while (!atEnd() && peek() != '|' && peek() != ')') {
+            int plain = -1;
+            PieceInfo piece = repetition(depth, plain);
+
+            if (depth == 0) {
+                if (plain >= 0 && plain != '\n') {
+                    run += static_cast<char>(plain);
+                } else {
+                    keepLiteral(run);
+                }
+            }
+
+            if (piece.exact && tail.size() * piece.strings.size() <= MAX_EXACT_STRINGS) {
+                std::vector<std::string> product;
+                for (const auto& prefix : tail) {
+                    for (const auto& suffix : piece.strings) {
+                        product.push_back(prefix + suffix);
+                    }
+                }
+                std::sort(product.begin(), product.end());
+                product.erase(std::unique(product.begin(), product.end()), product.end());
+                tail.swap(product);
+                continue;
+            }
+
+            exact = false;
+            query = combine(TrigramQuery::Type::And, std::move(query), matchAny(tail));
+            if (piece.exact) {
+                tail = std::move(piece.strings);
+            } else {
+                query = combine(TrigramQuery::Type::And, std::move(query), std::move(piece.query));
+                tail.assign(1, std::string());
+            }
+        }
+        if (depth == 0) {
+            keepLiteral(run);
+        }
+
+        PieceInfo result;
+        if (exact) {
+            result.strings = std::move(tail);
+        } else {
+            result.exact = false;
+            result.query = combine(TrigramQuery::Type::And, std::move(query), matchAny(tail));
+        }
+        return result;
+    }
+
+    void keepLiteral(std::string& run) {
+        if (run.size() > literals_.back().size()) {
+            literals_.back() = run;
+        }
+        run.clear();
+    }
+
+    // An atom and its quantifiers. `plain` is set to the character when
+    // the piece is one unquantified literal character.
+    PieceInfo repetition(int depth, int& plain) {
+        PieceInfo atom = this->atom(depth, plain);
+
+        bool optional = false;
+        bool quantified = false;
+        while (!atEnd()) {
+            char c = peek();
+            if (c == '*' || c == '?') {
+                optional = true;
+                ++pos_;
+            } else if (c == '+') {
+                ++pos_;
+            } else if (c == '{') {
+                size_t end = pos_ + 1;
+                while (end < pattern_.size() && ((pattern_[end] >= '0' && pattern_[end] <= '9') || pattern_[end] == ',')) {
+                    ++end;
+                }
+                if (end == pos_ + 1 || pattern_[pos_ + 1] == ',' || end >= pattern_.size() || pattern_[end] != '}') {
+                    break;  // A literal '{'
+                }
+                // {n}, {n,} and {n,m}: only the minimum matters
+                optional = optional || pattern_[pos_ + 1] == '0';
+                pos_ = end + 1;
+            } else {
+                break;
+            }
+            quantified = true;
+            if (!atEnd() && peek() == '?') {
+                ++pos_;  // Lazy
+            }
+        }
+
+        if (!quantified) {
+            return atom;
+        }
+        plain = -1;
+        if (optional) {
+            return PieceInfo::anything();
+        }
+        // At least one copy: its trigrams are still needed
+        PieceInfo result = PieceInfo::anything();
+        result.query = atom.toQuery();
+        return result;
+    }
+
+    PieceInfo atom(int depth, int& plain) {
+        char c = pattern_[pos_++];
+        switch (c) {
+        case '(': {
+            bool lookahead = false;
+            if (pattern_.substr(pos_, 2) == "?:") {
+                pos_ += 2;
+            } else if (pattern_.substr(pos_, 2) == "?=" || pattern_.substr(pos_, 2) == "?!") {
+                pos_ += 2;
+                lookahead = true;
+            }
+            PieceInfo inner = alternation(depth + 1);
+            if (!atEnd() && peek() == ')') {
+                ++pos_;
+            }
+            // Lookaheads match no text of their own
+            return lookahead ? PieceInfo() : inner;
+        }
+        case '[':
+            return characterClass();
+        case '.':
+            return PieceInfo::anything();
+        case '^':
+        case '$':
+            return PieceInfo();
+        case '\\':
+            return escape(plain);
+        case '*':
+        case '+':
+        case '?':
+            return PieceInfo::anything();
+        default:
+            plain = static_cast<unsigned char>(c);
+            return PieceInfo::byte(c);
+        }
+    }
+
+    // The byte an escape outside or inside a class stands for, or -1 for
+    // \d, \w, backreferences and the like. `inClass` reads \b as backspace.
+    int escapedByte(bool inClass, bool& boundary) {
+        boundary = false;
+        if (atEnd()) {
+            return '\\';
+        }
+        char c = pattern_[pos_++];
+        switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '0': return '\0';
+        case 'b':
+            if (inClass) {
+                return '\b';
+            }
+            boundary = true;
+            return -1;
+        case 'B':
+            boundary = true;
+            return -1;
+        case 'c':
+            if (!atEnd()) {
+                return pattern_[pos_++] & 31;
+            }
+            return -1;
+        case 'x':
+        case 'u': {
+            size_t digits = c == 'x' ? 2 : 4;
+            int value = 0;
+            for (size_t i = 0; i < digits; ++i) {
+                int digit = atEnd() ? -1 : hexValue(peek());
+                if (digit < 0) {
+                    return -1;
+                }
+                value = value * 16 + digit;
+                ++pos_;
+            }
+            return value < 0x80 ? value : -1;
+        }
+        default:
+            if ((c >= '1' && c <= '9') || std::string_view("dDwWsS").find(c) != std::string_view::npos) {
+                while (c >= '1' && c <= '9' && !atEnd() && peek() >= '0' && peek() <= '9') {
+                    ++pos_;
+                }
+                return -1;
+            }
+            return static_cast<unsigned char>(c);
+        }
+    }
+
+    PieceInfo escape(int& plain) {
+        bool boundary;
+        int byte = escapedByte(false, boundary);
+        if (boundary) {
+            return PieceInfo();
+        }
+        if (byte < 0) {
+            return PieceInfo::anything();
+        }
+        plain = byte;
+        return PieceInfo::byte(static_cast<char>(byte));
+    }
+
+    PieceInfo characterClass() {
+        bool negated = !atEnd() && peek() == '^';
+        if (negated) {
+            ++pos_;
+        }
+
+        bool members[256] = {};
+        bool tooBroad = negated;
+        while (!atEnd() && peek() != ']') {
+            int low = classByte();
+            if (low >= 0 && pos_ + 1 < pattern_.size() && peek() == '-' && pattern_[pos_ + 1] != ']') {
+                ++pos_;
+                int high = classByte();
+                if (high < 0 || high - low >= static_cast<int>(MAX_CLASS_SIZE * 2)) {
+                    tooBroad = true;
+                } else {
+                    for (int b = low; b <= high; ++b) {
+                        members[static_cast<unsigned char>(foldByte(static_cast<char>(b)))] = true;
+                    }
+                }
+            } else if (low < 0) {
+                tooBroad = true;
+            } else {
+                members[static_cast<unsigned char>(foldByte(static_cast<char>(low)))] = true;
+            }
+        }
+        if (!atEnd()) {
+            ++pos_;  // ']'
+        }
+
+        PieceInfo info;
+        info.strings.clear();
+        for (int b = 0; b < 256; ++b) {
+            if (members[b]) {
+                info.strings.push_back(std::string(1, static_cast<char>(b)));
+            }
+        }
+        // An empty class matches nothing, but the regex engine decides that
+        if (tooBroad || info.strings.empty() || info.strings.size() > MAX_CLASS_SIZE) {
+            return PieceInfo::anything();
+        }
+        return info;
+    }
+
+    // One member of a class, or -1 for \d and friends
+    int classByte() {
+        char c = pattern_[pos_++];
+        if (c != '\\') {
+            return static_cast<unsigned char>(c);
+        }
+        bool boundary;
+        return escapedByte(true, boundary);
+    }
+
+    std::string_view pattern_;
+    size_t pos_ = 0;
+    std::vector<std::string> literals_;  // Best so far, per top-level alternative
+};
+
+void evaluate(const MappedTrigrams& trigrams, const TrigramQuery& query, uint32_t numDocs,
+              std::vector<uint32_t>& out) {
+    using Type = TrigramQuery::Type;
+    out.clear();
+    switch (query.type) {
+    case Type::All:
+        out.resize(numDocs);
+        for (uint32_t docId = 0; docId < numDocs; ++docId) {
+            out[docId] = docId;
+        }
+        return;
+    case Type::None:
+        return;
+    case Type::Trigram:
+        if (const auto* entry = trigrams.find(query.trigram)) {
+            trigrams.docs(*entry, out);
+        }
+        return;
+    case Type::And: {
+        // Rarest trigram first; subqueries after the trigrams
+        std::vector<std::pair<uint64_t, const TrigramQuery*>> order;
+        for (const auto& child : query.children) {
+            uint64_t cost = UINT64_MAX;
+            if (child.type == Type::Trigram) {
+                const auto* entry = trigrams.find(child.trigram);
+                cost = entry ? entry->docCount : 0;
+            }
+            order.push_back({cost, &child});
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::vector<uint32_t> docs;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i == 0) {
+                evaluate(trigrams, *order[i].second, numDocs, out);
+            } else {
+                evaluate(trigrams, *order[i].second, numDocs, docs);
+                intersectInto(out, docs);
+            }
+            if (out.empty()) {
+                return;
+            }
+        }
+        return;
+    }
+    case Type::Or: {
+        std::vector<uint32_t> docs;
+        for (const auto& child : query.children) {
+            evaluate(trigrams, child, numDocs, docs);
+            unionInto(out, docs);
+        }
+        return;
+    }
+    }
+}
+
+} // namespace
+
+bool CodePattern::compile(const std::string& text, Mode mode, std::string& error) {
+    if (text.empty()) {
+        error = "Empty pattern";
+        return false;
+    }
+    mode_ = mode;
+    text_ = text;
+    literals_.clear();
+
+    if (mode == Mode::Substring) {
+        std::string folded(text);
+        for (char& c : folded) {
+            c = foldByte(c);
+        }
+        query_ = matchString(folded);
+        return true;
+    }
+
+    try {
+        regex_ = std::regex(text, std::regex::ECMAScript | std::regex::optimize);
+    } catch (const std::regex_error& e) {
+        error = std::string("Invalid regex: ") + e.what();
+        return false;
+    }
+    query_ = RegexAnalyzer(text).analyze(literals_);
+    return true;
+}
+
+MatchDeadline::MatchDeadline(std::chrono::milliseconds timeout)
+    : enabled_(timeout.count() > 0), end_(std::chrono::steady_clock::now() + timeout) {}
+
+bool MatchDeadline::check() const {
+    if (!enabled_) {
+        return true;
+    }
+    if (passed() || std::chrono::steady_clock::now() >= end_) {
+        passed_.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool CodePattern::matches(std::string_view content, const MatchDeadline& deadline) const {
+    if (mode_ == Mode::Substring) {
+        auto it = std::search(content.begin(), content.end(),
+                              std::boyer_moore_horspool_searcher<std::string::const_iterator>(text_.begin(), text_.end()));
+        return it != content.end();
+    }
+
+    // With literals, only lines containing one of them can match. Each
+    // literal's next occurrence is remembered until the scan passes it.
+    std::vector<size_t> next;
+    for (const auto& literal : literals_) {
+        next.push_back(content.find(literal));
+    }
+    TimedIterator::Clock clock{deadline};
+    const char* data = content.data();
+    size_t pos = 0;
+    while (pos < content.size()) {
+        size_t start = pos;
+        if (!literals_.empty()) {
+            size_t hit = std::string_view::npos;
+            for (size_t i = 0; i < literals_.size(); ++i) {
+                if (next[i] != std::string_view::npos && next[i] < pos) {
+                    next[i] = content.find(literals_[i], pos);
+                }
+                hit = std::min(hit, next[i]);
+            }
+            if (hit == std::string_view::npos) {
+                return false;
+            }
+            size_t newline = content.rfind('\n', hit);
+            start = (newline == std::string_view::npos || newline < pos) ? pos : newline + 1;
+        }
+        size_t end = content.find('\n', start);
+        if (end == std::string_view::npos) {
+            end = content.size();
+        }
+        pos = end + 1;
+        if (end > start && data[end - 1] == '\r') {
+            --end;
+        }
+        if (end - start > MAX_LINE_LENGTH) {
+            continue;
+        }
+        try {
+            if (std::regex_search(TimedIterator(data + start, &clock), TimedIterator(data + end, &clock), regex_)) {
+                return true;
+            }
+        } catch (const std::regex_error&) {
+            // Too complex for this line; treat it as no match
+        } catch (const DeadlinePassed&) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool CodePattern::matchesFile(const std::string& path, const MatchDeadline& deadline) const {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // Read rather than mapped: a file truncated while it is checked would
+    // fault a mapping. Each thread keeps its buffer for the next file.
+    thread_local std::string contents;
+    contents.resize(static_cast<size_t>(st.st_size));
+    size_t done = 0;
+    while (done < contents.size()) {
+        ssize_t n = pread(fd, &contents[done], contents.size() - done, static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    return matches(std::string_view(contents.data(), done), deadline);
+}
+
+void CodePattern::findInLine(std::string_view line, const MatchDeadline& deadline,
+                             std::vector<std::pair<size_t, size_t>>& ranges) const {
+    if (mode_ == Mode::Substring) {
+        for (size_t at = line.find(text_); at != std::string_view::npos; at = line.find(text_, at + text_.size())) {
+            ranges.emplace_back(at, at + text_.size());
+        }
+        return;
+    }
+
+    if (line.size() > MAX_LINE_LENGTH || deadline.passed()) {
+        return;
+    }
+    TimedIterator::Clock clock{deadline};
+    TimedIterator begin(line.data(), &clock);
+    TimedIterator end(line.data() + line.size(), &clock);
+    size_t first = ranges.size();
+    try {
+        for (std::regex_iterator<TimedIterator> it(begin, end, regex_), last; it != last; ++it) {
+            size_t start = static_cast<size_t>(it->position(0));
+            if (it->length(0) > 0) {
+                ranges.emplace_back(start, start + static_cast<size_t>(it->length(0)));
+            }
+        }
+    } catch (const std::regex_error&) {
+        // Too complex for this line; treat it as no match
+    } catch (const DeadlinePassed&) {
+        ranges.resize(first);
+    }
+}
+
+std::vector<uint32_t> trigramCandidates(const MappedTrigrams& trigrams, const TrigramQuery& query,
+                                        uint32_t numDocs) {
+    std::vector<uint32_t> docs;
+    evaluate(trigrams, query, numDocs, docs);
+    return docs;
+}
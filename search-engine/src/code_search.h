@@ -0,0 +1,97 @@
+#ifndef CODE_SEARCH_H
+#define CODE_SEARCH_H
+
+#include "trigrams.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Substring and regex search over the indexed files' contents:
+//
+//   requests.get(           substring: the bytes as written, case-sensitive
+//   def \w+_handler\(       regex: ECMAScript syntax, matched line by line
+//
+// The pattern becomes a boolean query over trigrams that every matching
+// file satisfies ("requests.get(" needs req AND equ AND ... AND et(). The
+// files it selects from trigrams.bin are then read and checked.
+
+// Documents a pattern can match in, as a boolean query over trigram keys
+struct TrigramQuery {
+    enum class Type { All, None, Trigram, And, Or };
+
+    Type type = Type::All;
+    uint32_t trigram = 0;                // Trigram nodes
+    std::vector<TrigramQuery> children;  // And and Or nodes, two or more
+};
+
+// When one request's regex matching gives up. std::regex backtracks, so
+// a pattern like (\w+\s?)+=$ can take exponential time on a single line;
+// matching looks at the clock every few thousand steps and stops once the
+// deadline has passed. Shared by the threads checking a request's files.
+class MatchDeadline {
+public:
+    MatchDeadline() = default;  // Never passes
+    explicit MatchDeadline(std::chrono::milliseconds timeout);  // 0 = never
+
+    MatchDeadline(const MatchDeadline&) = delete;
+    MatchDeadline& operator=(const MatchDeadline&) = delete;
+
+    // False once the deadline has passed, and from then on
+    bool check() const;
+
+    // Whether a check() found it passed, i.e. some matching was cut short
+    bool passed() const { return passed_.load(std::memory_order_relaxed); }
+
+private:
+    bool enabled_ = false;
+    std::chrono::steady_clock::time_point end_;
+    mutable std::atomic<bool> passed_{false};
+};
+
+class CodePattern {
+public:
+    enum class Mode { Substring, Regex };
+
+    // Returns false and sets `error` for an empty pattern or a malformed regex
+    bool compile(const std::string& text, Mode mode, std::string& error);
+
+    Mode mode() const { return mode_; }
+    const std::string& text() const { return text_; }
+    const TrigramQuery& trigrams() const { return query_; }
+
+    // Whether the content has a match. Regex lines longer than
+    // MAX_LINE_LENGTH bytes (minified code, data) are skipped, and once
+    // the deadline passes the answer is false.
+    bool matches(std::string_view content, const MatchDeadline& deadline) const;
+
+    // matches() on a file's contents; false if it can't be read
+    bool matchesFile(const std::string& path, const MatchDeadline& deadline) const;
+
+    // Appends the byte ranges [first, second) of the matches in one line
+    // (without its newline), for highlighting. Regex matches are found as
+    // matches() finds them, so over-long lines and lines searched after the
+    // deadline have none.
+    void findInLine(std::string_view line, const MatchDeadline& deadline,
+                    std::vector<std::pair<size_t, size_t>>& ranges) const;
+
+    static constexpr size_t MAX_LINE_LENGTH = 4096;
+
+private:
+    Mode mode_ = Mode::Substring;
+    std::string text_;
+    std::regex regex_;
+    std::vector<std::string> literals_;  // Regex: every match contains one; finds candidate lines
+    TrigramQuery query_;
+};
+
+// Sorted docIds of one segment's trigrams.bin that the query selects;
+// `numDocs` is the segment's document count, for queries matching all
+std::vector<uint32_t> trigramCandidates(const MappedTrigrams& trigrams, const TrigramQuery& query,
+                                        uint32_t numDocs);
+
+#endif // CODE_SEARCH_H
@@ -0,0 +1,240 @@
+#include "coordinator.h"
+#include "json_util.h"
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+
+Coordinator::Coordinator(const std::vector<std::string>& shards, std::chrono::milliseconds timeout, Metrics& metrics)
+    : client_(shards, timeout), metrics_(metrics) {}
+
+const std::string* Coordinator::firstError(const std::vector<ShardReply>& replies) {
+    for (const ShardReply& reply : replies) {
+        if (reply.ok && reply.response.compare(0, 9, "{\"error\":") == 0) {
+            return &reply.response;
+        }
+    }
+    return nullptr;
+}
+
+std::string Coordinator::failedShards(const std::vector<ShardReply>& replies) {
+    std::string failed;
+    for (size_t i = 0; i < replies.size(); ++i) {
+        if (!replies[i].ok) {
+            failed += (failed.empty() ? "" : ",") + std::to_string(i);
+        }
+    }
+    return failed.empty() ? "" : ",\"partial\":true,\"failed_shards\":[" + failed + "]";
+}
+
+std::string Coordinator::query(const std::string& text, size_t limit, int fuzzy, bool snippets) {
+    auto request = [&](int edits) {
+        std::string json = "{\"query\":\"" + jsonEscape(text) + "\",\"limit\":" + std::to_string(limit) +
+                           ",\"scores\":true" + (snippets ? ",\"snippets\":true" : "");
+        if (edits >= 0) {
+            json += ",\"fuzzy\":" + std::to_string(edits);
+        }
+        return json + "}";
+    };
+
+    // The typo fallback is for when nothing matches anywhere, so ask for
+    // exact matches first and only then let the shards fall back
+    uint64_t start = Metrics::now();
+    std::vector<ShardReply> replies = client_.fanOut(request(fuzzy < 0 ? 0 : fuzzy));
+    bool answered = std::any_of(replies.begin(), replies.end(), [](const ShardReply& reply) { return reply.ok; });
+    bool matched = std::any_of(replies.begin(), replies.end(), [](const ShardReply& reply) {
+        long long count = 0;
+        return reply.ok && jsonGetInt(reply.response, "count", count) && count > 0;
+    });
+    if (fuzzy < 0 && answered && !matched && !firstError(replies)) {
+        replies = client_.fanOut(request(-1));
+    }
+    metrics_.recordSince(Stage::Search, start);
+
+    if (const std::string* error = firstError(replies)) {
+        return *error;
+    }
+
+    start = Metrics::now();
+    struct Hit {
+        float score;
+        size_t shard;
+        size_t rank;
+        std::string name;     // Still JSON-encoded
+        std::string snippet;  // As the shard sent it; empty if it sent none
+    };
+    std::vector<Hit> hits;
+    bool anyAnswer = false;
+    bool usedFuzzy = false;
+    std::vector<std::string> names;
+    std::vector<std::string> scores;
+    std::vector<std::string> snippetLists;
+    for (size_t shard = 0; shard < replies.size(); ++shard) {
+        ShardReply& reply = replies[shard];
+        if (reply.ok && (!jsonGetArray(reply.response, "results", names) ||
+                         !jsonGetArray(reply.response, "scores", scores) || names.size() != scores.size() ||
+                         (snippets && !jsonGetArray(reply.response, "snippets", snippetLists)))) {
+            reply.ok = false;  // Not a response we understand; count it as failed
+        }
+        if (!reply.ok) {
+            continue;
+        }
+        anyAnswer = true;
+        bool fuzzyReply = false;
+        usedFuzzy = usedFuzzy || (jsonGetBool(reply.response, "fuzzy", fuzzyReply) && fuzzyReply);
+        for (size_t rank = 0; rank < names.size(); ++rank) {
+            hits.push_back({std::strtof(scores[rank].c_str(), nullptr), shard, rank, std::move(names[rank]),
+                            snippets && rank < snippetLists.size() ? std::move(snippetLists[rank]) : std::string()});
+        }
+    }
+    if (!anyAnswer) {
+        return "{\"error\":\"No shard answered\"}";
+    }
+
+    // Global top `limit`; ties keep shard, then rank order
+    size_t count = std::min(limit, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + count, hits.end(), [](const Hit& a, const Hit& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.shard != b.shard ? a.shard < b.shard : a.rank < b.rank;
+    });
+
+    std::string json = "{\"query\":\"" + jsonEscape(text) + "\",";
+    if (usedFuzzy) {
+        json += "\"fuzzy\":true,";
+    }
+    json += "\"count\":" + std::to_string(count) + ",\"results\":[";
+    for (size_t i = 0; i < count; ++i) {
+        json += (i ? "," : "") + hits[i].name;
+    }
+    json += "]";
+    if (snippets) {
+        // Shards send them for their top results, which include the merged top
+        json += ",\"snippets\":[";
+        for (size_t i = 0; i < count && !hits[i].snippet.empty(); ++i) {
+            json += (i ? "," : "") + hits[i].snippet;
+        }
+        json += "]";
+    }
+    json += failedShards(replies) + "}";
+    metrics_.recordSince(Stage::Serialize, start);
+    return json;
+}
+
+std::string Coordinator::suggest(const std::string& text, size_t limit) {
+    uint64_t start = Metrics::now();
+    std::vector<ShardReply> replies =
+        client_.fanOut("{\"suggest\":\"" + jsonEscape(text) + "\",\"limit\":" + std::to_string(limit) + "}");
+    metrics_.recordSince(Stage::Search, start);
+    if (const std::string* error = firstError(replies)) {
+        return *error;
+    }
+
+    // Each shard's best `limit` by its own counts; a completion that just
+    // misses the cut everywhere can be missing from the merged list
+    start = Metrics::now();
+    std::map<std::string, long long> documents;
+    bool anyAnswer = false;
+    std::vector<std::string> suggestions;
+    for (ShardReply& reply : replies) {
+        if (reply.ok && !jsonGetArray(reply.response, "suggestions", suggestions)) {
+            reply.ok = false;
+        }
+        if (!reply.ok) {
+            continue;
+        }
+        anyAnswer = true;
+        for (const std::string& suggestion : suggestions) {
+            std::string term;
+            long long count = 0;
+            if (jsonGetString(suggestion, "text", term) && jsonGetInt(suggestion, "documents", count)) {
+                documents[term] += count;
+            }
+        }
+    }
+    if (!anyAnswer) {
+        return "{\"error\":\"No shard answered\"}";
+    }
+
+    std::vector<std::pair<std::string, long long>> ranked(documents.begin(), documents.end());
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const auto& a, const auto& b) { return a.second > b.second; });
+    ranked.resize(std::min(ranked.size(), limit));
+
+    std::string json = "{\"suggest\":\"" + jsonEscape(text) + "\",\"count\":" + std::to_string(ranked.size()) +
+                       ",\"suggestions\":[";
+    for (size_t i = 0; i < ranked.size(); ++i) {
+        json += std::string(i ? "," : "") + "{\"text\":\"" + jsonEscape(ranked[i].first) +
+                "\",\"documents\":" + std::to_string(ranked[i].second) + "}";
+    }
+    json += "]" + failedShards(replies) + "}";
+    metrics_.recordSince(Stage::Serialize, start);
+    return json;
+}
+
+std::string Coordinator::codeSearch(const std::string& text, bool regex, size_t limit, bool snippets) {
+    const char* mode = regex ? "regex" : "substring";
+    uint64_t start = Metrics::now();
+    std::vector<ShardReply> replies =
+        client_.fanOut(std::string("{\"") + mode + "\":\"" + jsonEscape(text) + "\",\"limit\":" +
+                       std::to_string(limit) + (snippets ? ",\"snippets\":true" : "") + "}");
+    metrics_.recordSince(Stage::Search, start);
+    if (const std::string* error = firstError(replies)) {
+        return *error;
+    }
+
+    // Shard order; for range-partitioned shards that is index order
+    start = Metrics::now();
+    bool anyAnswer = false;
+    std::vector<std::string> names;
+    std::vector<std::string> snippetLists;
+    std::string results;
+    std::string snippetList;
+    size_t count = 0;
+    bool snippetsComplete = true;  // Every result so far has its snippets
+    for (ShardReply& reply : replies) {
+        if (reply.ok && (!jsonGetArray(reply.response, "results", names) ||
+                         (snippets && !jsonGetArray(reply.response, "snippets", snippetLists)))) {
+            reply.ok = false;
+        }
+        if (!reply.ok) {
+            continue;
+        }
+        anyAnswer = true;
+        for (size_t i = 0; i < names.size() && count < limit; ++i, ++count) {
+            results += (count ? "," : "") + names[i];
+            snippetsComplete = snippetsComplete && snippets && i < snippetLists.size();
+            if (snippetsComplete) {
+                snippetList += (count ? "," : "") + snippetLists[i];
+            }
+        }
+    }
+    if (!anyAnswer) {
+        return "{\"error\":\"No shard answered\"}";
+    }
+
+    std::string json = std::string("{\"") + mode + "\":\"" + jsonEscape(text) + "\",\"count\":" +
+                       std::to_string(count) + ",\"results\":[" + results + "]" +
+                       (snippets ? ",\"snippets\":[" + snippetList + "]" : "") + failedShards(replies) + "}";
+    metrics_.recordSince(Stage::Serialize, start);
+    return json;
+}
+
+std::string Coordinator::reload() {
+    std::vector<ShardReply> replies = client_.fanOut("{\"admin\":\"reload\"}");
+    long long documents = 0;
+    for (ShardReply& reply : replies) {
+        long long count = 0;
+        if (reply.ok && !jsonGetInt(reply.response, "documents", count)) {
+            reply.ok = false;  // The shard kept its previous index
+        }
+        documents += count;
+    }
+
+    std::string failed = failedShards(replies);
+    if (!failed.empty()) {
+        return "{\"error\":\"Reload failed on some shards\"" + failed + "}";
+    }
+    return "{\"reload\":\"ok\",\"shards\":" + std::to_string(replies.size()) +
+           ",\"documents\":" + std::to_string(documents) + "}";
+}
@@ -0,0 +1,52 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include "metrics.h"
+#include "shard_client.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Scatter-gather over shard servers (see --build --shards): every request
+// goes to all shards in parallel and the answers are merged into the
+// response a single server over the whole corpus would give.
+//
+//   query      each shard's top `limit` with BM25 scores, merged into the
+//              global top `limit`. Scores use each shard's own document
+//              frequencies, so hash-partitioned shards rank best.
+//   suggest    document counts of the same completion are summed
+//   substring/regex  results in shard order, up to `limit`
+//
+// Snippets come from the shard holding the file and follow it into the
+// merged results.
+//
+// A shard that fails or misses the timeout is left out: the response then
+// has "partial":true and lists it in "failed_shards". If no shard
+// answers, the request fails.
+class Coordinator {
+public:
+    Coordinator(const std::vector<std::string>& shards, std::chrono::milliseconds timeout, Metrics& metrics);
+
+    bool valid() const { return client_.valid(); }
+    const ShardClient& client() const { return client_; }
+
+    // fuzzy: edits allowed per term, -1 for exact with a fallback to fuzzy
+    // matching only if no shard has an exact match
+    std::string query(const std::string& text, size_t limit, int fuzzy, bool snippets);
+    std::string suggest(const std::string& text, size_t limit);
+    std::string codeSearch(const std::string& text, bool regex, size_t limit, bool snippets);
+
+    // Asks every shard to reload its index
+    std::string reload();
+
+private:
+    ShardClient client_;
+    Metrics& metrics_;
+
+    // Shards that answered with an error (as opposed to not answering)
+    // are the request's own fault; their first error is the response
+    static const std::string* firstError(const std::vector<ShardReply>& replies);
+    static std::string failedShards(const std::vector<ShardReply>& replies);
+};
+
+#endif // COORDINATOR_H
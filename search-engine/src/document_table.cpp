@@ -0,0 +1,353 @@
+#include "document_table.h"
+#include "index_format.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using index_format::ManifestHeader;
+
+namespace {
+
+// readVarint, but stopping at `end`
+bool readBoundedVarint(const unsigned char*& p, const unsigned char* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint32_t byte = *p++;
+        value |= (byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t alignTo8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+void writePadding(std::ofstream& file, uint64_t& offset) {
+    static const char zeros[8] = {0};
+    uint64_t aligned = alignTo8(offset);
+    file.write(zeros, static_cast<std::streamsize>(aligned - offset));
+    offset = aligned;
+}
+
+} // namespace
+
+DocumentTable::DocumentTable() {
+    pointAtOwned();
+}
+
+DocumentTable::~DocumentTable() {
+    unmap();
+}
+
+void DocumentTable::add(std::string_view path, uint32_t length, const FileInfo& info) {
+    if (mapping_) {
+        // Appending to a mapped table: bring it into memory first
+        std::vector<std::pair<std::string, std::pair<uint32_t, FileInfo>>> documents;
+        forEach([&](uint32_t docId, std::string_view existing) {
+            documents.push_back({std::string(existing), {lengths_[docId], fileInfo_[docId]}});
+        });
+        bool lengths = hasLengths_;
+        bool fileInfo = hasFileInfo_;
+        clear();
+        for (const auto& document : documents) {
+            add(document.first, document.second.first, document.second.second);
+        }
+        hasLengths_ = lengths;
+        hasFileInfo_ = fileInfo;
+    }
+
+    size_t shared = 0;
+    if (count_ % BLOCK_SIZE == 0) {
+        ownedBlockOffsets_.push_back(ownedPathData_.size());
+    } else {
+        size_t limit = std::min(path.size(), lastPath_.size());
+        while (shared < limit && path[shared] == lastPath_[shared]) {
+            ++shared;
+        }
+    }
+    appendVarint(ownedPathData_, static_cast<uint32_t>(shared));
+    appendVarint(ownedPathData_, static_cast<uint32_t>(path.size() - shared));
+    ownedPathData_.append(path.data() + shared, path.size() - shared);
+    lastPath_.assign(path.data(), path.size());
+
+    ownedLengths_.push_back(length);
+    ownedFileInfo_.push_back(info);
+    ++count_;
+    pointAtOwned();
+}
+
+void DocumentTable::clear() {
+    unmap();
+    ownedLengths_.clear();
+    ownedFileInfo_.clear();
+    ownedBlockOffsets_.clear();
+    ownedPathData_.clear();
+    lastPath_.clear();
+    count_ = 0;
+    hasLengths_ = true;
+    hasFileInfo_ = true;
+    pointAtOwned();
+}
+
+void DocumentTable::pointAtOwned() {
+    lengths_ = ownedLengths_.data();
+    fileInfo_ = ownedFileInfo_.data();
+    blockOffsets_ = ownedBlockOffsets_.data();
+    pathData_ = reinterpret_cast<const unsigned char*>(ownedPathData_.data());
+    pathDataSize_ = ownedPathData_.size();
+}
+
+void DocumentTable::unmap() {
+    if (mapping_) {
+        munmap(mapping_, mappedSize_);
+    }
+    mapping_ = nullptr;
+    mappedSize_ = 0;
+}
+
+const unsigned char* DocumentTable::blockStart(uint32_t block) const {
+    return pathData_ + blockOffsets_[block];
+}
+
+const unsigned char* DocumentTable::blockEnd(uint32_t block) const {
+    uint32_t numBlocks = (count_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return pathData_ + (block + 1 < numBlocks ? blockOffsets_[block + 1] : pathDataSize_);
+}
+
+bool DocumentTable::nextPath(const unsigned char*& p, const unsigned char* end, std::string& path) {
+    uint32_t shared;
+    uint32_t rest;
+    if (!readBoundedVarint(p, end, shared) || !readBoundedVarint(p, end, rest) || shared > path.size() ||
+        rest > static_cast<size_t>(end - p)) {
+        return false;
+    }
+    path.resize(shared);
+    path.append(reinterpret_cast<const char*>(p), rest);
+    p += rest;
+    return true;
+}
+
+std::string DocumentTable::path(uint32_t docId) const {
+    std::string path;
+    if (docId >= count_) {
+        return path;
+    }
+    uint32_t block = docId / BLOCK_SIZE;
+    const unsigned char* p = blockStart(block);
+    const unsigned char* end = blockEnd(block);
+    for (uint32_t i = 0; i <= docId % BLOCK_SIZE; ++i) {
+        if (!nextPath(p, end, path)) {
+            return std::string();
+        }
+    }
+    return path;
+}
+
+size_t DocumentTable::memoryBytes() const {
+    return ownedLengths_.capacity() * sizeof(uint32_t) + ownedFileInfo_.capacity() * sizeof(FileInfo) +
+           ownedBlockOffsets_.capacity() * sizeof(uint64_t) + ownedPathData_.capacity() + lastPath_.capacity();
+}
+
+bool DocumentTable::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    uint32_t numBlocks = (count_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    ManifestHeader header{};
+    std::memcpy(header.magic, index_format::MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = index_format::MANIFEST_VERSION;
+    header.numDocs = count_;
+    header.flags = (hasLengths_ ? index_format::MANIFEST_HAS_LENGTHS : 0) |
+                   (hasFileInfo_ ? index_format::MANIFEST_HAS_FILE_INFO : 0);
+    header.blockSize = BLOCK_SIZE;
+    header.lengthsOffset = sizeof(ManifestHeader);
+    header.fileInfoOffset = alignTo8(header.lengthsOffset + uint64_t(count_) * sizeof(uint32_t));
+    header.blockOffsetsOffset = header.fileInfoOffset + uint64_t(count_) * sizeof(FileInfo);
+    header.pathDataOffset = header.blockOffsetsOffset + uint64_t(numBlocks) * sizeof(uint64_t);
+    header.pathDataSize = pathDataSize_;
+    header.fileSize = header.pathDataOffset + header.pathDataSize;
+
+    uint64_t offset = header.lengthsOffset;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(lengths_), static_cast<std::streamsize>(count_ * sizeof(uint32_t)));
+    offset += uint64_t(count_) * sizeof(uint32_t);
+    writePadding(file, offset);
+    file.write(reinterpret_cast<const char*>(fileInfo_), static_cast<std::streamsize>(count_ * sizeof(FileInfo)));
+    file.write(reinterpret_cast<const char*>(blockOffsets_),
+               static_cast<std::streamsize>(numBlocks * sizeof(uint64_t)));
+    file.write(reinterpret_cast<const char*>(pathData_), static_cast<std::streamsize>(pathDataSize_));
+
+    file.close();
+    if (!file) {
+        std::cerr << "Error: Failed to write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DocumentTable::load(const std::string& filename) {
+    clear();
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file for reading: " << filename << std::endl;
+        return false;
+    }
+    char magic[sizeof(index_format::MANIFEST_MAGIC)] = {0};
+    uint32_t version = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.close();
+
+    bool loaded = std::memcmp(magic, index_format::MANIFEST_MAGIC, sizeof(magic)) == 0 &&
+                          version == index_format::MANIFEST_VERSION
+                      ? loadMapped(filename)
+                      : loadList(filename);
+    if (!loaded) {
+        clear();
+    }
+    return loaded;
+}
+
+bool DocumentTable::loadMapped(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening file for reading: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ManifestHeader)) {
+        std::cerr << "Error: " << filename << " is too small to be a manifest" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Failed to mmap " << filename << std::endl;
+        return false;
+    }
+    mapping_ = mapping;
+    mappedSize_ = size;
+
+    const char* data = static_cast<const char*>(mapping);
+    const ManifestHeader* header = reinterpret_cast<const ManifestHeader*>(data);
+    uint64_t numBlocks = (uint64_t(header->numDocs) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (header->fileSize != size || header->blockSize != BLOCK_SIZE ||
+        header->lengthsOffset % alignof(uint32_t) != 0 || header->fileInfoOffset % alignof(FileInfo) != 0 ||
+        header->blockOffsetsOffset % alignof(uint64_t) != 0 ||
+        header->lengthsOffset + uint64_t(header->numDocs) * sizeof(uint32_t) > size ||
+        header->fileInfoOffset + uint64_t(header->numDocs) * sizeof(FileInfo) > size ||
+        header->blockOffsetsOffset + numBlocks * sizeof(uint64_t) > size ||
+        header->pathDataOffset + header->pathDataSize > size) {
+        std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    const uint64_t* blockOffsets = reinterpret_cast<const uint64_t*>(data + header->blockOffsetsOffset);
+    for (uint64_t block = 0; block < numBlocks; ++block) {
+        if (blockOffsets[block] > header->pathDataSize || (block > 0 && blockOffsets[block] < blockOffsets[block - 1])) {
+            std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+            return false;
+        }
+    }
+
+    count_ = header->numDocs;
+    lengths_ = reinterpret_cast<const uint32_t*>(data + header->lengthsOffset);
+    fileInfo_ = reinterpret_cast<const FileInfo*>(data + header->fileInfoOffset);
+    blockOffsets_ = blockOffsets;
+    pathData_ = reinterpret_cast<const unsigned char*>(data + header->pathDataOffset);
+    pathDataSize_ = header->pathDataSize;
+    hasLengths_ = (header->flags & index_format::MANIFEST_HAS_LENGTHS) != 0;
+    hasFileInfo_ = (header->flags & index_format::MANIFEST_HAS_FILE_INFO) != 0;
+    return true;
+}
+
+bool DocumentTable::loadList(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file for reading: " << filename << std::endl;
+        return false;
+    }
+
+    // Versions 1 and 2 start with the magic and version; legacy files
+    // with the document count
+    uint32_t version = 0;
+    char magic[sizeof(index_format::MANIFEST_MAGIC)] = {0};
+    file.read(magic, sizeof(magic));
+    if (std::memcmp(magic, index_format::MANIFEST_MAGIC, sizeof(magic)) == 0) {
+        file.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+        if (version != 1 && version != 2) {
+            std::cerr << "Error: " << filename << " has manifest version " << version << ", expected "
+                      << index_format::MANIFEST_VERSION << ". Please rebuild the index." << std::endl;
+            return false;
+        }
+    } else {
+        file.clear();
+        file.seekg(0);
+    }
+
+    uint32_t numDocs = 0;
+    file.read(reinterpret_cast<char*>(&numDocs), sizeof(uint32_t));
+
+    // Entries are by docId in practice, but the format allows any order
+    struct Entry {
+        std::string path;
+        uint32_t length = 0;
+        FileInfo info;
+    };
+    std::vector<Entry> entries;
+    for (uint32_t i = 0; i < numDocs && file; ++i) {
+        int docId;
+        Entry entry;
+        file.read(reinterpret_cast<char*>(&docId), sizeof(int));
+        if (version >= 1) {
+            file.read(reinterpret_cast<char*>(&entry.length), sizeof(uint32_t));
+        }
+        if (version >= 2) {
+            file.read(reinterpret_cast<char*>(&entry.info.size), sizeof(uint64_t));
+            file.read(reinterpret_cast<char*>(&entry.info.mtime), sizeof(int64_t));
+            file.read(reinterpret_cast<char*>(&entry.info.contentHash), sizeof(uint64_t));
+        }
+
+        uint32_t pathLen = 0;
+        file.read(reinterpret_cast<char*>(&pathLen), sizeof(uint32_t));
+        if (!file || docId < 0 || static_cast<uint32_t>(docId) >= numDocs) {
+            break;
+        }
+        entry.path.resize(pathLen);
+        file.read(&entry.path[0], pathLen);
+
+        if (entries.size() <= static_cast<size_t>(docId)) {
+            entries.resize(static_cast<size_t>(docId) + 1);
+        }
+        entries[docId] = std::move(entry);
+    }
+    if (!file) {
+        std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    for (const Entry& entry : entries) {
+        add(entry.path, entry.length, entry.info);
+    }
+    hasLengths_ = version >= 1;
+    hasFileInfo_ = version >= 2;
+    return true;
+}
@@ -0,0 +1,115 @@
+#ifndef DOCUMENT_TABLE_H
+#define DOCUMENT_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A document's file as it was when indexed; --update compares against it
+struct FileInfo {
+    uint64_t size = 0;
+    int64_t mtime = 0;         // Nanoseconds since the epoch
+    uint64_t contentHash = 0;  // 0 if unknown (manifests before version 2)
+};
+
+static_assert(sizeof(FileInfo) == 24, "FileInfo is mapped from manifest.bin");
+
+// The documents of one segment by docId (dense, 0..size()-1): path,
+// length in tokens and file details. Paths are front-coded in blocks (see
+// index_format.h), so a path is decoded from at most BLOCK_SIZE entries
+// and the shared directories of neighbouring files are stored once.
+//
+// A build appends documents in memory and save() writes them as
+// manifest.bin. load() maps a current manifest.bin and reads it in place;
+// older manifests are converted into memory.
+class DocumentTable {
+public:
+    static constexpr uint32_t BLOCK_SIZE = 16;
+
+    DocumentTable();
+    ~DocumentTable();
+
+    DocumentTable(const DocumentTable&) = delete;
+    DocumentTable& operator=(const DocumentTable&) = delete;
+
+    // Appends the document with the next docId
+    void add(std::string_view path, uint32_t length, const FileInfo& info);
+    void clear();
+
+    // save returns false (and logs why) if the file can't be written; load
+    // if it can't be read, and then leaves the table empty
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+
+    uint32_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+
+    // Empty if docId is out of range
+    std::string path(uint32_t docId) const;
+    uint32_t length(uint32_t docId) const { return docId < count_ ? lengths_[docId] : 0; }
+    FileInfo fileInfo(uint32_t docId) const { return docId < count_ ? fileInfo_[docId] : FileInfo(); }
+
+    // Whether lengths and file details were recorded; legacy manifests
+    // have neither, version 1 manifests no file details
+    bool hasLengths() const { return hasLengths_; }
+    bool hasFileInfo() const { return hasFileInfo_; }
+
+    // Calls visit(docId, path) for every document in docId order,
+    // decoding each block once
+    template <typename Visit>
+    void forEach(Visit&& visit) const;
+
+    size_t memoryBytes() const;  // Heap, for tables built or converted in memory
+    size_t mappedBytes() const { return mappedSize_; }
+
+private:
+    // Decodes the next path of a block over `path` (which holds the one
+    // before); false if the data is corrupt
+    static bool nextPath(const unsigned char*& p, const unsigned char* end, std::string& path);
+    const unsigned char* blockStart(uint32_t block) const;
+    const unsigned char* blockEnd(uint32_t block) const;
+    bool loadMapped(const std::string& filename);
+    bool loadList(const std::string& filename);
+    void pointAtOwned();
+    void unmap();
+
+    // Either into the owned vectors below or into the mapping
+    uint32_t count_ = 0;
+    const uint32_t* lengths_ = nullptr;
+    const FileInfo* fileInfo_ = nullptr;
+    const uint64_t* blockOffsets_ = nullptr;
+    const unsigned char* pathData_ = nullptr;
+    size_t pathDataSize_ = 0;
+    bool hasLengths_ = true;
+    bool hasFileInfo_ = true;
+
+    std::vector<uint32_t> ownedLengths_;
+    std::vector<FileInfo> ownedFileInfo_;
+    std::vector<uint64_t> ownedBlockOffsets_;
+    std::string ownedPathData_;
+    std::string lastPath_;  // Last one added, for front coding the next
+
+    void* mapping_ = nullptr;
+    size_t mappedSize_ = 0;
+};
+
+template <typename Visit>
+void DocumentTable::forEach(Visit&& visit) const {
+    std::string path;
+    for (uint32_t docId = 0; docId < count_;) {
+        uint32_t block = docId / BLOCK_SIZE;
+        const unsigned char* p = blockStart(block);
+        const unsigned char* end = blockEnd(block);
+        path.clear();
+        for (uint32_t i = 0; i < BLOCK_SIZE && docId < count_; ++i, ++docId) {
+            if (!nextPath(p, end, path)) {
+                path.clear();
+            }
+            visit(docId, std::string_view(path));
+        }
+    }
+}
+
+#endif // DOCUMENT_TABLE_H
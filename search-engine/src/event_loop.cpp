@@ -0,0 +1,523 @@
+#include "event_loop.h"
+#include "binary_protocol.h"
+#include <cerrno>
+#include <iostream>
+
+// POSIX / Linux headers
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// epoll user data for the two fixed descriptors; connections count up from 2
+const uint64_t LISTEN_ID = 0;
+const uint64_t WAKE_ID = 1;
+
+const size_t READ_CHUNK = 64 * 1024;
+const int MAX_EVENTS = 256;
+
+// Chunks handed to one sendmsg
+const size_t MAX_IOVECS = 64;
+
+// Owned output is appended to the last chunk up to this size, so small
+// responses still go out as a few large iovecs
+const size_t MAX_OWNED_CHUNK = 64 * 1024;
+
+const char* BUSY_RESPONSE = "{\"error\":\"Server busy\"}";
+const char* TOO_LARGE_RESPONSE = "{\"error\":\"Request too large\"}";
+const char* BUSY_MESSAGE = "Server busy";
+const char* TOO_LARGE_MESSAGE = "Request too large";
+const char* HTTP_BUSY_RESPONSE = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+std::string frameError(const char* message) {
+    std::string frame;
+    binary_protocol::appendError(frame, binary_protocol::FRAME_ERROR_INDEX, message);
+    return frame;
+}
+
+bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+} // namespace
+
+EventLoop::EventLoop(int listenSocket, WorkerPool& workers, RequestHandler handler, FrameHandler frameHandler,
+                     Metrics& metrics, const LoopLimits& limits)
+    : listenSocket_(listenSocket), epollFd_(-1), wakeFd_(-1), workers_(workers), handler_(std::move(handler)),
+      frameHandler_(std::move(frameHandler)), metrics_(metrics), limits_(limits), stopping_(false),
+      nextId_(WAKE_ID + 1) {}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : connections_) {
+        ::close(entry.second.fd);
+    }
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+    if (wakeFd_ >= 0) {
+        ::close(wakeFd_);
+    }
+}
+
+bool EventLoop::init() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        std::cerr << "Error: Failed to create event loop" << std::endl;
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_ID;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenSocket_, &event) < 0) {
+        std::cerr << "Error: Failed to watch the listening socket" << std::endl;
+        return false;
+    }
+    event.data.u64 = WAKE_ID;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) < 0) {
+        std::cerr << "Error: Failed to watch the wake-up descriptor" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+
+    while (!stopping_.load()) {
+        int count = epoll_wait(epollFd_, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error: epoll_wait failed" << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID) {
+                acceptConnections();
+                continue;
+            }
+            if (id == WAKE_ID) {
+                uint64_t value;
+                ssize_t ignored = read(wakeFd_, &value, sizeof(value));
+                (void)ignored;
+                drainCompletions();
+                continue;
+            }
+
+            auto it = connections_.find(id);
+            if (it == connections_.end()) {
+                continue;  // Closed earlier in this batch
+            }
+            Connection& conn = it->second;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(id);
+            } else if (events[i].events & EPOLLOUT) {
+                if (!flush(conn)) {
+                    closeConnection(id);
+                    continue;
+                }
+                dispatch(id, conn);
+                update(id, conn);
+            } else {
+                readFrom(id, conn);
+            }
+        }
+    }
+
+    for (auto& entry : connections_) {
+        ::close(entry.second.fd);
+        if (entry.second.stream) {
+            metrics_.add(Gauge::InFlight, -1);
+        }
+    }
+    metrics_.add(Gauge::Connections, -static_cast<int64_t>(connections_.size()));
+    connections_.clear();
+}
+
+void EventLoop::stop() {
+    stopping_.store(true);
+    wake();
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::acceptConnections() {
+    uint64_t start = Metrics::now();
+    while (true) {
+        int fd = accept4(listenSocket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (!wouldBlock()) {
+                std::cerr << "Error: Failed to accept connection" << std::endl;
+            }
+            metrics_.recordSince(Stage::Accept, start);
+            return;
+        }
+
+        if (connections_.size() >= limits_.maxConnections) {
+            ::close(fd);
+            metrics_.add(Counter::Refused);
+            continue;
+        }
+
+        // Responses are single small writes; don't let Nagle hold them back
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        uint64_t id = nextId_++;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ::close(fd);
+            continue;
+        }
+
+        Connection& conn = connections_[id];
+        conn.fd = fd;
+        conn.events = EPOLLIN;
+        metrics_.add(Counter::Accepted);
+        metrics_.add(Gauge::Connections, 1);
+    }
+}
+
+void EventLoop::readFrom(uint64_t id, Connection& conn) {
+    char buffer[READ_CHUNK];
+    uint64_t start = Metrics::now();
+    ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+    metrics_.recordSince(Stage::Recv, start);
+    if (received > 0) {
+        conn.input.append(buffer, static_cast<size_t>(received));
+    } else if (received == 0) {
+        conn.peerClosed = true;
+    } else if (errno != EINTR && !wouldBlock()) {
+        closeConnection(id);
+        return;
+    }
+
+    dispatch(id, conn);
+    update(id, conn);
+}
+
+bool EventLoop::flush(Connection& conn) {
+    uint64_t start = Metrics::now();
+    while (conn.unsent > 0) {
+        struct iovec iov[MAX_IOVECS];
+        size_t count = 0;
+        for (auto it = conn.output.begin(); it != conn.output.end() && count < MAX_IOVECS; ++it, ++count) {
+            const std::string& data = it->data();
+            size_t skip = count == 0 ? conn.written : 0;
+            iov[count].iov_base = const_cast<char*>(data.data()) + skip;
+            iov[count].iov_len = data.size() - skip;
+        }
+        struct msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+
+        ssize_t sent = sendmsg(conn.fd, &message, MSG_NOSIGNAL);
+        if (sent > 0) {
+            consume(conn, static_cast<size_t>(sent));
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && wouldBlock()) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    metrics_.recordSince(Stage::Send, start);
+    return true;
+}
+
+void EventLoop::consume(Connection& conn, size_t sent) {
+    conn.unsent -= sent;
+    while (sent > 0) {
+        size_t left = conn.output.front().data().size() - conn.written;
+        if (sent < left) {
+            conn.written += sent;
+            return;
+        }
+        sent -= left;
+        conn.output.pop_front();
+        conn.written = 0;
+    }
+}
+
+void EventLoop::dispatch(uint64_t id, Connection& conn) {
+    if (conn.stream) {
+        resumeStream(id, conn);
+        return;
+    }
+    if (!conn.sniffed && !conn.input.empty()) {
+        conn.sniffed = true;
+        conn.binary = conn.input[0] == '\0';
+    }
+
+    while (!conn.busy && !conn.closeWhenFlushed &&
+           conn.unsent < limits_.maxPendingOutput) {
+        std::string request;
+        if (conn.binary) {
+            if (!nextFrame(conn, request)) {
+                return;
+            }
+        } else if (!nextLine(conn, request)) {
+            return;
+        } else if (conn.http) {
+            if (!request.empty()) {
+                continue;  // A header; the blank line after them ends the request
+            }
+            request.swap(conn.httpRequest);
+        } else if (request.compare(0, 4, "GET ") == 0) {
+            conn.http = true;
+            conn.httpRequest = std::move(request);
+            continue;
+        }
+        if (request.empty() && !conn.binary) {
+            continue;
+        }
+
+        uint64_t dispatched = Metrics::now();
+        bool queued = workers_.trySubmit([this, id, dispatched, binary = conn.binary, request = std::move(request)] {
+            metrics_.recordSince(Stage::Queue, dispatched);
+            Completion done{id, {}, dispatched, nullptr};
+            if (binary) {
+                ResponseStream stream = frameHandler_(request);
+                if (stream(done.response.text)) {
+                    done.more = std::move(stream);
+                }
+            } else {
+                done.response = handler_(request);
+            }
+            complete(std::move(done));
+        });
+
+        if (queued) {
+            conn.busy = true;
+            metrics_.add(Gauge::InFlight, 1);
+        } else if (conn.http) {
+            append(conn, HTTP_BUSY_RESPONSE);
+            conn.closeWhenFlushed = true;
+        } else {
+            metrics_.add(Counter::Busy);
+            metrics_.add(Counter::Errors);
+            if (conn.binary) {
+                append(conn, frameError(BUSY_MESSAGE));
+            } else {
+                reply(conn, BUSY_RESPONSE);
+            }
+        }
+    }
+}
+
+bool EventLoop::nextLine(Connection& conn, std::string& line) {
+    size_t newline = conn.input.find('\n', conn.scanned);
+    if (newline != std::string::npos && newline <= limits_.maxRequestBytes) {
+        line = conn.input.substr(0, newline);
+        conn.input.erase(0, newline + 1);
+        conn.scanned = 0;
+    } else if (newline != std::string::npos || conn.input.size() > limits_.maxRequestBytes) {
+        metrics_.add(Counter::Errors);
+        reply(conn, TOO_LARGE_RESPONSE);
+        conn.closeWhenFlushed = true;
+        conn.input.clear();
+        return false;
+    } else if (conn.peerClosed && !conn.input.empty()) {
+        // A client that sends one request without a newline and shuts down
+        line.swap(conn.input);
+        conn.scanned = 0;
+    } else {
+        conn.scanned = conn.input.size();
+        return false;
+    }
+
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return true;
+}
+
+bool EventLoop::nextFrame(Connection& conn, std::string& frame) {
+    if (conn.input.size() < 4) {
+        if (conn.peerClosed) {
+            conn.input.clear();  // A truncated frame will never be completed
+        }
+        return false;
+    }
+
+    size_t length = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        length = length << 8 | static_cast<unsigned char>(conn.input[i]);
+    }
+    if (length > limits_.maxRequestBytes) {
+        metrics_.add(Counter::Errors);
+        append(conn, frameError(TOO_LARGE_MESSAGE));
+        conn.closeWhenFlushed = true;
+        conn.input.clear();
+        return false;
+    }
+    if (conn.input.size() - 4 < length) {
+        if (conn.peerClosed) {
+            conn.input.clear();
+        }
+        return false;
+    }
+
+    frame = conn.input.substr(4, length);
+    conn.input.erase(0, 4 + length);
+    return true;
+}
+
+void EventLoop::resumeStream(uint64_t id, Connection& conn) {
+    if (conn.unsent >= limits_.streamLowWater) {
+        return;  // Wait for the client to read more of it
+    }
+
+    uint64_t dispatched = conn.streamDispatched;
+    bool queued = workers_.submit([this, id, dispatched, stream = std::move(conn.stream)]() mutable {
+        Completion done{id, {}, dispatched, nullptr};
+        if (stream(done.response.text)) {
+            done.more = std::move(stream);
+        }
+        complete(std::move(done));
+    });
+    conn.stream = nullptr;
+    if (!queued) {
+        metrics_.add(Gauge::InFlight, -1);  // Shutting down
+        conn.closeWhenFlushed = true;
+    }
+}
+
+void EventLoop::complete(Completion done) {
+    {
+        std::lock_guard<std::mutex> lock(completedMutex_);
+        completed_.push_back(std::move(done));
+    }
+    wake();
+}
+
+void EventLoop::append(Connection& conn, std::string text) {
+    if (text.empty()) {
+        return;
+    }
+    conn.unsent += text.size();
+    if (!conn.output.empty() && !conn.output.back().shared &&
+        conn.output.back().owned.size() + text.size() <= MAX_OWNED_CHUNK) {
+        conn.output.back().owned += text;
+    } else {
+        conn.output.push_back({std::move(text), nullptr});
+    }
+}
+
+void EventLoop::append(Connection& conn, std::shared_ptr<const std::string> shared) {
+    if (!shared || shared->empty()) {
+        return;
+    }
+    conn.unsent += shared->size();
+    conn.output.push_back({std::string(), std::move(shared)});
+}
+
+void EventLoop::reply(Connection& conn, Response response) {
+    append(conn, std::move(response.text));
+    append(conn, std::move(response.shared));
+    append(conn, "\n");
+}
+
+void EventLoop::drainCompletions() {
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex_);
+        done.swap(completed_);
+    }
+
+    for (auto& completion : done) {
+        auto it = connections_.find(completion.id);
+        if (!completion.more || it == connections_.end()) {
+            metrics_.add(Gauge::InFlight, -1);
+            metrics_.recordSince(Stage::Request, completion.dispatched);
+        }
+        if (it == connections_.end()) {
+            continue;  // Client went away while the query ran
+        }
+        Connection& conn = it->second;
+        if (completion.more) {
+            conn.stream = std::move(completion.more);
+            conn.streamDispatched = completion.dispatched;
+        } else {
+            conn.busy = false;
+        }
+        if (conn.http || conn.binary) {
+            append(conn, std::move(completion.response.text));
+            append(conn, std::move(completion.response.shared));
+            conn.closeWhenFlushed = conn.closeWhenFlushed || conn.http;
+        } else {
+            reply(conn, std::move(completion.response));
+        }
+        dispatch(completion.id, conn);
+        update(completion.id, conn);
+    }
+}
+
+void EventLoop::update(uint64_t id, Connection& conn) {
+    // Try to send right away; most responses fit in the socket buffer
+    if (conn.unsent > 0 && !flush(conn)) {
+        closeConnection(id);
+        return;
+    }
+
+    size_t unsent = conn.unsent;
+    bool finished = conn.closeWhenFlushed || (conn.peerClosed && !conn.busy && conn.input.empty());
+    if (unsent == 0 && finished) {
+        closeConnection(id);
+        return;
+    }
+
+    // Only read more while there's room to act on it
+    uint32_t events = 0;
+    if (unsent > 0) {
+        events |= EPOLLOUT;
+    }
+    if (!conn.busy && !conn.peerClosed && !conn.closeWhenFlushed && unsent < limits_.maxPendingOutput) {
+        events |= EPOLLIN;
+    }
+
+    if (events != conn.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = id;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &event) < 0) {
+            closeConnection(id);
+            return;
+        }
+        conn.events = events;
+    }
+}
+
+void EventLoop::closeConnection(uint64_t id) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    ::close(it->second.fd);
+    if (it->second.stream) {
+        metrics_.add(Gauge::InFlight, -1);  // Its response is abandoned
+    }
+    connections_.erase(it);
+    metrics_.add(Gauge::Connections, -1);
+}
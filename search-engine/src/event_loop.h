@@ -0,0 +1,153 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "metrics.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A response line (without the '\n'): `text`, then `shared` if it is set.
+// Shared bytes, such as a cached response body, are passed to the socket
+// from where they are instead of being copied into the connection.
+struct Response {
+    Response(std::string text = std::string(), std::shared_ptr<const std::string> shared = nullptr)
+        : text(std::move(text)), shared(std::move(shared)) {}
+    Response(const char* text) : text(text) {}
+
+    std::string text;
+    std::shared_ptr<const std::string> shared;
+};
+
+// Turns one request line into one response line. Runs on a worker
+// thread, so it must be safe to call concurrently.
+using RequestHandler = std::function<Response(const std::string& request)>;
+
+// A response produced a piece at a time: each call appends the next piece
+// to `out` and returns true while there is more to come.
+using ResponseStream = std::function<bool(std::string& out)>;
+
+// Turns one binary request frame (without its length; see binary_protocol.h)
+// into a response stream. The stream is called on worker threads too.
+using FrameHandler = std::function<ResponseStream(const std::string& frame)>;
+
+struct LoopLimits {
+    size_t maxConnections = 10000;         // Per loop; extra connections are closed on accept
+    size_t maxRequestBytes = 1 << 20;      // Longest request line accepted
+    size_t maxPendingOutput = 4 << 20;     // Stop reading a connection while this much is unsent
+    size_t streamLowWater = 64 << 10;      // Ask a streamed response for more below this much unsent
+};
+
+// Non-blocking epoll loop over one listening socket.
+//
+// Connections are persistent and carry newline-delimited requests. Each
+// connection has at most one request on the worker pool at a time, so
+// responses come back in request order. While a request is in flight, or
+// the client isn't reading its responses, the loop stops reading from
+// that socket and TCP flow control pushes back on the client. If the
+// worker queue is full the request is answered with a "busy" error.
+//
+// A connection whose first byte is 0 carries length-prefixed binary frames
+// instead. Their responses are streams: the first piece is produced with
+// the request, and each further piece only once the client has read
+// enough of the ones before, so a large response is never held whole.
+//
+// A connection that starts with "GET " is taken as one HTTP/1.x request
+// instead (for Prometheus to scrape): the request line goes to the
+// handler once the headers are in, the handler's return value is sent
+// as the whole HTTP response, and the connection is closed.
+class EventLoop {
+public:
+    EventLoop(int listenSocket, WorkerPool& workers, RequestHandler handler, FrameHandler frameHandler,
+              Metrics& metrics, const LoopLimits& limits = LoopLimits());
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Create the epoll instance. Returns false on error.
+    bool init();
+
+    // Serve until stop() is called, then close every connection
+    void run();
+
+    // Ask run() to return. Async-signal-safe.
+    void stop();
+
+private:
+    // Part of a connection's output: bytes of its own, or shared ones
+    struct OutputChunk {
+        std::string owned;
+        std::shared_ptr<const std::string> shared;
+        const std::string& data() const { return shared ? *shared : owned; }
+    };
+
+    struct Connection {
+        int fd = -1;
+        uint32_t events = 0;        // Current epoll interest
+        std::string input;          // Received bytes not yet dispatched
+        size_t scanned = 0;         // Prefix of `input` known to hold no '\n'
+        std::deque<OutputChunk> output;  // Responses not yet sent, written with one sendmsg
+        size_t written = 0;         // Prefix of the first chunk already sent
+        size_t unsent = 0;          // Bytes in `output` after that
+        bool busy = false;          // A request is on the worker pool
+        bool peerClosed = false;    // Client shut down its side
+        bool closeWhenFlushed = false;
+        bool http = false;          // An HTTP request, reading its headers or waiting for the answer
+        std::string httpRequest;    // Its request line
+        bool sniffed = false;       // The first byte has been seen
+        bool binary = false;        // It was 0: length-prefixed frames
+        ResponseStream stream;      // Rest of a streamed response, waiting for the client to read
+        uint64_t streamDispatched = 0;
+    };
+
+    struct Completion {
+        uint64_t id;
+        Response response;
+        uint64_t dispatched;        // Metrics::now() when it went to the pool
+        ResponseStream more;        // Set if the response goes on
+    };
+
+    void acceptConnections();
+    void readFrom(uint64_t id, Connection& conn);
+    bool flush(Connection& conn);
+    void consume(Connection& conn, size_t sent);
+    void dispatch(uint64_t id, Connection& conn);
+    bool nextLine(Connection& conn, std::string& line);
+    bool nextFrame(Connection& conn, std::string& frame);
+    void resumeStream(uint64_t id, Connection& conn);
+    void complete(Completion done);
+    void append(Connection& conn, std::string text);
+    void append(Connection& conn, std::shared_ptr<const std::string> shared);
+    void reply(Connection& conn, Response response);
+    void drainCompletions();
+    void update(uint64_t id, Connection& conn);
+    void closeConnection(uint64_t id);
+    void wake();
+
+    int listenSocket_;
+    int epollFd_;
+    int wakeFd_;
+    WorkerPool& workers_;
+    RequestHandler handler_;
+    FrameHandler frameHandler_;
+    Metrics& metrics_;
+    LoopLimits limits_;
+    std::atomic<bool> stopping_;
+
+    std::unordered_map<uint64_t, Connection> connections_;
+    uint64_t nextId_;
+
+    // Responses finished by workers, picked up by the loop on wakeFd_
+    std::mutex completedMutex_;
+    std::vector<Completion> completed_;
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,540 @@
+#include "file_reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// POSIX / Linux file and io_uring interfaces
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Files at least this large are mapped instead of copied into a buffer
+constexpr size_t MMAP_THRESHOLD = 256 << 10;
+constexpr size_t MIN_BUFFER = 64 << 10;
+
+// Without io_uring, this many threads block in open/pread at once
+constexpr unsigned READER_THREADS = 8;
+
+// Low bits of an io_uring user_data: which step of a file completed
+enum RingOp : uint64_t { OP_OPEN = 0, OP_STATX = 1, OP_READ = 2, OP_CLOSE = 3 };
+
+uint64_t ringTag(size_t slot, RingOp op) {
+    return (static_cast<uint64_t>(slot) << 2) | op;
+}
+
+int64_t mtimeOf(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+} // namespace
+
+// Minimal io_uring driver over the raw syscalls: one submission and one
+// completion ring, used by a single thread
+struct FileReader::Ring {
+    int fd = -1;
+    unsigned sqEntries = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+
+    unsigned queued = 0;  // Prepared but not yet submitted
+
+    ~Ring() {
+        if (sqes && sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return false;
+        }
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                  IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* mappedSqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQES);
+        if (mappedSqes == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(mappedSqes);
+
+        char* sq = static_cast<char*>(sqRing);
+        sqEntries = params.sq_entries;
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE});
+    }
+
+    // Older kernels have io_uring but not every opcode we queue
+    bool supports(std::initializer_list<int> ops) {
+        const unsigned numOps = 256;
+        std::vector<char> memory(sizeof(io_uring_probe) + numOps * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, numOps) < 0) {
+            return false;
+        }
+        for (int op : ops) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A zeroed entry to fill in; submitted by the next enter()
+    io_uring_sqe* prepare(uint8_t opcode, int fileFd, uint64_t userData) {
+        if (queued == sqEntries) {
+            enter(0);
+        }
+        unsigned tail = *sqTail + queued;
+        unsigned index = tail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fileFd;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        ++queued;
+        return sqe;
+    }
+
+    // Submit what is queued and wait for at least `waitFor` completions
+    void enter(unsigned waitFor) {
+        __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+        unsigned toSubmit = queued;
+        queued = 0;
+        while (true) {
+            long submitted = syscall(__NR_io_uring_enter, fd, toSubmit, waitFor,
+                                     waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (submitted >= 0) {
+                toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(submitted));
+                if (toSubmit == 0) {
+                    return;
+                }
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                std::cerr << "Error: io_uring_enter failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+        }
+    }
+
+    template <typename Handler>
+    void reap(Handler&& handler) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            handler(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+FileReader::FileReader(const std::vector<std::string>& paths, unsigned depth, bool useRing)
+    : paths_(paths), slots_(std::max(depth, 1u)) {
+    for (size_t slot = slots_.size(); slot-- > 0;) {
+        freeSlots_.push_back(slot);
+    }
+
+    if (useRing) {
+        // Each slot has at most three operations queued at once
+        ring_.reset(new Ring());
+        if (!ring_->setup(static_cast<unsigned>(slots_.size()) * 4)) {
+            ring_.reset();
+        }
+    }
+
+    if (ring_) {
+        producers_ = 1;
+        threads_.emplace_back(&FileReader::runRing, this);
+    } else {
+        producers_ = std::min<unsigned>(READER_THREADS, static_cast<unsigned>(slots_.size()));
+        for (unsigned t = 0; t < producers_; ++t) {
+            threads_.emplace_back(&FileReader::runThreads, this);
+        }
+    }
+}
+
+FileReader::~FileReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    slotFreed_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    for (auto& slot : slots_) {
+        if (slot.mapped) {
+            munmap(slot.mapped, slot.mappedSize);
+        }
+    }
+}
+
+bool FileReader::next(FileData& file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    readyChanged_.wait(lock, [this] { return !ready_.empty() || producers_ == 0; });
+    if (ready_.empty()) {
+        return false;
+    }
+    file = ready_.front();
+    ready_.pop_front();
+    return true;
+}
+
+void FileReader::release(const FileData& file) {
+    Slot& slot = slots_[file.slot];
+    if (slot.mapped) {
+        munmap(slot.mapped, slot.mappedSize);
+        slot.mapped = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        freeSlots_.push_back(file.slot);
+    }
+    slotFreed_.notify_one();
+}
+
+char* FileReader::bufferFor(size_t slot, size_t size) {
+    Slot& s = slots_[slot];
+    if (s.capacity < size) {
+        s.capacity = std::max({size, s.capacity * 2, MIN_BUFFER});
+        s.buffer.reset(new char[s.capacity]);
+    }
+    return s.buffer.get();
+}
+
+bool FileReader::takeSlot(size_t& slot, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (wait) {
+        slotFreed_.wait(lock, [this] { return !freeSlots_.empty() || stopping_; });
+    }
+    if (stopping_ || freeSlots_.empty()) {
+        return false;
+    }
+    slot = freeSlots_.back();
+    freeSlots_.pop_back();
+    return true;
+}
+
+void FileReader::returnSlot(size_t slot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        freeSlots_.push_back(slot);
+    }
+    slotFreed_.notify_one();
+}
+
+void FileReader::deliver(const FileData& file) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(file);
+    }
+    readyChanged_.notify_one();
+}
+
+void FileReader::finishProducer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --producers_;
+    }
+    readyChanged_.notify_all();
+}
+
+bool FileReader::readFile(size_t fileIndex, size_t slot, FileData& file) {
+    const std::string& path = paths_[fileIndex];
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    file.index = fileIndex;
+    file.slot = slot;
+    file.size = static_cast<size_t>(st.st_size);
+    file.mtime = mtimeOf(st);
+
+    if (file.size >= MMAP_THRESHOLD) {
+        void* mapped = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Error mapping file: " << path << std::endl;
+            return false;
+        }
+        slots_[slot].mapped = mapped;
+        slots_[slot].mappedSize = file.size;
+        file.data = static_cast<const char*>(mapped);
+        return true;
+    }
+
+    char* buffer = bufferFor(slot, file.size);
+    size_t done = 0;
+    while (done < file.size) {
+        ssize_t n = pread(fd, buffer + done, file.size - done, static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            std::cerr << "Error reading file: " << path << std::endl;
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) {
+            break;  // Truncated since fstat
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+
+    file.data = buffer;
+    file.size = done;
+    return done > 0;
+}
+
+void FileReader::runThreads() {
+    size_t slot;
+    while (takeSlot(slot, true)) {
+        size_t fileIndex;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fileIndex = nextFile_++;
+        }
+        if (fileIndex >= paths_.size()) {
+            returnSlot(slot);
+            break;
+        }
+
+        FileData file;
+        if (readFile(fileIndex, slot, file)) {
+            deliver(file);
+        } else {
+            returnSlot(slot);
+        }
+    }
+    finishProducer();
+}
+
+void FileReader::runRing() {
+    // Progress of the file in each slot the ring thread holds
+    struct Request {
+        size_t fileIndex = 0;
+        int fd = -1;
+        int pending = 0;  // Open and statx still outstanding
+        bool failed = false;
+        struct statx stx;
+        size_t size = 0;
+        size_t done = 0;
+    };
+    std::vector<Request> requests(slots_.size());
+    size_t inFlight = 0;       // Slots with a file in progress
+    size_t closesPending = 0;
+    size_t nextFile = 0;
+    bool stopped = false;
+
+    auto start = [&](size_t slot) {
+        Request& request = requests[slot];
+        request = Request();
+        request.fileIndex = nextFile++;
+        request.pending = 2;
+        const char* path = paths_[request.fileIndex].c_str();
+
+        io_uring_sqe* open = ring_->prepare(IORING_OP_OPENAT, AT_FDCWD, ringTag(slot, OP_OPEN));
+        open->addr = reinterpret_cast<uint64_t>(path);
+        open->open_flags = O_RDONLY | O_CLOEXEC;
+
+        io_uring_sqe* stat = ring_->prepare(IORING_OP_STATX, AT_FDCWD, ringTag(slot, OP_STATX));
+        stat->addr = reinterpret_cast<uint64_t>(path);
+        stat->len = STATX_SIZE | STATX_MTIME;
+        stat->off = reinterpret_cast<uint64_t>(&request.stx);
+        ++inFlight;
+    };
+    auto queueRead = [&](size_t slot) {
+        Request& request = requests[slot];
+        io_uring_sqe* read = ring_->prepare(IORING_OP_READ, request.fd, ringTag(slot, OP_READ));
+        read->addr = reinterpret_cast<uint64_t>(slots_[slot].buffer.get() + request.done);
+        read->len = static_cast<uint32_t>(request.size - request.done);
+        read->off = request.done;
+    };
+    auto closeFile = [&](Request& request) {
+        if (request.fd >= 0) {
+            ring_->prepare(IORING_OP_CLOSE, request.fd, ringTag(0, OP_CLOSE));
+            request.fd = -1;
+            ++closesPending;
+        }
+    };
+    // The slot's file is done: hand it out, or give the slot back
+    auto finish = [&](size_t slot, bool ok) {
+        Request& request = requests[slot];
+        closeFile(request);
+        --inFlight;
+        if (!ok || stopped) {
+            if (slots_[slot].mapped) {
+                munmap(slots_[slot].mapped, slots_[slot].mappedSize);
+                slots_[slot].mapped = nullptr;
+            }
+            returnSlot(slot);
+            return;
+        }
+        FileData file;
+        file.index = request.fileIndex;
+        file.slot = slot;
+        file.size = request.done;
+        file.data = slots_[slot].mapped ? static_cast<const char*>(slots_[slot].mapped) : slots_[slot].buffer.get();
+        file.mtime = static_cast<int64_t>(request.stx.stx_mtime.tv_sec) * 1000000000 + request.stx.stx_mtime.tv_nsec;
+        deliver(file);
+    };
+    auto opened = [&](size_t slot) {
+        Request& request = requests[slot];
+        const std::string& path = paths_[request.fileIndex];
+        if (request.failed) {
+            std::cerr << "Error opening file: " << path << std::endl;
+            finish(slot, false);
+            return;
+        }
+        request.size = static_cast<size_t>(request.stx.stx_size);
+        if (request.size == 0 || stopped) {
+            finish(slot, false);
+            return;
+        }
+        if (request.size >= MMAP_THRESHOLD) {
+            void* mapped = mmap(nullptr, request.size, PROT_READ, MAP_PRIVATE, request.fd, 0);
+            if (mapped == MAP_FAILED) {
+                std::cerr << "Error mapping file: " << path << std::endl;
+                finish(slot, false);
+                return;
+            }
+            slots_[slot].mapped = mapped;
+            slots_[slot].mappedSize = request.size;
+            request.done = request.size;
+            finish(slot, true);
+            return;
+        }
+        bufferFor(slot, request.size);
+        queueRead(slot);
+    };
+    auto complete = [&](uint64_t userData, int32_t result) {
+        size_t slot = static_cast<size_t>(userData >> 2);
+        Request& request = requests[slot];
+        switch (static_cast<RingOp>(userData & 3)) {
+        case OP_OPEN:
+            if (result < 0) {
+                request.failed = true;
+            } else {
+                request.fd = result;
+            }
+            if (--request.pending == 0) {
+                opened(slot);
+            }
+            break;
+        case OP_STATX:
+            if (result < 0) {
+                request.failed = true;
+            }
+            if (--request.pending == 0) {
+                opened(slot);
+            }
+            break;
+        case OP_READ:
+            if (result == -EINTR || result == -EAGAIN) {
+                queueRead(slot);
+            } else if (result < 0) {
+                std::cerr << "Error reading file: " << paths_[request.fileIndex] << std::endl;
+                finish(slot, false);
+            } else if (result == 0) {
+                // Truncated since statx
+                finish(slot, request.done > 0);
+            } else {
+                request.done += static_cast<size_t>(result);
+                if (request.done < request.size) {
+                    queueRead(slot);
+                } else {
+                    finish(slot, true);
+                }
+            }
+            break;
+        case OP_CLOSE:
+            --closesPending;
+            break;
+        }
+    };
+
+    while (true) {
+        // Keep every free slot busy; with nothing in flight, wait for a
+        // consumer to release one
+        size_t slot;
+        while (!stopped && nextFile < paths_.size() && takeSlot(slot, inFlight == 0)) {
+            start(slot);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped = stopped || stopping_;
+        }
+        if (inFlight == 0 && closesPending == 0 && (stopped || nextFile >= paths_.size())) {
+            break;
+        }
+        ring_->enter(1);
+        ring_->reap(complete);
+    }
+    finishProducer();
+}
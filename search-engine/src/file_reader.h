@@ -0,0 +1,83 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A file read into memory by FileReader. Valid until passed to release().
+struct FileData {
+    size_t index = 0;       // Position in the path list
+    const char* data = nullptr;
+    size_t size = 0;
+    int64_t mtime = 0;      // Nanoseconds since the epoch
+    size_t slot = 0;        // Buffer it lives in
+};
+
+// Reads a list of files with many reads in flight and hands them out as
+// they complete, in no particular order. On Linux one thread drives an
+// io_uring (open, statx, read and close are all queued); where that is
+// unavailable a few threads open and pread instead. Small files land in
+// reusable buffers, large ones are mapped.
+//
+// Empty files and files that can't be opened are skipped.
+class FileReader {
+public:
+    // `depth` buffers, so at most that many files are being read or held
+    // by consumers at once
+    explicit FileReader(const std::vector<std::string>& paths, unsigned depth = 64, bool useRing = true);
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    // Blocks until a file is ready. Returns false once every file has
+    // been handed out. Safe to call from several threads.
+    bool next(FileData& file);
+    void release(const FileData& file);
+
+    bool usingRing() const { return ring_ != nullptr; }
+
+private:
+    struct Slot {
+        std::unique_ptr<char[]> buffer;
+        size_t capacity = 0;
+        void* mapped = nullptr;  // Set instead of buffer for large files
+        size_t mappedSize = 0;
+    };
+    struct Ring;
+
+    void runRing();
+    void runThreads();
+    bool readFile(size_t fileIndex, size_t slot, FileData& file);
+    char* bufferFor(size_t slot, size_t size);
+
+    // Producer side. takeSlot() returns false once stopping, or without
+    // `wait` if no slot is free.
+    bool takeSlot(size_t& slot, bool wait);
+    void returnSlot(size_t slot);
+    void deliver(const FileData& file);
+    void finishProducer();
+
+    const std::vector<std::string>& paths_;
+    std::vector<Slot> slots_;
+    std::unique_ptr<Ring> ring_;
+    size_t nextFile_ = 0;  // Guarded by mutex_ in thread mode
+
+    std::mutex mutex_;
+    std::condition_variable readyChanged_;
+    std::condition_variable slotFreed_;
+    std::deque<FileData> ready_;
+    std::vector<size_t> freeSlots_;
+    unsigned producers_ = 0;  // Threads still reading
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+#endif // FILE_READER_H
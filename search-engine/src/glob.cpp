@@ -0,0 +1,85 @@
+#include "glob.h"
+
+namespace {
+
+bool matchHere(const char* pattern, const char* text) {
+    while (*pattern) {
+        if (pattern[0] == '*' && pattern[1] == '*') {
+            // "**/" also matches no directory at all
+            pattern += 2;
+            if (*pattern == '/' && matchHere(pattern + 1, text)) {
+                return true;
+            }
+            for (;; ++text) {
+                if (matchHere(pattern, text)) {
+                    return true;
+                }
+                if (!*text) {
+                    return false;
+                }
+            }
+        }
+        if (*pattern == '*') {
+            ++pattern;
+            for (;; ++text) {
+                if (matchHere(pattern, text)) {
+                    return true;
+                }
+                if (!*text || *text == '/') {
+                    return false;
+                }
+            }
+        }
+        if (!*text || (*pattern != '?' && *pattern != *text) || (*pattern == '?' && *text == '/')) {
+            return false;
+        }
+        ++pattern;
+        ++text;
+    }
+    return !*text;
+}
+
+} // namespace
+
+bool globMatch(const std::string& pattern, const std::string& path) {
+    if (pattern.find('/') == std::string::npos) {
+        size_t slash = path.rfind('/');
+        const char* name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+        return matchHere(pattern.c_str(), name);
+    }
+    return matchHere(pattern.c_str(), path.c_str());
+}
+
+bool globMatchAny(const std::vector<std::string>& patterns, const std::string& path) {
+    for (const auto& pattern : patterns) {
+        if (globMatch(pattern, path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool wildcardMatch(std::string_view pattern, std::string_view text) {
+    // Greedy, backing up to the last '*' on a mismatch: linear for the
+    // usual one or two stars
+    size_t p = 0, t = 0;
+    size_t star = std::string_view::npos, resume = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = t;
+        } else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
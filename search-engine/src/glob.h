@@ -0,0 +1,22 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Shell-style pattern match on '/'-separated paths: '?' matches one
+// character and '*' any run of characters, neither crossing a '/';
+// "**" matches across directories ("src/**/*.py", "**/test_*").
+// A pattern without '/' is matched against the last path component, so
+// "*.py" selects Python files at any depth.
+bool globMatch(const std::string& pattern, const std::string& path);
+
+// True if any pattern matches
+bool globMatchAny(const std::vector<std::string>& patterns, const std::string& path);
+
+// Wildcard match on a plain string such as a term: '?' matches one byte
+// and '*' any run of bytes, '/' included
+bool wildcardMatch(std::string_view pattern, std::string_view text);
+
+#endif // GLOB_H
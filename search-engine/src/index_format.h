@@ -0,0 +1,187 @@
+#ifndef INDEX_FORMAT_H
+#define INDEX_FORMAT_H
+
+#include <cstdint>
+
+// On-disk layout of index.bin. The file is written once by
+// Indexer::saveIndexToFile and memory-mapped read-only by MappedIndex,
+// so every section is a flat array that can be used in place.
+//
+//   IndexHeader
+//   TermEntry[numTerms]          sorted by term bytes
+//   term bytes                   all terms concatenated
+//   posting lists                per term, compressed (see posting_list.h)
+//
+// Section offsets are absolute file offsets, aligned to 8 bytes. Each
+// term's posting list starts on a 4-byte boundary.
+
+namespace index_format {
+
+constexpr char MAGIC[8] = {'S', 'S', 'I', 'N', 'D', 'E', 'X', '\0'};
+constexpr uint32_t VERSION = 4;
+
+// IndexHeader::tokenizerFlags
+constexpr uint32_t TOKENIZER_SPLIT_IDENTIFIERS = 1;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numTerms;
+    uint32_t numDocs;
+    float avgDocLength;      // Tokens per document; 0 if lengths were unknown
+    uint64_t termTableOffset;
+    uint64_t termBytesOffset;
+    uint64_t termBytesSize;
+    uint64_t postingsOffset;
+    uint64_t postingsSize;
+    uint64_t fileSize;
+    uint32_t tokenizer;      // TokenizerOptions::Kind the terms were produced with
+    uint32_t tokenizerFlags;
+};
+
+struct TermEntry {
+    uint32_t termOffset;     // Relative to the term bytes section
+    uint32_t termLength;
+    uint32_t docCount;
+    float maxTfNorm;         // Largest BM25 tfNorm in the list
+    uint64_t postingsOffset; // Relative to the postings section
+};
+
+static_assert(sizeof(IndexHeader) == 80, "IndexHeader layout changed");
+static_assert(sizeof(TermEntry) == 24, "TermEntry layout changed");
+
+// manifest.bin: every document of the segment by docId, mapped and used
+// in place (see DocumentTable).
+//
+//   ManifestHeader
+//   uint32_t docLengths[numDocs]         tokens per document
+//   FileInfo fileInfo[numDocs]           size, mtime (ns), content hash
+//   uint64_t blockOffsets[numBlocks]     relative to the path data
+//   path data                            front-coded blocks of blockSize paths
+//
+// Each path in a block is two LEB128 varints, the length it shares with
+// the path before (0 for a block's first) and the length of the rest, then
+// the rest. A block starts on a whole path, so any path is found by
+// decoding at most a block. Paths are in
+// docId order, which is sorted path order for a build, so neighbours
+// share most of their directories.
+//
+// Versions 1 and 2 were a list of (int32 docId, uint32 docLength, version
+// 2: uint64 fileSize, int64 mtime, uint64 contentHash, uint32 pathLength,
+// path) after the magic, version and numDocs. Files without the magic are
+// the legacy layout (no doc lengths). Both are still read.
+constexpr char MANIFEST_MAGIC[8] = {'S', 'S', 'M', 'A', 'N', 'I', 'F', '\0'};
+constexpr uint32_t MANIFEST_VERSION = 3;
+
+// ManifestHeader::flags; without them the lengths or file details are zeros
+constexpr uint32_t MANIFEST_HAS_LENGTHS = 1;
+constexpr uint32_t MANIFEST_HAS_FILE_INFO = 2;
+
+struct ManifestHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numDocs;
+    uint32_t flags;
+    uint32_t blockSize;          // Paths per front-coded block
+    uint64_t lengthsOffset;
+    uint64_t fileInfoOffset;
+    uint64_t blockOffsetsOffset;
+    uint64_t pathDataOffset;
+    uint64_t pathDataSize;
+    uint64_t fileSize;
+};
+
+static_assert(sizeof(ManifestHeader) == 72, "ManifestHeader layout changed");
+
+// positions.bin: optional positional postings, written next to index.bin
+// and only mapped when a phrase query needs it.
+//
+//   PositionsHeader
+//   uint64_t termOffsets[numTerms + 1]   by termId (index in the term table),
+//                                        relative to the data section
+//   data                                 per term, see positions.h
+constexpr char POSITIONS_MAGIC[8] = {'S', 'S', 'P', 'O', 'S', 'I', 'T', '\0'};
+constexpr uint32_t POSITIONS_VERSION = 1;
+
+struct PositionsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numTerms;
+    uint64_t indexFileSize;    // Size of the index.bin this file belongs to
+    uint64_t termOffsetsOffset;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t fileSize;
+};
+
+static_assert(sizeof(PositionsHeader) == 56, "PositionsHeader layout changed");
+
+// trigrams.bin: optional, written next to index.bin. For every trigram
+// (three bytes, ASCII letters lower-cased) the documents containing it,
+// for narrowing substring and regex searches down to a few files.
+//
+//   TrigramsHeader
+//   data                        per trigram, docId deltas as LEB128 varints
+//   TrigramEntry[numTrigrams]   sorted by trigram
+constexpr char TRIGRAMS_MAGIC[8] = {'S', 'S', 'T', 'R', 'I', 'G', 'M', '\0'};
+constexpr uint32_t TRIGRAMS_VERSION = 1;
+
+struct TrigramsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numTrigrams;
+    uint64_t indexFileSize;    // Size of the index.bin this file belongs to
+    uint64_t tableOffset;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t fileSize;
+};
+
+struct TrigramEntry {
+    uint32_t trigram;          // Bytes packed big-endian, so keys sort like the bytes
+    uint32_t docCount;
+    uint64_t dataOffset;       // Relative to the data section
+};
+
+static_assert(sizeof(TrigramsHeader) == 56, "TrigramsHeader layout changed");
+static_assert(sizeof(TrigramEntry) == 16, "TrigramEntry layout changed");
+
+// segments.bin: written by --update. Lists the segments that make up the
+// index, in docId order, each with a tombstone bitmap of deleted docs.
+// Segment 0 is index.bin / manifest.bin / positions.bin; segment N > 0 is
+// seg-N.index.bin and so on. Without this file the index is segment 0.
+//
+//   CatalogHeader
+//   per segment: SegmentHeader, uint64_t tombstones[(numDocs + 63) / 64]
+constexpr char CATALOG_MAGIC[8] = {'S', 'S', 'S', 'E', 'G', 'M', 'T', '\0'};
+constexpr uint32_t CATALOG_VERSION = 1;
+
+struct CatalogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numSegments;
+    uint32_t nextSegmentId;
+    uint32_t reserved;
+};
+
+struct SegmentHeader {
+    uint32_t id;
+    uint32_t numDocs;
+    uint32_t numDeleted;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(CatalogHeader) == 24, "CatalogHeader layout changed");
+static_assert(sizeof(SegmentHeader) == 16, "SegmentHeader layout changed");
+
+inline uint64_t alignTo8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+inline uint64_t alignTo4(uint64_t offset) {
+    return (offset + 3) & ~uint64_t(3);
+}
+
+} // namespace index_format
+
+#endif // INDEX_FORMAT_H
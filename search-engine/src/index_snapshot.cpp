@@ -0,0 +1,335 @@
+#include "index_snapshot.h"
+#include "json_util.h"
+#include "top_k.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+// A merge may delete segment files between reading the catalog and
+// opening them; read the catalog again that many times before giving up
+const int LOAD_ATTEMPTS = 3;
+
+bool segmentFilesExist(const SegmentCatalog& catalog) {
+    for (const auto& info : catalog.segments) {
+        SegmentFiles files = segmentFiles(info.id);
+        if (!std::filesystem::exists(files.index) || !std::filesystem::exists(files.manifest)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<IndexSegment> IndexSegment::load(const SegmentInfo& info) {
+    SegmentFiles files = segmentFiles(info.id);
+
+    // Check if binary index files exist
+    if (!std::filesystem::exists(files.index) || !std::filesystem::exists(files.manifest)) {
+        std::cerr << "Error: Pre-built index files not found (" << files.index << " or " << files.manifest << ")" << std::endl;
+        std::cerr << "Please run with --build mode first to create the index." << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<IndexSegment> segment(new IndexSegment());
+    segment->info_ = info;
+
+    // Map the index and load the manifest
+    try {
+        if (!segment->index_.open(files.index) || !segment->indexer_.loadManifestFromFile(files.manifest)) {
+            return nullptr;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Failed to load index: " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    // A build replaces the files one at a time; don't pair an index with
+    // a manifest or catalog entry from another build
+    if (segment->indexer_.getDocuments().size() != segment->index_.numDocs()) {
+        std::cerr << "Error: " << files.manifest << " does not match " << files.index << std::endl;
+        return nullptr;
+    }
+    if (info.numDocs != segment->index_.numDocs()) {
+        std::cerr << "Error: " << CATALOG_FILE << " does not match " << files.index << std::endl;
+        return nullptr;
+    }
+
+    if (!segment->index_.buildLookup()) {
+        std::cerr << "Error: " << files.index << " is truncated or corrupt" << std::endl;
+        return nullptr;
+    }
+
+    // Positions are optional; without them phrase queries are rejected
+    if (std::filesystem::exists(files.positions)) {
+        segment->positions_.open(files.positions, segment->index_);
+    }
+    if (std::filesystem::exists(files.trigrams)) {
+        segment->trigrams_.open(files.trigrams, segment->index_);
+    }
+
+    segment->searcher_ = std::make_unique<Searcher>(segment->index_, segment->indexer_.getDocuments(),
+                                                    &segment->positions_);
+    if (segment->info_.numDeleted > 0) {
+        segment->searcher_->setDeleted(&segment->info_.deleted);
+    }
+    segment->encodeNames();
+    return segment;
+}
+
+void IndexSegment::encodeNames() {
+    const DocumentTable& documents = indexer_.getDocuments();
+    jsonNameOffsets_.reserve(documents.size() + 1);
+    jsonNameOffsets_.push_back(0);
+    fileNameOffsets_.reserve(documents.size() + 1);
+    fileNameOffsets_.push_back(0);
+    documents.forEach([&](uint32_t, std::string_view path) {
+        std::string name = std::filesystem::path(path).filename().string();
+        jsonNames_ += '"';
+        jsonNames_ += jsonEscape(name);
+        jsonNames_ += '"';
+        jsonNameOffsets_.push_back(jsonNames_.size());
+        fileNames_ += name;
+        fileNameOffsets_.push_back(fileNames_.size());
+    });
+    jsonNames_.shrink_to_fit();
+    fileNames_.shrink_to_fit();
+}
+
+std::shared_ptr<const IndexSnapshot> IndexSnapshot::load() {
+    SegmentCatalog catalog;
+    for (int attempt = 1; attempt <= LOAD_ATTEMPTS; ++attempt) {
+        if (!catalog.load()) {
+            return nullptr;
+        }
+        if (segmentFilesExist(catalog)) {
+            break;
+        }
+    }
+
+    if (catalog.segments.empty()) {
+        SegmentFiles files = segmentFiles(0);
+        if (!std::filesystem::exists(files.index) || !std::filesystem::exists(files.manifest)) {
+            std::cerr << "Error: Pre-built index files not found (" << files.index << " or " << files.manifest << ")" << std::endl;
+            std::cerr << "Please run with --build mode first to create the index." << std::endl;
+        } else {
+            // index.bin isn't in the mapped format; let MappedIndex say why
+            MappedIndex index;
+            index.open(files.index);
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<IndexSnapshot> snapshot(new IndexSnapshot());
+    uint32_t docBase = 0;
+    for (const auto& info : catalog.segments) {
+        std::unique_ptr<IndexSegment> segment = IndexSegment::load(info);
+        if (!segment) {
+            return nullptr;
+        }
+        if (snapshot->segments_.empty()) {
+            snapshot->tokenizer_ = segment->index().tokenizer();
+        } else if (segment->index().tokenizer() != snapshot->tokenizer_) {
+            std::cerr << "Error: " << segmentFiles(info.id).index
+                      << " was built with different tokenizer settings. Please rebuild the index." << std::endl;
+            return nullptr;
+        }
+        snapshot->docBases_.push_back(docBase);
+        docBase += segment->index().numDocs();
+        snapshot->stats_.segments.push_back(&segment->index());
+        snapshot->stats_.numDocs += segment->index().numDocs();
+        snapshot->segments_.push_back(std::move(segment));
+    }
+
+    // With one segment its own counts are the collection's
+    if (snapshot->segments_.size() > 1) {
+        for (auto& segment : snapshot->segments_) {
+            segment->searcher().setCollectionStats(&snapshot->stats_);
+        }
+    }
+    return snapshot;
+}
+
+std::vector<SearchResult> IndexSnapshot::search(const QueryNode& query, size_t limit) const {
+    if (segments_.size() == 1) {
+        return segments_[0]->searcher().search(query, limit);
+    }
+
+    // Each segment's top `limit` holds everything it could add to the
+    // overall top `limit`
+    TopK<SearchResult> top(limit, numDocuments());
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        for (const SearchResult& result : segments_[i]->searcher().search(query, limit)) {
+            top.push({docBases_[i] + result.docId, result.score});
+        }
+    }
+    return top.take();
+}
+
+std::vector<SearchResult> IndexSnapshot::searchOrFuzzy(const QueryNode& query, size_t limit, bool& fuzzy) const {
+    fuzzy = false;
+    std::vector<SearchResult> results = search(query, limit);
+    if (results.empty() && limit > 0) {
+        QueryNode approximate = query;
+        if (makeFuzzy(approximate, 0)) {
+            results = search(approximate, limit);
+            fuzzy = !results.empty();
+        }
+    }
+    return results;
+}
+
+std::vector<Suggestion> IndexSnapshot::suggest(std::string_view prefix, size_t limit) const {
+    std::vector<Suggestion> suggestions;
+    if (prefix.empty() || limit == 0) {
+        return suggestions;
+    }
+
+    for (const auto& segment : segments_) {
+        const MappedIndex& index = segment->index();
+        auto range = index.prefixRange(prefix);
+        for (uint32_t termId : index.topTerms(range.first, range.second, limit, [](uint32_t) { return true; })) {
+            const index_format::TermEntry& entry = index.termAt(termId);
+            suggestions.push_back({std::string(index.termString(entry)), entry.docCount});
+        }
+    }
+
+    if (segments_.size() > 1) {
+        std::sort(suggestions.begin(), suggestions.end(),
+                  [](const Suggestion& a, const Suggestion& b) { return a.term < b.term; });
+        suggestions.erase(std::unique(suggestions.begin(), suggestions.end(),
+                                      [](const Suggestion& a, const Suggestion& b) { return a.term == b.term; }),
+                          suggestions.end());
+        for (auto& suggestion : suggestions) {
+            suggestion.documents = stats_.docCount(suggestion.term);
+        }
+        std::sort(suggestions.begin(), suggestions.end(), [](const Suggestion& a, const Suggestion& b) {
+            return a.documents > b.documents || (a.documents == b.documents && a.term < b.term);
+        });
+        if (suggestions.size() > limit) {
+            suggestions.resize(limit);
+        }
+    }
+    return suggestions;
+}
+
+std::vector<uint32_t> IndexSnapshot::searchCode(const CodePattern& pattern, size_t limit, WorkerPool* helpers,
+                                                const MatchDeadline& deadline) const {
+    std::vector<uint32_t> candidates;
+    for (size_t i = 0; i < segments_.size() && limit > 0; ++i) {
+        const IndexSegment& segment = *segments_[i];
+        for (uint32_t docId : trigramCandidates(segment.trigrams(), pattern.trigrams(), segment.index().numDocs())) {
+            if (!segment.info().isDeleted(docId)) {
+                candidates.push_back(docBases_[i] + docId);
+            }
+        }
+    }
+
+    // Candidates are claimed in order, so once `limit` matches are found
+    // every earlier candidate has been claimed and will be checked; the
+    // first `limit` matches are then final
+    std::vector<char> matched(candidates.size(), 0);
+    std::atomic<size_t> found{0};
+    auto verify = [&](size_t i) {
+        std::string path = documentPath(candidates[i]);
+        if (!path.empty() && pattern.matchesFile(path, deadline)) {
+            matched[i] = 1;
+            found++;
+        }
+        return found.load(std::memory_order_relaxed) < limit && deadline.check();
+    };
+    if (helpers) {
+        helpers->parallelFor(candidates.size(), verify);
+    } else {
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (!verify(i)) {
+                break;
+            }
+        }
+    }
+
+    std::vector<uint32_t> results;
+    for (size_t i = 0; i < candidates.size() && results.size() < limit; ++i) {
+        if (matched[i]) {
+            results.push_back(candidates[i]);
+        }
+    }
+    return results;
+}
+
+const IndexSegment* IndexSnapshot::segmentOf(uint32_t docId, uint32_t& localId) const {
+    auto it = std::upper_bound(docBases_.begin(), docBases_.end(), docId);
+    if (it == docBases_.begin()) {
+        return nullptr;
+    }
+    size_t segment = static_cast<size_t>(it - docBases_.begin()) - 1;
+    localId = docId - docBases_[segment];
+    return segments_[segment].get();
+}
+
+std::string IndexSnapshot::documentPath(uint32_t docId) const {
+    uint32_t localId;
+    const IndexSegment* segment = segmentOf(docId, localId);
+    return segment ? segment->documents().getDocuments().path(localId) : std::string();
+}
+
+std::string_view IndexSnapshot::jsonName(uint32_t docId) const {
+    uint32_t localId;
+    const IndexSegment* segment = segmentOf(docId, localId);
+    return segment ? segment->jsonName(localId) : std::string_view();
+}
+
+std::string_view IndexSnapshot::fileName(uint32_t docId) const {
+    uint32_t localId;
+    const IndexSegment* segment = segmentOf(docId, localId);
+    return segment ? segment->fileName(localId) : std::string_view();
+}
+
+bool IndexSnapshot::hasPositions() const {
+    return std::all_of(segments_.begin(), segments_.end(),
+                       [](const std::unique_ptr<IndexSegment>& segment) {
+                           return segment->searcher().hasPositions();
+                       });
+}
+
+bool IndexSnapshot::hasTrigrams() const {
+    return std::all_of(segments_.begin(), segments_.end(),
+                       [](const std::unique_ptr<IndexSegment>& segment) {
+                           return segment->trigrams().isOpen();
+                       });
+}
+
+size_t IndexSnapshot::numTerms() const {
+    size_t count = 0;
+    for (const auto& segment : segments_) {
+        count += segment->index().numTerms();
+    }
+    return count;
+}
+
+IndexMemory IndexSnapshot::memoryUsage() const {
+    IndexMemory memory;
+    for (const auto& segment : segments_) {
+        memory.indexFiles += segment->index().sizeBytes();
+        memory.positionFiles += segment->positions().sizeBytes();
+        memory.trigramFiles += segment->trigrams().sizeBytes();
+        memory.termLookup += segment->index().lookupBytes();
+        memory.manifestFiles += segment->documents().getDocuments().mappedBytes();
+        memory.documents += segment->documents().documentMemoryBytes() + segment->searcher().memoryBytes() +
+                            segment->nameBytes() +
+                            segment->info().deleted.capacity() * sizeof(uint64_t);
+    }
+    return memory;
+}
+
+size_t IndexSnapshot::numDocuments() const {
+    size_t count = 0;
+    for (const auto& segment : segments_) {
+        count += segment->info().liveDocs();
+    }
+    return count;
+}
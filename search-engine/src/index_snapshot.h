@@ -0,0 +1,163 @@
+#ifndef INDEX_SNAPSHOT_H
+#define INDEX_SNAPSHOT_H
+
+#include "code_search.h"
+#include "indexer.h"
+#include "mapped_index.h"
+#include "positions.h"
+#include "searcher.h"
+#include "segments.h"
+#include "trigrams.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class WorkerPool;
+
+// One segment of a loaded index: its mapped index file, manifest,
+// optional positions and tombstones, and a Searcher over them
+class IndexSegment {
+public:
+    // Returns nullptr (after printing why) if the files are missing,
+    // corrupt or don't belong together
+    static std::unique_ptr<IndexSegment> load(const SegmentInfo& info);
+
+    IndexSegment(const IndexSegment&) = delete;
+    IndexSegment& operator=(const IndexSegment&) = delete;
+
+    const SegmentInfo& info() const { return info_; }
+    const MappedIndex& index() const { return index_; }
+    const MappedPositions& positions() const { return positions_; }
+    const MappedTrigrams& trigrams() const { return trigrams_; }
+    const Indexer& documents() const { return indexer_; }
+    const Searcher& searcher() const { return *searcher_; }
+    Searcher& searcher() { return *searcher_; }
+
+    // A document's file name as a quoted, escaped JSON string, ready to be
+    // copied into a response; empty if the manifest doesn't list it
+    std::string_view jsonName(uint32_t docId) const {
+        return docId + 1 < jsonNameOffsets_.size()
+                   ? std::string_view(jsonNames_).substr(jsonNameOffsets_[docId],
+                                                         jsonNameOffsets_[docId + 1] - jsonNameOffsets_[docId])
+                   : std::string_view();
+    }
+
+    // The same file name unescaped, for the binary protocol
+    std::string_view fileName(uint32_t docId) const {
+        return docId + 1 < fileNameOffsets_.size()
+                   ? std::string_view(fileNames_).substr(fileNameOffsets_[docId],
+                                                         fileNameOffsets_[docId + 1] - fileNameOffsets_[docId])
+                   : std::string_view();
+    }
+    size_t nameBytes() const {
+        return jsonNames_.capacity() + fileNames_.capacity() +
+               (jsonNameOffsets_.capacity() + fileNameOffsets_.capacity()) * sizeof(size_t);
+    }
+
+private:
+    IndexSegment() = default;
+    void encodeNames();
+
+    SegmentInfo info_;
+    Indexer indexer_;            // Owns the document table
+    MappedIndex index_;          // Mapped read-only
+    MappedPositions positions_;  // Only paged in by phrase queries
+    MappedTrigrams trigrams_;    // Only paged in by substring and regex searches
+    std::unique_ptr<Searcher> searcher_;
+
+    // Every document's jsonName and fileName back to back, encoded once
+    // at load
+    std::string jsonNames_;
+    std::vector<size_t> jsonNameOffsets_;  // numDocs + 1
+    std::string fileNames_;
+    std::vector<size_t> fileNameOffsets_;  // numDocs + 1
+};
+
+// Where a loaded index's memory goes, in bytes
+struct IndexMemory {
+    size_t indexFiles = 0;     // Mapped index.bin files, paged in as queries touch them
+    size_t positionFiles = 0;  // Mapped positions.bin files
+    size_t trigramFiles = 0;   // Mapped trigrams.bin files
+    size_t manifestFiles = 0;  // Mapped manifest.bin files
+    size_t termLookup = 0;     // Hash tables over the term tables
+    size_t documents = 0;      // File names, BM25 norms and tables of older manifests
+};
+
+// A completion offered by IndexSnapshot::suggest
+struct Suggestion {
+    std::string term;
+    uint64_t documents = 0;  // Documents containing it, tombstoned ones included
+};
+
+// Every segment listed in the catalog, loaded together and never modified
+// afterwards, so any number of queries can share it. The server swaps in a
+// new snapshot on reload and the old one is unmapped when its last query
+// finishes.
+//
+// Document ids in results are global: a segment's ids follow those of the
+// segments before it in the catalog.
+class IndexSnapshot {
+public:
+    // Returns nullptr (after printing why) if the index can't be loaded
+    static std::shared_ptr<const IndexSnapshot> load();
+
+    IndexSnapshot(const IndexSnapshot&) = delete;
+    IndexSnapshot& operator=(const IndexSnapshot&) = delete;
+
+    // Top `limit` matches across all segments, best first
+    std::vector<SearchResult> search(const QueryNode& query, size_t limit) const;
+
+    // search(), but if nothing matches, once more allowing typos in the
+    // terms (makeFuzzy by term length); `fuzzy` says whether that answered
+    std::vector<SearchResult> searchOrFuzzy(const QueryNode& query, size_t limit, bool& fuzzy) const;
+
+    // Up to `limit` indexed terms starting with `prefix`, in the most
+    // documents first. Candidates are each segment's top `limit`, so with
+    // several segments a term that is in none of those can be missed.
+    std::vector<Suggestion> suggest(std::string_view prefix, size_t limit) const;
+
+    // Up to `limit` documents whose contents match the pattern, in docId
+    // order. Candidates from the trigram index are checked on the calling
+    // thread and any `helpers` threads, which stop once `limit` matches
+    // are found or the deadline passes (then the results are incomplete;
+    // see deadline.passed()). Needs hasTrigrams().
+    std::vector<uint32_t> searchCode(const CodePattern& pattern, size_t limit, WorkerPool* helpers,
+                                     const MatchDeadline& deadline) const;
+
+    // Path of a document by global id; empty if there is none
+    std::string documentPath(uint32_t docId) const;
+
+    // Its file name as a JSON string (see IndexSegment::jsonName)
+    std::string_view jsonName(uint32_t docId) const;
+
+    // Its file name unescaped; empty if there is none
+    std::string_view fileName(uint32_t docId) const;
+
+    // Phrase queries need positions in every segment
+    bool hasPositions() const;
+
+    // Substring and regex searches need trigrams in every segment
+    bool hasTrigrams() const;
+
+    // How queries must be split to match the indexed terms
+    const TokenizerOptions& tokenizer() const { return tokenizer_; }
+
+    size_t numSegments() const { return segments_.size(); }
+    size_t numDocuments() const;
+    size_t numTerms() const;  // Summed over segments
+    IndexMemory memoryUsage() const;
+
+private:
+    IndexSnapshot() = default;
+
+    // The segment holding a global document id, and the id within it
+    const IndexSegment* segmentOf(uint32_t docId, uint32_t& localId) const;
+
+    std::vector<std::unique_ptr<IndexSegment>> segments_;
+    std::vector<uint32_t> docBases_;  // First global id of each segment
+    CollectionStats stats_;
+    TokenizerOptions tokenizer_;
+};
+
+#endif // INDEX_SNAPSHOT_H
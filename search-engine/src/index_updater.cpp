@@ -0,0 +1,218 @@
+#include "index_updater.h"
+#include "index_snapshot.h"
+#include "mapped_index.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+
+namespace {
+
+// Where a live document of the current index lives
+struct DocumentLocation {
+    size_t segment;  // Catalog position
+    uint32_t docId;
+    FileInfo file;
+};
+
+bool unchanged(const std::string& path, const FileInfo& known) {
+    // Manifests before version 2 carry no hash; reindex those files
+    FileInfo current;
+    if (known.contentHash == 0 || !Indexer::statFile(path, current) || current.size != known.size) {
+        return false;
+    }
+    if (current.mtime == known.mtime) {
+        return true;
+    }
+
+    // Touched but possibly not modified
+    std::ifstream file(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return Indexer::contentHash(content) == known.contentHash;
+}
+
+} // namespace
+
+bool saveSegment(Indexer& indexer, uint32_t id) {
+    SegmentFiles files = segmentFiles(id);
+    bool positions = indexer.hasPositions();
+    bool trigrams = indexer.hasTrigrams();
+    if (indexer.saveIndexToFile(files.index) && indexer.saveManifestToFile(files.manifest) &&
+        indexer.savePositionsToFile(files.positions) == positions &&
+        indexer.saveTrigramsToFile(files.trigrams) == trigrams) {
+        return true;
+    }
+    std::cerr << "Error: could not write segment " << id << "; the index is unchanged" << std::endl;
+    removeSegmentFiles(id);
+    return false;
+}
+
+void removeSegmentFiles(uint32_t id) {
+    SegmentFiles files = segmentFiles(id);
+    std::remove(files.index.c_str());
+    std::remove(files.manifest.c_str());
+    std::remove(files.positions.c_str());
+    std::remove(files.trigrams.c_str());
+}
+
+int updateIndex(const std::string& directory, const UpdateOptions& options) {
+    CatalogLock lock;
+    SegmentCatalog catalog;
+    if (!lock.locked() || !catalog.load()) {
+        return 1;
+    }
+
+    // Every live document of the current index, by path
+    std::unordered_map<std::string, DocumentLocation> existing;
+    for (size_t s = 0; s < catalog.segments.size(); ++s) {
+        const SegmentInfo& info = catalog.segments[s];
+        Indexer documents;
+        if (!documents.loadManifestFromFile(segmentFiles(info.id).manifest)) {
+            return 1;
+        }
+        const DocumentTable& table = documents.getDocuments();
+        if (table.size() > info.numDocs) {
+            std::cerr << "Error: " << segmentFiles(info.id).manifest << " does not match "
+                      << CATALOG_FILE << std::endl;
+            return 1;
+        }
+        table.forEach([&](uint32_t docId, std::string_view path) {
+            if (!info.isDeleted(docId)) {
+                existing[std::string(path)] = {s, docId, table.fileInfo(docId)};
+            }
+        });
+    }
+
+    // The new segment's terms must match the existing ones
+    BuildOptions build = options.build;
+    if (!catalog.segments.empty()) {
+        MappedIndex index;
+        if (!index.open(segmentFiles(catalog.segments[0].id).index)) {
+            return 1;
+        }
+        if (index.tokenizer() != build.tokenizer) {
+            std::cout << "Note: keeping the tokenizer settings the index was built with" << std::endl;
+            build.tokenizer = index.tokenizer();
+        }
+    }
+
+    // New and changed files go into the new segment; the documents they
+    // replace are deleted
+    std::vector<std::string> delta;
+    size_t added = 0, changed = 0, removed = 0;
+    for (const std::string& path : Indexer::listFiles(directory, options.build)) {
+        auto it = existing.find(path);
+        if (it == existing.end()) {
+            FileInfo current;
+            if (Indexer::statFile(path, current) && current.size > 0) {
+                delta.push_back(path);
+                ++added;
+            }
+            continue;
+        }
+        if (!unchanged(path, it->second.file)) {
+            catalog.segments[it->second.segment].markDeleted(it->second.docId);
+            delta.push_back(path);
+            ++changed;
+        }
+        existing.erase(it);
+    }
+
+    // Whatever is left was deleted from the directory
+    for (const auto& entry : existing) {
+        catalog.segments[entry.second.segment].markDeleted(entry.second.docId);
+        ++removed;
+    }
+
+    if (delta.empty() && removed == 0) {
+        std::cout << "Index is up to date." << std::endl;
+    } else {
+        if (!delta.empty()) {
+            Indexer indexer;
+            indexer.buildIndex(delta, build);
+
+            // Files that were emptied have no document
+            if (!indexer.getDocuments().empty()) {
+                SegmentInfo info;
+                info.id = catalog.nextId++;
+                info.numDocs = indexer.getDocuments().size();
+                if (!saveSegment(indexer, info.id)) {
+                    return 1;
+                }
+                catalog.segments.push_back(std::move(info));
+            }
+        }
+
+        if (!catalog.save()) {
+            return 1;
+        }
+        std::cout << added << " added, " << changed << " changed, " << removed << " deleted ("
+                  << catalog.segments.size() << " segments)." << std::endl;
+    }
+
+    if (options.merge && compactSegments(catalog) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+int compactSegments(SegmentCatalog& catalog) {
+    int merges = 0;
+    for (std::vector<size_t> picked = pickMerge(catalog); !picked.empty(); picked = pickMerge(catalog)) {
+        std::vector<std::unique_ptr<IndexSegment>> loaded;
+        std::vector<SegmentSource> sources;
+        for (size_t position : picked) {
+            const SegmentInfo& info = catalog.segments[position];
+            std::unique_ptr<IndexSegment> segment = IndexSegment::load(info);
+            if (!segment) {
+                return -1;
+            }
+            sources.push_back({&segment->index(), &segment->positions(), &segment->trigrams(),
+                               &segment->documents(), info.numDeleted > 0 ? &info.deleted : nullptr});
+            loaded.push_back(std::move(segment));
+        }
+
+        Indexer merged;
+        merged.mergeSegments(sources);
+
+        // The merged segment takes the place of the first one it replaces;
+        // if every document was deleted it simply disappears
+        std::vector<uint32_t> replaced;
+        for (size_t position : picked) {
+            replaced.push_back(catalog.segments[position].id);
+        }
+        SegmentInfo info;
+        if (!merged.getDocuments().empty()) {
+            info.id = catalog.nextId++;
+            info.numDocs = merged.getDocuments().size();
+            if (!saveSegment(merged, info.id)) {
+                return -1;
+            }
+        }
+        for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+            catalog.segments.erase(catalog.segments.begin() + static_cast<std::ptrdiff_t>(*it));
+        }
+        if (info.numDocs > 0) {
+            catalog.segments.insert(catalog.segments.begin() + static_cast<std::ptrdiff_t>(picked[0]), info);
+        }
+
+        if (!catalog.save()) {
+            return -1;
+        }
+        loaded.clear();
+        for (uint32_t id : replaced) {
+            removeSegmentFiles(id);
+        }
+
+        if (info.numDocs == 0) {
+            std::cout << "Dropped " << replaced.size() << " segment(s) with no live documents." << std::endl;
+        } else {
+            std::cout << "Merged " << replaced.size() << " segment(s) into segment " << info.id << " ("
+                      << info.numDocs << " documents)." << std::endl;
+        }
+        ++merges;
+    }
+    return merges;
+}
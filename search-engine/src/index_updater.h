@@ -0,0 +1,35 @@
+#ifndef INDEX_UPDATER_H
+#define INDEX_UPDATER_H
+
+#include "indexer.h"
+#include "segments.h"
+#include <string>
+
+struct UpdateOptions {
+    BuildOptions build;
+    bool merge = true;  // Run the merge policy once the new segment is committed
+};
+
+// Bring the index in the working directory up to date with `directory`.
+// Files whose size and mtime match the manifest are skipped; otherwise the
+// content hash decides. New and changed files go into one new segment,
+// and the documents they replace (and those of deleted files) are
+// tombstoned. The catalog is committed before any merging, so a reload
+// can pick up the changes while merges are still running.
+// Returns 0 on success.
+int updateIndex(const std::string& directory, const UpdateOptions& options);
+
+// Apply pickMerge() until it finds nothing to do, committing the catalog
+// after each merge. The caller holds the CatalogLock. Returns the number
+// of merges, or -1 on error.
+int compactSegments(SegmentCatalog& catalog);
+
+// Write an indexer's contents as segment `id`. Returns false, with the
+// segment's files removed again, if any of them could not be written.
+bool saveSegment(Indexer& indexer, uint32_t id);
+
+// Remove a segment's files once no catalog refers to it. Servers that
+// still map them keep their copy until they reload.
+void removeSegmentFiles(uint32_t id);
+
+#endif // INDEX_UPDATER_H
@@ -1,108 +1,1243 @@
 #include "indexer.h"
+#include "mapped_index.h"
+#include "bm25.h"
+#include "file_reader.h"
+#include "glob.h"
+#include "positions.h"
+#include "trigrams.h"
+#include "varint.h"
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <filesystem>
 #include <cstdint> 
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <queue>
+
+// POSIX stat and getpid
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
+namespace {
+
+// Rough dictionary cost of a new term besides its bytes: the arena offset
+// and a hash slot at the table's average load
+constexpr size_t PARTIAL_TERM_BYTES = 12;
+
+// Run files are written and read through buffers of these sizes
+constexpr size_t RUN_WRITE_BUFFER = 1 << 20;
+constexpr size_t RUN_READ_BUFFER = 64 << 10;
+
+// Sort postings by docId, moving each posting's run of positions with it
+void sortPostings(vector<Posting>& postingList, vector<uint32_t>* positionList) {
+    auto byDocId = [](const Posting& a, const Posting& b) { return a.docId < b.docId; };
+    if (is_sorted(postingList.begin(), postingList.end(), byDocId)) {
+        return;
+    }
+    if (!positionList) {
+        sort(postingList.begin(), postingList.end(), byDocId);
+        return;
+    }
+
+    vector<size_t> starts(postingList.size());
+    size_t start = 0;
+    for (size_t i = 0; i < postingList.size(); ++i) {
+        starts[i] = start;
+        start += postingList[i].frequency;
+    }
+
+    vector<size_t> order(postingList.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return postingList[a].docId < postingList[b].docId;
+    });
+
+    vector<Posting> sortedPostings;
+    vector<uint32_t> sortedPositions;
+    sortedPostings.reserve(postingList.size());
+    sortedPositions.reserve(positionList->size());
+    for (size_t i : order) {
+        sortedPostings.push_back(postingList[i]);
+        auto first = positionList->begin() + starts[i];
+        sortedPositions.insert(sortedPositions.end(), first, first + postingList[i].frequency);
+    }
+    postingList.swap(sortedPostings);
+    positionList->swap(sortedPositions);
+}
+
+// LSD radix sort, a byte per pass; bytes that are the same in every value
+// (the high bytes of file indexes) are skipped. Several times faster than
+// std::sort on the millions of trigram pairs a build collects.
+void radixSort(vector<uint64_t>& values) {
+    vector<array<size_t, 256>> counts(sizeof(uint64_t));
+    for (auto& count : counts) {
+        count.fill(0);
+    }
+    for (uint64_t value : values) {
+        for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+            counts[b][(value >> (b * 8)) & 0xFF]++;
+        }
+    }
+
+    vector<uint64_t> buffer(values.size());
+    for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+        array<size_t, 256>& count = counts[b];
+        if (values.empty() || count[(values[0] >> (b * 8)) & 0xFF] == values.size()) {
+            continue;
+        }
+        size_t start = 0;
+        for (size_t& c : count) {
+            size_t n = c;
+            c = start;
+            start += n;
+        }
+        for (uint64_t value : values) {
+            buffer[count[(value >> (b * 8)) & 0xFF]++] = value;
+        }
+        values.swap(buffer);
+    }
+}
+
+index_format::IndexHeader makeHeader(const TokenizerOptions& tokenizer, size_t numDocs, size_t numTerms,
+                                     uint64_t termBytesSize, float avgDocLength) {
+    using namespace index_format;
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.numTerms = static_cast<uint32_t>(numTerms);
+    header.numDocs = static_cast<uint32_t>(numDocs);
+    header.avgDocLength = avgDocLength;
+    header.tokenizer = static_cast<uint32_t>(tokenizer.kind);
+    header.tokenizerFlags = tokenizer.splitIdentifiers ? TOKENIZER_SPLIT_IDENTIFIERS : 0;
+    header.termTableOffset = alignTo8(sizeof(IndexHeader));
+    header.termBytesOffset = alignTo8(header.termTableOffset + numTerms * sizeof(TermEntry));
+    header.termBytesSize = termBytesSize;
+    header.postingsOffset = alignTo8(header.termBytesOffset + termBytesSize);
+    return header;
+}
+
+// Append the whole of `path` to `out`
+bool appendFile(ofstream& out, const string& path) {
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    vector<char> buffer(RUN_WRITE_BUFFER);
+    while (in) {
+        in.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        out.write(buffer.data(), in.gcount());
+    }
+    return static_cast<bool>(out);
+}
+
+// Buffered sequential reads of varints and bytes from a run file
+class RunFile {
+public:
+    bool open(const string& path) {
+        file_.open(path, ios::binary);
+        buffer_.resize(RUN_READ_BUFFER);
+        return file_.is_open();
+    }
+
+    bool atEnd() { return !fill(1); }
+
+    uint32_t varint() {
+        fill(5);
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer_.data() + pos_);
+        uint32_t value;
+        pos_ += static_cast<size_t>(readVarint(p, value) - p);
+        return value;
+    }
+
+    void readBytes(char* out, size_t size) {
+        while (size > 0 && fill(1)) {
+            size_t chunk = min(size, end_ - pos_);
+            memcpy(out, buffer_.data() + pos_, chunk);
+            pos_ += chunk;
+            out += chunk;
+            size -= chunk;
+        }
+    }
+
+private:
+    // Make at least `size` bytes available unless the file ends first
+    bool fill(size_t size) {
+        if (end_ - pos_ >= size) {
+            return true;
+        }
+        memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+        file_.read(buffer_.data() + end_, static_cast<streamsize>(buffer_.size() - end_));
+        end_ += static_cast<size_t>(file_.gcount());
+        return end_ - pos_ >= size;
+    }
+
+    ifstream file_;
+    vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+// Reads back a run written by Indexer::writeRun, one term at a time:
+//
+//   per term, in byte order: varint length, term bytes, varint count,
+//   then per posting: varint file index delta, varint frequency and,
+//   if the build records them, `frequency` varint position deltas
+class RunReader {
+public:
+    bool open(const string& path) { return in_.open(path); }
+
+    // Move to the next term; false at the end of the run
+    bool nextTerm() {
+        if (in_.atEnd()) {
+            return false;
+        }
+        uint32_t length = in_.varint();
+        term_.resize(length);
+        in_.readBytes(&term_[0], length);
+        count_ = in_.varint();
+        return true;
+    }
+
+    const string& term() const { return term_; }
+
+    // Append the current term's postings, numbered by docId, and positions
+    void readPostings(const vector<int>& docIds, bool positions, vector<Posting>& postingList,
+                      vector<uint32_t>& positionList) {
+        uint32_t fileIndex = 0;
+        for (uint32_t i = 0; i < count_; ++i) {
+            fileIndex += in_.varint();
+            uint32_t frequency = in_.varint();
+            postingList.push_back({static_cast<uint32_t>(docIds[fileIndex]), frequency});
+            if (positions) {
+                uint32_t position = 0;
+                for (uint32_t j = 0; j < frequency; ++j) {
+                    position += in_.varint();
+                    positionList.push_back(position);
+                }
+            }
+        }
+    }
+
+private:
+    RunFile in_;
+    string term_;
+    uint32_t count_ = 0;
+};
+
+// Sorted (trigram << 32 | docId) pairs, from memory or from a trigram run
+// written by Indexer::writeRun:
+//
+//   per pair: varint trigram delta, then varint file index, as a delta
+//   from the previous one while the trigram is unchanged
+class TrigramReader {
+public:
+    TrigramReader(const vector<uint64_t>* pairs) : pairs_(pairs) {}
+    TrigramReader(const vector<int>* docIds) : docIds_(docIds) {}
+
+    bool open(const string& path) { return in_.open(path); }
+
+    // Move to the next pair; false at the end
+    bool next() {
+        if (pairs_) {
+            if (next_ == pairs_->size()) {
+                return false;
+            }
+            pair_ = (*pairs_)[next_++];
+            return true;
+        }
+        if (in_.atEnd()) {
+            return false;
+        }
+        uint32_t delta = in_.varint();
+        trigram_ += delta;
+        fileIndex_ = (delta == 0 ? fileIndex_ : 0) + in_.varint();
+        pair_ = uint64_t(trigram_) << 32 | static_cast<uint32_t>((*docIds_)[fileIndex_]);
+        return true;
+    }
+
+    uint32_t trigram() const { return static_cast<uint32_t>(pair_ >> 32); }
+    uint32_t docId() const { return static_cast<uint32_t>(pair_); }
+
+private:
+    const vector<uint64_t>* pairs_ = nullptr;
+    size_t next_ = 0;
+    const vector<int>* docIds_ = nullptr;
+    RunFile in_;
+    uint32_t trigram_ = 0;
+    uint32_t fileIndex_ = 0;
+    uint64_t pair_ = 0;
+};
+
+} // namespace
+
 Indexer::Indexer() {
    
 }
 
-string Indexer::getFileContent(const string& fileName) {
-    ifstream file(fileName);
-
-    if (!file.is_open()) {
-        cerr << "Error opening the file!\n";
-        return "";
+Indexer::~Indexer() {
+    if (!spill_.directory.empty()) {
+        error_code error;
+        filesystem::remove_all(spill_.directory, error);
     }
+}
 
-    string fileContents((istreambuf_iterator<char>(file)), 
-                            istreambuf_iterator<char>());
-    
-    file.close();
+vector<string> Indexer::listFiles(const string& directory, const BuildOptions& options) {
+    vector<string> paths;
+    error_code error;
+    filesystem::recursive_directory_iterator it(directory, filesystem::directory_options::skip_permission_denied, error);
+    for (; !error && it != filesystem::recursive_directory_iterator(); it.increment(error)) {
+        const auto& entry = *it;
+        string relative = entry.path().lexically_relative(directory).generic_string();
+        if (entry.is_directory(error)) {
+            if (globMatchAny(options.exclude, relative)) {
+                it.disable_recursion_pending();
+            }
+            continue;
+        }
+        if (!entry.is_regular_file(error) || globMatchAny(options.exclude, relative) ||
+            (!options.include.empty() && !globMatchAny(options.include, relative))) {
+            continue;
+        }
+        if (options.maxFileSize > 0 && entry.file_size(error) > options.maxFileSize) {
+            continue;
+        }
+        paths.push_back(entry.path().string());
+    }
+    if (error) {
+        cerr << "Error reading directory " << directory << ": " << error.message() << endl;
+    }
 
-    return fileContents;
+    // Sort the file list so doc ids do not depend on directory order
+    sort(paths.begin(), paths.end());
+    return paths;
 }
 
-unordered_map<string, int> Indexer::getFrequencies(const string& text) {
-    stringstream ss(text);
-    unordered_map<string, int> frequencies;
+bool Indexer::statFile(const string& path, FileInfo& info) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    info.size = static_cast<uint64_t>(st.st_size);
+    info.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
 
-    string word;
-    while (ss >> word) {
-        frequencies[word]++;
+uint64_t Indexer::contentHash(string_view content) {
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : content) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
     }
+    return hash;
+}
 
-    return frequencies;
+void Indexer::buildIndex(const string& directory, const BuildOptions& options) {
+    buildIndex(listFiles(directory, options), options);
 }
 
-void Indexer::buildIndex(const string& directory) {
-    int docId = 0;
+void Indexer::buildIndex(const vector<string>& paths, const BuildOptions& options) {
+    unsigned numThreads = options.numThreads;
+    if (numThreads == 0) {
+        numThreads = max(1u, thread::hardware_concurrency());
+    }
+    numThreads = static_cast<unsigned>(min<size_t>(numThreads, max<size_t>(paths.size(), 1)));
+
+    // Each worker keeps its own partial index keyed by position in `paths`.
+    // The reader keeps many files in flight and workers take whichever
+    // one is ready next.
+    FileReader reader(paths);
+    tokenizer_ = options.tokenizer;
+    vector<PartialIndex> partials(numThreads);
+    vector<char> indexed(paths.size(), 0);
+    vector<uint32_t> lengths(paths.size(), 0);
+    vector<FileInfo> infos(paths.size());
 
-    for (const auto& entry : filesystem::directory_iterator(directory)) {
-        if (entry.is_regular_file()) {
-            string path = entry.path().string();
-            manifest_[docId] = path;
+    // Each worker spills its partial index once it outgrows its share
+    uint64_t workerLimit = options.memoryLimit > 0 ? max<uint64_t>(options.memoryLimit / numThreads, 1) : 0;
 
-            string content = getFileContent(path);
-            if (content.empty()) {
-                continue;
+    auto worker = [&](PartialIndex& partial) {
+        Tokenizer tokenizer(options.tokenizer);
+        TrigramCollector collector;
+        vector<uint32_t> keys;
+        size_t partialBytes = 0;
+        FileData file;
+        while (reader.next(file)) {
+            uint32_t fileIndex = static_cast<uint32_t>(file.index);
+            string_view content(file.data, file.size);
+
+            indexed[fileIndex] = 1;
+            infos[fileIndex].size = content.size();
+            infos[fileIndex].mtime = file.mtime;
+            infos[fileIndex].contentHash = contentHash(content);
+
+            // A document's occurrences of a term arrive together and in
+            // position order, so they extend the list's last posting
+            lengths[fileIndex] = tokenizer.tokenize(content, [&](string_view term, uint32_t position) {
+                uint32_t termId = partial.terms.intern(term);
+                if (termId == partial.lists.size()) {
+                    size_t capacity = partial.lists.capacity();
+                    partial.lists.emplace_back();
+                    partialBytes += PARTIAL_TERM_BYTES + term.size() +
+                                    (partial.lists.capacity() - capacity) * sizeof(PartialList);
+                }
+                PartialList& list = partial.lists[termId];
+                if (list.postings.empty() || list.postings.back().first != fileIndex) {
+                    size_t capacity = list.postings.capacity();
+                    list.postings.push_back({fileIndex, 0});
+                    partialBytes += (list.postings.capacity() - capacity) * sizeof(list.postings[0]);
+                }
+                list.postings.back().second++;
+                if (options.positions) {
+                    size_t capacity = list.positions.capacity();
+                    list.positions.push_back(position);
+                    partialBytes += (list.positions.capacity() - capacity) * sizeof(uint32_t);
+                }
+            });
+            if (options.trigrams) {
+                collector.collect(content, keys);
+                size_t capacity = partial.trigrams.capacity();
+                for (uint32_t key : keys) {
+                    partial.trigrams.push_back(uint64_t(key) << 32 | fileIndex);
+                }
+                partialBytes += (partial.trigrams.capacity() - capacity) * sizeof(uint64_t);
             }
+            reader.release(file);
 
-            stringstream ss(content);
-            string word;
-            while (ss >> word) {
-                inverted_index[word][docId]++;
+            if (workerLimit > 0 && partialBytes > workerLimit) {
+                writeRun(partial, options.positions);
+                partialBytes = 0;
             }
+        }
+        radixSort(partial.trigrams);
+    };
+
+    if (numThreads == 1) {
+        worker(partials[0]);
+    } else {
+        vector<thread> workers;
+        for (unsigned t = 0; t < numThreads; ++t) {
+            workers.emplace_back(worker, ref(partials[t]));
+        }
+        for (auto& t : workers) {
+            t.join();
+        }
+    }
 
+    // Empty files get no doc id; the rest are numbered in path order
+    vector<int> docIds(paths.size(), -1);
+    int docId = 0;
+    for (size_t fileIndex = 0; fileIndex < paths.size(); ++fileIndex) {
+        if (indexed[fileIndex]) {
+            docIds[fileIndex] = docId;
+            documents_.add(paths[fileIndex], lengths[fileIndex], infos[fileIndex]);
             docId++;
         }
     }
 
+    // Once anything has spilled, the rest goes to runs too and
+    // saveIndexToFile merges them
+    if (!spill_.runs.empty()) {
+        for (auto& partial : partials) {
+            if (!partial.terms.empty() || !partial.trigrams.empty()) {
+                writeRun(partial, options.positions);
+            }
+        }
+        spill_.docIds.swap(docIds);
+        spill_.positions = options.positions;
+        withTrigrams_ = options.trigrams;
+        cout << "Spilled postings to " << spill_.runs.size() << " run(s) in " << spill_.directory << endl;
+        return;
+    }
+
+    // Renumbering by docId keeps each worker's trigram pairs sorted, since
+    // docIds follow file indexes
+    withTrigrams_ = options.trigrams;
+    trigrams_.clear();
+    for (auto& partial : partials) {
+        for (uint64_t& pair : partial.trigrams) {
+            pair = (pair & ~uint64_t(UINT32_MAX)) | static_cast<uint32_t>(docIds[static_cast<uint32_t>(pair)]);
+        }
+        trigrams_.push_back(move(partial.trigrams));
+    }
+
+    // Merge the partial indexes, releasing each one as soon as it is consumed
+    for (auto& partial : partials) {
+        for (uint32_t partialId = 0; partialId < partial.lists.size(); ++partialId) {
+            const PartialList& list = partial.lists[partialId];
+            uint32_t termId = addTerm(partial.terms.term(partialId));
+            auto& postingList = postings_[termId];
+            for (const auto& posting : list.postings) {
+                postingList.push_back({static_cast<uint32_t>(docIds[posting.first]), posting.second});
+            }
+            if (options.positions) {
+                positions_.resize(postings_.size());
+                auto& positionList = positions_[termId];
+                positionList.insert(positionList.end(), list.positions.begin(), list.positions.end());
+            }
+        }
+        partial = PartialIndex();
+    }
+
+    // Files complete out of order, so neither a worker's postings nor
+    // their concatenation are in docId order
+    sortPostingLists();
+}
+
+void Indexer::mergeSegments(const vector<SegmentSource>& sources) {
+    terms_.clear();
+    postings_.clear();
+    positions_.clear();
+    trigrams_.clear();
+    documents_.clear();
+    if (!sources.empty()) {
+        tokenizer_ = sources[0].index->tokenizer();
+    }
+
+    auto isDeleted = [](const SegmentSource& source, uint32_t docId) {
+        return source.deleted && (docId / 64) < source.deleted->size() &&
+               ((*source.deleted)[docId / 64] >> (docId % 64)) & 1;
+    };
+
+    // Number the surviving documents in segment order
+    vector<vector<int>> docIds(sources.size());
+    int nextDoc = 0;
+    bool withPositions = true;
+    withTrigrams_ = true;
+    for (size_t s = 0; s < sources.size(); ++s) {
+        const SegmentSource& source = sources[s];
+        const DocumentTable& documents = source.documents->getDocuments();
+
+        docIds[s].assign(source.index->numDocs(), -1);
+        documents.forEach([&](uint32_t docId, string_view path) {
+            if (docId >= source.index->numDocs() || isDeleted(source, docId)) {
+                return;
+            }
+            docIds[s][docId] = nextDoc;
+            documents_.add(path, documents.length(docId), documents.fileInfo(docId));
+            nextDoc++;
+        });
+        withPositions = withPositions && source.positions && source.positions->isOpen();
+        withTrigrams_ = withTrigrams_ && source.trigrams && source.trigrams->isOpen();
+    }
+
+    // One pair list per segment; renumbering keeps each one sorted
+    vector<uint32_t> docs;
+    for (size_t s = 0; withTrigrams_ && s < sources.size(); ++s) {
+        const MappedTrigrams& trigrams = *sources[s].trigrams;
+        vector<uint64_t> pairs;
+        for (uint32_t i = 0; i < trigrams.numTrigrams(); ++i) {
+            const auto& entry = trigrams.entryAt(i);
+            trigrams.docs(entry, docs);
+            for (uint32_t docId : docs) {
+                if (docId < docIds[s].size() && docIds[s][docId] >= 0) {
+                    pairs.push_back(uint64_t(entry.trigram) << 32 | static_cast<uint32_t>(docIds[s][docId]));
+                }
+            }
+        }
+        trigrams_.push_back(move(pairs));
+    }
+
+    // Later segments only hold higher doc ids, so appending keeps every
+    // posting list sorted
+    vector<uint32_t> offsets;
+    for (size_t s = 0; s < sources.size(); ++s) {
+        const SegmentSource& source = sources[s];
+        for (uint32_t termId = 0; termId < source.index->numTerms(); ++termId) {
+            const auto& entry = source.index->termAt(termId);
+            vector<Posting>* postingList = nullptr;
+            vector<uint32_t>* positionList = nullptr;
+
+            for (PostingCursor cursor = source.index->postings(entry); !cursor.atEnd(); cursor.next()) {
+                int docId = docIds[s][cursor.docId()];
+                if (docId < 0) {
+                    continue;
+                }
+                if (!postingList) {
+                    uint32_t id = addTerm(source.index->termString(entry));
+                    postingList = &postings_[id];
+                    if (withPositions) {
+                        positions_.resize(postings_.size());
+                        positionList = &positions_[id];
+                    }
+                }
+                postingList->push_back({static_cast<uint32_t>(docId), cursor.frequency()});
+                if (positionList) {
+                    source.positions->positions(termId, cursor, offsets);
+                    positionList->insert(positionList->end(), offsets.begin(), offsets.end());
+                }
+            }
+        }
+    }
+}
+
+uint32_t Indexer::addTerm(string_view term) {
+    uint32_t termId = terms_.intern(term);
+    if (termId == postings_.size()) {
+        postings_.emplace_back();
+    }
+    return termId;
+}
+
+void Indexer::sortPostingLists() {
+    for (uint32_t termId = 0; termId < postings_.size(); ++termId) {
+        sortPostings(postings_[termId], termId < positions_.size() ? &positions_[termId] : nullptr);
+    }
+}
+
+vector<float> Indexer::lengthNorms(float& avgDocLength) const {
+    avgDocLength = 0.0f;
+    vector<float> norms;
+    if (documents_.hasLengths() && !documents_.empty()) {
+        uint64_t totalLength = 0;
+        for (uint32_t docId = 0; docId < documents_.size(); ++docId) {
+            totalLength += documents_.length(docId);
+        }
+        avgDocLength = static_cast<float>(static_cast<double>(totalLength) / documents_.size());
+        norms.reserve(documents_.size());
+        for (uint32_t docId = 0; docId < documents_.size(); ++docId) {
+            norms.push_back(bm25::lengthNorm(documents_.length(docId), avgDocLength));
+        }
+    }
+    return norms;
 }
 
-void Indexer::saveIndexToFile(const std::string& filename) {
+bool Indexer::saveIndexToFile(const std::string& filename) {
+    using namespace index_format;
+
+    if (!spill_.runs.empty()) {
+        return saveMergedRuns(filename);
+    }
+
     ofstream file(filename, ios::binary);
     if (!file.is_open()) {
         cerr << "Error opening file for writing: " << filename << endl;
-        return;
+        return false;
     }
 
-    // Write number of words in the index
-    uint32_t numWords = inverted_index.size();
-    file.write(reinterpret_cast<const char*>(&numWords), sizeof(uint32_t));
+    // The mapped format keeps terms in sorted order
+    vector<uint32_t> terms = terms_.sortedIds();
 
-    // Write each word and its posting list
-    for (const auto& wordEntry : inverted_index) {
-        const string& word = wordEntry.first;
-        const auto& postingList = wordEntry.second;
+    // Lay out the term table and term bytes; posting offsets are filled in
+    // while the compressed lists are streamed out
+    vector<TermEntry> entries(terms.size());
+    uint64_t termBytesSize = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        entries[i].termOffset = static_cast<uint32_t>(termBytesSize);
+        entries[i].termLength = static_cast<uint32_t>(terms_.term(terms[i]).size());
+        entries[i].docCount = static_cast<uint32_t>(postings_[terms[i]].size());
+        entries[i].maxTfNorm = 0.0f;
+        entries[i].postingsOffset = 0;
+        termBytesSize += entries[i].termLength;
+    }
 
-        // Write word length and word
-        uint32_t wordLen = word.length();
-        file.write(reinterpret_cast<const char*>(&wordLen), sizeof(uint32_t));
-        file.write(word.c_str(), wordLen);
+    // BM25 length normalization, baked into the per-block score bounds
+    float avgDocLength;
+    vector<float> norms = lengthNorms(avgDocLength);
 
-        // Write number of documents for this word
-        uint32_t numDocs = postingList.size();
-        file.write(reinterpret_cast<const char*>(&numDocs), sizeof(uint32_t));
+    IndexHeader header = makeHeader(tokenizer_, documents_.size(), entries.size(), termBytesSize, avgDocLength);
 
-        // Write each document ID and frequency
-        for (const auto& docEntry : postingList) {
-            int docId = docEntry.first;
-            int frequency = docEntry.second;
-            file.write(reinterpret_cast<const char*>(&docId), sizeof(int));
-            file.write(reinterpret_cast<const char*>(&frequency), sizeof(int));
-        }
+    const char padding[8] = {0};
+    auto padTo = [&](uint64_t offset) {
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        file.write(padding, static_cast<streamsize>(offset - pos));
+    };
+
+    // Header and term table are rewritten once the offsets are known
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    padTo(header.termTableOffset);
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TermEntry));
+
+    padTo(header.termBytesOffset);
+    for (uint32_t termId : terms) {
+        string_view term = terms_.term(termId);
+        file.write(term.data(), static_cast<streamsize>(term.size()));
+    }
+
+    padTo(header.postingsOffset);
+    string encoded;
+    uint64_t postingsSize = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        postingsSize = alignTo4(postingsSize);
+        padTo(header.postingsOffset + postingsSize);
+        entries[i].postingsOffset = postingsSize;
+
+        encoded.clear();
+        entries[i].maxTfNorm = encodePostingList(postings_[terms[i]], norms, encoded);
+        file.write(encoded.data(), encoded.size());
+        postingsSize += encoded.size();
     }
 
+    header.postingsSize = postingsSize;
+    header.fileSize = header.postingsOffset + postingsSize;
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.seekp(header.termTableOffset);
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TermEntry));
+
     file.close();
+    if (!file) {
+        cerr << "Error writing " << filename << endl;
+        return false;
+    }
+    indexFileSize_ = header.fileSize;
     cout << "Index saved to " << filename << endl;
+    return true;
+}
+
+bool Indexer::savePositionsToFile(const std::string& filename) {
+    using namespace index_format;
+
+    if (!spill_.runs.empty()) {
+        return saveSpilledPositions(filename);
+    }
+    if (positions_.empty() || indexFileSize_ == 0) {
+        return false;
+    }
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+
+    // Term ids in positions.bin are positions in index.bin's sorted term table
+    vector<uint32_t> terms = terms_.sortedIds();
+    vector<uint64_t> termOffsets(terms.size() + 1, 0);
+
+    PositionsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POSITIONS_MAGIC, sizeof(POSITIONS_MAGIC));
+    header.version = POSITIONS_VERSION;
+    header.numTerms = static_cast<uint32_t>(terms.size());
+    header.indexFileSize = indexFileSize_;
+    header.termOffsetsOffset = alignTo8(sizeof(PositionsHeader));
+    header.dataOffset = alignTo8(header.termOffsetsOffset + termOffsets.size() * sizeof(uint64_t));
+
+    const char padding[8] = {0};
+    auto padTo = [&](uint64_t offset) {
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        file.write(padding, static_cast<streamsize>(offset - pos));
+    };
+
+    // Header and offsets are rewritten once the data has been streamed out
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    padTo(header.termOffsetsOffset);
+    file.write(reinterpret_cast<const char*>(termOffsets.data()), termOffsets.size() * sizeof(uint64_t));
+    padTo(header.dataOffset);
+
+    string encoded;
+    uint64_t dataSize = 0;
+    const vector<uint32_t> noPositions;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        dataSize = alignTo4(dataSize);
+        padTo(header.dataOffset + dataSize);
+        termOffsets[i] = dataSize;
+
+        encoded.clear();
+        encodePositionList(postings_[terms[i]],
+                           terms[i] < positions_.size() ? positions_[terms[i]] : noPositions,
+                           encoded);
+        file.write(encoded.data(), encoded.size());
+        dataSize += encoded.size();
+    }
+    termOffsets[terms.size()] = dataSize;
+
+    header.dataSize = dataSize;
+    header.fileSize = header.dataOffset + dataSize;
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.seekp(header.termOffsetsOffset);
+    file.write(reinterpret_cast<const char*>(termOffsets.data()), termOffsets.size() * sizeof(uint64_t));
+
+    file.close();
+    if (!file) {
+        cerr << "Error writing " << filename << endl;
+        return false;
+    }
+    cout << "Positions saved to " << filename << endl;
+    return true;
+}
+
+bool Indexer::writeRun(PartialIndex& partial, bool positions) {
+    string path;
+    string trigramPath;
+    {
+        lock_guard<mutex> lock(spillMutex_);
+        if (spill_.directory.empty()) {
+            // Next to the index rather than in /tmp, which may be memory
+            spill_.directory = "index-build-" + to_string(getpid()) + ".tmp";
+            error_code error;
+            filesystem::create_directory(spill_.directory, error);
+            if (error) {
+                cerr << "Error creating " << spill_.directory << ": " << error.message() << endl;
+            }
+        }
+        path = spill_.directory + "/run-" + to_string(spill_.runs.size()) + ".bin";
+        spill_.runs.push_back(path);
+        if (!partial.trigrams.empty()) {
+            trigramPath = spill_.directory + "/trigrams-" + to_string(spill_.trigramRuns.size()) + ".bin";
+            spill_.trigramRuns.push_back(trigramPath);
+        }
+    }
+
+    if (!trigramPath.empty()) {
+        radixSort(partial.trigrams);
+        if (!writeTrigramRun(trigramPath, partial.trigrams)) {
+            lock_guard<mutex> lock(spillMutex_);
+            spill_.failed = true;
+        }
+        vector<uint64_t>().swap(partial.trigrams);
+    }
+
+    ofstream file(path, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << path << endl;
+        lock_guard<mutex> lock(spillMutex_);
+        spill_.failed = true;
+        return false;
+    }
+
+    vector<uint32_t> terms = partial.terms.sortedIds();
+
+    // Postings still carry file indexes, which order files like docIds do
+    vector<Posting> postingList;
+    vector<uint32_t> positionList;
+    string out;
+    for (uint32_t termId : terms) {
+        PartialList& list = partial.lists[termId];
+        string_view term = partial.terms.term(termId);
+        postingList.clear();
+        for (const auto& posting : list.postings) {
+            postingList.push_back({posting.first, posting.second});
+        }
+        positionList.swap(list.positions);
+        sortPostings(postingList, positions ? &positionList : nullptr);
+
+        appendVarint(out, static_cast<uint32_t>(term.size()));
+        out += term;
+        appendVarint(out, static_cast<uint32_t>(postingList.size()));
+        uint32_t previousFile = 0;
+        size_t next = 0;
+        for (const Posting& posting : postingList) {
+            appendVarint(out, posting.docId - previousFile);
+            appendVarint(out, posting.frequency);
+            previousFile = posting.docId;
+            uint32_t previous = 0;
+            for (uint32_t j = 0; positions && j < posting.frequency; ++j) {
+                appendVarint(out, positionList[next] - previous);
+                previous = positionList[next++];
+            }
+        }
+
+        // Give memory back as the run is written, not only at the end
+        vector<pair<uint32_t, uint32_t>>().swap(list.postings);
+        vector<uint32_t>().swap(positionList);
+        if (out.size() >= RUN_WRITE_BUFFER) {
+            file.write(out.data(), static_cast<streamsize>(out.size()));
+            out.clear();
+        }
+    }
+    file.write(out.data(), static_cast<streamsize>(out.size()));
+    file.close();
+    partial = PartialIndex();
+
+    if (!file) {
+        cerr << "Error writing " << path << endl;
+        lock_guard<mutex> lock(spillMutex_);
+        spill_.failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool Indexer::writeTrigramRun(const string& path, const vector<uint64_t>& trigrams) {
+    ofstream file(path, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << path << endl;
+        return false;
+    }
+
+    string out;
+    uint32_t previousTrigram = 0;
+    uint32_t previousFile = 0;
+    for (uint64_t pair : trigrams) {
+        uint32_t trigram = static_cast<uint32_t>(pair >> 32);
+        uint32_t fileIndex = static_cast<uint32_t>(pair);
+        if (trigram != previousTrigram) {
+            previousFile = 0;
+        }
+        appendVarint(out, trigram - previousTrigram);
+        appendVarint(out, fileIndex - previousFile);
+        previousTrigram = trigram;
+        previousFile = fileIndex;
+        if (out.size() >= RUN_WRITE_BUFFER) {
+            file.write(out.data(), static_cast<streamsize>(out.size()));
+            out.clear();
+        }
+    }
+    file.write(out.data(), static_cast<streamsize>(out.size()));
+    file.close();
+    if (!file) {
+        cerr << "Error writing " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Indexer::saveMergedRuns(const std::string& filename) {
+    using namespace index_format;
+
+    if (spill_.failed) {
+        cerr << "Error: the build could not write its run files; not saving " << filename << endl;
+        return false;
+    }
+
+    vector<unique_ptr<RunReader>> readers;
+    for (const string& run : spill_.runs) {
+        readers.push_back(make_unique<RunReader>());
+        if (!readers.back()->open(run)) {
+            cerr << "Error opening file for reading: " << run << endl;
+            return false;
+        }
+    }
+
+    string postingsPath = spill_.directory + "/postings.bin";
+    ofstream postingsFile(postingsPath, ios::binary);
+    ofstream positionsFile;
+    if (spill_.positions) {
+        spill_.positionsData = spill_.directory + "/positions.bin";
+        positionsFile.open(spill_.positionsData, ios::binary);
+    }
+    if (!postingsFile.is_open() || (spill_.positions && !positionsFile.is_open())) {
+        cerr << "Error opening files for writing in " << spill_.directory << endl;
+        return false;
+    }
+
+    float avgDocLength;
+    vector<float> norms = lengthNorms(avgDocLength);
+
+    // Runs ordered by their current term; every run holding the smallest
+    // one contributes to the next merged list
+    auto laterTerm = [&](size_t a, size_t b) { return readers[a]->term() > readers[b]->term(); };
+    priority_queue<size_t, vector<size_t>, decltype(laterTerm)> heap(laterTerm);
+    for (size_t r = 0; r < readers.size(); ++r) {
+        if (readers[r]->nextTerm()) {
+            heap.push(r);
+        }
+    }
+
+    // Only the term table stays in memory; postings go straight to disk
+    const char padding[8] = {0};
+    vector<TermEntry> entries;
+    string termBytes;
+    uint64_t postingsSize = 0;
+    uint64_t positionsSize = 0;
+    spill_.termOffsets.clear();
+
+    vector<size_t> current;
+    vector<Posting> postingList;
+    vector<uint32_t> positionList;
+    string encoded;
+    while (!heap.empty()) {
+        current.assign(1, heap.top());
+        heap.pop();
+        const string& term = readers[current[0]]->term();
+        while (!heap.empty() && readers[heap.top()]->term() == term) {
+            current.push_back(heap.top());
+            heap.pop();
+        }
+
+        postingList.clear();
+        positionList.clear();
+        for (size_t r : current) {
+            readers[r]->readPostings(spill_.docIds, spill_.positions, postingList, positionList);
+        }
+        // Each run covers different files, but not a contiguous range
+        sortPostings(postingList, spill_.positions ? &positionList : nullptr);
+
+        TermEntry entry;
+        entry.termOffset = static_cast<uint32_t>(termBytes.size());
+        entry.termLength = static_cast<uint32_t>(term.size());
+        entry.docCount = static_cast<uint32_t>(postingList.size());
+        termBytes += term;
+
+        uint64_t aligned = alignTo4(postingsSize);
+        postingsFile.write(padding, static_cast<streamsize>(aligned - postingsSize));
+        entry.postingsOffset = aligned;
+        encoded.clear();
+        entry.maxTfNorm = encodePostingList(postingList, norms, encoded);
+        postingsFile.write(encoded.data(), static_cast<streamsize>(encoded.size()));
+        postingsSize = aligned + encoded.size();
+        entries.push_back(entry);
+
+        if (spill_.positions) {
+            aligned = alignTo4(positionsSize);
+            positionsFile.write(padding, static_cast<streamsize>(aligned - positionsSize));
+            spill_.termOffsets.push_back(aligned);
+            encoded.clear();
+            encodePositionList(postingList, positionList, encoded);
+            positionsFile.write(encoded.data(), static_cast<streamsize>(encoded.size()));
+            positionsSize = aligned + encoded.size();
+        }
+
+        for (size_t r : current) {
+            if (readers[r]->nextTerm()) {
+                heap.push(r);
+            }
+        }
+    }
+    spill_.termOffsets.push_back(positionsSize);
+    postingsFile.close();
+    positionsFile.close();
+    readers.clear();
+    for (const string& run : spill_.runs) {
+        remove(run.c_str());
+    }
+    if (!postingsFile || (spill_.positions && !positionsFile)) {
+        cerr << "Error writing merged postings in " << spill_.directory << endl;
+        spill_.positionsData.clear();
+        return false;
+    }
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+
+    IndexHeader header = makeHeader(tokenizer_, documents_.size(), entries.size(), termBytes.size(), avgDocLength);
+    header.postingsSize = postingsSize;
+    header.fileSize = header.postingsOffset + postingsSize;
+
+    auto padTo = [&](uint64_t offset) {
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        file.write(padding, static_cast<streamsize>(offset - pos));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    padTo(header.termTableOffset);
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TermEntry));
+    padTo(header.termBytesOffset);
+    file.write(termBytes.data(), static_cast<streamsize>(termBytes.size()));
+    padTo(header.postingsOffset);
+    bool copied = appendFile(file, postingsPath);
+    file.close();
+    remove(postingsPath.c_str());
+    if (!copied || !file) {
+        cerr << "Error writing " << filename << endl;
+        return false;
+    }
+
+    indexFileSize_ = header.fileSize;
+    cout << "Index saved to " << filename << " (merged " << spill_.runs.size() << " runs)" << endl;
+    return true;
+}
+
+bool Indexer::saveSpilledPositions(const std::string& filename) {
+    using namespace index_format;
+
+    if (spill_.positionsData.empty() || indexFileSize_ == 0) {
+        return false;
+    }
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+
+    PositionsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POSITIONS_MAGIC, sizeof(POSITIONS_MAGIC));
+    header.version = POSITIONS_VERSION;
+    header.numTerms = static_cast<uint32_t>(spill_.termOffsets.size() - 1);
+    header.indexFileSize = indexFileSize_;
+    header.termOffsetsOffset = alignTo8(sizeof(PositionsHeader));
+    header.dataOffset = alignTo8(header.termOffsetsOffset + spill_.termOffsets.size() * sizeof(uint64_t));
+    header.dataSize = spill_.termOffsets.back();
+    header.fileSize = header.dataOffset + header.dataSize;
+
+    const char padding[8] = {0};
+    auto padTo = [&](uint64_t offset) {
+        uint64_t pos = static_cast<uint64_t>(file.tellp());
+        file.write(padding, static_cast<streamsize>(offset - pos));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    padTo(header.termOffsetsOffset);
+    file.write(reinterpret_cast<const char*>(spill_.termOffsets.data()),
+               spill_.termOffsets.size() * sizeof(uint64_t));
+    padTo(header.dataOffset);
+    bool copied = appendFile(file, spill_.positionsData);
+    file.close();
+    remove(spill_.positionsData.c_str());
+    if (!copied || !file) {
+        cerr << "Error writing " << filename << endl;
+        return false;
+    }
+
+    cout << "Positions saved to " << filename << endl;
+    return true;
+}
+
+bool Indexer::saveTrigramsToFile(const std::string& filename) {
+    using namespace index_format;
+
+    if (!withTrigrams_ || indexFileSize_ == 0 || spill_.failed) {
+        return false;
+    }
+
+    vector<unique_ptr<TrigramReader>> readers;
+    for (const auto& pairs : trigrams_) {
+        readers.push_back(make_unique<TrigramReader>(&pairs));
+    }
+    for (const string& run : spill_.trigramRuns) {
+        readers.push_back(make_unique<TrigramReader>(&spill_.docIds));
+        if (!readers.back()->open(run)) {
+            cerr << "Error opening file for reading: " << run << endl;
+            return false;
+        }
+    }
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+
+    // The data is streamed out first, so the table goes after it
+    TrigramsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRIGRAMS_MAGIC, sizeof(TRIGRAMS_MAGIC));
+    header.version = TRIGRAMS_VERSION;
+    header.indexFileSize = indexFileSize_;
+    header.dataOffset = alignTo8(sizeof(TrigramsHeader));
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const char padding[8] = {0};
+    file.write(padding, static_cast<streamsize>(header.dataOffset - sizeof(header)));
+
+    // Lists ordered by their current trigram; every list holding the
+    // smallest one contributes documents to it
+    auto laterPair = [&](size_t a, size_t b) { return readers[a]->trigram() > readers[b]->trigram(); };
+    priority_queue<size_t, vector<size_t>, decltype(laterPair)> heap(laterPair);
+    for (size_t r = 0; r < readers.size(); ++r) {
+        if (readers[r]->next()) {
+            heap.push(r);
+        }
+    }
+
+    vector<TrigramEntry> entries;
+    vector<uint32_t> docs;
+    string out;
+    uint64_t dataSize = 0;
+    while (!heap.empty()) {
+        uint32_t trigram = readers[heap.top()]->trigram();
+        docs.clear();
+        bool sorted = true;
+        while (!heap.empty() && readers[heap.top()]->trigram() == trigram) {
+            size_t r = heap.top();
+            heap.pop();
+            // A list's documents for one trigram are consecutive; lists
+            // from different workers interleave
+            sorted = sorted && (docs.empty() || docs.back() < readers[r]->docId());
+            bool more;
+            do {
+                docs.push_back(readers[r]->docId());
+            } while ((more = readers[r]->next()) && readers[r]->trigram() == trigram);
+            if (more) {
+                heap.push(r);
+            }
+        }
+        if (!sorted) {
+            sort(docs.begin(), docs.end());
+        }
+
+        TrigramEntry entry;
+        entry.trigram = trigram;
+        entry.docCount = static_cast<uint32_t>(docs.size());
+        entry.dataOffset = dataSize + out.size();
+        entries.push_back(entry);
+        uint32_t previous = 0;
+        for (uint32_t docId : docs) {
+            appendVarint(out, docId - previous);
+            previous = docId;
+        }
+        if (out.size() >= RUN_WRITE_BUFFER) {
+            file.write(out.data(), static_cast<streamsize>(out.size()));
+            dataSize += out.size();
+            out.clear();
+        }
+    }
+    file.write(out.data(), static_cast<streamsize>(out.size()));
+    dataSize += out.size();
+    readers.clear();
+    for (const string& run : spill_.trigramRuns) {
+        remove(run.c_str());
+    }
+
+    header.numTrigrams = static_cast<uint32_t>(entries.size());
+    header.dataSize = dataSize;
+    header.tableOffset = alignTo8(header.dataOffset + dataSize);
+    header.fileSize = header.tableOffset + entries.size() * sizeof(TrigramEntry);
+    file.write(padding, static_cast<streamsize>(header.tableOffset - header.dataOffset - dataSize));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TrigramEntry));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file) {
+        cerr << "Error writing " << filename << endl;
+        return false;
+    }
+
+    cout << "Trigrams saved to " << filename << endl;
+    return true;
 }
 
 void Indexer::loadIndexFromFile(const std::string& filename) {
+    // Clear existing index
+    terms_.clear();
+    postings_.clear();
+    positions_.clear();
+
+    if (MappedIndex::isMappedFormat(filename)) {
+        MappedIndex mapped;
+        if (!mapped.open(filename)) {
+            return;
+        }
+        tokenizer_ = mapped.tokenizer();
+
+        for (uint32_t termId = 0; termId < mapped.numTerms(); ++termId) {
+            const auto& entry = mapped.termAt(termId);
+            auto& postingList = postings_[addTerm(mapped.termString(entry))];
+            postingList.reserve(entry.docCount);
+            for (PostingCursor cursor = mapped.postings(entry); !cursor.atEnd(); cursor.next()) {
+                postingList.push_back({cursor.docId(), cursor.frequency()});
+            }
+        }
+
+        cout << "Index loaded from " << filename << endl;
+        return;
+    }
+
+    loadLegacyIndexFromFile(filename);
+}
+
+void Indexer::loadLegacyIndexFromFile(const std::string& filename) {
     ifstream file(filename, ios::binary);
     if (!file.is_open()) {
         cerr << "Error opening file for reading: " << filename << endl;
@@ -110,7 +1245,13 @@ void Indexer::loadIndexFromFile(const std::string& filename) {
     }
 
     // Clear existing index
-    inverted_index.clear();
+    terms_.clear();
+    postings_.clear();
+    positions_.clear();
+
+    // Legacy indexes were split on whitespace only
+    tokenizer_.kind = TokenizerOptions::Kind::Whitespace;
+    tokenizer_.splitIdentifiers = false;
 
     // Read number of words
     uint32_t numWords;
@@ -128,6 +1269,7 @@ void Indexer::loadIndexFromFile(const std::string& filename) {
         // Read number of documents for this word
         uint32_t numDocs;
         file.read(reinterpret_cast<char*>(&numDocs), sizeof(uint32_t));
+        uint32_t termId = addTerm(word);
 
         // Read each document ID and frequency
         for (uint32_t j = 0; j < numDocs; ++j) {
@@ -135,72 +1277,37 @@ void Indexer::loadIndexFromFile(const std::string& filename) {
             int frequency;
             file.read(reinterpret_cast<char*>(&docId), sizeof(int));
             file.read(reinterpret_cast<char*>(&frequency), sizeof(int));
-            inverted_index[word][docId] = frequency;
+            postings_[termId].push_back({static_cast<uint32_t>(docId), static_cast<uint32_t>(frequency)});
         }
     }
 
+    // Legacy files store postings in hash order
+    sortPostingLists();
+
     file.close();
     cout << "Index loaded from " << filename << endl;
 }
 
-void Indexer::saveManifestToFile(const std::string& filename) {
-    ofstream file(filename, ios::binary);
-    if (!file.is_open()) {
-        cerr << "Error opening file for writing: " << filename << endl;
-        return;
-    }
-
-    // Write number of documents
-    uint32_t numDocs = manifest_.size();
-    file.write(reinterpret_cast<const char*>(&numDocs), sizeof(uint32_t));
-
-    // Write each document ID and path
-    for (const auto& entry : manifest_) {
-        int docId = entry.first;
-        const string& path = entry.second;
-
-        // Write document ID
-        file.write(reinterpret_cast<const char*>(&docId), sizeof(int));
-
-        // Write path length and path
-        uint32_t pathLen = path.length();
-        file.write(reinterpret_cast<const char*>(&pathLen), sizeof(uint32_t));
-        file.write(path.c_str(), pathLen);
+bool Indexer::saveManifestToFile(const std::string& filename) {
+    if (!documents_.save(filename)) {
+        return false;
     }
-
-    file.close();
     cout << "Manifest saved to " << filename << endl;
+    return true;
 }
 
-void Indexer::loadManifestFromFile(const std::string& filename) {
-    ifstream file(filename, ios::binary);
-    if (!file.is_open()) {
-        cerr << "Error opening file for reading: " << filename << endl;
-        return;
+bool Indexer::loadManifestFromFile(const std::string& filename) {
+    if (!documents_.load(filename)) {
+        return false;
     }
-
-    // Clear existing manifest
-    manifest_.clear();
-
-    // Read number of documents
-    uint32_t numDocs;
-    file.read(reinterpret_cast<char*>(&numDocs), sizeof(uint32_t));
-
-    // Read each document ID and path
-    for (uint32_t i = 0; i < numDocs; ++i) {
-        int docId;
-        file.read(reinterpret_cast<char*>(&docId), sizeof(int));
-
-        // Read path length and path
-        uint32_t pathLen;
-        file.read(reinterpret_cast<char*>(&pathLen), sizeof(uint32_t));
-
-        string path(pathLen, '\0');
-        file.read(&path[0], pathLen);
-
-        manifest_[docId] = path;
+    if (!documents_.hasLengths()) {
+        cout << "Manifest loaded from " << filename << " (legacy format, no document lengths)" << endl;
+    } else {
+        cout << "Manifest loaded from " << filename << endl;
     }
+    return true;
+}
 
-    file.close();
-    cout << "Manifest loaded from " << filename << endl;
-}
\ No newline at end of file
+size_t Indexer::documentMemoryBytes() const {
+    return documents_.memoryBytes();
+}
@@ -1,33 +1,166 @@
 #ifndef INDEXER_H
 #define INDEXER_H
 
+#include "document_table.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+#include "tokenizer.h"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct BuildOptions {
+    unsigned numThreads = 1;  // 0 uses every hardware thread
+    bool positions = true;    // Record token offsets for phrase queries
+    bool trigrams = true;     // Record each document's trigrams for substring and regex search
+    TokenizerOptions tokenizer;
+
+    // Which files under the directory are indexed (see glob.h); paths are
+    // matched relative to it. Excluded directories are not descended into.
+    std::vector<std::string> include;  // Empty includes everything
+    std::vector<std::string> exclude;
+    uint64_t maxFileSize = 0;          // Bytes; 0 = no limit
+
+    // Approximate memory for postings while building, in bytes; 0 = no
+    // limit. Past it, workers write what they have to sorted run files,
+    // which saveIndexToFile merges.
+    uint64_t memoryLimit = 0;
+};
+
+class Indexer;
+class MappedIndex;
+class MappedPositions;
+class MappedTrigrams;
+
+// One input to Indexer::mergeSegments
+struct SegmentSource {
+    const MappedIndex* index;
+    const MappedPositions* positions;      // nullptr if the segment has none
+    const MappedTrigrams* trigrams;        // nullptr if the segment has none
+    const Indexer* documents;              // Its manifest
+    const std::vector<uint64_t>* deleted;  // Tombstone bitmap; nullptr if none
+};
 
 class Indexer {
 public:
     Indexer(); 
+    ~Indexer();
+
+    Indexer(const Indexer&) = delete;
+    Indexer& operator=(const Indexer&) = delete;
 
     // Serialization of files
-    void saveIndexToFile(const std::string& filename);
+    // saveIndexToFile writes the mapped format (see index_format.h);
+    // loadIndexFromFile accepts both the mapped and the legacy format.
+    // The save and manifest functions return false (after printing why)
+    // if the file could not be written or read.
+    bool saveIndexToFile(const std::string& filename);
     void loadIndexFromFile(const std::string& filename);
-    void saveManifestToFile(const std::string& filename);
-    void loadManifestFromFile(const std::string& filename);
+    void loadLegacyIndexFromFile(const std::string& filename);
+    bool saveManifestToFile(const std::string& filename);
+
+    // Writes positions.bin for the index last written by saveIndexToFile.
+    // Returns false if the build recorded no positions.
+    bool savePositionsToFile(const std::string& filename);
+
+    // Writes trigrams.bin for the index last written by saveIndexToFile.
+    // Returns false if the build recorded no trigrams.
+    bool saveTrigramsToFile(const std::string& filename);
+
+    // Whether the build recorded positions / trigrams, i.e. whether a false
+    // return from the save functions above means an error
+    bool hasPositions() const { return spill_.runs.empty() ? !positions_.empty() : spill_.positions; }
+    bool hasTrigrams() const { return withTrigrams_; }
 
-    // Build the index
-    void buildIndex(const std::string& directory);
+    bool loadManifestFromFile(const std::string& filename);
 
-    // Getters
-    const std::unordered_map<std::string, std::unordered_map<int, int>>& getIndex() const { return inverted_index; }
-    const std::unordered_map<int, std::string>& getManifest() const { return manifest_; }
+    // Build the index. The output is identical for any thread count and
+    // memory limit. If the build spilled to run files, the postings are
+    // only available through saveIndexToFile / savePositionsToFile.
+    void buildIndex(const std::string& directory, const BuildOptions& options = BuildOptions());
+
+    // Build from an explicit file list; doc ids follow the list order
+    void buildIndex(const std::vector<std::string>& paths, const BuildOptions& options);
+
+    // Build from the live documents of several segments, keeping their
+    // order. Positions and trigrams are kept only if every source has them.
+    void mergeSegments(const std::vector<SegmentSource>& sources);
+
+    // Regular files under `directory` at any depth that pass the options'
+    // filters, sorted. Symlinked directories are not followed.
+    static std::vector<std::string> listFiles(const std::string& directory, const BuildOptions& options);
+
+    // Size and mtime of a file; false if it can't be read
+    static bool statFile(const std::string& path, FileInfo& info);
+    static uint64_t contentHash(std::string_view content);
+
+    // Getters. Postings are by term id in getTerms().
+    const TermDictionary& getTerms() const { return terms_; }
+    const std::vector<Posting>& getPostings(uint32_t termId) const { return postings_[termId]; }
+    const DocumentTable& getDocuments() const { return documents_; }
+    const TokenizerOptions& getTokenizer() const { return tokenizer_; }
+
+    // Approximate heap used by the document table; a loaded one is mapped
+    size_t documentMemoryBytes() const;
 
 private:
-    // Helper functions
-    std::string getFileContent(const std::string& fileName); 
-    std::unordered_map<std::string, int> getFrequencies(const std::string& text);
+    // Per-worker postings during a parallel build: (file index, frequency)
+    // pairs plus their token offsets, back to back, by the worker's term ids
+    struct PartialList {
+        std::vector<std::pair<uint32_t, uint32_t>> postings;
+        std::vector<uint32_t> positions;
+    };
+    struct PartialIndex {
+        TermDictionary terms;
+        std::vector<PartialList> lists;
+        std::vector<uint64_t> trigrams;  // (trigram << 32 | file index), sorted once the worker is done
+    };
+
+    // Sorted runs spilled by a build over its memory limit. Postings in
+    // them refer to files by their position in the build's path list.
+    struct Spill {
+        std::string directory;            // Removed with the Indexer
+        std::vector<std::string> runs;
+        std::vector<std::string> trigramRuns;
+        std::vector<int> docIds;          // File index -> docId, -1 if not indexed
+        bool positions = false;
+        bool failed = false;              // A run could not be written
+        std::string positionsData;        // Written by saveIndexToFile for savePositionsToFile
+        std::vector<uint64_t> termOffsets;
+    };
+
+    // Write a partial index as the next sorted run, and its trigrams as
+    // the next trigram run, and empty it
+    bool writeRun(PartialIndex& partial, bool positions);
+    bool writeTrigramRun(const std::string& path, const std::vector<uint64_t>& trigrams);
+    bool saveMergedRuns(const std::string& filename);
+    bool saveSpilledPositions(const std::string& filename);
+    std::vector<float> lengthNorms(float& avgDocLength) const;  // By docId; empty if lengths are unknown
+
+    // Id of a term in terms_, adding an empty posting list if it is new
+    uint32_t addTerm(std::string_view term);
+    void sortPostingLists();
+
+    TermDictionary terms_;
+    std::vector<std::vector<Posting>> postings_;  // By term id, sorted by docId
+
+    // By term id, the token offsets of each posting concatenated in
+    // posting order; empty if the build recorded none
+    std::vector<std::vector<uint32_t>> positions_;
+    uint64_t indexFileSize_ = 0;
 
-    std::unordered_map<std::string, std::unordered_map<int, int>> inverted_index;
-    std::unordered_map<int, std::string> manifest_;
+    // Sorted (trigram << 32 | docId) pairs, one list per worker or merged
+    // segment; lists may share trigrams but not documents
+    std::vector<std::vector<uint64_t>> trigrams_;
+    bool withTrigrams_ = false;
+    DocumentTable documents_;
+    TokenizerOptions tokenizer_;        // How the terms were produced
+    Spill spill_;
+    std::mutex spillMutex_;             // Guards spill_ while workers write runs
 };
 
 #endif
\ No newline at end of file
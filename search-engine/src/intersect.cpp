@@ -0,0 +1,131 @@
+#include "intersect.h"
+#include <algorithm>
+#include <iterator>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Past this size ratio, probing the big side beats merging through it
+constexpr size_t GALLOP_RATIO = 32;
+
+size_t intersectGalloping(const uint32_t* small, size_t ns, const uint32_t* large, size_t nl, uint32_t* out) {
+    size_t count = 0;
+    size_t low = 0;
+    for (size_t i = 0; i < ns && low < nl; ++i) {
+        uint32_t target = small[i];
+
+        // Exponential search for a range that contains the target
+        size_t step = 1;
+        size_t high = low;
+        while (high < nl && large[high] < target) {
+            low = high + 1;
+            high += step;
+            step <<= 1;
+        }
+        high = std::min(high + 1, nl);
+
+        const uint32_t* it = std::lower_bound(large + low, large + high, target);
+        low = static_cast<size_t>(it - large);
+        if (low < nl && large[low] == target) {
+            out[count++] = target;
+            ++low;
+        }
+    }
+    return count;
+}
+
+size_t intersectScalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, count = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            out[count++] = a[i];
+            ++i;
+            ++j;
+        }
+    }
+    return count;
+}
+
+#ifdef __SSE2__
+// Compare a block of four from each side against all four rotations of the
+// other, then advance whichever block ends lower.
+size_t intersectSimd(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, count = 0;
+
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+
+        __m128i cmp0 = _mm_cmpeq_epi32(va, vb);
+        __m128i cmp1 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)));
+        __m128i cmp2 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i cmp3 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)));
+        __m128i any = _mm_or_si128(_mm_or_si128(cmp0, cmp1), _mm_or_si128(cmp2, cmp3));
+
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(any));
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            out[count++] = a[i + lane];
+            mask &= mask - 1;
+        }
+
+        uint32_t lastA = a[i + 3];
+        uint32_t lastB = b[j + 3];
+        if (lastA <= lastB) {
+            i += 4;
+        }
+        if (lastB <= lastA) {
+            j += 4;
+        }
+    }
+
+    return count + intersectScalar(a + i, na - i, b + j, nb - j, out + count);
+}
+#endif
+
+} // namespace
+
+size_t intersectSorted(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    if (na == 0 || nb == 0) {
+        return 0;
+    }
+    if (na > nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    if (na * GALLOP_RATIO < nb) {
+        return intersectGalloping(a, na, b, nb, out);
+    }
+#ifdef __SSE2__
+    return intersectSimd(a, na, b, nb, out);
+#else
+    return intersectScalar(a, na, b, nb, out);
+#endif
+}
+
+void intersectInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other) {
+    std::vector<uint32_t> out(std::min(result.size(), other.size()));
+    out.resize(intersectSorted(result.data(), result.size(), other.data(), other.size(), out.data()));
+    result.swap(out);
+}
+
+void unionInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other) {
+    std::vector<uint32_t> out;
+    out.reserve(result.size() + other.size());
+    std::set_union(result.begin(), result.end(), other.begin(), other.end(), std::back_inserter(out));
+    result.swap(out);
+}
+
+void subtractInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other) {
+    std::vector<uint32_t> out;
+    out.reserve(result.size());
+    std::set_difference(result.begin(), result.end(), other.begin(), other.end(), std::back_inserter(out));
+    result.swap(out);
+}
@@ -0,0 +1,20 @@
+#ifndef INTERSECT_H
+#define INTERSECT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Set operations over strictly increasing docId arrays.
+
+// Intersect a and b into out (which may alias neither input). Picks
+// galloping search when one side is much smaller, otherwise a SIMD block
+// merge (SSE2 where available, scalar elsewhere). Returns the output size.
+size_t intersectSorted(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+
+// In-place helpers built on the kernels above
+void intersectInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other);
+void unionInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other);
+void subtractInto(std::vector<uint32_t>& result, const std::vector<uint32_t>& other);
+
+#endif // INTERSECT_H
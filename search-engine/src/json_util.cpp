@@ -0,0 +1,227 @@
+#include "json_util.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Position just past the ':' that follows "key" at the top level of the
+// object, or npos. Skips over string values so keys inside them don't match.
+size_t findValue(const std::string& json, const std::string& key) {
+    bool inString = false;
+    for (size_t i = 0; i < json.size(); ++i) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                inString = false;
+            }
+            continue;
+        }
+        if (c != '"') {
+            continue;
+        }
+
+        // A string starts here: is it our key followed by a colon?
+        size_t end = i + 1 + key.size();
+        if (json.compare(i + 1, key.size(), key) == 0 && end < json.size() && json[end] == '"') {
+            size_t pos = end + 1;
+            while (pos < json.size() && std::isspace(static_cast<unsigned char>(json[pos]))) {
+                ++pos;
+            }
+            if (pos < json.size() && json[pos] == ':') {
+                ++pos;
+                while (pos < json.size() && std::isspace(static_cast<unsigned char>(json[pos]))) {
+                    ++pos;
+                }
+                return pos;
+            }
+        }
+        inString = true;
+    }
+    return std::string::npos;
+}
+
+void appendUtf8(std::string& out, unsigned long codepoint) {
+    if (codepoint < 0x80) {
+        out.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+}
+
+bool readHex4(const std::string& json, size_t pos, unsigned long& value) {
+    if (pos + 4 > json.size()) {
+        return false;
+    }
+    std::string digits = json.substr(pos, 4);
+    char* end = nullptr;
+    value = std::strtoul(digits.c_str(), &end, 16);
+    return end == digits.c_str() + 4;
+}
+
+} // namespace
+
+bool jsonGetString(const std::string& json, const std::string& key, std::string& value) {
+    size_t pos = findValue(json, key);
+    if (pos == std::string::npos || pos >= json.size() || json[pos] != '"') {
+        return false;
+    }
+
+    std::string result;
+    for (size_t i = pos + 1; i < json.size(); ++i) {
+        char c = json[i];
+        if (c == '"') {
+            value = result;
+            return true;
+        }
+        if (c != '\\') {
+            result.push_back(c);
+            continue;
+        }
+
+        if (++i >= json.size()) {
+            return false;
+        }
+        switch (json[i]) {
+            case '"': result.push_back('"'); break;
+            case '\\': result.push_back('\\'); break;
+            case '/': result.push_back('/'); break;
+            case 'b': result.push_back('\b'); break;
+            case 'f': result.push_back('\f'); break;
+            case 'n': result.push_back('\n'); break;
+            case 'r': result.push_back('\r'); break;
+            case 't': result.push_back('\t'); break;
+            case 'u': {
+                unsigned long codepoint;
+                if (!readHex4(json, i + 1, codepoint)) {
+                    return false;
+                }
+                i += 4;
+
+                // Combine a UTF-16 surrogate pair
+                unsigned long low;
+                if (codepoint >= 0xD800 && codepoint < 0xDC00 &&
+                    i + 2 < json.size() && json[i + 1] == '\\' && json[i + 2] == 'u' &&
+                    readHex4(json, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                appendUtf8(result, codepoint);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+bool jsonGetInt(const std::string& json, const std::string& key, long long& value) {
+    size_t pos = findValue(json, key);
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    const char* begin = json.c_str() + pos;
+    char* end = nullptr;
+    long long result = std::strtoll(begin, &end, 10);
+    if (end == begin) {
+        return false;
+    }
+    value = result;
+    return true;
+}
+
+bool jsonGetBool(const std::string& json, const std::string& key, bool& value) {
+    size_t pos = findValue(json, key);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    if (json.compare(pos, 4, "true") == 0) {
+        value = true;
+        return true;
+    }
+    if (json.compare(pos, 5, "false") == 0) {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+bool jsonGetArray(const std::string& json, const std::string& key, std::vector<std::string>& elements) {
+    size_t pos = findValue(json, key);
+    if (pos == std::string::npos || pos >= json.size() || json[pos] != '[') {
+        return false;
+    }
+
+    elements.clear();
+    int depth = 0;
+    bool inString = false;
+    size_t start = pos + 1;
+    for (size_t i = pos + 1; i < json.size(); ++i) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                inString = false;
+            }
+            continue;
+        }
+        if (c == '"') {
+            inString = true;
+        } else if (c == '[' || c == '{') {
+            ++depth;
+        } else if ((c == ',' || c == ']') && depth == 0) {
+            size_t first = json.find_first_not_of(" \t\r\n", start);
+            size_t last = json.find_last_not_of(" \t\r\n", i - 1);
+            if (first != std::string::npos && first < i && last >= first) {
+                elements.push_back(json.substr(first, last - first + 1));
+            } else if (c == ',') {
+                return false;  // Empty element
+            }
+            if (c == ']') {
+                return true;
+            }
+            start = i + 1;
+        } else if (c == ']' || c == '}') {
+            --depth;
+        }
+    }
+    return false;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size() + 2);
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(c));
+                    out += buffer;
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+    return out;
+}
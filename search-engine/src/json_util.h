@@ -0,0 +1,23 @@
+#ifndef JSON_UTIL_H
+#define JSON_UTIL_H
+
+#include <string>
+#include <vector>
+
+// Minimal helpers for the flat JSON objects used by the socket protocol.
+// Lookups find the first `"key":` outside of string values and decode
+// the value that follows. They return false if the key is missing or the
+// value has the wrong type.
+
+bool jsonGetString(const std::string& json, const std::string& key, std::string& value);
+bool jsonGetInt(const std::string& json, const std::string& key, long long& value);
+bool jsonGetBool(const std::string& json, const std::string& key, bool& value);
+
+// The elements of an array value as raw JSON text (strings keep their
+// quotes and escapes, objects their braces), for passing them on as they are
+bool jsonGetArray(const std::string& json, const std::string& key, std::vector<std::string>& elements);
+
+// Escape a string for use inside a JSON string literal (no quotes added)
+std::string jsonEscape(const std::string& text);
+
+#endif // JSON_UTIL_H
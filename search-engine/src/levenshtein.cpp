@@ -0,0 +1,42 @@
+#include "levenshtein.h"
+#include <algorithm>
+
+LevenshteinAutomaton::LevenshteinAutomaton(std::string_view term, unsigned maxEdits)
+    : masks_(), accept_(uint64_t(1) << std::min(term.size(), MAX_LENGTH)),
+      maxEdits_(std::min(maxEdits, MAX_EDITS)) {
+    for (size_t i = 0; i < term.size() && i < MAX_LENGTH; ++i) {
+        masks_[static_cast<unsigned char>(term[i])] |= uint64_t(1) << (i + 1);
+    }
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::start() const {
+    // Empty input is within e edits of the term's first e bytes
+    State state = {};
+    uint64_t valid = accept_ | (accept_ - 1);
+    for (unsigned e = 0; e <= maxEdits_; ++e) {
+        state.rows[e] = ((uint64_t(2) << e) - 1) & valid;
+    }
+    return state;
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::step(const State& state, unsigned char c) const {
+    uint64_t mask = masks_[c];
+    uint64_t valid = accept_ | (accept_ - 1);
+    State next = {};
+    next.rows[0] = (state.rows[0] << 1) & mask;
+    for (unsigned e = 1; e <= maxEdits_; ++e) {
+        next.rows[e] = (((state.rows[e] << 1) & mask)     // Match
+                        | state.rows[e - 1]               // Extra input byte
+                        | (state.rows[e - 1] << 1)        // Substituted byte
+                        | (next.rows[e - 1] << 1)) & valid;  // Missing input byte
+    }
+    return next;
+}
+
+unsigned LevenshteinAutomaton::distance(const State& state) const {
+    unsigned e = 0;
+    while (e < maxEdits_ && !(state.rows[e] & accept_)) {
+        ++e;
+    }
+    return e;
+}
@@ -0,0 +1,44 @@
+#ifndef LEVENSHTEIN_H
+#define LEVENSHTEIN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Levenshtein automaton for one term: accepts the strings within
+// `maxEdits` byte insertions, deletions or substitutions of it. Runs the
+// nondeterministic automaton bit-parallel: bit i of row e is set when the
+// input so far is within e edits of the term's first i bytes, so a step
+// is a few shifts and masks per row. Since it is fed a byte at a time, a
+// sorted term table can be matched by carrying states along shared
+// prefixes and seeking past the prefixes that kill it.
+class LevenshteinAutomaton {
+public:
+    static constexpr unsigned MAX_EDITS = 2;
+    static constexpr size_t MAX_LENGTH = 63;  // One bit per term byte, plus the empty prefix
+
+    struct State {
+        uint64_t rows[MAX_EDITS + 1];
+    };
+
+    // `term` must be at most MAX_LENGTH bytes; maxEdits is capped at MAX_EDITS
+    LevenshteinAutomaton(std::string_view term, unsigned maxEdits);
+
+    State start() const;
+    State step(const State& state, unsigned char c) const;
+
+    // Input so far is within maxEdits of the term
+    bool isMatch(const State& state) const { return (state.rows[maxEdits_] & accept_) != 0; }
+    // Some continuation of the input could still match; rows only grow
+    // with e, so the last one decides
+    bool canMatch(const State& state) const { return state.rows[maxEdits_] != 0; }
+    // Edit distance of the input so far, if isMatch()
+    unsigned distance(const State& state) const;
+
+private:
+    uint64_t masks_[256];  // Bit i + 1 set where the term's byte i is c
+    uint64_t accept_;      // Bit for the whole term
+    unsigned maxEdits_;
+};
+
+#endif // LEVENSHTEIN_H
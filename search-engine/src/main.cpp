@@ -1,7 +1,13 @@
+#include "index_snapshot.h"
+#include "index_updater.h"
 #include "indexer.h"
-#include "searcher.h"
+#include "json_util.h"
+#include "mapped_index.h"
+#include "query.h"
+#include "segments.h"
 #include "server.h"
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <filesystem>
@@ -10,18 +16,146 @@ void printUsage(const char* programName) {
     std::cout << "Search Engine - Build, Search, and Server Modes" << std::endl;
     std::cout << std::endl;
     std::cout << "Usage:" << std::endl;
-    std::cout << "  Build Mode:  " << programName << " --build <directory_path>" << std::endl;
-    std::cout << "  Search Mode: " << programName << " --search <search_query>" << std::endl;
-    std::cout << "  Server Mode: " << programName << " --server [port]" << std::endl;
+    std::cout << "  Build Mode:  " << programName << " --build <directory_path> [--threads N] [--no-positions] [--no-trigrams] [--mem-limit MB] [filters]" << std::endl;
+    std::cout << "  Update Mode: " << programName << " --update <directory_path> [--threads N] [--no-positions] [--no-trigrams] [--mem-limit MB] [--no-merge] [filters]" << std::endl;
+    std::cout << "  Search Mode: " << programName << " --search <search_query> [--limit N] [--fuzzy N | --substring | --regex] [--regex-timeout-ms N]" << std::endl;
+    std::cout << "  Server Mode: " << programName << " --server [port] [--workers N] [--io-threads N] [--cache-mb N] [--source-cache-mb N] [--regex-timeout-ms N] [--index-dir DIR]" << std::endl;
+    std::cout << "  Coordinator: " << programName << " --coordinator [port] --shards HOST:PORT,... [--shard-timeout-ms N] [--workers N]" << std::endl;
+    std::cout << "  Convert:     " << programName << " --convert <old_index> [new_index]" << std::endl;
     std::cout << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << "  --build <directory_path>    Build the inverted index from a directory and save to disk" << std::endl;
+    std::cout << "  --update <directory_path>   Index only new, changed and deleted files as a new segment" << std::endl;
+    std::cout << "  --threads N                 Worker threads for --build and --update (default: 1, 0 = all cores)" << std::endl;
+    std::cout << "  --no-positions              Skip positions.bin (smaller build, no phrase queries)" << std::endl;
+    std::cout << "  --no-trigrams               Skip trigrams.bin (smaller build, no --substring / --regex)" << std::endl;
+    std::cout << "  --mem-limit MB              Spill postings to sorted runs past about MB MiB and merge them" << std::endl;
+    std::cout << "                              into the index at the end (default: 0 = keep all in memory)" << std::endl;
+    std::cout << "  --no-merge                  Leave merging small segments to a later --update" << std::endl;
+    std::cout << "  --tokenizer code|whitespace How to split files into terms (default: code, lower-cased," << std::endl;
+    std::cout << "                              split on punctuation; whitespace keeps words as written)" << std::endl;
+    std::cout << "  --no-split-identifiers      Don't also index the parts of camelCase / snake_case names" << std::endl;
+    std::cout << "  --include GLOB              Only index matching files, e.g. '*.py' (repeatable)" << std::endl;
+    std::cout << "  --exclude GLOB              Skip matching files and directories, e.g. '.git' (repeatable)" << std::endl;
+    std::cout << "  --max-file-kb N             Skip files larger than N KiB (default: 0 = no limit)" << std::endl;
+    std::cout << "  --shards N                  Build N independent indexes in shard-0 .. shard-N-1 instead" << std::endl;
+    std::cout << "  --shard-by hash|range       Assign files to shards by a hash of their path (default) or" << std::endl;
+    std::cout << "                              in contiguous ranges of the sorted file list" << std::endl;
     std::cout << "  --search <search_query>     Search using pre-built index (loads index.bin and manifest.bin)" << std::endl;
+    std::cout << "                              Terms are ANDed; supports AND, OR, NOT, parentheses and" << std::endl;
+    std::cout << "                              wildcards (num*, get?ame)" << std::endl;
+    std::cout << "  --limit N                   Return the N best matches by BM25 score (default: 100)" << std::endl;
+    std::cout << "  --fuzzy N                   Also match terms within N edits (1 or 2); by default this is" << std::endl;
+    std::cout << "                              only tried when nothing matches, and 0 turns that off" << std::endl;
+    std::cout << "  --substring                 Find files containing the text exactly (needs trigrams.bin);" << std::endl;
+    std::cout << "                              results are in index order, not ranked" << std::endl;
+    std::cout << "  --regex                     Find files with a line matching the ECMAScript regex" << std::endl;
+    std::cout << "  --regex-timeout-ms N        Fail substring and regex searches that take longer checking" << std::endl;
+    std::cout << "                              files, e.g. a regex that backtracks (default: 2000, 0 = no limit)" << std::endl;
     std::cout << "  --server [port]             Start persistent server listening on port (default: 9000)" << std::endl;
+    std::cout << "  --workers N                 Query threads for --server (default: 0 = all cores)" << std::endl;
+    std::cout << "  --io-threads N              Event loops for --server, one SO_REUSEPORT listener each (default: 1)" << std::endl;
+    std::cout << "  --cache-mb N                Memory for cached query responses (default: 64, 0 = off)" << std::endl;
+    std::cout << "  --source-cache-mb N         Source files kept in memory for \"snippets\" (default: 256," << std::endl;
+    std::cout << "                              0 = read them per request)" << std::endl;
+    std::cout << "  --index-dir DIR             Serve the index in DIR, e.g. a shard-N directory" << std::endl;
+    std::cout << "  --coordinator [port]        Answer requests by fanning them out to shard servers and" << std::endl;
+    std::cout << "                              merging their results (default port: 9000)" << std::endl;
+    std::cout << "  --shards HOST:PORT,...      The coordinator's shard servers (a bare port means 127.0.0.1)" << std::endl;
+    std::cout << "  --shard-timeout-ms N        Leave out shards that take longer (default: 1000)" << std::endl;
+    std::cout << "  --convert <old> [new]       Rewrite a legacy index.bin in the mapped format (default output: index.bin)" << std::endl;
     std::cout << std::endl;
     std::cout << "Binary files created/used:" << std::endl;
     std::cout << "  index.bin       - Binary file containing the inverted index" << std::endl;
     std::cout << "  manifest.bin    - Binary file containing the document manifest" << std::endl;
+    std::cout << "  positions.bin   - Token positions for \"phrase queries\" (optional)" << std::endl;
+    std::cout << "  trigrams.bin    - Documents by trigram for substring and regex search (optional)" << std::endl;
+    std::cout << "  segments.bin    - Segment list and deleted documents, written by --update" << std::endl;
+    std::cout << "  seg-N.*.bin     - Files of segment N, written by --update" << std::endl;
+}
+
+// A timeout option's milliseconds; false (after printing why) if invalid
+bool parseTimeout(const char* text, unsigned& timeoutMs) {
+    try {
+        int value = std::stoi(text);
+        if (value < 0) {
+            throw std::invalid_argument("negative");
+        }
+        timeoutMs = static_cast<unsigned>(value);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid timeout: " << text << std::endl;
+        return false;
+    }
+}
+
+// Builds an index of `paths` in the current directory, replacing whatever
+// index is there
+int writeIndex(const std::vector<std::string>& paths, const BuildOptions& options) {
+    // A build replaces every segment; keep updates out until it's done
+    CatalogLock lock;
+    SegmentCatalog previous;
+    if (!lock.locked() || !previous.load()) {
+        return 1;
+    }
+
+    // Build the index
+    Indexer indexer;
+    indexer.buildIndex(paths, options);
+
+    // Write to temporary files and rename them into place, so a running
+    // server that still maps the old files is never left reading a
+    // half-written one
+    bool hasPositions = indexer.hasPositions();
+    bool hasTrigrams = indexer.hasTrigrams();
+    if (!indexer.saveIndexToFile("index.bin.tmp") || !indexer.saveManifestToFile("manifest.bin.tmp") ||
+        indexer.savePositionsToFile("positions.bin.tmp") != hasPositions ||
+        indexer.saveTrigramsToFile("trigrams.bin.tmp") != hasTrigrams) {
+        // The old index stays in place
+        for (const char* tmp : {"index.bin.tmp", "manifest.bin.tmp", "positions.bin.tmp", "trigrams.bin.tmp"}) {
+            std::filesystem::remove(tmp);
+        }
+        std::cerr << "Error: Build failed; the index is unchanged" << std::endl;
+        return 1;
+    }
+
+    // Without a catalog the new files are the whole index. Dropping it
+    // first means a reload in between sees the old segment 0 alone,
+    // never the old catalog with the new index.bin.
+    std::filesystem::remove(CATALOG_FILE);
+    std::filesystem::rename("manifest.bin.tmp", "manifest.bin");
+    if (hasPositions) {
+        std::filesystem::rename("positions.bin.tmp", "positions.bin");
+    } else {
+        // Positions from an earlier build would not match the new index
+        std::filesystem::remove("positions.bin");
+    }
+    if (hasTrigrams) {
+        std::filesystem::rename("trigrams.bin.tmp", "trigrams.bin");
+    } else {
+        std::filesystem::remove("trigrams.bin");
+    }
+    std::filesystem::rename("index.bin.tmp", "index.bin");
+
+    for (const auto& info : previous.segments) {
+        if (info.id != 0) {
+            removeSegmentFiles(info.id);
+        }
+    }
+
+    std::cout << "Build completed successfully!" << std::endl;
+    std::cout << "Index and manifest have been saved to index.bin and manifest.bin" << std::endl;
+
+    return 0;
+}
+
+// FNV-1a, for assigning files to shards the same way on every platform
+uint64_t pathHash(const std::string& path) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : path) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
 }
 
 int main(int argc, char* argv[]) {
@@ -33,16 +167,103 @@ int main(int argc, char* argv[]) {
 
     std::string mode = argv[1];
 
-    // BUILD MODE
-    if (mode == "--build") {
+    // BUILD AND UPDATE MODES
+    if (mode == "--build" || mode == "--update") {
         if (argc < 3) {
-            std::cerr << "Error: --build requires a directory path" << std::endl;
+            std::cerr << "Error: " << mode << " requires a directory path" << std::endl;
             std::cout << std::endl;
             printUsage(argv[0]);
             return 1;
         }
 
         std::string directory = argv[2];
+        UpdateOptions update;
+        BuildOptions& options = update.build;
+        unsigned shards = 0;  // 0: one index in the current directory
+        bool shardByHash = true;
+
+        // Parse optional build flags
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    options.numThreads = static_cast<unsigned>(value);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid thread count: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--no-positions") {
+                options.positions = false;
+            } else if (arg == "--no-trigrams") {
+                options.trigrams = false;
+            } else if (arg == "--tokenizer" && i + 1 < argc) {
+                std::string kind = argv[++i];
+                if (kind == "code") {
+                    options.tokenizer.kind = TokenizerOptions::Kind::Code;
+                } else if (kind == "whitespace") {
+                    options.tokenizer.kind = TokenizerOptions::Kind::Whitespace;
+                    options.tokenizer.splitIdentifiers = false;
+                } else {
+                    std::cerr << "Error: Unknown tokenizer '" << kind << "' (expected code or whitespace)" << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--no-split-identifiers") {
+                options.tokenizer.splitIdentifiers = false;
+            } else if (arg == "--mem-limit" && i + 1 < argc) {
+                try {
+                    long long value = std::stoll(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    options.memoryLimit = static_cast<uint64_t>(value) << 20;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid memory limit: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--no-merge" && mode == "--update") {
+                update.merge = false;
+            } else if (arg == "--shards" && i + 1 < argc && mode == "--build") {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 1 || value > 1024) {
+                        throw std::invalid_argument("out of range");
+                    }
+                    shards = static_cast<unsigned>(value);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid shard count: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--shard-by" && i + 1 < argc && mode == "--build") {
+                std::string kind = argv[++i];
+                if (kind != "hash" && kind != "range") {
+                    std::cerr << "Error: Unknown shard partitioning '" << kind << "' (expected hash or range)" << std::endl;
+                    return 1;
+                }
+                shardByHash = kind == "hash";
+            } else if (arg == "--include" && i + 1 < argc) {
+                options.include.push_back(argv[++i]);
+            } else if (arg == "--exclude" && i + 1 < argc) {
+                options.exclude.push_back(argv[++i]);
+            } else if (arg == "--max-file-kb" && i + 1 < argc) {
+                try {
+                    long long value = std::stoll(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    options.maxFileSize = static_cast<uint64_t>(value) << 10;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid file size limit: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Unknown build option '" << arg << "'" << std::endl;
+                return 1;
+            }
+        }
 
         // Verify directory exists
         if (!std::filesystem::is_directory(directory)) {
@@ -50,18 +271,50 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        std::cout << "Building index from directory: " << directory << std::endl;
+        if (mode == "--update") {
+            std::cout << "Updating index from directory: " << directory << std::endl;
+            return updateIndex(directory, update);
+        }
 
-        // Build the index
-        Indexer indexer;
-        indexer.buildIndex(directory);
+        if (shards == 0) {
+            std::cout << "Building index from directory: " << directory << std::endl;
+            return writeIndex(Indexer::listFiles(directory, options), options);
+        }
 
-        // Save index and manifest to binary files
-        indexer.saveIndexToFile("index.bin");
-        indexer.saveManifestToFile("manifest.bin");
+        // Shard servers run in their own directories, so the paths they
+        // store must not be relative to this one
+        std::filesystem::path root = std::filesystem::absolute(directory).lexically_normal();
+        std::vector<std::string> paths = Indexer::listFiles(root.string(), options);
+        std::vector<std::vector<std::string>> parts(shards);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            size_t shard = i * shards / paths.size();
+            if (shardByHash) {
+                std::string relative = std::filesystem::path(paths[i]).lexically_relative(root).generic_string();
+                shard = pathHash(relative) % shards;
+            }
+            parts[shard].push_back(paths[i]);
+        }
 
-        std::cout << "Build completed successfully!" << std::endl;
-        std::cout << "Index and manifest have been saved to index.bin and manifest.bin" << std::endl;
+        std::filesystem::path home = std::filesystem::current_path();
+        for (unsigned shard = 0; shard < shards; ++shard) {
+            std::string shardDirectory = "shard-" + std::to_string(shard);
+            std::cout << "Building " << shardDirectory << " from " << parts[shard].size() << " files of "
+                      << directory << std::endl;
+            std::error_code error;
+            std::filesystem::create_directories(shardDirectory, error);
+            std::filesystem::current_path(shardDirectory, error);
+            if (error) {
+                std::cerr << "Error: Can't use " << shardDirectory << ": " << error.message() << std::endl;
+                return 1;
+            }
+            int result = writeIndex(parts[shard], options);
+            std::filesystem::current_path(home);
+            if (result != 0) {
+                return result;
+            }
+        }
+        std::cout << "Serve each shard with --server PORT --index-dir shard-N, and query them through "
+                  << "--coordinator PORT --shards PORT,PORT,..." << std::endl;
 
         return 0;
     }
@@ -76,41 +329,122 @@ int main(int argc, char* argv[]) {
         }
 
         std::string query = argv[2];
+        size_t limit = DEFAULT_RESULT_LIMIT;
+        int fuzzy = -1;
+        bool code = false;
+        unsigned regexTimeoutMs = ServerOptions().regexTimeoutMs;
+        CodePattern::Mode codeMode = CodePattern::Mode::Substring;
 
-        // Check if binary index files exist
-        if (!std::filesystem::exists("index.bin") || !std::filesystem::exists("manifest.bin")) {
-            std::cerr << "Error: Pre-built index files not found (index.bin or manifest.bin)" << std::endl;
-            std::cerr << "Please run with --build mode first to create the index." << std::endl;
-            return 1;
+        // Parse optional search flags
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--limit" && i + 1 < argc) {
+                try {
+                    long long value = std::stoll(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    limit = static_cast<size_t>(value);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid result limit: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--fuzzy" && i + 1 < argc) {
+                try {
+                    fuzzy = std::stoi(argv[++i]);
+                    if (fuzzy < 0 || fuzzy > 2) {
+                        throw std::invalid_argument("range");
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid edit distance (0-2): " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--substring" || arg == "--regex") {
+                code = true;
+                codeMode = arg == "--regex" ? CodePattern::Mode::Regex : CodePattern::Mode::Substring;
+            } else if (arg == "--regex-timeout-ms" && i + 1 < argc) {
+                if (!parseTimeout(argv[++i], regexTimeoutMs)) {
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Unknown search option '" << arg << "'" << std::endl;
+                return 1;
+            }
         }
 
         std::cout << "Loading pre-built index..." << std::endl;
 
-        // Load the index and manifest from binary files
-        Indexer indexer;
-        indexer.loadIndexFromFile("index.bin");
-        indexer.loadManifestFromFile("manifest.bin");
+        std::shared_ptr<const IndexSnapshot> snapshot = IndexSnapshot::load();
+        if (!snapshot) {
+            return 1;
+        }
 
-        const auto& completed_index = indexer.getIndex();
-        const auto& manifest = indexer.getManifest();
+        // Substring and regex searches check the files the trigram index
+        // selects, and list matches in index order
+        std::vector<uint32_t> docIds;
+        bool approximate = false;
+        std::string error;
+        if (code) {
+            if (!snapshot->hasTrigrams()) {
+                std::cerr << "Error: Substring and regex searches need trigrams.bin; rebuild without --no-trigrams" << std::endl;
+                return 1;
+            }
+            CodePattern pattern;
+            if (!pattern.compile(query, codeMode, error)) {
+                std::cerr << "Error: " << error << std::endl;
+                return 1;
+            }
+            WorkerPool helpers(0, 0);
+            MatchDeadline deadline(std::chrono::milliseconds{regexTimeoutMs});
+            docIds = snapshot->searchCode(pattern, limit, &helpers, deadline);
+            if (deadline.passed()) {
+                std::cerr << "Error: Search took longer than " << regexTimeoutMs
+                          << " ms; try a simpler pattern or a larger --regex-timeout-ms" << std::endl;
+                return 1;
+            }
+        }
+
+        // Parse the boolean query, splitting words the way the index was built
+        QueryNode parsed;
+        if (!code && !parseQuery(query, snapshot->tokenizer(), parsed, error)) {
+            std::cerr << "Error: Invalid query: " << error << std::endl;
+            return 1;
+        }
+        if (!code && queryHasPhrase(parsed) && !snapshot->hasPositions()) {
+            std::cerr << "Error: Phrase queries need positions.bin; rebuild without --no-positions" << std::endl;
+            return 1;
+        }
+
+        if (fuzzy > 0) {
+            makeFuzzy(parsed, static_cast<unsigned>(fuzzy));
+        }
 
-        // Create searcher and perform search
-        Searcher searcher(completed_index, manifest);
-        std::vector<std::string> file_paths = searcher.search(query);
+        // Perform ranked search, allowing typos if nothing matches exactly
+        if (!code) {
+            std::vector<SearchResult> results = fuzzy < 0 ? snapshot->searchOrFuzzy(parsed, limit, approximate)
+                                                          : snapshot->search(parsed, limit);
+            for (const SearchResult& result : results) {
+                docIds.push_back(result.docId);
+            }
+        }
 
-        // Output results as JSON
+        // Output results as JSON, best match first
+        const char* key = !code ? "query" : codeMode == CodePattern::Mode::Regex ? "regex" : "substring";
         std::cout << "{" << std::endl;
-        std::cout << "  \"query\": \"" << query << "\"," << std::endl;
-        std::cout << "  \"count\": " << file_paths.size() << "," << std::endl;
+        std::cout << "  \"" << key << "\": \"" << jsonEscape(query) << "\"," << std::endl;
+        if (approximate) {
+            std::cout << "  \"fuzzy\": true," << std::endl;
+        }
+        std::cout << "  \"count\": " << docIds.size() << "," << std::endl;
         std::cout << "  \"results\": [" << std::endl;
 
-        for (size_t i = 0; i < file_paths.size(); ++i) {
+        for (size_t i = 0; i < docIds.size(); ++i) {
             // Extract just the filename from the full path
-            std::filesystem::path path(file_paths[i]);
+            std::filesystem::path path(snapshot->documentPath(docIds[i]));
             std::string filename = path.filename().string();
 
-            std::cout << "    \"" << filename << "\"";
-            if (i < file_paths.size() - 1) {
+            std::cout << "    \"" << jsonEscape(filename) << "\"";
+            if (i < docIds.size() - 1) {
                 std::cout << ",";
             }
             std::cout << std::endl;
@@ -122,33 +456,159 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    // SERVER MODE
-    else if (mode == "--server") {
-        int port = 9000;  // Default port
+    // SERVER AND COORDINATOR MODES
+    else if (mode == "--server" || mode == "--coordinator") {
+        ServerOptions options;
+        std::string indexDirectory;
 
-        // Parse optional port argument
-        if (argc >= 3) {
+        // Optional port, then server flags
+        int i = 2;
+        if (i < argc && std::string(argv[i]).rfind("--", 0) != 0) {
             try {
-                port = std::stoi(argv[2]);
-                if (port < 1 || port > 65535) {
+                options.port = std::stoi(argv[i]);
+                if (options.port < 1 || options.port > 65535) {
                     std::cerr << "Error: Port must be between 1 and 65535" << std::endl;
                     return 1;
                 }
             } catch (const std::exception& e) {
-                std::cerr << "Error: Invalid port number: " << argv[2] << std::endl;
+                std::cerr << "Error: Invalid port number: " << argv[i] << std::endl;
+                return 1;
+            }
+            ++i;
+        }
+        for (; i < argc; ++i) {
+            std::string arg = argv[i];
+            if ((arg == "--workers" || arg == "--io-threads") && i + 1 < argc) {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 0 || (value == 0 && arg == "--io-threads")) {
+                        throw std::invalid_argument("out of range");
+                    }
+                    if (arg == "--workers") {
+                        options.workers = static_cast<unsigned>(value);
+                    } else {
+                        options.ioThreads = static_cast<unsigned>(value);
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid value for " << arg << ": " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--index-dir" && i + 1 < argc && mode == "--server") {
+                indexDirectory = argv[++i];
+            } else if (arg == "--shards" && i + 1 < argc && mode == "--coordinator") {
+                std::stringstream list(argv[++i]);
+                std::string address;
+                while (std::getline(list, address, ',')) {
+                    if (!address.empty()) {
+                        options.shards.push_back(address);
+                    }
+                }
+            } else if (arg == "--shard-timeout-ms" && i + 1 < argc && mode == "--coordinator") {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 1) {
+                        throw std::invalid_argument("out of range");
+                    }
+                    options.shardTimeoutMs = static_cast<unsigned>(value);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid shard timeout: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--cache-mb" && i + 1 < argc) {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    options.cacheBytes = static_cast<size_t>(value) << 20;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid cache size: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--regex-timeout-ms" && i + 1 < argc && mode == "--server") {
+                if (!parseTimeout(argv[++i], options.regexTimeoutMs)) {
+                    return 1;
+                }
+            } else if (arg == "--source-cache-mb" && i + 1 < argc) {
+                try {
+                    int value = std::stoi(argv[++i]);
+                    if (value < 0) {
+                        throw std::invalid_argument("negative");
+                    }
+                    options.sourceCacheBytes = static_cast<size_t>(value) << 20;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid source cache size: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Unknown server option '" << arg << "'" << std::endl;
+                return 1;
+            }
+        }
+
+        if (mode == "--coordinator" && options.shards.empty()) {
+            std::cerr << "Error: --coordinator needs --shards HOST:PORT,..." << std::endl;
+            return 1;
+        }
+        if (!indexDirectory.empty()) {
+            std::error_code error;
+            std::filesystem::current_path(indexDirectory, error);
+            if (error) {
+                std::cerr << "Error: Can't use index directory '" << indexDirectory << "': " << error.message()
+                          << std::endl;
                 return 1;
             }
         }
 
-        std::cout << "Starting search engine server..." << std::endl;
+        std::cout << "Starting search engine " << (mode == "--server" ? "server" : "coordinator") << "..." << std::endl;
 
         // Create and start server
-        Server server(port);
-        int result = server.start("index.bin", "manifest.bin");
+        Server server(options);
+        int result = server.start();
 
         return result;
     }
 
+    // CONVERT MODE
+    else if (mode == "--convert") {
+        if (argc < 3) {
+            std::cerr << "Error: --convert requires the path of the old index" << std::endl;
+            std::cout << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        std::string oldIndex = argv[2];
+        std::string newIndex = argc >= 4 ? argv[3] : "index.bin";
+
+        if (!std::filesystem::exists(oldIndex)) {
+            std::cerr << "Error: '" << oldIndex << "' does not exist" << std::endl;
+            return 1;
+        }
+        if (MappedIndex::isMappedFormat(oldIndex)) {
+            std::cerr << "Error: '" << oldIndex << "' is already in the mapped format" << std::endl;
+            return 1;
+        }
+
+        // The document count in the new header comes from the manifest
+        Indexer indexer;
+        indexer.loadLegacyIndexFromFile(oldIndex);
+        if (std::filesystem::exists("manifest.bin") && !indexer.loadManifestFromFile("manifest.bin")) {
+            return 1;
+        }
+
+        // Write to a temporary file first so old == new is safe
+        std::string tmpIndex = newIndex + ".tmp";
+        if (!indexer.saveIndexToFile(tmpIndex)) {
+            std::filesystem::remove(tmpIndex);
+            return 1;
+        }
+        std::filesystem::rename(tmpIndex, newIndex);
+
+        std::cout << "Converted " << oldIndex << " to " << newIndex << std::endl;
+        return 0;
+    }
+
     // INVALID MODE
     else {
         std::cerr << "Error: Unknown mode '" << mode << "'" << std::endl;
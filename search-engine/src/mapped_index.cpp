@@ -0,0 +1,318 @@
+#include "mapped_index.h"
+#include "levenshtein.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// POSIX mapping headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace index_format;
+
+MappedIndex::MappedIndex()
+    : data_(nullptr), size_(0), header_(nullptr), terms_(nullptr),
+      termBytes_(nullptr), postings_(nullptr) {}
+
+MappedIndex::~MappedIndex() {
+    close();
+}
+
+bool MappedIndex::isMappedFormat(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    if (!file.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool MappedIndex::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening file for reading: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(IndexHeader)) {
+        std::cerr << "Error: " << filename << " is too small to be an index" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Failed to mmap " << filename << std::endl;
+        return false;
+    }
+
+    data_ = static_cast<const char*>(mapping);
+    size_ = size;
+    header_ = reinterpret_cast<const IndexHeader*>(data_);
+
+    if (std::memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        std::cerr << "Error: " << filename << " is in the legacy index format. "
+                  << "Run with --convert to upgrade it." << std::endl;
+        close();
+        return false;
+    }
+    if (header_->version != VERSION) {
+        std::cerr << "Error: " << filename << " has index version " << header_->version
+                  << ", expected " << VERSION << ". Please rebuild the index." << std::endl;
+        close();
+        return false;
+    }
+    if (header_->tokenizer > static_cast<uint32_t>(TokenizerOptions::Kind::Code)) {
+        std::cerr << "Error: " << filename << " uses an unknown tokenizer. Please rebuild the index." << std::endl;
+        close();
+        return false;
+    }
+
+    // Written so that a corrupt offset can't overflow
+    auto fits = [this](uint64_t offset, uint64_t size) { return offset <= size_ && size <= size_ - offset; };
+    if (header_->fileSize != size_ ||
+        !fits(header_->termTableOffset, uint64_t(header_->numTerms) * sizeof(TermEntry)) ||
+        !fits(header_->termBytesOffset, header_->termBytesSize) ||
+        !fits(header_->postingsOffset, header_->postingsSize)) {
+        std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+        close();
+        return false;
+    }
+
+    terms_ = reinterpret_cast<const TermEntry*>(data_ + header_->termTableOffset);
+    termBytes_ = data_ + header_->termBytesOffset;
+    postings_ = data_ + header_->postingsOffset;
+
+    // Queries touch the dictionary on every lookup and postings at random
+    madvise(mapping, size_, MADV_RANDOM);
+
+    return true;
+}
+
+void MappedIndex::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    terms_ = nullptr;
+    termBytes_ = nullptr;
+    postings_ = nullptr;
+    lookup_.clear();
+    blockMaxDocCount_.clear();
+    blockMaxDocCount_.shrink_to_fit();
+}
+
+TokenizerOptions MappedIndex::tokenizer() const {
+    TokenizerOptions options;
+    if (header_) {
+        options.kind = static_cast<TokenizerOptions::Kind>(header_->tokenizer);
+        options.splitIdentifiers = (header_->tokenizerFlags & TOKENIZER_SPLIT_IDENTIFIERS) != 0;
+    }
+    return options;
+}
+
+std::string_view MappedIndex::termString(const TermEntry& entry) const {
+    return std::string_view(termBytes_ + entry.termOffset, entry.termLength);
+}
+
+bool MappedIndex::buildLookup() {
+    if (!terms_ || lookup_.size() == header_->numTerms) {
+        return terms_ != nullptr;
+    }
+
+    // Every term is read once, so let the kernel read ahead despite MADV_RANDOM
+    uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+    uintptr_t start = reinterpret_cast<uintptr_t>(terms_) & ~pageMask;
+    uintptr_t end = reinterpret_cast<uintptr_t>(termBytes_ + header_->termBytesSize);
+    madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+
+    auto termAt = [this](uint32_t termId) { return termString(terms_[termId]); };
+    lookup_.reserve(header_->numTerms, termAt);
+    blockMaxDocCount_.assign((header_->numTerms + TERM_BLOCK - 1) / TERM_BLOCK, 0);
+    for (uint32_t termId = 0; termId < header_->numTerms; ++termId) {
+        // Lists are written in term order, so each one ends where the next
+        // begins; its skip table must fit in between (which also keeps a
+        // non-empty list's offset below postingsSize)
+        const TermEntry& entry = terms_[termId];
+        uint64_t listEnd = termId + 1 < header_->numTerms ? terms_[termId + 1].postingsOffset : header_->postingsSize;
+        uint64_t skipBytes = uint64_t(postingBlockCount(entry.docCount)) * 3 * sizeof(uint32_t);
+        if (uint64_t(entry.termOffset) + entry.termLength > header_->termBytesSize ||
+            listEnd > header_->postingsSize || entry.postingsOffset > listEnd ||
+            skipBytes > listEnd - entry.postingsOffset) {
+            lookup_.clear();
+            blockMaxDocCount_.clear();
+            return false;
+        }
+        lookup_.insert(hashTerm(termAt(termId)), termId, termAt);
+        uint32_t& blockMax = blockMaxDocCount_[termId / TERM_BLOCK];
+        blockMax = std::max(blockMax, terms_[termId].docCount);
+    }
+    return true;
+}
+
+PostingCursor MappedIndex::postings(const TermEntry& entry) const {
+    return PostingCursor(postings_ + entry.postingsOffset, entry.docCount);
+}
+
+const TermEntry* MappedIndex::findTerm(std::string_view term) const {
+    if (!terms_) {
+        return nullptr;
+    }
+
+    if (lookup_.size() == header_->numTerms) {
+        uint32_t termId = lookup_.find(term, hashTerm(term),
+                                       [this](uint32_t id) { return termString(terms_[id]); });
+        return termId == TermHash::NOT_FOUND ? nullptr : &terms_[termId];
+    }
+
+    const TermEntry* begin = terms_;
+    const TermEntry* end = terms_ + header_->numTerms;
+    const TermEntry* it = std::lower_bound(begin, end, term,
+        [this](const TermEntry& entry, std::string_view value) {
+            return termString(entry) < value;
+        });
+
+    if (it != end && termString(*it) == term) {
+        return it;
+    }
+    return nullptr;
+}
+
+std::pair<uint32_t, uint32_t> MappedIndex::prefixRange(std::string_view prefix) const {
+    if (!terms_) {
+        return {0, 0};
+    }
+
+    const TermEntry* end = terms_ + header_->numTerms;
+    const TermEntry* first = std::lower_bound(terms_, end, prefix,
+        [this](const TermEntry& entry, std::string_view value) {
+            return termString(entry) < value;
+        });
+    const TermEntry* last = std::partition_point(first, end, [this, prefix](const TermEntry& entry) {
+        return termString(entry).substr(0, prefix.size()) == prefix;
+    });
+    return {static_cast<uint32_t>(first - terms_), static_cast<uint32_t>(last - terms_)};
+}
+
+std::vector<std::pair<uint32_t, unsigned>> MappedIndex::fuzzyTerms(std::string_view term, unsigned maxEdits,
+                                                                   size_t exactPrefix) const {
+    std::vector<std::pair<uint32_t, unsigned>> matches;
+    if (!terms_) {
+        return matches;
+    }
+    if (term.size() > LevenshteinAutomaton::MAX_LENGTH) {
+        // Too long for the automaton; such terms are rarely mistyped
+        const TermEntry* entry = findTerm(term);
+        if (entry) {
+            matches.push_back({termId(*entry), 0});
+        }
+        return matches;
+    }
+
+    using State = LevenshteinAutomaton::State;
+    LevenshteinAutomaton automaton(term, maxEdits);
+
+    // Bytes outside the term all move the automaton the same way, so the
+    // candidates for the next live byte are the term's own and the first
+    // byte that isn't in it
+    bool inTerm[256] = {};
+    for (char c : term) {
+        inTerm[static_cast<unsigned char>(c)] = true;
+    }
+    auto nextLiveByte = [&](const State& state, unsigned after, unsigned& byte) {
+        bool otherTried = false;
+        for (unsigned b = after + 1; b < 256; ++b) {
+            if (!inTerm[b]) {
+                if (otherTried) {
+                    continue;
+                }
+                otherTried = true;
+            }
+            if (automaton.canMatch(automaton.step(state, static_cast<unsigned char>(b)))) {
+                byte = b;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto range = prefixRange(term.substr(0, std::min(exactPrefix, term.size())));
+    const TermEntry* end = terms_ + range.second;
+
+    // First entry at or after `from` not below `target`; usually close by,
+    // so gallop before binary searching
+    auto seek = [this, end](const TermEntry* from, std::string_view target) {
+        auto below = [this, target](const TermEntry& entry) { return termString(entry) < target; };
+        const TermEntry* low = from;
+        size_t step = 1;
+        while (low < end && below(*low)) {
+            from = low + 1;
+            low = step < static_cast<size_t>(end - low) ? low + step : end;
+            step *= 2;
+        }
+        return std::partition_point(from, low, below);
+    };
+
+    // states[d] is the automaton after the first d bytes of `previous`;
+    // the next term reuses the ones for the prefix they share
+    std::vector<State> states(1, automaton.start());
+    std::string_view previous;
+    size_t valid = 0;
+    std::string target;
+    for (const TermEntry* entry = terms_ + range.first; entry < end;) {
+        std::string_view current = termString(*entry);
+        size_t depth = 0;
+        while (depth < valid && depth < current.size() && previous[depth] == current[depth]) {
+            ++depth;
+        }
+
+        bool dead = false;
+        if (states.size() < current.size() + 1) {
+            states.resize(current.size() + 1);
+        }
+        while (depth < current.size()) {
+            states[depth + 1] = automaton.step(states[depth], static_cast<unsigned char>(current[depth]));
+            ++depth;
+            if (!automaton.canMatch(states[depth])) {
+                dead = true;
+                break;
+            }
+        }
+        previous = current;
+        valid = depth;
+
+        if (!dead) {
+            if (automaton.isMatch(states[depth])) {
+                matches.push_back({termId(*entry), automaton.distance(states[depth])});
+            }
+            ++entry;
+            continue;
+        }
+
+        // Byte depth - 1 killed it. Seek to the smallest prefix that could
+        // still match: a larger live byte there, or failing that, at an
+        // earlier position.
+        size_t position = depth - 1;
+        unsigned byte = 0;
+        while (!nextLiveByte(states[position], static_cast<unsigned char>(current[position]), byte)) {
+            if (position == 0) {
+                return matches;
+            }
+            --position;
+        }
+        target.assign(current.substr(0, position));
+        target += static_cast<char>(byte);
+        entry = seek(entry + 1, target);
+    }
+    return matches;
+}
@@ -0,0 +1,121 @@
+#ifndef MAPPED_INDEX_H
+#define MAPPED_INDEX_H
+
+#include "index_format.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Read-only view of an index.bin file mapped into memory. Queries are
+// answered directly from the mapping; nothing is deserialized on open.
+class MappedIndex {
+public:
+    MappedIndex();
+    ~MappedIndex();
+
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+
+    // Map and validate the file. Returns false (and logs why) on failure.
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+
+    // Returns true if the file starts with the current format's magic bytes
+    static bool isMappedFormat(const std::string& filename);
+
+    uint32_t numTerms() const { return header_ ? header_->numTerms : 0; }
+    uint32_t numDocs() const { return header_ ? header_->numDocs : 0; }
+    float avgDocLength() const { return header_ ? header_->avgDocLength : 0.0f; }
+    TokenizerOptions tokenizer() const;
+    size_t sizeBytes() const { return size_; }
+    // Heap used by the term hash and block maxima
+    size_t lookupBytes() const { return lookup_.memoryBytes() + blockMaxDocCount_.capacity() * sizeof(uint32_t); }
+
+    // Hash the term table so findTerm needn't binary search it, and note
+    // each block's largest document count for topTerms. Reads every term,
+    // so it's for indexes that will serve queries. Returns false if a term
+    // lies outside the term bytes or its postings outside the postings.
+    bool buildLookup();
+
+    // Returns nullptr if not found
+    const index_format::TermEntry* findTerm(std::string_view term) const;
+
+    // Term ids [first, last) of the terms starting with `prefix`; the
+    // table is sorted, so they are contiguous
+    std::pair<uint32_t, uint32_t> prefixRange(std::string_view prefix) const;
+
+    // Ids of the terms within `maxEdits` edits of `term` that share its
+    // first `exactPrefix` bytes, with their distances, in term order.
+    // Walks the table with a Levenshtein automaton and seeks past every
+    // prefix it can't extend.
+    std::vector<std::pair<uint32_t, unsigned>> fuzzyTerms(std::string_view term, unsigned maxEdits,
+                                                          size_t exactPrefix = 0) const;
+
+    // Up to `limit` ids in [first, last) for which accept(termId) holds,
+    // in the most documents first (ties: earlier term first). Blocks of
+    // terms that can't beat the current `limit`-th are skipped unread.
+    template <typename Accept>
+    std::vector<uint32_t> topTerms(uint32_t first, uint32_t last, size_t limit, Accept&& accept) const;
+
+    const index_format::TermEntry& termAt(uint32_t termId) const { return terms_[termId]; }
+    uint32_t termId(const index_format::TermEntry& entry) const { return static_cast<uint32_t>(&entry - terms_); }
+    std::string_view termString(const index_format::TermEntry& entry) const;
+    PostingCursor postings(const index_format::TermEntry& entry) const;
+
+private:
+    const char* data_;
+    size_t size_;
+    const index_format::IndexHeader* header_;
+    const index_format::TermEntry* terms_;
+    const char* termBytes_;
+    const char* postings_;
+    TermHash lookup_;  // Term bytes -> index in the term table, once built
+
+    static constexpr uint32_t TERM_BLOCK = 64;
+    std::vector<uint32_t> blockMaxDocCount_;  // Per TERM_BLOCK terms, once built
+};
+
+template <typename Accept>
+std::vector<uint32_t> MappedIndex::topTerms(uint32_t first, uint32_t last, size_t limit, Accept&& accept) const {
+    auto better = [this](uint32_t a, uint32_t b) {
+        return terms_[a].docCount > terms_[b].docCount || (terms_[a].docCount == terms_[b].docCount && a < b);
+    };
+
+    // Heap with the worst of the best so far on top. Terms come in id
+    // order, so one no more frequent than the top can't displace it.
+    std::vector<uint32_t> heap;
+    for (uint32_t termId = first; termId < last && limit > 0; ++termId) {
+        if (heap.size() == limit) {
+            uint32_t floor = terms_[heap.front()].docCount;
+            if (termId % TERM_BLOCK == 0 && termId / TERM_BLOCK < blockMaxDocCount_.size() &&
+                blockMaxDocCount_[termId / TERM_BLOCK] <= floor) {
+                termId += TERM_BLOCK - 1;
+                continue;
+            }
+            if (terms_[termId].docCount <= floor) {
+                continue;
+            }
+        }
+        if (!accept(termId)) {
+            continue;
+        }
+        heap.push_back(termId);
+        std::push_heap(heap.begin(), heap.end(), better);
+        if (heap.size() > limit) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.pop_back();
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+#endif // MAPPED_INDEX_H
@@ -0,0 +1,122 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+constexpr size_t NUM_STAGES = static_cast<size_t>(Stage::Count);
+constexpr size_t NUM_COUNTERS = static_cast<size_t>(Counter::Count);
+constexpr size_t NUM_GAUGES = static_cast<size_t>(Gauge::Count);
+
+std::atomic<uint64_t> nextMetricsId(1);
+
+// Only the owning thread writes a shard, so a plain load and store is
+// enough and avoids a locked read-modify-write
+inline void bump(std::atomic<uint64_t>& value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+} // namespace
+
+struct Metrics::Shard {
+    std::atomic<uint64_t> counters[NUM_COUNTERS] = {};
+    std::atomic<uint64_t> gauges[NUM_GAUGES] = {};  // Two's complement: one thread's share may be negative
+    std::atomic<uint64_t> counts[NUM_STAGES] = {};
+    std::atomic<uint64_t> sums[NUM_STAGES] = {};
+    std::atomic<uint64_t> buckets[NUM_STAGES][BUCKETS] = {};
+};
+
+Metrics::Metrics() : id_(nextMetricsId.fetch_add(1)) {}
+
+Metrics::~Metrics() = default;
+
+Metrics::Shard& Metrics::local() {
+    // Threads usually record into one Metrics, so the cache is tiny
+    thread_local std::vector<std::pair<uint64_t, Shard*>> cache;
+    for (const auto& entry : cache) {
+        if (entry.first == id_) {
+            return *entry.second;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.push_back(std::make_unique<Shard>());
+    cache.emplace_back(id_, shards_.back().get());
+    return *shards_.back();
+}
+
+size_t Metrics::bucketOf(uint64_t nanos) {
+    if (nanos < (uint64_t(1) << SUB_BITS)) {
+        return static_cast<size_t>(nanos);
+    }
+    unsigned bit = 63 - static_cast<unsigned>(__builtin_clzll(nanos));
+    unsigned shift = bit - SUB_BITS;
+    uint64_t sub = (nanos >> shift) & ((uint64_t(1) << SUB_BITS) - 1);
+    return (static_cast<size_t>(shift + 1) << SUB_BITS) + static_cast<size_t>(sub);
+}
+
+uint64_t Metrics::bucketUpperBound(size_t bucket) {
+    if (bucket < (size_t(1) << SUB_BITS)) {
+        return bucket + 1;
+    }
+    if (bucket + 1 >= BUCKETS) {
+        return UINT64_MAX;
+    }
+    unsigned shift = static_cast<unsigned>(bucket >> SUB_BITS) - 1;
+    uint64_t mantissa = (uint64_t(1) << SUB_BITS) + (bucket & ((size_t(1) << SUB_BITS) - 1)) + 1;
+    return mantissa << shift;
+}
+
+uint64_t Metrics::Histogram::quantileNanos(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(buckets.size() - 1);
+}
+
+void Metrics::record(Stage stage, uint64_t nanos) {
+    Shard& shard = local();
+    size_t s = static_cast<size_t>(stage);
+    bump(shard.counts[s], 1);
+    bump(shard.sums[s], nanos);
+    bump(shard.buckets[s][bucketOf(nanos)], 1);
+}
+
+void Metrics::add(Counter counter, uint64_t n) {
+    bump(local().counters[static_cast<size_t>(counter)], n);
+}
+
+void Metrics::add(Gauge gauge, int64_t delta) {
+    bump(local().gauges[static_cast<size_t>(gauge)], static_cast<uint64_t>(delta));
+}
+
+Metrics::Snapshot Metrics::snapshot() const {
+    Snapshot snapshot;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_) {
+        for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+            snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < NUM_GAUGES; ++i) {
+            snapshot.gauges[i] += static_cast<int64_t>(shard->gauges[i].load(std::memory_order_relaxed));
+        }
+        for (size_t s = 0; s < NUM_STAGES; ++s) {
+            Histogram& histogram = snapshot.stages[s];
+            histogram.count += shard->counts[s].load(std::memory_order_relaxed);
+            histogram.sumNanos += shard->sums[s].load(std::memory_order_relaxed);
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                histogram.buckets[b] += shard->buckets[s][b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return snapshot;
+}
@@ -0,0 +1,108 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Server counters and per-stage latency histograms.
+//
+// Every thread that records gets its own shard, so the hot path never
+// shares a cache line or takes a lock: an update is a relaxed load and
+// store by the shard's only writer. snapshot() sums the shards, which
+// readers may do at any time; a value can be one update behind.
+
+enum class Stage {
+    Accept,     // One accept4() batch on an event loop
+    Recv,       // One recv() call
+    Queue,      // Waiting for a worker
+    Parse,      // Decoding the request JSON
+    Search,     // Running the query against the index (cache misses only)
+    Serialize,  // Rendering the results as JSON (cache misses only)
+    Snippets,   // Reading result sources for snippets (cache misses only)
+    Send,       // One send() pass over a connection's output
+    Request,    // Handed to the worker pool until the response is back on the loop
+    Count
+};
+
+enum class Counter {
+    Accepted,           // Connections accepted
+    Refused,            // Connections closed on accept: too many open
+    QueryRequests,
+    SuggestRequests,
+    CodeRequests,       // Substring and regex
+    AdminRequests,
+    StatsRequests,      // {"stats":true} and GET /metrics
+    Errors,             // Responses with an "error" member, busy ones included
+    Busy,               // Requests refused because the worker queue was full
+    Count
+};
+
+enum class Gauge {
+    Connections,  // Open client connections
+    InFlight,     // Requests queued or running on the worker pool
+    Count
+};
+
+class Metrics {
+public:
+    // Histogram buckets: 8 per power of two of nanoseconds, so a
+    // quantile read from them is at most 12.5% high
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t sumNanos = 0;
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKETS);
+
+        // Upper bound of the bucket holding the q-quantile (0 <= q <= 1)
+        uint64_t quantileNanos(double q) const;
+    };
+
+    struct Snapshot {
+        uint64_t counters[static_cast<size_t>(Counter::Count)] = {};
+        int64_t gauges[static_cast<size_t>(Gauge::Count)] = {};
+        Histogram stages[static_cast<size_t>(Stage::Count)];
+
+        uint64_t counter(Counter c) const { return counters[static_cast<size_t>(c)]; }
+        int64_t gauge(Gauge g) const { return gauges[static_cast<size_t>(g)]; }
+        const Histogram& stage(Stage s) const { return stages[static_cast<size_t>(s)]; }
+    };
+
+    Metrics();
+    ~Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void record(Stage stage, uint64_t nanos);
+    void recordSince(Stage stage, uint64_t start) { record(stage, now() - start); }
+    void add(Counter counter, uint64_t n = 1);
+    void add(Gauge gauge, int64_t delta);
+
+    Snapshot snapshot() const;
+
+    static size_t bucketOf(uint64_t nanos);
+    static uint64_t bucketUpperBound(size_t bucket);  // Exclusive
+
+private:
+    struct Shard;
+
+    Shard& local();
+
+    const uint64_t id_;  // Tells this instance's shards apart in the thread-local cache
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,149 @@
+#include "positions.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// POSIX mapping headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace index_format;
+
+void encodePositionList(const std::vector<Posting>& postings,
+                        const std::vector<uint32_t>& positions,
+                        std::string& out) {
+    uint32_t docCount = static_cast<uint32_t>(postings.size());
+    uint32_t numBlocks = postingBlockCount(docCount);
+
+    std::string blocks;
+    std::vector<uint32_t> blockStarts(numBlocks);
+
+    size_t next = 0;
+    for (uint32_t i = 0; i < docCount; ++i) {
+        if (i % POSTING_BLOCK_SIZE == 0) {
+            blockStarts[i / POSTING_BLOCK_SIZE] = static_cast<uint32_t>(blocks.size());
+        }
+
+        uint32_t previous = 0;
+        for (uint32_t j = 0; j < postings[i].frequency; ++j) {
+            uint32_t position = positions[next++];
+            appendVarint(blocks, position - previous);
+            previous = position;
+        }
+    }
+
+    for (uint32_t value : blockStarts) {
+        char bytes[sizeof(uint32_t)];
+        std::memcpy(bytes, &value, sizeof(value));
+        out.append(bytes, sizeof(bytes));
+    }
+    out += blocks;
+}
+
+MappedPositions::MappedPositions()
+    : data_(nullptr), size_(0), header_(nullptr), termOffsets_(nullptr), termData_(nullptr) {}
+
+MappedPositions::~MappedPositions() {
+    close();
+}
+
+bool MappedPositions::open(const std::string& filename, const MappedIndex& index) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PositionsHeader)) {
+        std::cerr << "Error: " << filename << " is too small to be a positions file" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Failed to mmap " << filename << std::endl;
+        return false;
+    }
+
+    data_ = static_cast<const char*>(mapping);
+    size_ = size;
+    header_ = reinterpret_cast<const PositionsHeader*>(data_);
+
+    if (std::memcmp(header_->magic, POSITIONS_MAGIC, sizeof(POSITIONS_MAGIC)) != 0 ||
+        header_->version != POSITIONS_VERSION) {
+        std::cerr << "Error: " << filename << " is not a supported positions file" << std::endl;
+        close();
+        return false;
+    }
+    if (header_->numTerms != index.numTerms() || header_->indexFileSize != index.sizeBytes()) {
+        std::cerr << "Error: " << filename << " does not belong to the loaded index. "
+                  << "Please rebuild the index." << std::endl;
+        close();
+        return false;
+    }
+
+    uint64_t offsetsEnd = header_->termOffsetsOffset + (uint64_t(header_->numTerms) + 1) * sizeof(uint64_t);
+    if (header_->fileSize != size_ || offsetsEnd > size_ ||
+        header_->dataOffset + header_->dataSize > size_) {
+        std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+        close();
+        return false;
+    }
+
+    termOffsets_ = reinterpret_cast<const uint64_t*>(data_ + header_->termOffsetsOffset);
+    termData_ = data_ + header_->dataOffset;
+
+    madvise(mapping, size_, MADV_RANDOM);
+    return true;
+}
+
+void MappedPositions::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    termOffsets_ = nullptr;
+    termData_ = nullptr;
+}
+
+void MappedPositions::positions(uint32_t termId, PostingCursor& cursor, std::vector<uint32_t>& out) const {
+    out.clear();
+    if (!termData_ || termId >= header_->numTerms || cursor.atEnd()) {
+        return;
+    }
+
+    const char* term = termData_ + termOffsets_[termId];
+    uint32_t numBlocks = postingBlockCount(cursor.docCount());
+    uint32_t blockStart;
+    std::memcpy(&blockStart, term + cursor.blockIndex() * sizeof(uint32_t), sizeof(uint32_t));
+
+    // Skip the positions of earlier postings in the same block
+    const uint32_t* freqs = cursor.blockFrequencies();
+    uint32_t skip = 0;
+    for (uint32_t i = 0; i < cursor.indexInBlock(); ++i) {
+        skip += freqs[i];
+    }
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(term + numBlocks * sizeof(uint32_t)) + blockStart;
+    p = skipVarints(p, skip);
+
+    uint32_t count = freqs[cursor.indexInBlock()];
+    out.reserve(count);
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t delta;
+        p = readVarint(p, delta);
+        position += delta;
+        out.push_back(position);
+    }
+}
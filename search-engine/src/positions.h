@@ -0,0 +1,54 @@
+#ifndef POSITIONS_H
+#define POSITIONS_H
+
+#include "index_format.h"
+#include "mapped_index.h"
+#include "posting_list.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-term layout in positions.bin. Postings are grouped into the same
+// blocks as the posting list in index.bin:
+//
+//   uint32_t blockStart[numBlocks]   relative to the end of this table
+//   block data                       per posting, `frequency` position
+//                                    deltas as LEB128 varints
+//
+// A posting's positions are found by jumping to its block and skipping
+// the positions of the postings before it in that block.
+
+// Appends the positions for one term. `positions` holds every posting's
+// token offsets back to back, in posting order.
+void encodePositionList(const std::vector<Posting>& postings,
+                        const std::vector<uint32_t>& positions,
+                        std::string& out);
+
+// Read-only view of positions.bin mapped into memory
+class MappedPositions {
+public:
+    MappedPositions();
+    ~MappedPositions();
+
+    MappedPositions(const MappedPositions&) = delete;
+    MappedPositions& operator=(const MappedPositions&) = delete;
+
+    // Map the file and check that it was written with `index`
+    bool open(const std::string& filename, const MappedIndex& index);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+    size_t sizeBytes() const { return size_; }
+
+    // Token offsets of the posting the cursor is on, for term `termId`
+    void positions(uint32_t termId, PostingCursor& cursor, std::vector<uint32_t>& out) const;
+
+private:
+    const char* data_;
+    size_t size_;
+    const index_format::PositionsHeader* header_;
+    const uint64_t* termOffsets_;
+    const char* termData_;
+};
+
+#endif // POSITIONS_H
@@ -0,0 +1,176 @@
+#include "posting_list.h"
+#include "bm25.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+void appendUint32(std::string& out, uint32_t value) {
+    char bytes[sizeof(uint32_t)];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.append(bytes, sizeof(bytes));
+}
+
+} // namespace
+
+float encodePostingList(const std::vector<Posting>& postings,
+                        const std::vector<float>& lengthNorms,
+                        std::string& out) {
+    uint32_t docCount = static_cast<uint32_t>(postings.size());
+    uint32_t numBlocks = postingBlockCount(docCount);
+
+    // Encode the blocks first so the skip table can record where each ends
+    std::string blocks;
+    std::vector<uint32_t> lastDocIds(numBlocks);
+    std::vector<uint32_t> blockEnds(numBlocks);
+    std::vector<float> blockMaxes(numBlocks, 0.0f);
+    float listMax = 0.0f;
+
+    uint32_t previous = 0;
+    for (uint32_t block = 0; block < numBlocks; ++block) {
+        uint32_t begin = block * POSTING_BLOCK_SIZE;
+        uint32_t end = std::min(begin + POSTING_BLOCK_SIZE, docCount);
+
+        for (uint32_t i = begin; i < end; ++i) {
+            appendVarint(blocks, postings[i].docId - previous);
+            previous = postings[i].docId;
+        }
+        for (uint32_t i = begin; i < end; ++i) {
+            appendVarint(blocks, postings[i].frequency);
+
+            float norm = lengthNorms.empty() ? bm25::K1 : lengthNorms[postings[i].docId];
+            blockMaxes[block] = std::max(blockMaxes[block], bm25::tfNorm(postings[i].frequency, norm));
+        }
+        listMax = std::max(listMax, blockMaxes[block]);
+
+        lastDocIds[block] = previous;
+        blockEnds[block] = static_cast<uint32_t>(blocks.size());
+    }
+
+    for (uint32_t value : lastDocIds) {
+        appendUint32(out, value);
+    }
+    for (uint32_t value : blockEnds) {
+        appendUint32(out, value);
+    }
+    for (float value : blockMaxes) {
+        char bytes[sizeof(float)];
+        std::memcpy(bytes, &value, sizeof(value));
+        out.append(bytes, sizeof(bytes));
+    }
+    out += blocks;
+    return listMax;
+}
+
+PostingCursor::PostingCursor()
+    : lastDocIds_(nullptr), blockEnds_(nullptr), blockMaxes_(nullptr), blockData_(nullptr),
+      docCount_(0), numBlocks_(0), block_(0), blockLength_(0), position_(0),
+      current_(END), freqData_(nullptr), freqsDecoded_(false) {}
+
+PostingCursor::PostingCursor(const char* data, uint32_t docCount)
+    : PostingCursor() {
+    docCount_ = docCount;
+    numBlocks_ = postingBlockCount(docCount);
+    if (numBlocks_ == 0) {
+        return;
+    }
+
+    lastDocIds_ = reinterpret_cast<const uint32_t*>(data);
+    blockEnds_ = lastDocIds_ + numBlocks_;
+    blockMaxes_ = reinterpret_cast<const float*>(blockEnds_ + numBlocks_);
+    blockData_ = reinterpret_cast<const unsigned char*>(blockMaxes_ + numBlocks_);
+    decodeBlock(0);
+}
+
+void PostingCursor::decodeBlock(uint32_t block) {
+    block_ = block;
+    blockLength_ = std::min(POSTING_BLOCK_SIZE, docCount_ - block * POSTING_BLOCK_SIZE);
+    position_ = 0;
+
+    const unsigned char* p = blockData_ + (block == 0 ? 0 : blockEnds_[block - 1]);
+    uint32_t docId = block == 0 ? 0 : lastDocIds_[block - 1];
+    for (uint32_t i = 0; i < blockLength_; ++i) {
+        uint32_t delta;
+        p = readVarint(p, delta);
+        docId += delta;
+        docs_[i] = docId;
+    }
+
+    freqData_ = p;
+    freqsDecoded_ = false;
+    current_ = docs_[0];
+}
+
+uint32_t PostingCursor::frequency() {
+    return blockFrequencies()[position_];
+}
+
+const uint32_t* PostingCursor::blockFrequencies() {
+    if (!freqsDecoded_) {
+        const unsigned char* p = freqData_;
+        for (uint32_t i = 0; i < blockLength_; ++i) {
+            p = readVarint(p, freqs_[i]);
+        }
+        freqsDecoded_ = true;
+    }
+    return freqs_;
+}
+
+void PostingCursor::next() {
+    if (current_ == END) {
+        return;
+    }
+    if (++position_ < blockLength_) {
+        current_ = docs_[position_];
+    } else if (block_ + 1 < numBlocks_) {
+        decodeBlock(block_ + 1);
+    } else {
+        current_ = END;
+    }
+}
+
+void PostingCursor::advanceTo(uint32_t target) {
+    if (current_ >= target) {
+        return;
+    }
+
+    // Skip whole blocks whose last docId is still below the target
+    if (lastDocIds_[block_] < target) {
+        const uint32_t* begin = lastDocIds_ + block_ + 1;
+        const uint32_t* end = lastDocIds_ + numBlocks_;
+        const uint32_t* it = std::lower_bound(begin, end, target);
+        if (it == end) {
+            current_ = END;
+            return;
+        }
+        decodeBlock(static_cast<uint32_t>(it - lastDocIds_));
+    }
+
+    // The target is inside the decoded block
+    const uint32_t* it = std::lower_bound(docs_ + position_, docs_ + blockLength_, target);
+    position_ = static_cast<uint32_t>(it - docs_);
+    current_ = docs_[position_];
+}
+
+float PostingCursor::blockMaxAt(uint32_t target, uint32_t& blockLast) const {
+    if (current_ == END) {
+        blockLast = END;
+        return 0.0f;
+    }
+
+    uint32_t block = block_;
+    if (lastDocIds_[block] < target) {
+        const uint32_t* begin = lastDocIds_ + block + 1;
+        const uint32_t* end = lastDocIds_ + numBlocks_;
+        const uint32_t* it = std::lower_bound(begin, end, target);
+        if (it == end) {
+            blockLast = END;
+            return 0.0f;
+        }
+        block = static_cast<uint32_t>(it - lastDocIds_);
+    }
+
+    blockLast = lastDocIds_[block];
+    return blockMaxes_[block];
+}
@@ -0,0 +1,93 @@
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A single (document, term frequency) pair. Posting lists are kept sorted
+// by docId both in memory and on disk.
+struct Posting {
+    uint32_t docId;
+    uint32_t frequency;
+};
+
+// Compressed posting list layout, as stored per term in index.bin:
+//
+//   uint32_t lastDocId[numBlocks]   skip pointers, one per block
+//   uint32_t blockEnd[numBlocks]    end of each block, relative to the block data
+//   float    blockMax[numBlocks]    largest BM25 tfNorm in each block
+//   block data                      per block: docId deltas, then frequencies
+//
+// Blocks hold POSTING_BLOCK_SIZE postings (the last one may be short). Both
+// docId deltas and frequencies are LEB128 varints. The first delta of a block
+// is relative to the previous block's lastDocId, so any block can be decoded
+// on its own after a skip.
+constexpr uint32_t POSTING_BLOCK_SIZE = 128;
+
+inline uint32_t postingBlockCount(uint32_t docCount) {
+    return (docCount + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+}
+
+// Appends the compressed form of a docId-sorted posting list to `out`.
+// lengthNorms[docId] is bm25::lengthNorm for each document (empty if doc
+// lengths are unknown). Returns the largest tfNorm in the list.
+float encodePostingList(const std::vector<Posting>& postings,
+                        const std::vector<float>& lengthNorms,
+                        std::string& out);
+
+// Forward iterator over a compressed posting list. Decodes one block at a
+// time into a small buffer; frequencies are only decoded when asked for.
+class PostingCursor {
+public:
+    static constexpr uint32_t END = UINT32_MAX;
+
+    PostingCursor();
+    PostingCursor(const char* data, uint32_t docCount);
+
+    uint32_t docId() const { return current_; }
+    bool atEnd() const { return current_ == END; }
+    uint32_t docCount() const { return docCount_; }
+
+    uint32_t frequency();
+
+    // Where the cursor is, for side data stored per block (positions.bin)
+    uint32_t blockIndex() const { return block_; }
+    uint32_t indexInBlock() const { return position_; }
+    const uint32_t* blockFrequencies();
+
+    // Move to the next posting
+    void next();
+
+    // Move to the first posting with docId >= target, using the skip
+    // pointers to jump over whole blocks without decoding them
+    void advanceTo(uint32_t target);
+
+    // Upper bound on tfNorm for the block that would hold target, without
+    // moving or decoding. Sets blockLast to that block's last docId
+    // (END if target is past the list).
+    float blockMaxAt(uint32_t target, uint32_t& blockLast) const;
+
+private:
+    const uint32_t* lastDocIds_;
+    const uint32_t* blockEnds_;
+    const float* blockMaxes_;
+    const unsigned char* blockData_;
+    uint32_t docCount_;
+    uint32_t numBlocks_;
+
+    uint32_t block_;        // Index of the decoded block
+    uint32_t blockLength_;  // Postings in the decoded block
+    uint32_t position_;     // Position within the decoded block
+    uint32_t current_;
+    const unsigned char* freqData_;
+    bool freqsDecoded_;
+
+    uint32_t docs_[POSTING_BLOCK_SIZE];
+    uint32_t freqs_[POSTING_BLOCK_SIZE];
+
+    void decodeBlock(uint32_t block);
+};
+
+#endif // POSTING_LIST_H
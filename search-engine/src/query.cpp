@@ -0,0 +1,386 @@
+#include "query.h"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// Most parentheses and NOTs an operand may be nested in. Parsing, and
+// everything that walks the tree after it, recurses once per level.
+constexpr size_t MAX_DEPTH = 256;
+
+struct Token {
+    enum class Type { Word, Phrase, And, Or, Not, LParen, RParen, End, Error };
+    Type type;
+    std::string text;
+};
+
+// Split on whitespace. A leading '(' always opens a group; a trailing ')'
+// only closes one while a group is open and the word's own parentheses are
+// unbalanced, so code terms like `foo()` survive. A word starting with '"'
+// opens a phrase that runs to the next '"'.
+std::vector<Token> tokenize(const std::string& text) {
+    std::vector<Token> tokens;
+    int depth = 0;
+    size_t i = 0;
+
+    while (i < text.size()) {
+        if (std::isspace(static_cast<unsigned char>(text[i]))) {
+            ++i;
+            continue;
+        }
+
+        if (text[i] == '"') {
+            size_t close = text.find('"', i + 1);
+            if (close == std::string::npos) {
+                tokens.push_back({Token::Type::Error, "Missing closing '\"'"});
+                break;
+            }
+            tokens.push_back({Token::Type::Phrase, text.substr(i + 1, close - i - 1)});
+            i = close + 1;
+
+            // Group parentheses may close right after the phrase
+            while (i < text.size() && text[i] == ')' && depth > 0) {
+                tokens.push_back({Token::Type::RParen, ")"});
+                --depth;
+                ++i;
+            }
+            continue;
+        }
+
+        size_t end = i;
+        while (end < text.size() && !std::isspace(static_cast<unsigned char>(text[end]))) {
+            ++end;
+        }
+
+        size_t begin = i;
+        while (begin < end && text[begin] == '(') {
+            tokens.push_back({Token::Type::LParen, "("});
+            ++depth;
+            ++begin;
+        }
+
+        // Only peel ')' that the word itself leaves unbalanced
+        long balance = 0;
+        for (size_t k = begin; k < end; ++k) {
+            balance += text[k] == ')' ? 1 : (text[k] == '(' ? -1 : 0);
+        }
+        size_t closing = 0;
+        while (end > begin && text[end - 1] == ')' && balance > 0 && depth > 0) {
+            --end;
+            --depth;
+            --balance;
+            ++closing;
+        }
+
+        if (begin < end) {
+            std::string word = text.substr(begin, end - begin);
+            if (word == "AND") {
+                tokens.push_back({Token::Type::And, word});
+            } else if (word == "OR") {
+                tokens.push_back({Token::Type::Or, word});
+            } else if (word == "NOT") {
+                tokens.push_back({Token::Type::Not, word});
+            } else {
+                tokens.push_back({Token::Type::Word, word});
+            }
+        }
+        for (size_t c = 0; c < closing; ++c) {
+            tokens.push_back({Token::Type::RParen, ")"});
+        }
+
+        // Skip past the whole whitespace-delimited word, including any ')'
+        // that were peeled off above
+        while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i]))) {
+            ++i;
+        }
+    }
+
+    tokens.push_back({Token::Type::End, ""});
+    return tokens;
+}
+
+class Parser {
+public:
+    Parser(std::vector<Token> tokens, const TokenizerOptions& tokenizer)
+        : tokens_(std::move(tokens)), pos_(0), tokenizer_(tokenizer) {}
+
+    bool parse(QueryNode& query, std::string& error) {
+        if (peek() == Token::Type::End) {
+            error = "Empty query";
+            return false;
+        }
+        if (!parseOr(query, error)) {
+            return false;
+        }
+        if (peek() != Token::Type::End) {
+            error = "Unexpected '" + tokens_[pos_].text + "'";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<Token> tokens_;
+    size_t pos_;
+    size_t depth_ = 0;  // Parentheses and NOTs around the current operand
+    Tokenizer tokenizer_;
+
+    Token::Type peek() const { return tokens_[pos_].type; }
+
+    static bool startsOperand(Token::Type type) {
+        return type == Token::Type::Word || type == Token::Type::Phrase ||
+               type == Token::Type::Not || type == Token::Type::LParen;
+    }
+
+    // Collapse single-child And/Or nodes
+    static void finish(QueryNode& node) {
+        if (node.children.size() == 1) {
+            QueryNode child = std::move(node.children[0]);
+            node = std::move(child);
+        }
+    }
+
+    bool parseOr(QueryNode& node, std::string& error) {
+        node.type = QueryNode::Type::Or;
+        node.children.emplace_back();
+        if (!parseAnd(node.children.back(), error)) {
+            return false;
+        }
+        while (peek() == Token::Type::Or) {
+            ++pos_;
+            node.children.emplace_back();
+            if (!parseAnd(node.children.back(), error)) {
+                return false;
+            }
+        }
+        finish(node);
+        return true;
+    }
+
+    bool parseAnd(QueryNode& node, std::string& error) {
+        node.type = QueryNode::Type::And;
+        node.children.emplace_back();
+        if (!parseUnary(node.children.back(), error)) {
+            return false;
+        }
+        while (peek() == Token::Type::And || startsOperand(peek())) {
+            if (peek() == Token::Type::And) {
+                ++pos_;
+            }
+            node.children.emplace_back();
+            if (!parseUnary(node.children.back(), error)) {
+                return false;
+            }
+        }
+        finish(node);
+        return true;
+    }
+
+    // A word with '*' or '?': one node per pattern term, ANDed. Parts that
+    // are nothing but wildcards (`os.*`) would match every term and are
+    // dropped; a word made only of them is an error.
+    bool parseWildcard(const std::string& text, QueryNode& node, std::string& error) {
+        node.type = QueryNode::Type::And;
+        for (auto& pattern : tokenizer_.patternTerms(text)) {
+            if (pattern.find_first_not_of("*?") == std::string::npos) {
+                continue;
+            }
+            QueryNode child;
+            child.type = pattern.find_first_of("*?") == std::string::npos ? QueryNode::Type::Term
+                                                                          : QueryNode::Type::Wildcard;
+            child.term = std::move(pattern);
+            node.children.push_back(std::move(child));
+        }
+        if (node.children.empty()) {
+            error = "Wildcard '" + text + "' needs at least one other character";
+            return false;
+        }
+        finish(node);
+        return true;
+    }
+
+    bool parseUnary(QueryNode& node, std::string& error) {
+        const Token& token = tokens_[pos_];
+        switch (token.type) {
+            case Token::Type::Not: {
+                ++pos_;
+                if (++depth_ > MAX_DEPTH) {
+                    error = "Query nested too deeply";
+                    return false;
+                }
+                node.type = QueryNode::Type::Not;
+                node.children.emplace_back();
+                bool parsed = parseUnary(node.children.back(), error);
+                --depth_;
+                return parsed;
+            }
+
+            case Token::Type::LParen:
+                ++pos_;
+                if (++depth_ > MAX_DEPTH) {
+                    error = "Query nested too deeply";
+                    return false;
+                }
+                if (!parseOr(node, error)) {
+                    return false;
+                }
+                if (peek() != Token::Type::RParen) {
+                    error = "Missing ')'";
+                    return false;
+                }
+                ++pos_;
+                --depth_;
+                return true;
+
+            case Token::Type::Word:
+                if (token.text.find_first_of("*?") != std::string::npos) {
+                    ++pos_;
+                    return parseWildcard(token.text, node, error);
+                }
+                [[fallthrough]];
+            case Token::Type::Phrase: {
+                ++pos_;
+                std::vector<std::string> words = tokenizer_.terms(token.text);
+                if (words.empty()) {
+                    error = token.type == Token::Type::Phrase ? "Empty phrase"
+                                                              : "No searchable terms in '" + token.text + "'";
+                    return false;
+                }
+                if (words.size() == 1) {
+                    node.type = QueryNode::Type::Term;
+                    node.term = std::move(words[0]);
+                } else {
+                    node.type = QueryNode::Type::Phrase;
+                    node.phrase = std::move(words);
+                }
+                return true;
+            }
+
+            case Token::Type::End:
+                error = "Query ends with an operator";
+                return false;
+
+            case Token::Type::Error:
+                error = token.text;
+                return false;
+
+            default:
+                error = "Unexpected '" + token.text + "'";
+                return false;
+        }
+    }
+};
+
+} // namespace
+
+bool parseQuery(const std::string& text, const TokenizerOptions& tokenizer, QueryNode& query,
+                std::string& error) {
+    query = QueryNode();
+    return Parser(tokenize(text), tokenizer).parse(query, error);
+}
+
+bool queryHasPhrase(const QueryNode& query) {
+    if (query.type == QueryNode::Type::Phrase) {
+        return true;
+    }
+    for (const auto& child : query.children) {
+        if (queryHasPhrase(child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool queryNeedsExpansion(const QueryNode& query) {
+    if (query.type == QueryNode::Type::Wildcard || query.type == QueryNode::Type::Fuzzy) {
+        return true;
+    }
+    for (const auto& child : query.children) {
+        if (queryNeedsExpansion(child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool makeFuzzy(QueryNode& query, unsigned maxEdits) {
+    switch (query.type) {
+        case QueryNode::Type::Term: {
+            unsigned edits = maxEdits;
+            if (edits == 0) {
+                edits = query.term.size() <= 2 ? 0 : (query.term.size() <= 5 ? 1 : 2);
+            }
+            if (edits == 0) {
+                return false;
+            }
+            query.type = QueryNode::Type::Fuzzy;
+            query.maxEdits = std::min(edits, 2u);
+            return true;
+        }
+        case QueryNode::Type::And:
+        case QueryNode::Type::Or: {
+            bool changed = false;
+            for (auto& child : query.children) {
+                changed |= makeFuzzy(child, maxEdits);
+            }
+            return changed;
+        }
+        default:
+            // Excluded terms stay exact, as do phrases and wildcards
+            return false;
+    }
+}
+
+namespace {
+
+void appendCanonical(const QueryNode& node, std::string& out) {
+    switch (node.type) {
+        case QueryNode::Type::Term:
+            out += std::to_string(node.term.size());
+            out += ':';
+            out += node.term;
+            return;
+        case QueryNode::Type::Phrase:
+            out += "(phrase";
+            for (const auto& term : node.phrase) {
+                out += ' ';
+                out += std::to_string(term.size());
+                out += ':';
+                out += term;
+            }
+            out += ')';
+            return;
+        case QueryNode::Type::Wildcard:
+            out += "(wild ";
+            out += std::to_string(node.term.size());
+            out += ':';
+            out += node.term;
+            out += ')';
+            return;
+        case QueryNode::Type::Fuzzy:
+            out += "(fuzzy ";
+            out += std::to_string(node.maxEdits);
+            out += ' ';
+            out += std::to_string(node.term.size());
+            out += ':';
+            out += node.term;
+            out += ')';
+            return;
+        case QueryNode::Type::And: out += "(and"; break;
+        case QueryNode::Type::Or: out += "(or"; break;
+        case QueryNode::Type::Not: out += "(not"; break;
+    }
+    for (const auto& child : node.children) {
+        out += ' ';
+        appendCanonical(child, out);
+    }
+    out += ')';
+}
+
+} // namespace
+
+std::string canonicalQuery(const QueryNode& query) {
+    std::string out;
+    appendCanonical(query, out);
+    return out;
+}
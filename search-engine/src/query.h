@@ -0,0 +1,56 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "tokenizer.h"
+#include <string>
+#include <vector>
+
+// Parsed boolean query.
+//
+// Syntax: terms separated by whitespace are ANDed; AND, OR and NOT are
+// operators when written in upper case; parentheses group. NOT binds
+// tighter than AND, which binds tighter than OR:
+//
+//   import numpy                  both terms
+//   numpy OR pandas               either term
+//   self AND NOT cls              self without cls
+//   (numpy OR pandas) DataFrame
+//   "from typing import"          exact token sequence (needs positions.bin)
+//   num* OR get?ame               wildcards: '*' any run, '?' one character
+//
+// Words and phrases are split into terms by the index's tokenizer, so
+// `Foo` finds foo; a word that splits into several terms (`os.path`)
+// becomes a phrase of them, or, when it has wildcards (`os.pa*`), an AND.
+// Parentheses and NOTs nest at most 256 deep.
+struct QueryNode {
+    enum class Type { Term, And, Or, Not, Phrase, Wildcard, Fuzzy };
+
+    Type type = Type::Term;
+    std::string term;                 // Term nodes; the pattern for Wildcard nodes; Fuzzy nodes
+    unsigned maxEdits = 0;            // Fuzzy nodes: 1 or 2
+    std::vector<std::string> phrase;  // Phrase nodes: two or more terms, in order
+    std::vector<QueryNode> children;  // And, Or and Not nodes
+};
+
+// Parse a query string. Returns false and sets `error` on malformed input.
+bool parseQuery(const std::string& text, const TokenizerOptions& tokenizer, QueryNode& query,
+                std::string& error);
+
+// True if evaluating the query needs positional postings
+bool queryHasPhrase(const QueryNode& query);
+
+// True if the query has Wildcard or Fuzzy nodes, to be expanded against
+// a term dictionary before evaluation
+bool queryNeedsExpansion(const QueryNode& query);
+
+// Allow typos: turn the Term nodes outside NOT subtrees into Fuzzy nodes
+// matching terms within `maxEdits` (1 or 2) edits. With maxEdits 0 the
+// distance follows the term's length: none up to 2 bytes, 1 up to 5,
+// then 2. Returns false if no node changed.
+bool makeFuzzy(QueryNode& query, unsigned maxEdits);
+
+// Unambiguous text form of a parsed query. Spellings that parse to the
+// same tree ("a b", "a AND b", "(a) b") give the same string.
+std::string canonicalQuery(const QueryNode& query);
+
+#endif // QUERY_H
@@ -0,0 +1,209 @@
+#include "query_cache.h"
+#include <algorithm>
+
+namespace {
+
+const size_t NUM_SHARDS = 16;
+
+// Rough per-entry bookkeeping: map node, LRU node, shared_ptr control block
+const size_t ENTRY_OVERHEAD = 128;
+
+// Average response size assumed when sizing the frequency sketch
+const size_t EXPECTED_ENTRY_BYTES = 512;
+
+uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t hashKey(const std::string& key) {
+    return mix(std::hash<std::string>{}(key));
+}
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+FrequencySketch::FrequencySketch(size_t width)
+    : counters_(ROWS * roundUpToPowerOfTwo(std::max<size_t>(width, 1)), 0),
+      mask_(roundUpToPowerOfTwo(std::max<size_t>(width, 1)) - 1),
+      additions_(0),
+      sampleSize_(10 * (mask_ + 1)) {}
+
+size_t FrequencySketch::slot(uint64_t hash, size_t row) const {
+    uint64_t rowHash = mix(hash + (row + 1) * 0x9e3779b97f4a7c15ULL);
+    return row * (mask_ + 1) + (rowHash & mask_);
+}
+
+void FrequencySketch::record(uint64_t hash) {
+    for (size_t row = 0; row < ROWS; ++row) {
+        uint8_t& counter = counters_[slot(hash, row)];
+        if (counter < MAX_COUNT) {
+            ++counter;
+        }
+    }
+
+    // Age every counter so the sketch follows recent traffic
+    if (++additions_ >= sampleSize_) {
+        for (auto& counter : counters_) {
+            counter >>= 1;
+        }
+        additions_ /= 2;
+    }
+}
+
+uint32_t FrequencySketch::estimate(uint64_t hash) const {
+    uint32_t result = MAX_COUNT;
+    for (size_t row = 0; row < ROWS; ++row) {
+        result = std::min<uint32_t>(result, counters_[slot(hash, row)]);
+    }
+    return result;
+}
+
+struct QueryCache::Shard {
+    struct Entry {
+        std::shared_ptr<const std::string> value;
+        uint64_t generation;
+        size_t cost;
+        std::list<const std::string*>::iterator lru;
+    };
+
+    explicit Shard(size_t budgetBytes)
+        : budget(budgetBytes),
+          bytes(0),
+          sketch(std::min<size_t>(std::max<size_t>(budgetBytes / EXPECTED_ENTRY_BYTES, 64), 1 << 16)) {}
+
+    void erase(std::unordered_map<std::string, Entry>::iterator it) {
+        bytes -= it->second.cost;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    std::mutex mutex;
+    size_t budget;
+    size_t bytes;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<const std::string*> lru;  // Keys of `entries`, most recent first
+    FrequencySketch sketch;
+};
+
+QueryCache::QueryCache(size_t budgetBytes)
+    : budget_(budgetBytes), generation_(0), hits_(0), misses_(0), inserts_(0),
+      evictions_(0), rejections_(0) {
+    if (budget_ == 0) {
+        return;
+    }
+    shards_.reserve(NUM_SHARDS);
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        shards_.push_back(std::make_unique<Shard>(budget_ / NUM_SHARDS));
+    }
+}
+
+QueryCache::~QueryCache() = default;
+
+QueryCache::Shard& QueryCache::shardFor(uint64_t hash) {
+    // The sketch uses the low bits; pick the shard from the high ones
+    return *shards_[(hash >> 56) % NUM_SHARDS];
+}
+
+std::shared_ptr<const std::string> QueryCache::lookup(const std::string& key) {
+    if (!enabled()) {
+        return nullptr;
+    }
+
+    uint64_t hash = hashKey(key);
+    Shard& shard = shardFor(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sketch.record(hash);
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || it->second.generation != generation()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return it->second.value;
+}
+
+void QueryCache::insert(const std::string& key, std::shared_ptr<const std::string> value,
+                        uint64_t generation) {
+    if (!enabled()) {
+        return;
+    }
+
+    uint64_t hash = hashKey(key);
+    Shard& shard = shardFor(hash);
+    size_t cost = key.size() + value->size() + ENTRY_OVERHEAD;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // Checked under the lock so a concurrent invalidate() either sees
+    // this entry and drops it, or makes us drop it here
+    if (generation != this->generation() || cost > shard.budget) {
+        rejections_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto existing = shard.entries.find(key);
+    if (existing != shard.entries.end()) {
+        shard.erase(existing);
+    } else if (shard.bytes + cost > shard.budget && !shard.lru.empty()) {
+        // TinyLFU admission: only replace the LRU victim with something
+        // that has been asked for more often
+        const std::string& victim = *shard.lru.back();
+        if (shard.sketch.estimate(hash) <= shard.sketch.estimate(hashKey(victim))) {
+            rejections_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    while (shard.bytes + cost > shard.budget && !shard.lru.empty()) {
+        shard.erase(shard.entries.find(*shard.lru.back()));
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto inserted = shard.entries.emplace(key, Shard::Entry{std::move(value), generation, cost, {}}).first;
+    shard.lru.push_front(&inserted->first);
+    inserted->second.lru = shard.lru.begin();
+    shard.bytes += cost;
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void QueryCache::invalidate() {
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        shard->lru.clear();
+        shard->bytes = 0;
+    }
+}
+
+QueryCache::Stats QueryCache::stats() const {
+    Stats result;
+    result.hits = hits_.load(std::memory_order_relaxed);
+    result.misses = misses_.load(std::memory_order_relaxed);
+    result.inserts = inserts_.load(std::memory_order_relaxed);
+    result.evictions = evictions_.load(std::memory_order_relaxed);
+    result.rejections = rejections_.load(std::memory_order_relaxed);
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        result.entries += shard->entries.size();
+        result.bytes += shard->bytes;
+    }
+    return result;
+}
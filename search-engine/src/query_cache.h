@@ -0,0 +1,95 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Count-min sketch of recent access frequencies with 4-bit style
+// saturating counters. All counters are halved every `10 * width`
+// records so old popularity fades out.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t width);
+
+    void record(uint64_t hash);
+    uint32_t estimate(uint64_t hash) const;
+
+private:
+    size_t slot(uint64_t hash, size_t row) const;
+
+    static const size_t ROWS = 4;
+    static const uint8_t MAX_COUNT = 15;
+
+    std::vector<uint8_t> counters_;  // ROWS rows of `width` counters
+    size_t mask_;
+    size_t additions_;
+    size_t sampleSize_;
+};
+
+// Cache of serialized query responses, split into independently locked
+// shards. Each shard is an LRU list behind a TinyLFU admission filter: a
+// new entry only displaces the LRU victim if it has been asked for more
+// often recently, so one-off queries can't flush the popular ones.
+//
+// Entries are tagged with the cache generation current when their query
+// started. invalidate() bumps the generation, so results computed against
+// an index that has since been replaced are never stored or returned.
+class QueryCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        uint64_t rejections = 0;  // Refused by the admission filter
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    // budgetBytes == 0 disables the cache
+    explicit QueryCache(size_t budgetBytes);
+    ~QueryCache();
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    bool enabled() const { return budget_ > 0; }
+    size_t budgetBytes() const { return budget_; }
+
+    // Read before running a query and pass to insert()
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+    // Cached value for `key`, or nullptr
+    std::shared_ptr<const std::string> lookup(const std::string& key);
+
+    void insert(const std::string& key, std::shared_ptr<const std::string> value, uint64_t generation);
+
+    // Drop every entry; call after the index changes
+    void invalidate();
+
+    Stats stats() const;
+
+private:
+    struct Shard;
+
+    Shard& shardFor(uint64_t hash);
+
+    size_t budget_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> generation_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> inserts_;
+    std::atomic<uint64_t> evictions_;
+    std::atomic<uint64_t> rejections_;
+};
+
+#endif // QUERY_CACHE_H
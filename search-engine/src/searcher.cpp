@@ -1,23 +1,646 @@
 #include "searcher.h"
+#include "bm25.h"
+#include "glob.h"
+#include "intersect.h"
+#include "top_k.h"
+#include <algorithm>
 #include <iostream>
 
+namespace {
+
+// Below this candidates-to-postings ratio, probing a posting list through
+// its skip pointers is cheaper than decoding it and merging
+constexpr uint64_t PROBE_RATIO = 16;
+
+// Fuzzy matches at two edits keep the term's first byte, as spell
+// checkers usually do: typos there are rare, and it confines the walk to
+// one slice of the term table
+constexpr unsigned FULL_SCAN_MAX_EDITS = 1;
+
+} // namespace
+
+uint64_t CollectionStats::docCount(const std::string& term) const {
+    uint64_t count = 0;
+    for (const MappedIndex* segment : segments) {
+        const index_format::TermEntry* entry = segment->findTerm(term);
+        if (entry) {
+            count += entry->docCount;
+        }
+    }
+    return count;
+}
+
 Searcher::Searcher(
-    const std::unordered_map<std::string, std::unordered_map<int, int>>& index,
-    const std::unordered_map<int, std::string>& manifest
+    const MappedIndex& index,
+    const DocumentTable& documents,
+    const MappedPositions* positions
 )
-    : index_(index), manifest_(manifest) {}
+    : index_(index), positions_(positions) {
+    // Must match the norms the writer used for the block maxima
+    if (index_.avgDocLength() > 0.0f && documents.hasLengths() && documents.size() == index_.numDocs()) {
+        lengthNorms_.reserve(documents.size());
+        for (uint32_t docId = 0; docId < documents.size(); ++docId) {
+            lengthNorms_.push_back(bm25::lengthNorm(documents.length(docId), index_.avgDocLength()));
+        }
+    }
+}
+
+std::vector<SearchResult> Searcher::search(const QueryNode& query, size_t limit) const {
+    if (limit == 0) {
+        return {};
+    }
+    if (queryNeedsExpansion(query)) {
+        return search(expandTerms(query), limit);
+    }
+
+    std::vector<std::string> terms;
+    collectTerms(query, terms);
+
+    bool disjunction = query.type == QueryNode::Type::Term;
+    if (query.type == QueryNode::Type::Or) {
+        disjunction = std::all_of(query.children.begin(), query.children.end(),
+            [](const QueryNode& child) { return child.type == QueryNode::Type::Term; });
+    }
+
+    if (disjunction) {
+        return rankDisjunction(terms, limit);
+    }
+
+    // Plain words parse as an AND of terms, optionally with NOT-ed terms
+    bool conjunction = query.type == QueryNode::Type::And &&
+        std::any_of(query.children.begin(), query.children.end(),
+            [](const QueryNode& child) { return child.type == QueryNode::Type::Term; }) &&
+        std::all_of(query.children.begin(), query.children.end(), [](const QueryNode& child) {
+            return child.type == QueryNode::Type::Term ||
+                   (child.type == QueryNode::Type::Not && child.children[0].type == QueryNode::Type::Term);
+        });
+
+    if (conjunction) {
+        return rankConjunction(query, terms, limit);
+    }
+
+    std::vector<uint32_t> docs = evaluate(query);
+    removeDeleted(docs);
+    return rankMatches(docs, terms, limit);
+}
+
+std::vector<uint32_t> Searcher::match(const QueryNode& query) const {
+    if (queryNeedsExpansion(query)) {
+        return match(expandTerms(query));
+    }
+    std::vector<uint32_t> docs = evaluate(query);
+    removeDeleted(docs);
+    return docs;
+}
+
+float Searcher::lengthNorm(uint32_t docId) const {
+    return docId < lengthNorms_.size() ? lengthNorms_[docId] : bm25::K1;
+}
+
+float Searcher::termWeight(const std::string& term, const index_format::TermEntry& entry) const {
+    if (stats_) {
+        return bm25::termWeight(static_cast<uint32_t>(stats_->docCount(term)),
+                                static_cast<uint32_t>(stats_->numDocs));
+    }
+    return bm25::termWeight(entry.docCount, index_.numDocs());
+}
+
+bool Searcher::isDeleted(uint32_t docId) const {
+    return deleted_ && (docId / 64) < deleted_->size() && (((*deleted_)[docId / 64] >> (docId % 64)) & 1);
+}
+
+void Searcher::removeDeleted(std::vector<uint32_t>& docs) const {
+    if (deleted_) {
+        docs.erase(std::remove_if(docs.begin(), docs.end(),
+                                  [this](uint32_t docId) { return isDeleted(docId); }),
+                   docs.end());
+    }
+}
+
+std::vector<SearchResult> Searcher::rankDisjunction(const std::vector<std::string>& terms, size_t limit) const {
+    struct TermState {
+        PostingCursor cursor;
+        float weight;    // bm25::termWeight
+        float maxScore;  // Upper bound over the whole list
+    };
+
+    std::vector<TermState> states;
+    states.reserve(terms.size());
+    for (const auto& term : terms) {
+        const index_format::TermEntry* entry = index_.findTerm(term);
+        if (entry) {
+            float weight = termWeight(term, *entry);
+            states.push_back({index_.postings(*entry), weight, weight * entry->maxTfNorm});
+        }
+    }
+
+    std::vector<TermState*> order;
+    for (auto& state : states) {
+        order.push_back(&state);
+    }
+
+    TopK<SearchResult> top(limit, index_.numDocs());
+    while (true) {
+        order.erase(std::remove_if(order.begin(), order.end(),
+                        [](const TermState* state) { return state->cursor.atEnd(); }),
+                    order.end());
+        if (order.empty()) {
+            break;
+        }
+        std::sort(order.begin(), order.end(), [](const TermState* a, const TermState* b) {
+            return a->cursor.docId() < b->cursor.docId();
+        });
+
+        // Pivot: the first term at which the summed upper bounds could beat
+        // the current k-th best score. No document before it can qualify.
+        float threshold = top.threshold();
+        float bound = 0.0f;
+        size_t pivot = 0;
+        while (pivot < order.size()) {
+            bound += order[pivot]->maxScore;
+            if (bound > threshold) {
+                break;
+            }
+            ++pivot;
+        }
+        if (pivot == order.size()) {
+            break;
+        }
+
+        uint32_t pivotDoc = order[pivot]->cursor.docId();
+        while (pivot + 1 < order.size() && order[pivot + 1]->cursor.docId() == pivotDoc) {
+            ++pivot;
+        }
+
+        // Block-max check: tighter bounds from the blocks holding pivotDoc.
+        // If they cannot win, skip to the end of the shortest of those blocks.
+        float blockBound = 0.0f;
+        uint32_t skipTo = pivot + 1 < order.size() ? order[pivot + 1]->cursor.docId() : PostingCursor::END;
+        for (size_t i = 0; i <= pivot; ++i) {
+            uint32_t blockLast;
+            blockBound += order[i]->weight * order[i]->cursor.blockMaxAt(pivotDoc, blockLast);
+            if (blockLast != PostingCursor::END) {
+                skipTo = std::min(skipTo, blockLast + 1);
+            }
+        }
+        if (blockBound <= threshold) {
+            for (size_t i = 0; i <= pivot; ++i) {
+                order[i]->cursor.advanceTo(skipTo);
+            }
+            continue;
+        }
+
+        if (order[0]->cursor.docId() == pivotDoc && isDeleted(pivotDoc)) {
+            for (size_t i = 0; i <= pivot; ++i) {
+                order[i]->cursor.next();
+            }
+        } else if (order[0]->cursor.docId() == pivotDoc) {
+            // Every term up to the pivot is on pivotDoc: score it
+            float norm = lengthNorm(pivotDoc);
+            float score = 0.0f;
+            for (size_t i = 0; i <= pivot; ++i) {
+                score += order[i]->weight * bm25::tfNorm(order[i]->cursor.frequency(), norm);
+                order[i]->cursor.next();
+            }
+            top.push({pivotDoc, score});
+        } else {
+            for (size_t i = 0; i < pivot; ++i) {
+                order[i]->cursor.advanceTo(pivotDoc);
+            }
+        }
+    }
+
+    return top.take();
+}
+
+std::vector<SearchResult> Searcher::rankConjunction(const QueryNode& query, const std::vector<std::string>& terms,
+                                                    size_t limit) const {
+    struct TermState {
+        PostingCursor cursor;
+        float weight;  // bm25::termWeight
+    };
+
+    // Kept in query order and scored in it, as rankMatches does
+    std::vector<TermState> states;
+    states.reserve(terms.size());
+    for (const auto& term : terms) {
+        const index_format::TermEntry* entry = index_.findTerm(term);
+        if (!entry) {
+            return {};
+        }
+        states.push_back({index_.postings(*entry), termWeight(term, *entry)});
+    }
+
+    std::vector<PostingCursor> excluded;
+    for (const auto& child : query.children) {
+        if (child.type == QueryNode::Type::Not) {
+            const index_format::TermEntry* entry = index_.findTerm(child.children[0].term);
+            if (entry) {
+                excluded.push_back(index_.postings(*entry));
+            }
+        }
+    }
+
+    // The rarest list drives; the others are probed through their skip pointers
+    std::vector<TermState*> order;
+    for (auto& state : states) {
+        order.push_back(&state);
+    }
+    std::sort(order.begin(), order.end(), [](const TermState* a, const TermState* b) {
+        return a->cursor.docCount() < b->cursor.docCount();
+    });
+    PostingCursor& lead = order[0]->cursor;
+
+    // Block-max bound over the blocks of every list that hold the current
+    // document; it holds for every document before windowEnd
+    float blockBound = 0.0f;
+    uint32_t windowEnd = 0;
+
+    TopK<SearchResult> top(limit, lead.docCount());
+    uint32_t doc = lead.docId();
+    while (doc != PostingCursor::END) {
+        if (top.full()) {
+            if (doc >= windowEnd) {
+                blockBound = 0.0f;
+                windowEnd = PostingCursor::END;
+                for (const TermState* state : order) {
+                    uint32_t blockLast;
+                    blockBound += state->weight * state->cursor.blockMaxAt(doc, blockLast);
+                    windowEnd = std::min(windowEnd, blockLast == PostingCursor::END ? blockLast : blockLast + 1);
+                }
+            }
+            // Nothing before the end of the shortest of those blocks can win
+            if (blockBound <= top.threshold()) {
+                if (windowEnd == PostingCursor::END) {
+                    break;
+                }
+                lead.advanceTo(windowEnd);
+                doc = lead.docId();
+                continue;
+            }
+        }
+
+        // Every other list must hold doc too; if one doesn't, its next
+        // document is the next candidate
+        uint32_t next = doc;
+        for (size_t i = 1; i < order.size() && next == doc; ++i) {
+            order[i]->cursor.advanceTo(doc);
+            next = order[i]->cursor.docId();
+        }
+        if (next != doc) {
+            if (next == PostingCursor::END) {
+                break;
+            }
+            lead.advanceTo(next);
+            doc = lead.docId();
+            continue;
+        }
+
+        bool skip = isDeleted(doc);
+        for (size_t i = 0; i < excluded.size() && !skip; ++i) {
+            excluded[i].advanceTo(doc);
+            skip = excluded[i].docId() == doc;
+        }
+        if (!skip) {
+            float norm = lengthNorm(doc);
+            float score = 0.0f;
+            for (auto& state : states) {
+                score += state.weight * bm25::tfNorm(state.cursor.frequency(), norm);
+            }
+            top.push({doc, score});
+        }
+        lead.next();
+        doc = lead.docId();
+    }
+
+    return top.take();
+}
+
+std::vector<SearchResult> Searcher::rankMatches(const std::vector<uint32_t>& docs,
+                                                const std::vector<std::string>& terms, size_t limit) const {
+    std::vector<float> scores(docs.size(), 0.0f);
+    for (const auto& term : terms) {
+        const index_format::TermEntry* entry = index_.findTerm(term);
+        if (!entry) {
+            continue;
+        }
+
+        float weight = termWeight(term, *entry);
+        PostingCursor cursor = index_.postings(*entry);
+        for (size_t i = 0; i < docs.size() && !cursor.atEnd(); ++i) {
+            cursor.advanceTo(docs[i]);
+            if (cursor.docId() == docs[i]) {
+                scores[i] += weight * bm25::tfNorm(cursor.frequency(), lengthNorm(docs[i]));
+            }
+        }
+    }
+
+    TopK<SearchResult> top(limit, docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+        top.push({docs[i], scores[i]});
+    }
+    return top.take();
+}
+
+QueryNode Searcher::expandTerms(const QueryNode& node) const {
+    QueryNode expanded;
+    if (node.type == QueryNode::Type::Wildcard || node.type == QueryNode::Type::Fuzzy) {
+        std::vector<uint32_t> termIds;
+        if (node.type == QueryNode::Type::Wildcard) {
+            // Only terms starting with the literal prefix can match
+            std::string_view pattern(node.term);
+            auto range = index_.prefixRange(pattern.substr(0, pattern.find_first_of("*?")));
+            termIds = index_.topTerms(range.first, range.second, MAX_WILDCARD_TERMS,
+                [this, pattern](uint32_t termId) {
+                    return wildcardMatch(pattern, index_.termString(index_.termAt(termId)));
+                });
+        } else {
+            // Closest first, then the most frequent
+            auto matches = index_.fuzzyTerms(node.term, node.maxEdits,
+                                             node.maxEdits > FULL_SCAN_MAX_EDITS ? 1 : 0);
+            std::sort(matches.begin(), matches.end(), [this](const auto& a, const auto& b) {
+                if (a.second != b.second) {
+                    return a.second < b.second;
+                }
+                uint32_t countA = index_.termAt(a.first).docCount;
+                uint32_t countB = index_.termAt(b.first).docCount;
+                return countA > countB || (countA == countB && a.first < b.first);
+            });
+            for (size_t i = 0; i < matches.size() && i < MAX_FUZZY_TERMS; ++i) {
+                termIds.push_back(matches[i].first);
+            }
+        }
+
+        // No matching terms leaves an empty OR, which matches nothing
+
+        expanded.type = QueryNode::Type::Or;
+        for (uint32_t termId : termIds) {
+            QueryNode term;
+            term.term = std::string(index_.termString(index_.termAt(termId)));
+            expanded.children.push_back(std::move(term));
+        }
+        if (expanded.children.size() == 1) {
+            QueryNode term = std::move(expanded.children[0]);
+            return term;
+        }
+        return expanded;
+    }
+
+    expanded.type = node.type;
+    expanded.term = node.term;
+    expanded.phrase = node.phrase;
+    for (const auto& child : node.children) {
+        QueryNode expandedChild = expandTerms(child);
+        // Splice ORs into an OR so `num* OR foo` stays a pure disjunction
+        if (node.type == QueryNode::Type::Or && expandedChild.type == QueryNode::Type::Or) {
+            for (auto& grandchild : expandedChild.children) {
+                expanded.children.push_back(std::move(grandchild));
+            }
+        } else {
+            expanded.children.push_back(std::move(expandedChild));
+        }
+    }
+    return expanded;
+}
+
+void Searcher::collectTerms(const QueryNode& node, std::vector<std::string>& terms) {
+    switch (node.type) {
+        case QueryNode::Type::Term:
+            if (std::find(terms.begin(), terms.end(), node.term) == terms.end()) {
+                terms.push_back(node.term);
+            }
+            break;
+        case QueryNode::Type::And:
+        case QueryNode::Type::Or:
+            for (const auto& child : node.children) {
+                collectTerms(child, terms);
+            }
+            break;
+        case QueryNode::Type::Phrase:
+            for (const auto& term : node.phrase) {
+                if (std::find(terms.begin(), terms.end(), term) == terms.end()) {
+                    terms.push_back(term);
+                }
+            }
+            break;
+        case QueryNode::Type::Not:
+            // Excluded terms never contribute to a score
+            break;
+        case QueryNode::Type::Wildcard:
+        case QueryNode::Type::Fuzzy:
+            // Expanded into terms before scoring
+            break;
+    }
+}
+
+std::vector<uint32_t> Searcher::evaluate(const QueryNode& node) const {
+    switch (node.type) {
+        case QueryNode::Type::Term:
+            return decodeTerm(node.term);
+        case QueryNode::Type::And:
+            return evaluateAnd(node);
+        case QueryNode::Type::Or:
+            return evaluateOr(node);
+        case QueryNode::Type::Phrase:
+            return evaluatePhrase(node);
+        case QueryNode::Type::Not: {
+            std::vector<uint32_t> result = allDocs();
+            subtractInto(result, evaluate(node.children[0]));
+            return result;
+        }
+        case QueryNode::Type::Wildcard:
+        case QueryNode::Type::Fuzzy:
+            return evaluate(expandTerms(node));
+    }
+    return {};
+}
+
+std::vector<uint32_t> Searcher::evaluateAnd(const QueryNode& node) const {
+    std::vector<const QueryNode*> positives;
+    std::vector<const QueryNode*> negatives;
+    for (const auto& child : node.children) {
+        if (child.type == QueryNode::Type::Not) {
+            negatives.push_back(&child.children[0]);
+        } else {
+            positives.push_back(&child);
+        }
+    }
+
+    // Rarest first, so the candidate set starts (and stays) small
+    std::sort(positives.begin(), positives.end(), [this](const QueryNode* a, const QueryNode* b) {
+        return estimateCount(*a) < estimateCount(*b);
+    });
+
+    std::vector<uint32_t> result = positives.empty() ? allDocs() : evaluate(*positives[0]);
+
+    for (size_t i = 1; i < positives.size() && !result.empty(); ++i) {
+        const QueryNode& child = *positives[i];
+        if (child.type == QueryNode::Type::Term &&
+            result.size() * PROBE_RATIO < estimateCount(child)) {
+            filterByTerm(result, child.term, true);
+        } else {
+            intersectInto(result, evaluate(child));
+        }
+    }
+
+    for (size_t i = 0; i < negatives.size() && !result.empty(); ++i) {
+        const QueryNode& child = *negatives[i];
+        if (child.type == QueryNode::Type::Term) {
+            filterByTerm(result, child.term, false);
+        } else {
+            subtractInto(result, evaluate(child));
+        }
+    }
+
+    return result;
+}
+
+std::vector<uint32_t> Searcher::evaluateOr(const QueryNode& node) const {
+    std::vector<uint32_t> result;
+    for (const auto& child : node.children) {
+        unionInto(result, evaluate(child));
+    }
+    return result;
+}
+
+std::vector<uint32_t> Searcher::evaluatePhrase(const QueryNode& node) const {
+    if (!hasPositions()) {
+        return {};
+    }
+
+    // Candidates are the documents that contain every term of the phrase
+    QueryNode conjunction;
+    conjunction.type = QueryNode::Type::And;
+    for (const auto& term : node.phrase) {
+        QueryNode child;
+        child.term = term;
+        conjunction.children.push_back(child);
+    }
+    std::vector<uint32_t> candidates = evaluateAnd(conjunction);
+    if (candidates.empty()) {
+        return candidates;
+    }
+
+    size_t length = node.phrase.size();
+    std::vector<uint32_t> termIds(length);
+    std::vector<PostingCursor> cursors(length);
+    for (size_t i = 0; i < length; ++i) {
+        const index_format::TermEntry* entry = index_.findTerm(node.phrase[i]);
+        termIds[i] = index_.termId(*entry);
+        cursors[i] = index_.postings(*entry);
+    }
+
+    std::vector<std::vector<uint32_t>> positions(length);
+    size_t out = 0;
+    for (uint32_t doc_id : candidates) {
+        size_t anchor = 0;
+        for (size_t i = 0; i < length; ++i) {
+            cursors[i].advanceTo(doc_id);
+            positions_->positions(termIds[i], cursors[i], positions[i]);
+            if (positions[i].size() < positions[anchor].size()) {
+                anchor = i;
+            }
+        }
+
+        // Walk the rarest term's offsets and look for the others around them
+        bool found = false;
+        for (uint32_t position : positions[anchor]) {
+            if (position < anchor) {
+                continue;
+            }
+            uint32_t start = position - static_cast<uint32_t>(anchor);
+            found = true;
+            for (size_t i = 0; i < length && found; ++i) {
+                found = std::binary_search(positions[i].begin(), positions[i].end(),
+                                           start + static_cast<uint32_t>(i));
+            }
+            if (found) {
+                break;
+            }
+        }
 
-std::vector<std::string> Searcher::search(const std::string& searchTerm) {
-    std::vector<std::string> results;
-    auto it = index_.find(searchTerm);
-    if (it != index_.end()) {
-        const auto& doc_map = it->second;
-        for (const auto& pair : doc_map) {
-            int doc_id = pair.first;
-            if (manifest_.count(doc_id)) {
-                results.push_back(manifest_.at(doc_id));
+        if (found) {
+            candidates[out++] = doc_id;
+        }
+    }
+    candidates.resize(out);
+    return candidates;
+}
+
+std::vector<uint32_t> Searcher::decodeTerm(const std::string& term) const {
+    std::vector<uint32_t> docs;
+    const index_format::TermEntry* entry = index_.findTerm(term);
+    if (entry) {
+        docs.reserve(entry->docCount);
+        for (PostingCursor cursor = index_.postings(*entry); !cursor.atEnd(); cursor.next()) {
+            docs.push_back(cursor.docId());
+        }
+    }
+    return docs;
+}
+
+void Searcher::filterByTerm(std::vector<uint32_t>& candidates, const std::string& term, bool keep) const {
+    const index_format::TermEntry* entry = index_.findTerm(term);
+    if (!entry) {
+        if (keep) {
+            candidates.clear();
+        }
+        return;
+    }
+
+    PostingCursor cursor = index_.postings(*entry);
+    size_t out = 0;
+    for (uint32_t doc_id : candidates) {
+        cursor.advanceTo(doc_id);
+        if ((cursor.docId() == doc_id) == keep) {
+            candidates[out++] = doc_id;
+        }
+    }
+    candidates.resize(out);
+}
+
+std::vector<uint32_t> Searcher::allDocs() const {
+    std::vector<uint32_t> docs(index_.numDocs());
+    for (uint32_t i = 0; i < docs.size(); ++i) {
+        docs[i] = i;
+    }
+    return docs;
+}
+
+uint64_t Searcher::estimateCount(const QueryNode& node) const {
+    switch (node.type) {
+        case QueryNode::Type::Term: {
+            const index_format::TermEntry* entry = index_.findTerm(node.term);
+            return entry ? entry->docCount : 0;
+        }
+        case QueryNode::Type::And: {
+            uint64_t estimate = index_.numDocs();
+            for (const auto& child : node.children) {
+                if (child.type != QueryNode::Type::Not) {
+                    estimate = std::min(estimate, estimateCount(child));
+                }
+            }
+            return estimate;
+        }
+        case QueryNode::Type::Or: {
+            uint64_t estimate = 0;
+            for (const auto& child : node.children) {
+                estimate += estimateCount(child);
+            }
+            return std::min<uint64_t>(estimate, index_.numDocs());
+        }
+        case QueryNode::Type::Phrase: {
+            uint64_t estimate = index_.numDocs();
+            for (const auto& term : node.phrase) {
+                const index_format::TermEntry* entry = index_.findTerm(term);
+                estimate = std::min<uint64_t>(estimate, entry ? entry->docCount : 0);
             }
+            return estimate;
         }
+        case QueryNode::Type::Not:
+        case QueryNode::Type::Wildcard:
+        case QueryNode::Type::Fuzzy:
+            return index_.numDocs();
     }
-    return results;
+    return 0;
 }
\ No newline at end of file
@@ -1,22 +1,101 @@
 #ifndef SEARCHER_H
 #define SEARCHER_H
 
+#include "document_table.h"
+#include "mapped_index.h"
+#include "positions.h"
+#include "query.h"
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <unordered_map>
+
+struct SearchResult {
+    uint32_t docId;
+    float score;
+};
+
+constexpr size_t DEFAULT_RESULT_LIMIT = 100;
+// Largest limit a request may ask for, so a request's results fit in memory
+constexpr size_t MAX_RESULT_LIMIT = 1000000;
+
+// Most terms a wildcard or fuzzy term expands to in one segment
+constexpr size_t MAX_WILDCARD_TERMS = 128;
+constexpr size_t MAX_FUZZY_TERMS = 64;
+
+// Document counts summed over every segment of the index, so a term's IDF
+// is the same whichever segment scores it
+struct CollectionStats {
+    std::vector<const MappedIndex*> segments;
+    uint64_t numDocs = 0;
+
+    uint64_t docCount(const std::string& term) const;
+};
 
 class Searcher {
 public:
     Searcher(
-        const std::unordered_map<std::string, std::unordered_map<int, int>>& index,
-        const std::unordered_map<int, std::string>& manifest
+        const MappedIndex& index,
+        const DocumentTable& documents,  // For the document lengths
+        const MappedPositions* positions = nullptr
     );
 
-    std::vector<std::string> search(const std::string& searchTerm);
+    // Phrase queries can only be answered when positions.bin was loaded
+    bool hasPositions() const { return positions_ != nullptr && positions_->isOpen(); }
+
+    // For one segment of a larger index: IDF from the whole collection,
+    // and a bitmap of docIds to leave out of every result
+    void setCollectionStats(const CollectionStats* stats) { stats_ = stats; }
+    void setDeleted(const std::vector<uint64_t>* deleted) { deleted_ = deleted; }
+
+    // Top `limit` matches of a parsed query by BM25 score, best first
+    std::vector<SearchResult> search(const QueryNode& query, size_t limit = DEFAULT_RESULT_LIMIT) const;
+
+    // Sorted docIds of all documents matching a parsed query
+    std::vector<uint32_t> match(const QueryNode& query) const;
+
+    size_t memoryBytes() const { return lengthNorms_.capacity() * sizeof(float); }
 
 private:
-    const std::unordered_map<std::string, std::unordered_map<int, int>>& index_;
-    const std::unordered_map<int, std::string>& manifest_;
+    const MappedIndex& index_;
+    const MappedPositions* positions_;
+    const CollectionStats* stats_ = nullptr;
+    const std::vector<uint64_t>* deleted_ = nullptr;
+    std::vector<float> lengthNorms_;  // bm25::lengthNorm by docId; empty if unknown
+
+    // Pure disjunctions (including single terms) are ranked with block-max
+    // WAND, and ANDs of terms (and NOT-ed terms) by walking the rarest list
+    // and skipping blocks that can't reach the top `limit`. Phrases and
+    // nested trees are matched first and the matches scored.
+    std::vector<SearchResult> rankDisjunction(const std::vector<std::string>& terms, size_t limit) const;
+    std::vector<SearchResult> rankConjunction(const QueryNode& query, const std::vector<std::string>& terms,
+                                              size_t limit) const;
+    std::vector<SearchResult> rankMatches(const std::vector<uint32_t>& docs,
+                                          const std::vector<std::string>& terms, size_t limit) const;
+    float lengthNorm(uint32_t docId) const;
+    float termWeight(const std::string& term, const index_format::TermEntry& entry) const;
+    bool isDeleted(uint32_t docId) const;
+    void removeDeleted(std::vector<uint32_t>& docs) const;
+
+    // The query with each Wildcard and Fuzzy node replaced by an OR of
+    // the matching terms of this segment: at most MAX_WILDCARD_TERMS, the
+    // most frequent, or MAX_FUZZY_TERMS, the closest
+    QueryNode expandTerms(const QueryNode& node) const;
+
+    // Distinct terms outside NOT subtrees, i.e. the ones that score
+    static void collectTerms(const QueryNode& node, std::vector<std::string>& terms);
+
+    std::vector<uint32_t> evaluate(const QueryNode& node) const;
+    std::vector<uint32_t> evaluateAnd(const QueryNode& node) const;
+    std::vector<uint32_t> evaluateOr(const QueryNode& node) const;
+    std::vector<uint32_t> evaluatePhrase(const QueryNode& node) const;
+
+    std::vector<uint32_t> decodeTerm(const std::string& term) const;
+    std::vector<uint32_t> allDocs() const;
+    uint64_t estimateCount(const QueryNode& node) const;
+
+    // Keep (or with keep == false, drop) the candidates that contain term,
+    // probing its posting list through the skip pointers
+    void filterByTerm(std::vector<uint32_t>& candidates, const std::string& term, bool keep) const;
 };
 
 #endif
\ No newline at end of file
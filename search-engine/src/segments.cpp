@@ -0,0 +1,184 @@
+#include "segments.h"
+#include "index_format.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+// POSIX file locking
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+using namespace index_format;
+
+namespace {
+
+// Segments with up to TIER_FLOOR_DOCS live documents share the lowest tier
+const uint32_t TIER_FLOOR_DOCS = 1000;
+const size_t MERGE_FACTOR = 4;
+
+size_t tierOf(uint32_t liveDocs) {
+    size_t tier = 0;
+    uint64_t limit = TIER_FLOOR_DOCS;
+    while (liveDocs > limit) {
+        limit *= MERGE_FACTOR;
+        ++tier;
+    }
+    return tier;
+}
+
+} // namespace
+
+SegmentFiles segmentFiles(uint32_t id) {
+    if (id == 0) {
+        return {"index.bin", "manifest.bin", "positions.bin", "trigrams.bin"};
+    }
+    std::string prefix = "seg-" + std::to_string(id);
+    return {prefix + ".index.bin", prefix + ".manifest.bin", prefix + ".positions.bin",
+            prefix + ".trigrams.bin"};
+}
+
+bool SegmentInfo::isDeleted(uint32_t docId) const {
+    return (docId / 64) < deleted.size() && ((deleted[docId / 64] >> (docId % 64)) & 1);
+}
+
+void SegmentInfo::markDeleted(uint32_t docId) {
+    if (docId >= numDocs || isDeleted(docId)) {
+        return;
+    }
+    deleted.resize((numDocs + 63) / 64, 0);
+    deleted[docId / 64] |= uint64_t(1) << (docId % 64);
+    ++numDeleted;
+}
+
+bool SegmentCatalog::load() {
+    nextId = 1;
+    segments.clear();
+
+    std::ifstream file(CATALOG_FILE, std::ios::binary);
+    if (!file.is_open()) {
+        // A plain --build: segment 0 with no deletions
+        std::ifstream base(segmentFiles(0).index, std::ios::binary);
+        IndexHeader header;
+        if (base.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+            std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0) {
+            SegmentInfo info;
+            info.numDocs = header.numDocs;
+            segments.push_back(info);
+        }
+        return true;
+    }
+
+    CatalogHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+        header.version != CATALOG_VERSION) {
+        std::cerr << "Error: " << CATALOG_FILE << " is not a supported segment catalog" << std::endl;
+        return false;
+    }
+
+    nextId = header.nextSegmentId;
+    for (uint32_t i = 0; i < header.numSegments; ++i) {
+        SegmentHeader entry;
+        file.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+
+        SegmentInfo info;
+        info.id = entry.id;
+        info.numDocs = entry.numDocs;
+        info.numDeleted = entry.numDeleted;
+        info.deleted.resize((entry.numDocs + 63) / 64);
+        file.read(reinterpret_cast<char*>(info.deleted.data()), info.deleted.size() * sizeof(uint64_t));
+        if (!file) {
+            std::cerr << "Error: " << CATALOG_FILE << " is truncated" << std::endl;
+            segments.clear();
+            return false;
+        }
+        segments.push_back(std::move(info));
+    }
+    return true;
+}
+
+bool SegmentCatalog::save() const {
+    std::string temporary = std::string(CATALOG_FILE) + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file for writing: " << temporary << std::endl;
+        return false;
+    }
+
+    CatalogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.version = CATALOG_VERSION;
+    header.numSegments = static_cast<uint32_t>(segments.size());
+    header.nextSegmentId = nextId;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& info : segments) {
+        SegmentHeader entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.id = info.id;
+        entry.numDocs = info.numDocs;
+        entry.numDeleted = info.numDeleted;
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+        std::vector<uint64_t> words(info.deleted);
+        words.resize((info.numDocs + 63) / 64, 0);
+        file.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+    }
+
+    file.close();
+    if (!file) {
+        std::cerr << "Error: Failed to write " << temporary << std::endl;
+        return false;
+    }
+    if (std::rename(temporary.c_str(), CATALOG_FILE) != 0) {
+        std::cerr << "Error: Failed to replace " << CATALOG_FILE << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CatalogLock::CatalogLock() : fd_(-1) {
+    int fd = ::open(CATALOG_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Failed to open " << CATALOG_LOCK_FILE << std::endl;
+        return;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        std::cerr << "Error: Failed to lock " << CATALOG_LOCK_FILE << std::endl;
+        ::close(fd);
+        return;
+    }
+    fd_ = fd;
+}
+
+CatalogLock::~CatalogLock() {
+    if (fd_ >= 0) {
+        flock(fd_, LOCK_UN);
+        ::close(fd_);
+    }
+}
+
+std::vector<size_t> pickMerge(const SegmentCatalog& catalog) {
+    // Mostly deleted segments first: rewriting them frees the most
+    for (size_t i = 0; i < catalog.segments.size(); ++i) {
+        const SegmentInfo& info = catalog.segments[i];
+        if (info.numDeleted > info.liveDocs()) {
+            return {i};
+        }
+    }
+
+    std::map<size_t, std::vector<size_t>> tiers;
+    for (size_t i = 0; i < catalog.segments.size(); ++i) {
+        tiers[tierOf(catalog.segments[i].liveDocs())].push_back(i);
+    }
+    for (const auto& tier : tiers) {
+        if (tier.second.size() >= MERGE_FACTOR) {
+            return tier.second;
+        }
+    }
+    return {};
+}
@@ -0,0 +1,75 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The index is a list of immutable segments (see index_format.h for
+// segments.bin). --build writes segment 0 on its own; --update adds a
+// segment holding new and changed files and marks the documents they
+// replace as deleted in the older segments' tombstone bitmaps. Small
+// segments are merged in tiers so the count stays logarithmic.
+
+constexpr const char* CATALOG_FILE = "segments.bin";
+constexpr const char* CATALOG_LOCK_FILE = "segments.lock";
+
+struct SegmentFiles {
+    std::string index;
+    std::string manifest;
+    std::string positions;
+    std::string trigrams;
+};
+
+// Segment 0 is index.bin / manifest.bin / positions.bin / trigrams.bin
+SegmentFiles segmentFiles(uint32_t id);
+
+struct SegmentInfo {
+    uint32_t id = 0;
+    uint32_t numDocs = 0;
+    uint32_t numDeleted = 0;
+    std::vector<uint64_t> deleted;  // Tombstone bitmap by docId
+
+    bool isDeleted(uint32_t docId) const;
+    void markDeleted(uint32_t docId);
+    uint32_t liveDocs() const { return numDocs - numDeleted; }
+};
+
+struct SegmentCatalog {
+    uint32_t nextId = 1;
+    std::vector<SegmentInfo> segments;
+
+    // Reads CATALOG_FILE. Without one the index is segment 0 alone, if
+    // index.bin exists. Returns false on a corrupt catalog.
+    bool load();
+
+    // Replaces CATALOG_FILE atomically
+    bool save() const;
+};
+
+// Exclusive lock on the catalog for the lifetime of the object, so two
+// updates can't both rewrite it. Readers don't take it.
+class CatalogLock {
+public:
+    CatalogLock();
+    ~CatalogLock();
+
+    CatalogLock(const CatalogLock&) = delete;
+    CatalogLock& operator=(const CatalogLock&) = delete;
+
+    bool locked() const { return fd_ >= 0; }
+
+private:
+    int fd_;
+};
+
+// Tiered merge policy. Segments fall into tiers by live document count,
+// each MERGE_FACTOR times the one below; a tier holding MERGE_FACTOR
+// segments is merged into one. A segment with more deleted than live
+// documents is rewritten on its own. Returns the catalog positions of
+// the next segments to merge, in order, or an empty list if nothing
+// needs merging.
+std::vector<size_t> pickMerge(const SegmentCatalog& catalog);
+
+#endif // SEGMENTS_H
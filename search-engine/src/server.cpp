@@ -1,13 +1,18 @@
 #include "server.h"
+#include "binary_protocol.h"
+#include "json_util.h"
+#include <cerrno>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <cstring>
-#include <filesystem>
+#include <iomanip>
 #include <csignal>
 #include <thread>
 #include <mutex>
 
 // POSIX socket headers
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -18,33 +23,76 @@
 static Server* global_server = nullptr;
 static std::mutex server_mutex;
 
+namespace {
+
+// Threads helping workers check substring and regex candidate files and
+// read snippet sources, shared by every request (a request's own worker
+// works too). Requests already run on the worker pool, so don't claim
+// every core.
+constexpr unsigned HELPER_THREADS = 3;
+
+const char* STAGE_NAMES[] = {"accept", "recv", "queue", "parse", "search", "serialize", "snippets", "send", "request"};
+static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == static_cast<size_t>(Stage::Count),
+              "a name for every stage");
+
+// Prometheus histogram bounds: powers of two from 2^10 ns (about 1 us) to 2^34 ns (about 17 s)
+constexpr unsigned FIRST_BOUND_BIT = 10;
+constexpr unsigned LAST_BOUND_BIT = 34;
+
+void printMemory(const IndexSnapshot& snapshot) {
+    IndexMemory memory = snapshot.memoryUsage();
+    auto mb = [](size_t bytes) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / (1 << 20) << " MB";
+        return out.str();
+    };
+    std::cout << "Index memory: " << mb(memory.indexFiles) << " index, " << mb(memory.positionFiles)
+              << " positions, " << mb(memory.trigramFiles) << " trigrams and " << mb(memory.manifestFiles)
+              << " manifests mapped, " << mb(memory.termLookup) << " term lookup ("
+              << snapshot.numTerms() << " terms), " << mb(memory.documents) << " documents" << std::endl;
+}
+
+} // namespace
+
 void signalHandler(int signum) {
-    if (global_server) {
-        std::cout << "\nReceived signal " << signum << ". Shutting down gracefully..." << std::endl;
+    if (!global_server) {
+        return;
+    }
+    if (signum == SIGHUP) {
+        global_server->requestReload();
+    } else {
         global_server->stop();
     }
 }
 
-Server::Server(int port) : port_(port), server_socket_(-1), running_(false), searcher_(nullptr) {}
+Server::Server(const ServerOptions& options)
+    : options_(options), cache_(options.cacheBytes), sources_(options.sourceCacheBytes, options.snippets.fileBytes), startedAt_(Metrics::now()),
+      lastStatsAt_(startedAt_),
+      lastStatsRequests_(0), reloadFd_(-1), stopping_(false) {}
 
 Server::~Server() {
     stop();
+    closeSockets();
+    if (reloadFd_ >= 0) {
+        close(reloadFd_);
+    }
 }
 
-int Server::initializeSocket() {
+int Server::openListenSocket(bool reusePort) {
     // Create server socket
-    server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket_ < 0) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
         std::cerr << "Error: Failed to create socket" << std::endl;
-        return 1;
+        return -1;
     }
 
-    // Set socket to reuse address
+    // Set socket to reuse address, and share the port between loops
     int reuse = 1;
-    if (setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)) {
         std::cerr << "Error: Failed to set socket options" << std::endl;
-        close(server_socket_);
-        return 1;
+        close(fd);
+        return -1;
     }
 
     // Bind socket to port
@@ -52,198 +100,859 @@ int Server::initializeSocket() {
     std::memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    server_addr.sin_port = htons(port_);
+    server_addr.sin_port = htons(options_.port);
 
-    if (bind(server_socket_, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "Error: Failed to bind socket to port " << port_ << std::endl;
-        close(server_socket_);
-        return 1;
+    if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "Error: Failed to bind socket to port " << options_.port << std::endl;
+        close(fd);
+        return -1;
     }
 
     // Listen for incoming connections
-    if (listen(server_socket_, 5) < 0) {
+    if (listen(fd, SOMAXCONN) < 0) {
         std::cerr << "Error: Failed to listen on socket" << std::endl;
-        close(server_socket_);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int Server::initializeSockets() {
+    // With several loops each gets its own listener and the kernel
+    // spreads new connections across them
+    unsigned numLoops = std::max(1u, options_.ioThreads);
+    bool reusePort = numLoops > 1;
+
+    int first = openListenSocket(reusePort);
+    if (first < 0 && reusePort) {
+        std::cerr << "Warning: SO_REUSEPORT unavailable, using a single event loop" << std::endl;
+        numLoops = 1;
+        first = openListenSocket(false);
+    }
+    if (first < 0) {
         return 1;
     }
+    listenSockets_.push_back(first);
 
+    for (unsigned i = 1; i < numLoops; ++i) {
+        int fd = openListenSocket(true);
+        if (fd < 0) {
+            closeSockets();
+            return 1;
+        }
+        listenSockets_.push_back(fd);
+    }
     return 0;
 }
 
-std::string Server::parseJsonQuery(const std::string& json_request) {
-    // Simple JSON parsing to extract "query" value
-    // Expected format: {"query":"search_term"}
+void Server::closeSockets() {
+    for (int fd : listenSockets_) {
+        close(fd);
+    }
+    listenSockets_.clear();
+}
 
-    size_t query_pos = json_request.find("\"query\"");
-    if (query_pos == std::string::npos) {
-        return "";
+bool Server::parseJsonQuery(const std::string& json_request, SearchRequest& request) {
+    // Expected format: {"query":"search_term"} with optional "limit":N, "fuzzy":N,
+    // "scores":true and "snippets":true
+    if (!jsonGetString(json_request, "query", request.query)) {
+        return false;
+    }
+
+    long long limit;
+    if (jsonGetInt(json_request, "limit", limit)) {
+        if (limit < 0 || static_cast<unsigned long long>(limit) > MAX_RESULT_LIMIT) {
+            return false;
+        }
+        request.limit = static_cast<size_t>(limit);
     }
 
-    // Find the colon after "query"
-    size_t colon_pos = json_request.find(':', query_pos);
-    if (colon_pos == std::string::npos) {
-        return "";
+    long long fuzzy;
+    if (jsonGetInt(json_request, "fuzzy", fuzzy)) {
+        if (fuzzy < 0 || fuzzy > 2) {
+            return false;
+        }
+        request.fuzzy = static_cast<int>(fuzzy);
     }
 
-    // Find the opening quote
-    size_t quote_start = json_request.find('\"', colon_pos);
-    if (quote_start == std::string::npos) {
-        return "";
+    bool scores;
+    if (jsonGetBool(json_request, "scores", scores)) {
+        request.scores = scores;
     }
 
-    // Find the closing quote
-    size_t quote_end = json_request.find('\"', quote_start + 1);
-    if (quote_end == std::string::npos) {
-        return "";
+    bool snippets;
+    if (jsonGetBool(json_request, "snippets", snippets)) {
+        request.snippets = snippets;
     }
 
-    return json_request.substr(quote_start + 1, quote_end - quote_start - 1);
+    return true;
 }
 
-std::string Server::processQuery(const std::string& query) {
-    if (!searcher_ || query.empty()) {
+Response Server::processQuery(const SearchRequest& request) {
+    // Read the cache generation before the snapshot; see reload()
+    uint64_t generation = cache_.generation();
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+    if (!snapshot || request.query.empty()) {
         return "{\"error\":\"Invalid query\"}";
     }
 
-    // Perform search
-    std::vector<std::string> results = searcher_->search(query);
+    // Parse the boolean query
+    QueryNode parsed;
+    std::string error;
+    if (!prepareQuery(*snapshot, request.query, request.fuzzy, parsed, error)) {
+        return "{\"error\":\"" + jsonEscape(error) + "\"}";
+    }
+
+    // Responses differ only in the echoed query text, so the cache holds
+    // everything after it and is shared by every spelling of the query.
+    // Snippets are read from the files every time, so edits show up, and
+    // responses with them aren't cached.
+    bool fallback = request.fuzzy < 0;
+    std::string key = canonicalQuery(parsed) + '\n' + std::to_string(request.limit) + (fallback ? "" : "\nexact") +
+                      (request.scores ? "\nscores" : "");
+    std::shared_ptr<const std::string> body = request.snippets ? nullptr : cache_.lookup(key);
+    if (!body) {
+        body = std::make_shared<const std::string>(
+            renderResults(*snapshot, parsed, request.limit, fallback, request.scores, request.snippets));
+        if (!request.snippets) {
+            cache_.insert(key, body, generation);
+        }
+    }
 
-    // Build JSON response
-    std::stringstream json;
-    json << "{";
-    json << "\"query\":\"" << query << "\",";
-    json << "\"count\":" << results.size() << ",";
-    json << "\"results\":[";
+    return Response("{\"query\":\"" + jsonEscape(request.query) + "\",", std::move(body));
+}
+
+bool Server::prepareQuery(const IndexSnapshot& snapshot, const std::string& text, int fuzzy, QueryNode& parsed,
+                          std::string& error) {
+    if (!parseQuery(text, snapshot.tokenizer(), parsed, error)) {
+        return false;
+    }
+    if (queryHasPhrase(parsed) && !snapshot.hasPositions()) {
+        error = "Phrase queries need positions.bin; rebuild the index with positions";
+        return false;
+    }
+    if (fuzzy > 0) {
+        makeFuzzy(parsed, static_cast<unsigned>(fuzzy));
+    }
+    return true;
+}
 
+std::string Server::renderResults(const IndexSnapshot& snapshot, const QueryNode& query, size_t limit,
+                                  bool fuzzyFallback, bool scores, bool snippets) {
+    // Perform ranked search
+    uint64_t start = Metrics::now();
+    bool fuzzy = false;
+    std::vector<SearchResult> results = fuzzyFallback ? snapshot.searchOrFuzzy(query, limit, fuzzy)
+                                                      : snapshot.search(query, limit);
+    metrics_.recordSince(Stage::Search, start);
+
+    // Build the rest of the JSON response, best match first. The names
+    // are encoded once per index, so this only copies bytes.
+    start = Metrics::now();
+    std::string body;
+    if (fuzzy) {
+        body += "\"fuzzy\":true,";
+    }
+    body += "\"count\":" + std::to_string(results.size()) + ",\"results\":[";
+
+    size_t written = 0;
+    std::vector<uint32_t> shown;  // The results written, for snippets
+    std::ostringstream scoreList;
+    scoreList << std::setprecision(9);  // Enough to tell any two floats apart
     for (size_t i = 0; i < results.size(); ++i) {
-        // Extract just the filename from the full path
-        std::filesystem::path path(results[i]);
-        std::string filename = path.filename().string();
+        std::string_view name = snapshot.jsonName(results[i].docId);
+        if (name.empty()) {
+            continue;
+        }
 
-        json << "\"" << filename << "\"";
-        if (i < results.size() - 1) {
-            json << ",";
+        if (written++ > 0) {
+            body += ',';
+            if (scores) {
+                scoreList << ',';
+            }
+        }
+        body.append(name);
+        if (scores) {
+            scoreList << results[i].score;
+        }
+        if (snippets && shown.size() < options_.snippets.results) {
+            shown.push_back(results[i].docId);
         }
     }
 
-    json << "]}";
+    body += ']';
+    if (scores) {
+        body += ",\"scores\":[" + scoreList.str() + "]";
+    }
+    metrics_.recordSince(Stage::Serialize, start);
 
-    return json.str();
+    if (snippets) {
+        // Highlight what the results were found with, typos included
+        QueryNode approximate = query;
+        if (fuzzy) {
+            makeFuzzy(approximate, 0);
+        }
+        body += ",\"snippets\":" + resultSnippets(snapshot, shown, SnippetMatcher(approximate, snapshot.tokenizer()));
+    }
+    body += '}';
+    return body;
 }
 
-void Server::handleConnection(int client_socket) {
-    const int BUFFER_SIZE = 4096;
-    char buffer[BUFFER_SIZE];
+std::string Server::resultSnippets(const IndexSnapshot& snapshot, const std::vector<uint32_t>& docIds,
+                                   const SnippetMatcher& matcher) {
+    uint64_t start = Metrics::now();
+    std::vector<std::string> paths;
+    paths.reserve(docIds.size());
+    for (uint32_t docId : docIds) {
+        paths.push_back(snapshot.documentPath(docId));
+    }
+    std::string json = renderSnippets(paths, matcher, sources_, options_.snippets, helpers_.get());
+    metrics_.recordSince(Stage::Snippets, start);
+    return json;
+}
 
-    // Receive data from client
-    std::memset(buffer, 0, BUFFER_SIZE);
-    ssize_t bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
+std::string Server::processSuggest(const SuggestRequest& request) {
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+    if (!snapshot) {
+        return "{\"error\":\"No index loaded\"}";
+    }
 
-    if (bytes_received < 0) {
-        std::cerr << "Error: Failed to receive data from client" << std::endl;
-        close(client_socket);
-        return;
+    // Complete the last word as the tokenizer would index it; whatever
+    // comes before it is kept, so "np.arr" offers "np.array"
+    size_t start;
+    uint64_t searchStart = Metrics::now();
+    std::string prefix = Tokenizer(snapshot->tokenizer()).lastWord(request.text, start);
+    std::vector<Suggestion> suggestions = snapshot->suggest(prefix, request.limit);
+    metrics_.recordSince(Stage::Search, searchStart);
+
+    uint64_t serializeStart = Metrics::now();
+    std::string before = jsonEscape(request.text.substr(0, start));
+
+    std::string json = "{\"suggest\":\"" + jsonEscape(request.text) + "\",\"count\":" +
+                       std::to_string(suggestions.size()) + ",\"suggestions\":[";
+    for (size_t i = 0; i < suggestions.size(); ++i) {
+        if (i > 0) {
+            json += ',';
+        }
+        json += "{\"text\":\"" + before + jsonEscape(suggestions[i].term) + "\",\"documents\":" +
+                std::to_string(suggestions[i].documents) + "}";
     }
+    json += "]}";
+    metrics_.recordSince(Stage::Serialize, serializeStart);
+    return json;
+}
 
-    std::string request(buffer);
+Response Server::processCodeSearch(const CodeSearchRequest& request) {
+    uint64_t generation = cache_.generation();
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+    if (!snapshot) {
+        return "{\"error\":\"No index loaded\"}";
+    }
+    if (!snapshot->hasTrigrams()) {
+        return "{\"error\":\"Substring and regex searches need trigrams.bin; rebuild the index with trigrams\"}";
+    }
 
-    // Parse query from JSON
-    std::string query = parseJsonQuery(request);
+    bool regex = request.mode == CodePattern::Mode::Regex;
+    CodePattern pattern;
+    std::string error;
+    if (!pattern.compile(request.text, request.mode, error)) {
+        return "{\"error\":\"" + jsonEscape(error) + "\"}";
+    }
 
-    // Process query and generate response
-    std::string response = processQuery(query);
+    // Keyed apart from boolean queries, whose canonical forms start with
+    // '(' or a digit. As in processQuery, responses with snippets aren't cached.
+    std::string key = std::string(regex ? "regex\n" : "substring\n") + request.text + '\n' +
+                      std::to_string(request.limit);
+    std::shared_ptr<const std::string> body = request.snippets ? nullptr : cache_.lookup(key);
+    if (!body) {
+        uint64_t start = Metrics::now();
+        MatchDeadline deadline(std::chrono::milliseconds{options_.regexTimeoutMs});
+        std::vector<uint32_t> docIds = snapshot->searchCode(pattern, request.limit, helpers_.get(), deadline);
+        metrics_.recordSince(Stage::Search, start);
+        if (deadline.passed()) {
+            return "{\"error\":\"" + regexTimeoutError() + "\"}";
+        }
+
+        start = Metrics::now();
+        std::string json = "\"count\":" + std::to_string(docIds.size()) + ",\"results\":[";
+        for (size_t i = 0; i < docIds.size(); ++i) {
+            std::string_view name = snapshot->jsonName(docIds[i]);
+            if (i > 0) {
+                json += ',';
+            }
+            json.append(name.empty() ? std::string_view("\"\"") : name);
+        }
+        json += ']';
+        metrics_.recordSince(Stage::Serialize, start);
+        if (request.snippets) {
+            docIds.resize(std::min(docIds.size(), options_.snippets.results));
+            json += ",\"snippets\":" + resultSnippets(*snapshot, docIds, SnippetMatcher(pattern, deadline));
+        }
+        json += '}';
+        body = std::make_shared<const std::string>(std::move(json));
+        if (!request.snippets) {
+            cache_.insert(key, body, generation);
+        }
+    }
 
-    // Add newline to response
-    response += "\n";
+    return Response(std::string("{\"") + (regex ? "regex" : "substring") + "\":\"" + jsonEscape(request.text) + "\",",
+                    std::move(body));
+}
 
-    // Send response to client
-    if (send(client_socket, response.c_str(), response.length(), 0) < 0) {
-        std::cerr << "Error: Failed to send response to client" << std::endl;
+Response Server::handleRequest(const std::string& request) {
+    if (request.compare(0, 4, "GET ") == 0) {
+        return handleHttp(request);
     }
 
-    close(client_socket);
+    Response response = routeRequest(request);
+    if (response.text.compare(0, 9, "{\"error\":") == 0) {
+        metrics_.add(Counter::Errors);
+    }
+    return response;
 }
 
-int Server::start(const std::string& indexFile, const std::string& manifestFile) {
-    // Check if binary index files exist
-    if (!std::filesystem::exists(indexFile) || !std::filesystem::exists(manifestFile)) {
-        std::cerr << "Error: Pre-built index files not found (" << indexFile << " or " << manifestFile << ")" << std::endl;
-        std::cerr << "Please run with --build mode first to create the index." << std::endl;
-        return 1;
+Response Server::routeRequest(const std::string& request) {
+    uint64_t start = Metrics::now();
+    std::string command;
+    if (jsonGetString(request, "admin", command)) {
+        metrics_.add(Counter::AdminRequests);
+        return handleAdmin(command);
     }
 
-    std::cout << "Loading index files..." << std::endl;
+    bool stats;
+    if (jsonGetBool(request, "stats", stats) && stats) {
+        metrics_.add(Counter::StatsRequests);
+        return renderStats();
+    }
 
-    // Load index and manifest
-    try {
-        indexer_.loadIndexFromFile(indexFile);
-        indexer_.loadManifestFromFile(manifestFile);
-    } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to load index: " << e.what() << std::endl;
-        return 1;
+    SuggestRequest suggest_request;
+    if (jsonGetString(request, "suggest", suggest_request.text)) {
+        metrics_.add(Counter::SuggestRequests);
+        long long limit;
+        if (jsonGetInt(request, "limit", limit)) {
+            if (limit < 0 || static_cast<unsigned long long>(limit) > MAX_RESULT_LIMIT) {
+                return "{\"error\":\"Invalid limit\"}";
+            }
+            suggest_request.limit = static_cast<size_t>(limit);
+        }
+        metrics_.recordSince(Stage::Parse, start);
+        return coordinator_ ? coordinator_->suggest(suggest_request.text, suggest_request.limit)
+                            : processSuggest(suggest_request);
+    }
+
+    CodeSearchRequest code_request;
+    bool regex = jsonGetString(request, "regex", code_request.text);
+    if (regex || jsonGetString(request, "substring", code_request.text)) {
+        metrics_.add(Counter::CodeRequests);
+        code_request.mode = regex ? CodePattern::Mode::Regex : CodePattern::Mode::Substring;
+        long long limit;
+        if (jsonGetInt(request, "limit", limit)) {
+            if (limit < 0 || static_cast<unsigned long long>(limit) > MAX_RESULT_LIMIT) {
+                return "{\"error\":\"Invalid limit\"}";
+            }
+            code_request.limit = static_cast<size_t>(limit);
+        }
+        jsonGetBool(request, "snippets", code_request.snippets);
+        metrics_.recordSince(Stage::Parse, start);
+        return coordinator_ ? coordinator_->codeSearch(code_request.text, regex, code_request.limit, code_request.snippets)
+                            : processCodeSearch(code_request);
     }
 
-    // Create searcher with loaded data
-    const auto& index = indexer_.getIndex();
-    const auto& manifest = indexer_.getManifest();
-    searcher_ = new Searcher(index, manifest);
+    // Parse query from JSON
+    metrics_.add(Counter::QueryRequests);
+    SearchRequest search_request;
+    bool valid = parseJsonQuery(request, search_request);
+    metrics_.recordSince(Stage::Parse, start);
+    if (!valid) {
+        return "{\"error\":\"Invalid query\"}";
+    }
+    return coordinator_ ? coordinator_->query(search_request.query, search_request.limit, search_request.fuzzy,
+                                              search_request.snippets)
+                        : processQuery(search_request);
+}
 
-    std::cout << "Index loaded successfully with " << index.size() << " terms and "
-              << manifest.size() << " documents." << std::endl;
+// A binary request frame's queries, run one at a time as the client reads
+// the results of the ones before
+struct Server::FrameBatch {
+    std::vector<binary_protocol::Query> queries;
+    std::shared_ptr<const IndexSnapshot> snapshot;  // Every query sees the same index
+    size_t next = 0;                     // Query to run next
+    uint16_t current = 0;                // Query whose page is being sent
+    std::vector<SearchResult> page;      // Its results; code search scores are 0
+    size_t sent = 0;                     // Of `page`
+};
+
+ResponseStream Server::handleFrame(const std::string& frame) {
+    uint64_t start = Metrics::now();
+    auto batch = std::make_shared<FrameBatch>();
+    std::string error;
+    bool valid = binary_protocol::decodeBatch(frame, batch->queries, error);
+    metrics_.recordSince(Stage::Parse, start);
+    if (valid && coordinator_) {
+        valid = false;
+        error = "The coordinator only serves JSON requests";
+    }
+    if (valid) {
+        batch->snapshot = std::atomic_load(&snapshot_);
+        if (!batch->snapshot) {
+            valid = false;
+            error = "No index loaded";
+        }
+    }
+    if (!valid) {
+        metrics_.add(Counter::Errors);
+        return [error](std::string& out) {
+            binary_protocol::appendError(out, binary_protocol::FRAME_ERROR_INDEX, error);
+            return false;
+        };
+    }
+    return [this, batch](std::string& out) { return continueFrame(*batch, out); };
+}
 
-    // Initialize socket
-    if (initializeSocket() != 0) {
-        return 1;
+bool Server::continueFrame(FrameBatch& batch, std::string& out) {
+    while (out.size() < binary_protocol::RESULTS_FRAME_BYTES) {
+        if (batch.sent < batch.page.size()) {
+            uint64_t start = Metrics::now();
+            binary_protocol::ResultsFrame frame;
+            frame.begin(out, batch.current);
+            for (size_t n = 0; n < 0xFFFF && batch.sent < batch.page.size() &&
+                               out.size() < binary_protocol::RESULTS_FRAME_BYTES; ++n) {
+                const SearchResult& result = batch.page[batch.sent++];
+                frame.add(out, result.score, batch.snapshot->fileName(result.docId));
+            }
+            frame.finish(out);
+            metrics_.recordSince(Stage::Serialize, start);
+            continue;
+        }
+        if (batch.next == batch.queries.size()) {
+            binary_protocol::appendEnd(out, static_cast<uint16_t>(batch.queries.size()));
+            batch.snapshot.reset();
+            return false;
+        }
+        runFrameQuery(batch, out);
     }
+    return true;
+}
 
-    running_ = true;
+void Server::runFrameQuery(FrameBatch& batch, std::string& out) {
+    const binary_protocol::Query& query = batch.queries[batch.next];
+    batch.current = static_cast<uint16_t>(batch.next++);
+    batch.page.clear();
+    batch.sent = 0;
+
+    // The results before `offset` are needed to rank the page, then
+    // dropped, so it is their sum that bounds the page's memory
+    const IndexSnapshot& snapshot = *batch.snapshot;
+    size_t wanted = static_cast<size_t>(query.offset) + query.limit;
+    bool fuzzy = false;
+    std::string error;
+    uint64_t start = Metrics::now();
+    if (wanted > MAX_RESULT_LIMIT) {
+        error = "Offset plus limit is over " + std::to_string(MAX_RESULT_LIMIT);
+    } else if (query.kind == binary_protocol::Kind::Query) {
+        metrics_.add(Counter::QueryRequests);
+        QueryNode parsed;
+        if (query.text.empty()) {
+            error = "Invalid query";
+        } else if (prepareQuery(snapshot, query.text, query.fuzzy, parsed, error)) {
+            batch.page = query.fuzzy < 0 ? snapshot.searchOrFuzzy(parsed, wanted, fuzzy)
+                                         : snapshot.search(parsed, wanted);
+        }
+    } else {
+        metrics_.add(Counter::CodeRequests);
+        CodePattern pattern;
+        CodePattern::Mode mode = query.kind == binary_protocol::Kind::Regex ? CodePattern::Mode::Regex
+                                                                             : CodePattern::Mode::Substring;
+        if (!snapshot.hasTrigrams()) {
+            error = "Substring and regex searches need trigrams.bin; rebuild the index with trigrams";
+        } else if (pattern.compile(query.text, mode, error)) {
+            MatchDeadline deadline(std::chrono::milliseconds{options_.regexTimeoutMs});
+            for (uint32_t docId : snapshot.searchCode(pattern, wanted, helpers_.get(), deadline)) {
+                batch.page.push_back({docId, 0.0f});
+            }
+            if (deadline.passed()) {
+                batch.page.clear();
+                error = regexTimeoutError();
+            }
+        }
+    }
+    metrics_.recordSince(Stage::Search, start);
 
-    // Set up signal handlers for graceful shutdown
-    std::lock_guard<std::mutex> lock(server_mutex);
-    global_server = this;
-    signal(SIGINT, signalHandler);
-    signal(SIGTERM, signalHandler);
+    if (!error.empty()) {
+        metrics_.add(Counter::Errors);
+        binary_protocol::appendError(out, batch.current, error);
+        return;
+    }
+    batch.page.erase(batch.page.begin(), batch.page.begin() + std::min<size_t>(query.offset, batch.page.size()));
+    binary_protocol::appendBegin(out, batch.current, fuzzy ? binary_protocol::FLAG_FUZZY : 0,
+                                 static_cast<uint32_t>(batch.page.size()));
+}
 
-    std::cout << "Server started on 127.0.0.1:" << port_ << std::endl;
-    std::cout << "Listening for incoming connections..." << std::endl;
-    std::cout << "Press Ctrl+C to shutdown." << std::endl;
+std::string Server::regexTimeoutError() const {
+    return "Search took longer than " + std::to_string(options_.regexTimeoutMs) + " ms; try a simpler pattern";
+}
+
+std::string Server::handleAdmin(const std::string& command) {
+    if (command != "reload") {
+        return "{\"error\":\"Unknown admin command\"}";
+    }
+    if (coordinator_) {
+        return coordinator_->reload();
+    }
+    if (!reload()) {
+        return "{\"error\":\"Reload failed; still serving the previous index\"}";
+    }
+
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+    return "{\"reload\":\"ok\",\"segments\":" + std::to_string(snapshot->numSegments()) +
+           ",\"documents\":" + std::to_string(snapshot->numDocuments()) + "}";
+}
+
+std::string Server::handleHttp(const std::string& requestLine) {
+    // "GET /metrics HTTP/1.1"
+    size_t pathStart = requestLine.find_first_not_of(' ', 4);
+    size_t pathEnd = requestLine.find(' ', pathStart);
+    std::string path = pathStart == std::string::npos ? "" : requestLine.substr(pathStart, pathEnd - pathStart);
+
+    std::string status = "200 OK";
+    std::string body;
+    if (path == "/metrics") {
+        metrics_.add(Counter::StatsRequests);
+        body = renderPrometheus();
+    } else {
+        status = "404 Not Found";
+        body = "Not found; metrics are at /metrics\n";
+    }
+    return "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+}
 
-    // Main server loop
-    while (running_) {
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
+std::string Server::renderStats() {
+    Metrics::Snapshot metrics = metrics_.snapshot();
+    QueryCache::Stats cache = cache_.stats();
+    SourceCache::Stats sources = sources_.stats();
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+
+    uint64_t requests = metrics.counter(Counter::QueryRequests) + metrics.counter(Counter::SuggestRequests) +
+                        metrics.counter(Counter::CodeRequests) + metrics.counter(Counter::AdminRequests) +
+                        metrics.counter(Counter::StatsRequests);
+    uint64_t now = Metrics::now();
+    double qps;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        double seconds = static_cast<double>(now - lastStatsAt_) / 1e9;
+        qps = seconds > 0 ? static_cast<double>(requests - lastStatsRequests_) / seconds : 0.0;
+        lastStatsAt_ = now;
+        lastStatsRequests_ = requests;
+    }
 
-        // Accept incoming connection
-        int client_socket = accept(server_socket_, (struct sockaddr*)&client_addr, &client_addr_len);
+    size_t lookups = cache.hits + cache.misses;
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\"stats\":{\"uptime_seconds\":" << static_cast<double>(now - startedAt_) / 1e9 << ",\"qps\":" << qps
+         << ",\"requests\":{\"query\":" << metrics.counter(Counter::QueryRequests)
+         << ",\"suggest\":" << metrics.counter(Counter::SuggestRequests)
+         << ",\"code\":" << metrics.counter(Counter::CodeRequests)
+         << ",\"admin\":" << metrics.counter(Counter::AdminRequests)
+         << ",\"stats\":" << metrics.counter(Counter::StatsRequests) << "}"
+         << ",\"errors\":" << metrics.counter(Counter::Errors) << ",\"busy\":" << metrics.counter(Counter::Busy)
+         << ",\"connections\":{\"open\":" << metrics.gauge(Gauge::Connections)
+         << ",\"accepted\":" << metrics.counter(Counter::Accepted)
+         << ",\"refused\":" << metrics.counter(Counter::Refused) << "}"
+         << ",\"in_flight\":" << metrics.gauge(Gauge::InFlight)
+         << ",\"cache\":{\"hits\":" << cache.hits << ",\"misses\":" << cache.misses
+         << ",\"hit_rate\":" << (lookups ? static_cast<double>(cache.hits) / lookups : 0.0)
+         << ",\"entries\":" << cache.entries << ",\"bytes\":" << cache.bytes
+         << ",\"evictions\":" << cache.evictions << "}"
+         << ",\"sources\":{\"hits\":" << sources.hits << ",\"misses\":" << sources.misses
+         << ",\"files\":" << sources.files << ",\"bytes\":" << sources.bytes << "}";
+    if (snapshot) {
+        IndexMemory memory = snapshot->memoryUsage();
+        json << ",\"index\":{\"documents\":" << snapshot->numDocuments() << ",\"segments\":" << snapshot->numSegments()
+             << ",\"terms\":" << snapshot->numTerms() << ",\"bytes\":"
+             << memory.indexFiles + memory.positionFiles + memory.trigramFiles + memory.manifestFiles +
+                    memory.termLookup + memory.documents
+             << "}";
+    }
+    if (coordinator_) {
+        const ShardClient& client = coordinator_->client();
+        json << ",\"shards\":[";
+        for (size_t i = 0; i < client.size(); ++i) {
+            ShardClient::Health health = client.health(i);
+            json << (i ? "," : "") << "{\"address\":\"" << jsonEscape(client.address(i)) << "\",\"up\":"
+                 << (health.up ? "true" : "false") << ",\"failures\":" << health.failures << "}";
+        }
+        json << "]";
+    }
 
-        if (client_socket < 0) {
-            if (running_) {  // Only print error if we're still running
-                std::cerr << "Error: Failed to accept connection" << std::endl;
+    // Microseconds; quantiles are bucket upper bounds, at most 12.5% high
+    json << ",\"latency_us\":{";
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        const Metrics::Histogram& histogram = metrics.stages[s];
+        double mean = histogram.count ? static_cast<double>(histogram.sumNanos) / histogram.count / 1e3 : 0.0;
+        json << (s ? "," : "") << "\"" << STAGE_NAMES[s] << "\":{\"count\":" << histogram.count
+             << ",\"mean\":" << mean << ",\"p50\":" << histogram.quantileNanos(0.5) / 1e3
+             << ",\"p99\":" << histogram.quantileNanos(0.99) / 1e3
+             << ",\"p999\":" << histogram.quantileNanos(0.999) / 1e3 << "}";
+    }
+    json << "}}}";
+    return json.str();
+}
+
+std::string Server::renderPrometheus() {
+    Metrics::Snapshot metrics = metrics_.snapshot();
+    QueryCache::Stats cache = cache_.stats();
+    std::shared_ptr<const IndexSnapshot> snapshot = std::atomic_load(&snapshot_);
+
+    std::ostringstream out;
+    out << std::setprecision(12);
+    auto header = [&](const char* name, const char* type, const char* help) {
+        out << "# HELP search_engine_" << name << ' ' << help << "\n# TYPE search_engine_" << name << ' ' << type
+            << '\n';
+    };
+    auto value = [&](const char* name, const char* type, const char* help, double number) {
+        header(name, type, help);
+        out << "search_engine_" << name << ' ' << number << '\n';
+    };
+
+    value("uptime_seconds", "gauge", "Seconds since the server started.",
+          static_cast<double>(Metrics::now() - startedAt_) / 1e9);
+
+    header("requests_total", "counter", "Requests received, by type.");
+    const std::pair<const char*, Counter> types[] = {
+        {"query", Counter::QueryRequests}, {"suggest", Counter::SuggestRequests}, {"code", Counter::CodeRequests},
+        {"admin", Counter::AdminRequests}, {"stats", Counter::StatsRequests}};
+    for (const auto& type : types) {
+        out << "search_engine_requests_total{type=\"" << type.first << "\"} " << metrics.counter(type.second) << '\n';
+    }
+    value("errors_total", "counter", "Responses that were errors, busy ones included.",
+          metrics.counter(Counter::Errors));
+    value("busy_total", "counter", "Requests refused because the worker queue was full.",
+          metrics.counter(Counter::Busy));
+    value("requests_in_flight", "gauge", "Requests queued or running on the worker pool.",
+          metrics.gauge(Gauge::InFlight));
+    value("connections", "gauge", "Open client connections.", metrics.gauge(Gauge::Connections));
+    value("connections_accepted_total", "counter", "Client connections accepted.", metrics.counter(Counter::Accepted));
+    value("connections_refused_total", "counter", "Client connections closed for exceeding the limit.",
+          metrics.counter(Counter::Refused));
+
+    value("cache_hits_total", "counter", "Query cache hits.", cache.hits);
+    value("cache_misses_total", "counter", "Query cache misses.", cache.misses);
+    value("cache_evictions_total", "counter", "Query cache evictions.", cache.evictions);
+    value("cache_entries", "gauge", "Responses in the query cache.", cache.entries);
+    value("cache_bytes", "gauge", "Bytes held by the query cache.", cache.bytes);
+
+    SourceCache::Stats sources = sources_.stats();
+    value("source_cache_hits_total", "counter", "Snippet source files found cached.", sources.hits);
+    value("source_cache_misses_total", "counter", "Snippet source files read on use.", sources.misses);
+    value("source_cache_files", "gauge", "Source files kept for snippets.", sources.files);
+    value("source_cache_bytes", "gauge", "Bytes of source files kept for snippets.", sources.bytes);
+
+    if (snapshot) {
+        IndexMemory memory = snapshot->memoryUsage();
+        value("index_documents", "gauge", "Documents in the index.", snapshot->numDocuments());
+        value("index_segments", "gauge", "Index segments.", snapshot->numSegments());
+        value("index_terms", "gauge", "Terms, summed over segments.", snapshot->numTerms());
+        header("index_bytes", "gauge", "Index memory, mapped and allocated, by part.");
+        const std::pair<const char*, size_t> parts[] = {
+            {"index", memory.indexFiles}, {"positions", memory.positionFiles}, {"trigrams", memory.trigramFiles},
+            {"manifests", memory.manifestFiles}, {"term_lookup", memory.termLookup}, {"documents", memory.documents}};
+        for (const auto& part : parts) {
+            out << "search_engine_index_bytes{part=\"" << part.first << "\"} " << part.second << '\n';
+        }
+    }
+    if (coordinator_) {
+        const ShardClient& client = coordinator_->client();
+        header("shard_up", "gauge", "Whether the last connection attempt to the shard succeeded.");
+        for (size_t i = 0; i < client.size(); ++i) {
+            out << "search_engine_shard_up{shard=\"" << client.address(i) << "\"} " << client.health(i).up << '\n';
+        }
+        header("shard_failures_total", "counter", "Requests the shard failed or didn't answer in time.");
+        for (size_t i = 0; i < client.size(); ++i) {
+            out << "search_engine_shard_failures_total{shard=\"" << client.address(i) << "\"} "
+                << client.health(i).failures << '\n';
+        }
+    }
+
+    header("stage_seconds", "histogram", "Time spent in each stage of serving requests.");
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        const Metrics::Histogram& histogram = metrics.stages[s];
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (unsigned bit = FIRST_BOUND_BIT; bit <= LAST_BOUND_BIT; ++bit) {
+            uint64_t bound = uint64_t(1) << bit;
+            for (; bucket < Metrics::BUCKETS && Metrics::bucketUpperBound(bucket) <= bound; ++bucket) {
+                cumulative += histogram.buckets[bucket];
             }
-            continue;
+            out << "search_engine_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\""
+                << static_cast<double>(bound) / 1e9 << "\"} " << cumulative << '\n';
         }
+        out << "search_engine_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\"+Inf\"} "
+            << histogram.count << '\n';
+        out << "search_engine_stage_seconds_sum{stage=\"" << STAGE_NAMES[s] << "\"} "
+            << static_cast<double>(histogram.sumNanos) / 1e9 << '\n';
+        out << "search_engine_stage_seconds_count{stage=\"" << STAGE_NAMES[s] << "\"} " << histogram.count << '\n';
+    }
+    return out.str();
+}
+
+bool Server::reload() {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
 
-        // Handle connection in a separate thread
-        std::thread(&Server::handleConnection, this, client_socket).detach();
+    if (coordinator_) {
+        std::string result = coordinator_->reload();
+        std::cout << "Shard reload: " << result << std::endl;
+        return result.compare(0, 9, "{\"error\":") != 0;
     }
 
-    return 0;
+    std::cout << "Reloading index files..." << std::endl;
+    std::shared_ptr<const IndexSnapshot> snapshot = IndexSnapshot::load();
+    if (!snapshot) {
+        std::cerr << "Error: Reload failed; still serving the previous index" << std::endl;
+        return false;
+    }
+
+    // Publish first, then invalidate. A query that read the old cache
+    // generation can't store its result after this, and one that reads
+    // the new generation is guaranteed to see the new snapshot.
+    std::atomic_store(&snapshot_, snapshot);
+    cache_.invalidate();
+
+    std::cout << "Index reloaded with " << snapshot->numSegments() << " segments and "
+              << snapshot->numDocuments() << " documents." << std::endl;
+    printMemory(*snapshot);
+    return true;
 }
 
-void Server::stop() {
-    running_ = false;
+void Server::requestReload() {
+    if (reloadFd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(reloadFd_, &one, sizeof(one));
+        (void)ignored;
+    }
+}
 
-    // Close server socket
-    if (server_socket_ >= 0) {
-        close(server_socket_);
-        server_socket_ = -1;
+void Server::runReloader() {
+    while (true) {
+        uint64_t value;
+        if (read(reloadFd_, &value, sizeof(value)) < 0 && errno == EINTR) {
+            continue;
+        }
+        if (stopping_.load()) {
+            return;
+        }
+        reload();
     }
+}
 
-    // Clean up searcher
-    if (searcher_) {
-        delete searcher_;
-        searcher_ = nullptr;
+int Server::start() {
+    if (!options_.shards.empty()) {
+        coordinator_ = std::make_unique<Coordinator>(
+            options_.shards, std::chrono::milliseconds(options_.shardTimeoutMs), metrics_);
+        if (!coordinator_->valid()) {
+            return 1;
+        }
+        std::cout << "Coordinating " << options_.shards.size() << " shards with a "
+                  << options_.shardTimeoutMs << " ms timeout." << std::endl;
+    } else {
+        std::cout << "Loading index files..." << std::endl;
+
+        std::shared_ptr<const IndexSnapshot> snapshot = IndexSnapshot::load();
+        if (!snapshot) {
+            return 1;
+        }
+        std::atomic_store(&snapshot_, snapshot);
+
+        std::cout << "Index loaded successfully with " << snapshot->numSegments() << " segments and "
+                  << snapshot->numDocuments() << " documents." << std::endl;
+        printMemory(*snapshot);
+    }
+
+    // Nothing cached so far can describe this index
+    cache_.invalidate();
+
+    reloadFd_ = eventfd(0, EFD_CLOEXEC);
+    if (reloadFd_ < 0) {
+        std::cerr << "Error: Failed to create reload trigger" << std::endl;
+        return 1;
+    }
+
+    // Initialize sockets, workers and one event loop per listener
+    if (initializeSockets() != 0) {
+        return 1;
+    }
+
+    workers_ = std::make_unique<WorkerPool>(options_.workers, options_.maxQueued);
+    helpers_ = std::make_unique<WorkerPool>(HELPER_THREADS, 0);
+    for (int fd : listenSockets_) {
+        auto loop = std::make_unique<EventLoop>(
+            fd, *workers_, [this](const std::string& request) { return handleRequest(request); },
+            [this](const std::string& frame) { return handleFrame(frame); }, metrics_, options_.limits);
+        if (!loop->init()) {
+            loops_.clear();
+            workers_->stop();
+            closeSockets();
+            return 1;
+        }
+        loops_.push_back(std::move(loop));
+    }
+
+    // Set up signal handlers for graceful shutdown
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        global_server = this;
+        signal(SIGINT, signalHandler);
+        signal(SIGTERM, signalHandler);
+        signal(SIGHUP, signalHandler);
+    }
+    reloader_ = std::thread(&Server::runReloader, this);
+
+    std::cout << "Server started on 127.0.0.1:" << options_.port << " with "
+              << loops_.size() << " event loop(s) and " << workers_->numThreads()
+              << " worker thread(s)" << std::endl;
+    std::cout << "Listening for incoming connections..." << std::endl;
+    std::cout << "Press Ctrl+C to shutdown, send SIGHUP to reload the index." << std::endl;
+
+    // Run the first loop here and the rest on their own threads
+    std::vector<std::thread> loopThreads;
+    for (size_t i = 1; i < loops_.size(); ++i) {
+        loopThreads.emplace_back(&EventLoop::run, loops_[i].get());
+    }
+    loops_[0]->run();
+    for (auto& thread : loopThreads) {
+        thread.join();
+    }
+
+    std::cout << "\nShutting down gracefully..." << std::endl;
+
+    // Workers may still post to the loops, so they go first
+    workers_->stop();
+    helpers_->stop();
+    {
+        std::lock_guard<std::mutex> lock(server_mutex);
+        global_server = nullptr;
+    }
+    stopping_.store(true);
+    requestReload();
+    reloader_.join();
+
+    loops_.clear();
+    closeSockets();
+    std::atomic_store(&snapshot_, std::shared_ptr<const IndexSnapshot>());
+
+    if (cache_.enabled()) {
+        QueryCache::Stats stats = cache_.stats();
+        std::cout << "Query cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << stats.rejections << " rejected" << std::endl;
     }
 
     std::cout << "Server stopped." << std::endl;
+    return 0;
+}
+
+void Server::stop() {
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
 }
@@ -1,42 +1,162 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include "indexer.h"
+#include "coordinator.h"
+#include "event_loop.h"
+#include "index_snapshot.h"
+#include "metrics.h"
+#include "query_cache.h"
 #include "searcher.h"
+#include "snippets.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
+// A decoded client request: {"query":"...", "limit":N, "fuzzy":N, "scores":true, "snippets":true}
+struct SearchRequest {
+    std::string query;
+    size_t limit = DEFAULT_RESULT_LIMIT;
+    int fuzzy = -1;  // Edits allowed per term; -1: exact, fuzzy only if nothing matches
+    bool scores = false;  // Also return each result's BM25 score (for merging shards)
+    bool snippets = false;  // Also return the matching lines of the top results
+};
+
+// {"suggest":"np.arr", "limit":N}: completions of the text's last word
+struct SuggestRequest {
+    std::string text;
+    size_t limit = 10;
+};
+
+// {"regex":"def \\w+_handler", "limit":N} or {"substring":"requests.get(", ...}:
+// files whose contents match, in index order
+struct CodeSearchRequest {
+    std::string text;
+    CodePattern::Mode mode = CodePattern::Mode::Substring;
+    size_t limit = DEFAULT_RESULT_LIMIT;
+    bool snippets = false;
+};
+
+struct ServerOptions {
+    int port = 9000;
+    unsigned ioThreads = 1;   // Event loops, each on its own SO_REUSEPORT listener
+    unsigned workers = 0;     // Query threads, 0 = all cores
+    size_t maxQueued = 1024;  // Queries waiting for a worker before new ones get "busy"
+    size_t cacheBytes = 64 << 20;  // Response cache budget, 0 disables it
+    size_t sourceCacheBytes = 256 << 20;  // Source files kept for snippets, 0 reads them per use
+    SnippetLimits snippets;
+    unsigned regexTimeoutMs = 2000;  // Regex searches checking files for longer fail, 0 = no limit
+    LoopLimits limits;
+
+    // --coordinator: serve no index, fan requests out to these servers
+    std::vector<std::string> shards;  // "host:port" or a port on 127.0.0.1
+    unsigned shardTimeoutMs = 1000;   // Shards answering later are left out
+};
+
+// Serves newline-delimited JSON requests on persistent TCP connections.
+// Event loops own the sockets; queries run on a shared worker pool.
+//
+// The same port takes batches of queries in the binary protocol (see
+// binary_protocol.h), with offset/limit paging. Their results are
+// streamed back a frame at a time and bypass the response cache.
+//
+// With ServerOptions::shards it is a coordinator instead: requests are
+// answered by fanning them out to the shard servers (see Coordinator).
+//
+// "snippets":true on a query, substring or regex request adds the
+// matching lines of the top results (see renderSnippets), read from the
+// indexed files through a SourceCache. Those responses aren't cached.
+//
+// {"stats":true} reports counters and per-stage latencies as JSON, and
+// "GET /metrics" on the same port serves them to Prometheus.
+//
+// The index can be replaced without a restart: SIGHUP or the request
+// {"admin":"reload"} loads the current segments (e.g. after --update)
+// into a new IndexSnapshot and swaps it in. Queries already running
+// finish on the snapshot they started with.
 class Server {
 public:
-    Server(int port = 9000);
+    Server(const ServerOptions& options = ServerOptions());
     ~Server();
 
     // Start the server and load the index
     // Returns 0 on success, non-zero on error
-    int start(const std::string& indexFile = "index.bin",
-              const std::string& manifestFile = "manifest.bin");
+    int start();
 
-    // Stop the server gracefully
+    // Stop the server gracefully. Async-signal-safe; start() returns
+    // once the event loops have exited.
     void stop();
 
+    // Load the index files again and publish them. On failure the
+    // current snapshot stays in place. Returns true on success.
+    bool reload();
+
+    // Ask the background reloader to call reload(). Async-signal-safe.
+    void requestReload();
+
 private:
-    int port_;
-    int server_socket_;
-    bool running_;
+    ServerOptions options_;
+    std::vector<int> listenSockets_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::unique_ptr<WorkerPool> workers_;
+    std::unique_ptr<WorkerPool> helpers_;  // Check code search candidates and read snippets alongside a worker
+
+    // Current index; read and replaced with std::atomic_load / atomic_store
+    std::shared_ptr<const IndexSnapshot> snapshot_;
+    std::unique_ptr<Coordinator> coordinator_;  // Instead of an index, with --coordinator
+    QueryCache cache_;     // Serialized results keyed on canonical query + limit
+    SourceCache sources_;  // Source files read for snippets
+    Metrics metrics_;
+    uint64_t startedAt_;   // Metrics::now() at construction
 
-    Indexer indexer_;
-    Searcher* searcher_;
+    // For the "qps" of {"stats":true}: requests since the previous one
+    std::mutex statsMutex_;
+    uint64_t lastStatsAt_;
+    uint64_t lastStatsRequests_;
+
+    // Reloads run one at a time, on request from the reloader thread
+    std::mutex reloadMutex_;
+    int reloadFd_;         // eventfd poked by requestReload()
+    std::atomic<bool> stopping_;
+    std::thread reloader_;
+    void runReloader();
 
     // Server initialization
-    int initializeSocket();
+    int openListenSocket(bool reusePort);
+    int initializeSockets();
+    void closeSockets();
+
+    // One request line in, one response line out (runs on a worker)
+    Response handleRequest(const std::string& request);
+    Response routeRequest(const std::string& request);
+    std::string handleAdmin(const std::string& command);
+    std::string handleHttp(const std::string& requestLine);
+
+    // Binary request frames
+    struct FrameBatch;
+    ResponseStream handleFrame(const std::string& frame);
+    bool continueFrame(FrameBatch& batch, std::string& out);
+    void runFrameQuery(FrameBatch& batch, std::string& out);
 
-    // Connection handling
-    void handleConnection(int client_socket);
+    // Metrics, with the cache's and the index's figures
+    std::string renderStats();
+    std::string renderPrometheus();
 
     // JSON processing
-    std::string processQuery(const std::string& query);
-    std::string parseJsonQuery(const std::string& json_request);
+    Response processQuery(const SearchRequest& request);
+    bool prepareQuery(const IndexSnapshot& snapshot, const std::string& text, int fuzzy, QueryNode& parsed,
+                      std::string& error);
+    std::string renderResults(const IndexSnapshot& snapshot, const QueryNode& query, size_t limit,
+                              bool fuzzyFallback, bool scores, bool snippets);
+    std::string resultSnippets(const IndexSnapshot& snapshot, const std::vector<uint32_t>& docIds,
+                               const SnippetMatcher& matcher);
+    std::string processSuggest(const SuggestRequest& request);
+    Response processCodeSearch(const CodeSearchRequest& request);
+    std::string regexTimeoutError() const;  // For a code search past options_.regexTimeoutMs
+    bool parseJsonQuery(const std::string& json_request, SearchRequest& request);
 };
 
 #endif // SERVER_H
@@ -0,0 +1,272 @@
+#include "shard_client.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// POSIX socket headers
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t READ_CHUNK = 64 * 1024;
+
+bool resolve(const std::string& address, sockaddr_storage& out, socklen_t& length) {
+    std::string host = "127.0.0.1";
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (port.empty() || getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result) {
+        return false;
+    }
+    std::memcpy(&out, result->ai_addr, result->ai_addrlen);
+    length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+int remainingMs(uint64_t deadline) {
+    uint64_t now = Metrics::now();
+    return now >= deadline ? 0 : static_cast<int>((deadline - now + 999999) / 1000000);
+}
+
+} // namespace
+
+ShardClient::ShardClient(const std::vector<std::string>& addresses, std::chrono::milliseconds timeout)
+    : timeout_(timeout), valid_(!addresses.empty()) {
+    for (const std::string& address : addresses) {
+        auto shard = std::make_unique<Shard>();
+        shard->address = address;
+        if (!resolve(address, shard->socketAddress, shard->socketAddressLength)) {
+            std::cerr << "Error: Can't resolve shard address '" << address << "'" << std::endl;
+            valid_ = false;
+        }
+        shards_.push_back(std::move(shard));
+    }
+}
+
+ShardClient::~ShardClient() {
+    for (auto& shard : shards_) {
+        for (int fd : shard->idle) {
+            close(fd);
+        }
+    }
+}
+
+ShardClient::Health ShardClient::health(size_t index) const {
+    Shard& shard = *shards_[index];
+    Health health;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    health.up = shard.downUntil == 0;
+    health.failures = shard.failures.load(std::memory_order_relaxed);
+    return health;
+}
+
+int ShardClient::acquire(Shard& shard, bool& connecting) {
+    connecting = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.downUntil > Metrics::now()) {
+            return -1;
+        }
+        while (!shard.idle.empty()) {
+            int fd = shard.idle.back();
+            shard.idle.pop_back();
+
+            // An idle connection should have nothing to read; EOF means
+            // the shard restarted since it was last used
+            char byte;
+            if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return fd;
+            }
+            close(fd);
+        }
+    }
+    return connectTo(shard, connecting);
+}
+
+int ShardClient::connectTo(Shard& shard, bool& connecting) {
+    int fd = socket(shard.socketAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        int result = connect(fd, reinterpret_cast<const sockaddr*>(&shard.socketAddress), shard.socketAddressLength);
+        if (result == 0) {
+            markUp(shard, fd);
+            return fd;
+        }
+        if (errno == EINPROGRESS) {
+            connecting = true;
+            return fd;
+        }
+        close(fd);
+    }
+    markDown(shard);
+    return -1;
+}
+
+bool ShardClient::finishConnect(Shard& shard, int fd) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+        close(fd);
+        markDown(shard);
+        return false;
+    }
+    markUp(shard, fd);
+    return true;
+}
+
+void ShardClient::markUp(Shard& shard, int fd) {
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.downUntil != 0) {
+        std::cerr << "Shard " << shard.address << " is back" << std::endl;
+    }
+    shard.downUntil = 0;
+}
+
+void ShardClient::markDown(Shard& shard) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.downUntil == 0) {
+        std::cerr << "Warning: Shard " << shard.address << " is unreachable" << std::endl;
+    }
+    shard.downUntil = Metrics::now() + static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(RETRY_INTERVAL).count());
+}
+
+void ShardClient::release(Shard& shard, int fd) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.idle.push_back(fd);
+}
+
+std::vector<ShardReply> ShardClient::fanOut(const std::vector<std::string>& requests) {
+    struct Exchange {
+        int fd = -1;
+        bool connecting = false;  // Its connect() is still in progress
+        std::string output;
+        size_t written = 0;
+        std::string input;
+        bool done = false;
+    };
+
+    uint64_t deadline = Metrics::now() +
+                        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_).count());
+    size_t count = std::min(requests.size(), shards_.size());
+    std::vector<ShardReply> replies(count);
+    std::vector<Exchange> exchanges(count);
+    // Every connection is started before waiting on any of them, so one
+    // shard that never answers its SYN can't use up the others' time
+    for (size_t i = 0; i < count; ++i) {
+        exchanges[i].fd = acquire(*shards_[i], exchanges[i].connecting);
+        exchanges[i].output = requests[i] + '\n';
+    }
+
+    auto drop = [&](Exchange& exchange) {
+        close(exchange.fd);
+        exchange.fd = -1;
+    };
+
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> owners;
+    char buffer[READ_CHUNK];
+    while (true) {
+        fds.clear();
+        owners.clear();
+        for (size_t i = 0; i < count; ++i) {
+            Exchange& exchange = exchanges[i];
+            if (exchange.fd >= 0 && !exchange.done) {
+                short events = exchange.connecting ? POLLOUT
+                                                   : POLLIN | (exchange.written < exchange.output.size() ? POLLOUT : 0);
+                fds.push_back({exchange.fd, events, 0});
+                owners.push_back(i);
+            }
+        }
+        int waitMs = remainingMs(deadline);
+        if (fds.empty() || waitMs == 0) {
+            break;
+        }
+        int ready = poll(fds.data(), fds.size(), waitMs);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (size_t f = 0; f < fds.size() && ready > 0; ++f) {
+            Exchange& exchange = exchanges[owners[f]];
+            short revents = fds[f].revents;
+            if (exchange.connecting) {
+                if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+                    exchange.connecting = false;
+                    if (!finishConnect(*shards_[owners[f]], exchange.fd)) {
+                        exchange.fd = -1;
+                    }
+                }
+                continue;
+            }
+            if (revents & POLLOUT) {
+                ssize_t sent = send(exchange.fd, exchange.output.data() + exchange.written,
+                                    exchange.output.size() - exchange.written, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    exchange.written += static_cast<size_t>(sent);
+                } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    drop(exchange);
+                    continue;
+                }
+            }
+            if (!(revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            ssize_t received = recv(exchange.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                size_t scanFrom = exchange.input.size();
+                exchange.input.append(buffer, static_cast<size_t>(received));
+                size_t newline = exchange.input.find('\n', scanFrom);
+                if (newline == std::string::npos) {
+                    continue;
+                }
+                if (newline + 1 != exchange.input.size()) {
+                    drop(exchange);  // More than one response: out of step with its requests
+                    continue;
+                }
+                exchange.input.pop_back();
+                exchange.done = true;
+            } else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                drop(exchange);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Exchange& exchange = exchanges[i];
+        if (exchange.fd >= 0 && exchange.done) {
+            replies[i].ok = true;
+            replies[i].response = std::move(exchange.input);
+            release(*shards_[i], exchange.fd);
+            continue;
+        }
+        if (exchange.fd >= 0) {
+            close(exchange.fd);  // Timed out; a late answer must not reach the next caller
+            if (exchange.connecting) {
+                // It had the whole timeout to accept the connection
+                markDown(*shards_[i]);
+            }
+        }
+        shards_[i]->failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return replies;
+}
@@ -0,0 +1,89 @@
+#ifndef SHARD_CLIENT_H
+#define SHARD_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// POSIX socket headers
+#include <sys/socket.h>
+
+// One shard's answer to a fanned-out request
+struct ShardReply {
+    bool ok = false;       // A response line arrived in time
+    std::string response;  // Without the '\n'
+};
+
+// Connections from a coordinator to its shard servers, which speak the
+// same newline-delimited JSON protocol as any client.
+//
+// fanOut() sends a request to every shard at once and waits for all the
+// answers until a shared deadline. A connection that answered cleanly
+// goes back to its shard's idle pool for the next caller, so callers on
+// different threads each have their own connections and never interleave
+// requests. One that timed out may still receive the late answer, so it
+// is closed instead. Connections to every shard are opened in parallel;
+// a shard that refuses one, or doesn't accept it before the deadline, is
+// marked down and skipped until RETRY_INTERVAL has passed, so a dead
+// shard costs nothing per request and never takes healthy ones with it.
+class ShardClient {
+public:
+    static constexpr std::chrono::milliseconds RETRY_INTERVAL{1000};
+
+    struct Health {
+        bool up = true;         // Its last connection attempt succeeded
+        uint64_t failures = 0;  // Requests it didn't answer in time, or at all
+    };
+
+    // Addresses are "host:port" or a port on 127.0.0.1
+    ShardClient(const std::vector<std::string>& addresses, std::chrono::milliseconds timeout);
+    ~ShardClient();
+
+    ShardClient(const ShardClient&) = delete;
+    ShardClient& operator=(const ShardClient&) = delete;
+
+    // Whether every address resolved; otherwise the error was printed
+    bool valid() const { return valid_; }
+
+    size_t size() const { return shards_.size(); }
+    const std::string& address(size_t shard) const { return shards_[shard]->address; }
+    Health health(size_t shard) const;
+
+    // requests[i] goes to shard i; one line each, without the '\n'
+    std::vector<ShardReply> fanOut(const std::vector<std::string>& requests);
+    std::vector<ShardReply> fanOut(const std::string& request) {
+        return fanOut(std::vector<std::string>(shards_.size(), request));
+    }
+
+private:
+    struct Shard {
+        std::string address;
+        sockaddr_storage socketAddress{};
+        socklen_t socketAddressLength = 0;
+
+        std::mutex mutex;
+        std::vector<int> idle;          // Connections with no request outstanding
+        uint64_t downUntil = 0;         // Steady-clock nanoseconds; 0 = up
+        std::atomic<uint64_t> failures{0};
+    };
+
+    // A connection to the shard, idle or new; -1 if it's down. A new one
+    // may still be connecting, to be completed by finishConnect once it
+    // polls writable.
+    int acquire(Shard& shard, bool& connecting);
+    void release(Shard& shard, int fd);
+    int connectTo(Shard& shard, bool& connecting);
+    bool finishConnect(Shard& shard, int fd);
+    void markUp(Shard& shard, int fd);
+    void markDown(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::chrono::milliseconds timeout_;
+    bool valid_;
+};
+
+#endif // SHARD_CLIENT_H
@@ -0,0 +1,521 @@
+#include "snippets.h"
+#include "glob.h"
+#include "json_util.h"
+#include <algorithm>
+#include <cerrno>
+
+// POSIX file headers
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+using Ranges = std::vector<std::pair<size_t, size_t>>;
+
+// A file larger than this share of the cache budget is read for one use
+constexpr size_t MAX_CACHED_SHARE = 8;
+
+char foldCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+int64_t mtimeOf(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Takes up to `want` bytes from the request's budget
+size_t claim(std::atomic<size_t>& budget, size_t want) {
+    size_t available = budget.load(std::memory_order_relaxed);
+    size_t take;
+    do {
+        take = std::min(want, available);
+    } while (take > 0 && !budget.compare_exchange_weak(available, available - take, std::memory_order_relaxed));
+    return take;
+}
+
+bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// Length of the valid UTF-8 sequence starting at text[i], or 0
+size_t sequenceLength(std::string_view text, size_t i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c < 0x80) {
+        return 1;
+    }
+    size_t length = c >= 0xC2 && c < 0xE0 ? 2 : c >= 0xE0 && c < 0xF0 ? 3 : c >= 0xF0 && c < 0xF5 ? 4 : 0;
+    if (length == 0 || i + length > text.size()) {
+        return 0;
+    }
+    for (size_t k = 1; k < length; ++k) {
+        if (!isContinuation(text[i + k])) {
+            return 0;
+        }
+    }
+    unsigned char next = static_cast<unsigned char>(text[i + 1]);
+    if ((c == 0xE0 && next < 0xA0) || (c == 0xED && next >= 0xA0) || (c == 0xF0 && next < 0x90) ||
+        (c == 0xF4 && next >= 0x90)) {
+        return 0;  // Overlong, a surrogate or past U+10FFFF
+    }
+    return length;
+}
+
+// The text with each byte that isn't part of valid UTF-8 replaced by '?',
+// so offsets into it stay the same
+std::string validUtf8(std::string_view text) {
+    std::string out(text);
+    for (size_t i = 0; i < out.size();) {
+        size_t length = sequenceLength(out, i);
+        if (length == 0) {
+            out[i++] = '?';
+        } else {
+            i += length;
+        }
+    }
+    return out;
+}
+
+// Cuts a line longer than `bytes` to a window around its first highlight,
+// on character boundaries, and moves the highlights with it
+void cutLine(std::string_view& text, Ranges& highlights, size_t bytes) {
+    if (text.size() <= bytes) {
+        return;
+    }
+    size_t first = highlights.empty() ? 0 : highlights[0].first;
+    size_t start = std::min(first > bytes / 4 ? first - bytes / 4 : 0, text.size() - bytes);
+    while (start > 0 && isContinuation(text[start])) {
+        --start;
+    }
+    size_t end = std::min(text.size(), start + bytes);
+    while (end > start && end < text.size() && isContinuation(text[end])) {
+        --end;
+    }
+    text = text.substr(start, end - start);
+
+    Ranges moved;
+    for (const auto& range : highlights) {
+        size_t from = std::max(range.first, start);
+        size_t to = std::min(range.second, end);
+        if (from < to) {
+            moved.emplace_back(from - start, to - start);
+        }
+    }
+    highlights.swap(moved);
+}
+
+// The line starting at `start`, without its newline or a '\r' before it
+std::string_view lineAt(std::string_view contents, size_t start) {
+    size_t end = contents.find('\n', start);
+    if (end == std::string_view::npos) {
+        end = contents.size();
+    }
+    if (end > start && contents[end - 1] == '\r') {
+        --end;
+    }
+    return contents.substr(start, end - start);
+}
+
+void appendLine(std::string& json, size_t number, std::string_view text, Ranges highlights, size_t lineBytes) {
+    cutLine(text, highlights, lineBytes);
+    if (json.size() > 1) {
+        json += ',';
+    }
+    json += "{\"line\":" + std::to_string(number) + ",\"text\":\"" + jsonEscape(validUtf8(text)) +
+            "\",\"highlights\":[";
+    for (size_t i = 0; i < highlights.size(); ++i) {
+        json += (i ? ",[" : "[") + std::to_string(highlights[i].first) + ',' + std::to_string(highlights[i].second) +
+                ']';
+    }
+    json += "]}";
+}
+
+// One file's snippets as a JSON array
+std::string snippetsOf(std::string_view contents, const SnippetMatcher& matcher, Tokenizer& tokenizer,
+                       const SnippetLimits& limits, std::atomic<size_t>& budget) {
+    size_t granted = claim(budget, std::min(contents.size(), limits.fileBytes));
+    if (granted == 0) {
+        return "[]";
+    }
+
+    // Search whole lines of the bytes granted
+    std::string_view searched = contents.substr(0, granted);
+    if (granted < contents.size()) {
+        size_t lastNewline = searched.rfind('\n');
+        searched = searched.substr(0, lastNewline == std::string_view::npos ? 0 : lastNewline + 1);
+    }
+
+    struct Match {
+        size_t number;  // From 1
+        size_t start;   // In the file
+        Ranges highlights;
+    };
+    std::vector<Match> matches;
+    Ranges highlights;
+    std::vector<size_t> next;
+    size_t number = 0;
+    size_t pos = 0;
+    while (pos < searched.size() && matches.size() < limits.matchLines) {
+        size_t hit = matcher.nextCandidate(searched, pos, next);
+        if (hit >= searched.size()) {
+            pos = searched.size();
+            break;
+        }
+        size_t newline = hit > pos ? searched.rfind('\n', hit - 1) : std::string_view::npos;
+        size_t lineStart = newline == std::string_view::npos || newline < pos ? pos : newline + 1;
+        number += static_cast<size_t>(std::count(searched.begin() + pos, searched.begin() + lineStart, '\n'));
+        pos = lineStart;
+
+        std::string_view line = lineAt(searched, pos);
+        ++number;
+        highlights.clear();
+        matcher.findInLine(line, tokenizer, highlights);
+        if (!highlights.empty()) {
+            matches.push_back({number, pos, highlights});
+        }
+        newline = searched.find('\n', pos);
+        pos = newline == std::string_view::npos ? searched.size() : newline + 1;
+    }
+    if (pos < granted) {
+        budget.fetch_add(granted - pos, std::memory_order_relaxed);  // Not searched after all
+    }
+
+    // Each match with the context lines around it, never showing a line twice
+    std::string json = "[";
+    size_t shown = 0;  // Number of the last line written
+    for (size_t m = 0; m < matches.size(); ++m) {
+        const Match& match = matches[m];
+
+        std::vector<size_t> before;  // Line starts, nearest first
+        size_t start = match.start;
+        for (size_t k = 1; k <= limits.contextLines && start > 0 && match.number - k > shown; ++k) {
+            size_t previous = start >= 2 ? contents.rfind('\n', start - 2) : std::string_view::npos;
+            start = previous == std::string_view::npos ? 0 : previous + 1;
+            before.push_back(start);
+        }
+        for (size_t k = before.size(); k > 0; --k) {
+            appendLine(json, match.number - k, lineAt(contents, before[k - 1]), Ranges(), limits.lineBytes);
+        }
+        appendLine(json, match.number, lineAt(contents, match.start), match.highlights, limits.lineBytes);
+        shown = match.number;
+
+        size_t next = m + 1 < matches.size() ? matches[m + 1].number : static_cast<size_t>(-1);
+        size_t newline = contents.find('\n', match.start);
+        for (size_t k = 1; k <= limits.contextLines && shown + 1 < next; ++k) {
+            if (newline == std::string_view::npos || newline + 1 >= contents.size()) {
+                break;
+            }
+            appendLine(json, ++shown, lineAt(contents, newline + 1), Ranges(), limits.lineBytes);
+            newline = contents.find('\n', newline + 1);
+        }
+    }
+    json += ']';
+    return json;
+}
+
+} // namespace
+
+bool SourceFile::open(const std::string& path, size_t maxBytes) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+    mtime_ = mtimeOf(st);
+
+    // A file shrinking meanwhile just ends the read early
+    contents_.resize(static_cast<size_t>(std::min<uint64_t>(size_, maxBytes)));
+    size_t done = 0;
+    while (done < contents_.size()) {
+        ssize_t n = pread(fd, &contents_[done], contents_.size() - done, static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    contents_.resize(done);
+    if (done < size_) {
+        size_t lastNewline = contents_.rfind('\n');
+        contents_.resize(lastNewline == std::string::npos ? 0 : lastNewline + 1);
+    }
+    contents_.shrink_to_fit();
+    return true;
+}
+
+SourceCache::SourceCache(size_t budgetBytes, size_t fileBytes) : budget_(budgetBytes), fileBytes_(fileBytes) {}
+
+std::shared_ptr<const SourceFile> SourceCache::open(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(path);
+        if (it != entries_.end()) {
+            const SourceFile& file = *it->second.file;
+            if (file.size() == static_cast<uint64_t>(st.st_size) && file.mtime() == mtimeOf(st)) {
+                lru_.splice(lru_.begin(), lru_, it->second.position);
+                hits_++;
+                return it->second.file;
+            }
+
+            // Changed since it was read
+            bytes_ -= file.contents().size();
+            lru_.erase(it->second.position);
+            entries_.erase(it);
+        }
+    }
+
+    misses_++;
+    auto file = std::make_shared<SourceFile>();
+    if (!file->open(path, fileBytes_)) {
+        return nullptr;
+    }
+    if (budget_ == 0 || file->contents().size() > budget_ / MAX_CACHED_SHARE) {
+        return file;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.find(path) == entries_.end()) {
+        lru_.push_front(path);
+        entries_[path] = {file, lru_.begin()};
+        bytes_ += file->contents().size();
+        evict();
+    }
+    return file;
+}
+
+void SourceCache::evict() {
+    while (bytes_ > budget_ && !lru_.empty()) {
+        auto it = entries_.find(lru_.back());
+        bytes_ -= it->second.file->contents().size();
+        entries_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+SourceCache::Stats SourceCache::stats() const {
+    Stats stats;
+    stats.hits = hits_.load();
+    stats.misses = misses_.load();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.files = entries_.size();
+    stats.bytes = bytes_;
+    return stats;
+}
+
+size_t SnippetMatcher::FoldHash::operator()(char c) const {
+    return static_cast<unsigned char>(foldCase(c));
+}
+
+bool SnippetMatcher::FoldEqual::operator()(char a, char b) const {
+    return foldCase(a) == foldCase(b);
+}
+
+SnippetMatcher::SnippetMatcher(const QueryNode& query, const TokenizerOptions& tokenizer) : tokenizer_(tokenizer) {
+    collect(query);
+    if (wildcards_.empty() && fuzzy_.empty()) {
+        for (const auto& term : terms_) {
+            searchers_.emplace_back(term.begin(), term.end());
+        }
+        // A line holding a phrase holds its longest word
+        for (const auto& phrase : phrases_) {
+            const std::string& word = *std::max_element(phrase.begin(), phrase.end(),
+                [](const std::string& a, const std::string& b) { return a.size() < b.size(); });
+            searchers_.emplace_back(word.begin(), word.end());
+        }
+    }
+}
+
+SnippetMatcher::SnippetMatcher(const CodePattern& pattern, const MatchDeadline& deadline)
+    : pattern_(&pattern), deadline_(&deadline) {}
+
+void SnippetMatcher::collect(const QueryNode& node) {
+    switch (node.type) {
+        case QueryNode::Type::Term:
+            terms_.push_back(node.term);
+            break;
+        case QueryNode::Type::Phrase:
+            if (!node.phrase.empty()) {
+                phrases_.push_back(node.phrase);
+            }
+            break;
+        case QueryNode::Type::Wildcard:
+            wildcards_.push_back(node.term);
+            break;
+        case QueryNode::Type::Fuzzy:
+            if (node.term.size() <= LevenshteinAutomaton::MAX_LENGTH) {
+                fuzzy_.push_back(std::make_unique<LevenshteinAutomaton>(node.term, node.maxEdits));
+            } else {
+                terms_.push_back(node.term);
+            }
+            break;
+        case QueryNode::Type::And:
+        case QueryNode::Type::Or:
+            for (const auto& child : node.children) {
+                collect(child);
+            }
+            break;
+        case QueryNode::Type::Not:
+            break;  // Documents don't contain what they matched by lacking
+    }
+}
+
+size_t SnippetMatcher::nextCandidate(std::string_view text, size_t from, std::vector<size_t>& next) const {
+    if (pattern_) {
+        return pattern_->mode() == CodePattern::Mode::Substring ? text.find(pattern_->text(), from) : from;
+    }
+    if (searchers_.empty()) {
+        return terms_.empty() && phrases_.empty() && wildcards_.empty() && fuzzy_.empty() ? std::string_view::npos
+                                                                                          : from;
+    }
+
+    auto find = [&](size_t term) {
+        auto it = std::search(text.begin() + from, text.end(), searchers_[term]);
+        return it == text.end() ? std::string_view::npos : static_cast<size_t>(it - text.begin());
+    };
+    if (next.empty()) {
+        for (size_t term = 0; term < searchers_.size(); ++term) {
+            next.push_back(find(term));
+        }
+    }
+    size_t first = std::string_view::npos;
+    for (size_t term = 0; term < searchers_.size(); ++term) {
+        if (next[term] != std::string_view::npos && next[term] < from) {
+            next[term] = find(term);
+        }
+        first = std::min(first, next[term]);
+    }
+    return first;
+}
+
+bool SnippetMatcher::matchesTerm(std::string_view term) const {
+    if (std::find(terms_.begin(), terms_.end(), term) != terms_.end()) {
+        return true;
+    }
+    for (const auto& pattern : wildcards_) {
+        if (wildcardMatch(pattern, term)) {
+            return true;
+        }
+    }
+    for (const auto& automaton : fuzzy_) {
+        LevenshteinAutomaton::State state = automaton->start();
+        size_t i = 0;
+        for (; i < term.size() && automaton->canMatch(state); ++i) {
+            state = automaton->step(state, static_cast<unsigned char>(term[i]));
+        }
+        if (i == term.size() && automaton->isMatch(state)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SnippetMatcher::findInLine(std::string_view line, Tokenizer& tokenizer, Ranges& ranges) const {
+    if (pattern_) {
+        pattern_->findInLine(line, *deadline_, ranges);
+        return;
+    }
+
+    // Phrases match words at consecutive positions, where a word and its
+    // identifier parts share one, as in the index. `previous` holds the
+    // partial matches ending at the last position, `current` those
+    // ending at this one.
+    struct Partial {
+        size_t phrase;
+        size_t next;  // Words matched so far
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Partial> previous, current;
+    auto extend = [&](size_t phrase, size_t next, size_t begin, size_t end) {
+        if (next == phrases_[phrase].size()) {
+            ranges.emplace_back(begin, end);
+        } else {
+            current.push_back({phrase, next, begin, end});
+        }
+    };
+    size_t wordEnd = 0;
+
+    // A word and its identifier parts can both match; keep the outermost
+    size_t first = ranges.size();
+    tokenizer.locate(line, [&](std::string_view term, size_t offset, size_t length) {
+        if (matchesTerm(term)) {
+            ranges.emplace_back(offset, offset + length);
+        }
+        if (phrases_.empty()) {
+            return;
+        }
+
+        // Parts lie inside their word; anything past it is the next position
+        if (offset >= wordEnd) {
+            previous.swap(current);
+            current.clear();
+            wordEnd = offset + length;
+        }
+        for (const Partial& partial : previous) {
+            if (phrases_[partial.phrase][partial.next] == term) {
+                extend(partial.phrase, partial.next + 1, partial.begin, offset + length);
+            }
+        }
+        for (size_t phrase = 0; phrase < phrases_.size(); ++phrase) {
+            if (phrases_[phrase][0] == term) {
+                extend(phrase, 1, offset, offset + length);
+            }
+        }
+    });
+    std::sort(ranges.begin() + first, ranges.end());
+    size_t kept = first;
+    for (size_t i = first; i < ranges.size(); ++i) {
+        if (kept > first && ranges[i].first < ranges[kept - 1].second) {
+            ranges[kept - 1].second = std::max(ranges[kept - 1].second, ranges[i].second);
+        } else {
+            ranges[kept++] = ranges[i];
+        }
+    }
+    ranges.resize(kept);
+}
+
+std::string renderSnippets(const std::vector<std::string>& paths, const SnippetMatcher& matcher,
+                           SourceCache& cache, const SnippetLimits& limits, WorkerPool* helpers) {
+    size_t count = std::min(paths.size(), limits.results);
+    std::vector<std::string> rendered(count);
+    std::atomic<size_t> budget{limits.requestBytes};
+
+    // Results are claimed in rank order, so the best ones are read first
+    auto work = [&](size_t i) {
+        std::shared_ptr<const SourceFile> file = paths[i].empty() ? nullptr : cache.open(paths[i]);
+        if (file) {
+            Tokenizer tokenizer(matcher.tokenizer());
+            rendered[i] = snippetsOf(file->contents(), matcher, tokenizer, limits, budget);
+        } else {
+            rendered[i] = "[]";
+        }
+        return true;
+    };
+    if (helpers) {
+        helpers->parallelFor(count, work);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            work(i);
+        }
+    }
+
+    std::string json = "[";
+    for (size_t i = 0; i < count; ++i) {
+        json += (i ? "," : "") + rendered[i];
+    }
+    json += ']';
+    return json;
+}
@@ -0,0 +1,162 @@
+#ifndef SNIPPETS_H
+#define SNIPPETS_H
+
+#include "code_search.h"
+#include "levenshtein.h"
+#include "query.h"
+#include "tokenizer.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Result snippets: the lines of a result's source file that matched, with
+// a little context and the byte ranges to highlight. Requests ask for
+// them with "snippets":true; see renderSnippets for the JSON.
+
+// Bounds on the work one request's snippets may do. Files are read in
+// rank order, so when the budget runs out it is the lower results that
+// go without.
+struct SnippetLimits {
+    size_t results = 10;         // Top results given snippets
+    size_t matchLines = 3;       // Matching lines shown per result
+    size_t contextLines = 1;     // Lines shown before and after each
+    size_t lineBytes = 240;      // Longer lines are cut to a window around the first match
+    size_t fileBytes = 1 << 20;  // Only the start of a larger file is searched
+    size_t requestBytes = 2 << 20;  // Source bytes searched over all of a request's results
+};
+
+// The start of a source file, read into memory. Reading rather than
+// mapping it means a file truncated while a snippet is being made can't
+// fault the server.
+class SourceFile {
+public:
+    // False if the file can't be opened or read. A file longer than
+    // maxBytes is read up to the end of its last whole line in them.
+    bool open(const std::string& path, size_t maxBytes);
+
+    std::string_view contents() const { return contents_; }
+    uint64_t size() const { return size_; }   // Of the file, when read
+    int64_t mtime() const { return mtime_; }  // Nanoseconds since the epoch
+
+private:
+    std::string contents_;
+    uint64_t size_ = 0;
+    int64_t mtime_ = 0;
+};
+
+// Source files read for snippets, least recently used out first once
+// the bytes held pass the budget. A cached file is checked against the
+// file's size and mtime on every use, so an edited file is read again
+// rather than shown stale. Safe to use from several threads; a file
+// evicted while in use is kept until its last user is done.
+class SourceCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t files = 0;
+        size_t bytes = 0;
+    };
+
+    // Files are read up to fileBytes (see SourceFile::open); budgetBytes
+    // == 0 reads every file for one use only
+    SourceCache(size_t budgetBytes, size_t fileBytes);
+
+    SourceCache(const SourceCache&) = delete;
+    SourceCache& operator=(const SourceCache&) = delete;
+
+    // nullptr if the file can't be read
+    std::shared_ptr<const SourceFile> open(const std::string& path);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const SourceFile> file;
+        std::list<std::string>::iterator position;  // In lru_
+    };
+
+    void evict();  // Until the budget is met; mutex_ held
+
+    size_t budget_;
+    size_t fileBytes_;
+    mutable std::mutex mutex_;
+    std::list<std::string> lru_;  // Paths, most recently used first
+    std::unordered_map<std::string, Entry> entries_;
+    size_t bytes_ = 0;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+// What to highlight in a line: the terms of a ranked query (outside NOT)
+// as its index's tokenizer splits the line, wildcards and typos included,
+// each occurrence of its phrases as one range, or the matches of a substring or regex pattern found before the
+// request's deadline
+class SnippetMatcher {
+public:
+    SnippetMatcher(const QueryNode& query, const TokenizerOptions& tokenizer);
+    SnippetMatcher(const CodePattern& pattern, const MatchDeadline& deadline);
+
+    const TokenizerOptions& tokenizer() const { return tokenizer_; }
+
+    // Where the next line that can have a match may start, at or after
+    // `from`: a plain-term query or a substring only matches where its
+    // bytes occur (ignoring case for terms), so lines without them are
+    // skipped unread. npos if no line can. `next` keeps each term's next
+    // occurrence between calls over the same text; start it empty.
+    size_t nextCandidate(std::string_view text, size_t from, std::vector<size_t>& next) const;
+
+    // Appends the byte ranges [first, second) to highlight in the line
+    // (without its newline), sorted and not overlapping. `tokenizer`
+    // is the calling thread's, made with tokenizer().
+    void findInLine(std::string_view line, Tokenizer& tokenizer,
+                    std::vector<std::pair<size_t, size_t>>& ranges) const;
+
+private:
+    // ASCII case-insensitive byte hash and comparison, for finding terms
+    struct FoldHash {
+        size_t operator()(char c) const;
+    };
+    struct FoldEqual {
+        bool operator()(char a, char b) const;
+    };
+    using TermSearcher = std::boyer_moore_horspool_searcher<std::string::const_iterator, FoldHash, FoldEqual>;
+
+    void collect(const QueryNode& node);
+    bool matchesTerm(std::string_view term) const;
+
+    const CodePattern* pattern_ = nullptr;  // Else the query's terms below
+    const MatchDeadline* deadline_ = nullptr;
+    TokenizerOptions tokenizer_;
+    std::vector<std::string> terms_;
+    std::vector<std::vector<std::string>> phrases_;  // Highlighted only where the whole phrase occurs
+    std::vector<std::string> wildcards_;
+    std::vector<std::unique_ptr<LevenshteinAutomaton>> fuzzy_;
+    std::vector<TermSearcher> searchers_;  // For terms_ and phrases_, when they are all there is
+};
+
+// Snippets for the files at `paths` (best result first, at most
+// limits.results of them), read on the calling thread and any `helpers`
+// threads, as a JSON array with an array per file:
+//
+//   [[{"line":12,"text":"import numpy as np","highlights":[[7,12]]}, ...], ...]
+//
+// Lines are numbered from 1 and come in file order; context lines have no
+// highlights. Highlights are byte offsets into the text, which is the line
+// as UTF-8 with any invalid byte replaced by '?'. A file that can't be
+// read, has no match in its first limits.fileBytes, or is past the
+// request's byte budget gets an empty array.
+std::string renderSnippets(const std::vector<std::string>& paths, const SnippetMatcher& matcher,
+                           SourceCache& cache, const SnippetLimits& limits, WorkerPool* helpers);
+
+#endif // SNIPPETS_H
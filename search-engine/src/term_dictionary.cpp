@@ -0,0 +1,106 @@
+#include "term_dictionary.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+inline uint64_t mix(uint64_t value) {
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ULL;
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ULL;
+    value ^= value >> 32;
+    return value;
+}
+
+} // namespace
+
+uint64_t hashTerm(std::string_view term) {
+    // Eight bytes at a time; terms are mostly short identifiers
+    const char* p = term.data();
+    size_t size = term.size();
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        hash = mix(hash ^ word) + 0x9e3779b97f4a7c15ULL;
+    }
+    if (size > 0) {
+        uint64_t word = 0;
+        std::memcpy(&word, p, size);
+        hash = mix(hash ^ word) + 0x9e3779b97f4a7c15ULL;
+    }
+    return mix(hash);
+}
+
+void TermHash::clear() {
+    control_.assign(GROUP_SIZE, EMPTY);
+    ids_.assign(GROUP_SIZE, 0);
+    control_.shrink_to_fit();
+    ids_.shrink_to_fit();
+    groupMask_ = 0;
+    size_ = 0;
+    growAt_ = GROUP_SIZE * 7 / 8;
+}
+
+void TermHash::resize(size_t groups) {
+    std::vector<uint8_t>(groups * GROUP_SIZE, EMPTY).swap(control_);
+    std::vector<uint32_t>(groups * GROUP_SIZE, 0).swap(ids_);
+    groupMask_ = groups - 1;
+    size_ = 0;
+    growAt_ = groups * GROUP_SIZE * 7 / 8;
+}
+
+void TermHash::place(uint64_t hash, uint32_t id) {
+    size_t group = firstGroup(hash);
+    for (size_t step = 1;; ++step) {
+        unsigned empty = matchGroup(group, EMPTY);
+        if (empty) {
+            size_t slot = group * GROUP_SIZE + static_cast<size_t>(__builtin_ctz(empty));
+            control_[slot] = tagOf(hash);
+            ids_[slot] = id;
+            ++size_;
+            return;
+        }
+        group = (group + step) & groupMask_;
+    }
+}
+
+void TermDictionary::clear() {
+    std::string().swap(bytes_);
+    offsets_.assign(1, 0);
+    offsets_.shrink_to_fit();
+    hash_.clear();
+}
+
+uint32_t TermDictionary::intern(std::string_view term) {
+    auto termAt = [this](uint32_t id) { return this->term(id); };
+    uint64_t hash = hashTerm(term);
+    uint32_t id = hash_.find(term, hash, termAt);
+    if (id != NOT_FOUND) {
+        return id;
+    }
+
+    id = static_cast<uint32_t>(size());
+    bytes_.append(term.data(), term.size());
+    offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+    hash_.insert(hash, id, termAt);
+    return id;
+}
+
+uint32_t TermDictionary::find(std::string_view term) const {
+    return hash_.find(term, hashTerm(term), [this](uint32_t id) { return this->term(id); });
+}
+
+std::vector<uint32_t> TermDictionary::sortedIds() const {
+    std::vector<uint32_t> ids(size());
+    for (uint32_t id = 0; id < ids.size(); ++id) {
+        ids[id] = id;
+    }
+    std::sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) { return term(a) < term(b); });
+    return ids;
+}
+
+size_t TermDictionary::memoryBytes() const {
+    return bytes_.capacity() + offsets_.capacity() * sizeof(uint32_t) + hash_.memoryBytes();
+}
@@ -0,0 +1,161 @@
+#ifndef TERM_DICTIONARY_H
+#define TERM_DICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Hash of a term's bytes, shared by every TermHash
+uint64_t hashTerm(std::string_view term);
+
+// Open-addressing map from term bytes to dense ids, laid out like a Swiss
+// table: one control byte per slot (empty, or 7 bits of the hash) and a
+// parallel array of ids. A probe compares a group of 16 control bytes at
+// once and only looks at term bytes when the 7 bits match. The table
+// doesn't hold the terms; `termAt(id)` gives them back as string_views.
+// Entries are never removed.
+class TermHash {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    TermHash() { clear(); }
+
+    void clear();
+
+    // Size the table for `count` terms up front, avoiding rehashes
+    template <typename TermAt>
+    void reserve(size_t count, TermAt&& termAt);
+
+    template <typename TermAt>
+    uint32_t find(std::string_view term, uint64_t hash, TermAt&& termAt) const;
+
+    // Add an id whose term isn't in the table yet
+    template <typename TermAt>
+    void insert(uint64_t hash, uint32_t id, TermAt&& termAt);
+
+    size_t size() const { return size_; }
+    size_t memoryBytes() const { return control_.capacity() + ids_.capacity() * sizeof(uint32_t); }
+
+private:
+    static constexpr size_t GROUP_SIZE = 16;
+    static constexpr uint8_t EMPTY = 0x80;
+
+    static uint8_t tagOf(uint64_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+    size_t firstGroup(uint64_t hash) const { return static_cast<size_t>(hash >> 7) & groupMask_; }
+
+    // Bit i set if control byte i of the group equals `value`
+    unsigned matchGroup(size_t group, uint8_t value) const;
+
+    // Rebuilds at `groups` groups, with room up to a 7/8 load factor
+    void resize(size_t groups);
+    void place(uint64_t hash, uint32_t id);
+
+    std::vector<uint8_t> control_;
+    std::vector<uint32_t> ids_;
+    size_t groupMask_ = 0;
+    size_t size_ = 0;
+    size_t growAt_ = 0;  // Size at which the table doubles
+};
+
+inline unsigned TermHash::matchGroup(size_t group, uint8_t value) const {
+    const uint8_t* bytes = control_.data() + group * GROUP_SIZE;
+#ifdef __SSE2__
+    __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(static_cast<char>(value)))));
+#else
+    unsigned mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= static_cast<unsigned>(bytes[i] == value) << i;
+    }
+    return mask;
+#endif
+}
+
+template <typename TermAt>
+void TermHash::reserve(size_t count, TermAt&& termAt) {
+    size_t groups = 1;
+    while (groups * GROUP_SIZE * 7 / 8 < count) {
+        groups *= 2;
+    }
+    if (groups > groupMask_ + 1) {
+        std::vector<uint32_t> ids;
+        ids.reserve(size_);
+        for (size_t slot = 0; slot < control_.size(); ++slot) {
+            if (control_[slot] != EMPTY) {
+                ids.push_back(ids_[slot]);
+            }
+        }
+        resize(groups);
+        for (uint32_t id : ids) {
+            place(hashTerm(termAt(id)), id);
+        }
+    }
+}
+
+template <typename TermAt>
+uint32_t TermHash::find(std::string_view term, uint64_t hash, TermAt&& termAt) const {
+    uint8_t tag = tagOf(hash);
+    size_t group = firstGroup(hash);
+    // Triangular steps over a power-of-two number of groups visit each once
+    for (size_t step = 1;; ++step) {
+        for (unsigned hits = matchGroup(group, tag); hits; hits &= hits - 1) {
+            uint32_t id = ids_[group * GROUP_SIZE + static_cast<size_t>(__builtin_ctz(hits))];
+            if (termAt(id) == term) {
+                return id;
+            }
+        }
+        if (matchGroup(group, EMPTY)) {
+            return NOT_FOUND;
+        }
+        group = (group + step) & groupMask_;
+    }
+}
+
+template <typename TermAt>
+void TermHash::insert(uint64_t hash, uint32_t id, TermAt&& termAt) {
+    if (size_ >= growAt_) {
+        reserve(size_ + 1, termAt);
+    }
+    place(hash, id);
+}
+
+// Terms interned into one byte arena, numbered 0, 1, ... in the order
+// they were first seen. Replaces a map keyed by std::string: no node or
+// string header per term, and ids index plain vectors of per-term data.
+class TermDictionary {
+public:
+    static constexpr uint32_t NOT_FOUND = TermHash::NOT_FOUND;
+
+    TermDictionary() { clear(); }
+
+    // Id of the term, added if new. A new term's id is size() - 1.
+    uint32_t intern(std::string_view term);
+    uint32_t find(std::string_view term) const;
+
+    // Valid until the next intern()
+    std::string_view term(uint32_t id) const {
+        return std::string_view(bytes_.data() + offsets_[id], offsets_[id + 1] - offsets_[id]);
+    }
+
+    size_t size() const { return offsets_.size() - 1; }
+    bool empty() const { return size() == 0; }
+    void clear();
+
+    // Ids ordered by term bytes, as the on-disk term table wants them
+    std::vector<uint32_t> sortedIds() const;
+
+    size_t memoryBytes() const;
+
+private:
+    std::string bytes_;              // Every term back to back
+    std::vector<uint32_t> offsets_;  // Start of each term in bytes_, plus the end
+    TermHash hash_;
+};
+
+#endif // TERM_DICTIONARY_H
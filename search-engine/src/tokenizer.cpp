@@ -0,0 +1,188 @@
+#include "tokenizer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Parts shorter than this are too common to be worth a posting
+constexpr size_t MIN_PART_LENGTH = 2;
+
+struct CharClasses {
+    bool word[256];
+    bool space[256];
+
+    CharClasses() : word(), space() {
+        for (int c = 0; c < 256; ++c) {
+            word[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                      c == '_' || c >= 0x80;
+            // The characters std::isspace accepts in the C locale
+            space[c] = c == ' ' || (c >= '\t' && c <= '\r');
+        }
+    }
+};
+
+const CharClasses CLASSES;
+
+inline bool isWord(char c) {
+    return CLASSES.word[static_cast<unsigned char>(c)];
+}
+
+inline bool isPatternWord(char c) {
+    return isWord(c) || c == '*' || c == '?';
+}
+
+inline bool isSpace(char c) {
+    return CLASSES.space[static_cast<unsigned char>(c)];
+}
+
+inline char toLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline bool isUpper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+inline bool isLowerOrDigit(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+#ifdef __SSE2__
+// Bit i set if byte i of the 16 is a word character
+inline unsigned wordMask(const char* p) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(bytes, _mm_set1_epi8('9' + 1)));
+    __m128i underscore = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'));
+    // Bytes >= 0x80 are negative as signed chars
+    __m128i high = _mm_cmplt_epi8(bytes, _mm_setzero_si128());
+    __m128i word = _mm_or_si128(_mm_or_si128(letter, digit), _mm_or_si128(underscore, high));
+    return static_cast<unsigned>(_mm_movemask_epi8(word));
+}
+#endif
+
+// First index at or after `i` whose byte is (`word`) or isn't a word character
+size_t scan(std::string_view text, size_t i, bool word) {
+    const char* data = text.data();
+    size_t size = text.size();
+#ifdef __SSE2__
+    for (; i + 16 <= size; i += 16) {
+        unsigned mask = wordMask(data + i);
+        unsigned hits = word ? mask : (~mask & 0xFFFF);
+        if (hits) {
+            return i + static_cast<size_t>(__builtin_ctz(hits));
+        }
+    }
+#endif
+    while (i < size && isWord(data[i]) != word) {
+        ++i;
+    }
+    return i;
+}
+
+} // namespace
+
+size_t Tokenizer::findWordStart(std::string_view text, size_t i) {
+    return scan(text, i, true);
+}
+
+size_t Tokenizer::findWordEnd(std::string_view text, size_t i) {
+    return scan(text, i, false);
+}
+
+size_t Tokenizer::findSpace(std::string_view text, size_t i, bool space) {
+    while (i < text.size() && isSpace(text[i]) != space) {
+        ++i;
+    }
+    return i;
+}
+
+void Tokenizer::splitIdentifier(std::string_view word) {
+    parts_.clear();
+
+    // Boundaries: '_' (dropped), lower or digit -> Upper ("getName"), and
+    // the last capital of an acronym before lower case ("HTTPServer")
+    size_t start = 0;
+    auto addPart = [&](size_t end) {
+        if (end - start >= MIN_PART_LENGTH && end - start < word.size()) {
+            std::string_view part(lowered_.data() + start, end - start);
+            for (const auto& seen : parts_) {
+                if (std::string_view(lowered_.data() + seen.first, seen.second) == part) {
+                    return;
+                }
+            }
+            parts_.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(end - start)});
+        }
+    };
+    for (size_t k = 0; k < word.size(); ++k) {
+        char c = word[k];
+        if (c == '_') {
+            addPart(k);
+            start = k + 1;
+        } else if (k > start && isUpper(c) &&
+                   (isLowerOrDigit(word[k - 1]) ||
+                    (isUpper(word[k - 1]) && k + 1 < word.size() && word[k + 1] >= 'a' && word[k + 1] <= 'z'))) {
+            addPart(k);
+            start = k;
+        }
+    }
+    addPart(word.size());
+}
+
+std::vector<std::string> Tokenizer::terms(std::string_view text) {
+    std::vector<std::string> result;
+    uint32_t next = 0;
+    tokenize(text, [&](std::string_view term, uint32_t position) {
+        if (position == next) {
+            result.emplace_back(term);
+            ++next;
+        }
+    });
+    return result;
+}
+
+std::vector<std::string> Tokenizer::patternTerms(std::string_view text) {
+    std::vector<std::string> result;
+    bool code = options_.kind == TokenizerOptions::Kind::Code;
+    auto inWord = [code](char c) { return code ? isPatternWord(c) : !isSpace(c); };
+
+    for (size_t i = 0; i < text.size();) {
+        if (!inWord(text[i])) {
+            ++i;
+            continue;
+        }
+        size_t end = i;
+        while (end < text.size() && inWord(text[end])) {
+            ++end;
+        }
+        std::string word(text.substr(i, end - i));
+        if (code) {
+            for (char& c : word) {
+                c = toLower(c);
+            }
+        }
+        result.push_back(std::move(word));
+        i = end;
+    }
+    return result;
+}
+
+std::string Tokenizer::lastWord(std::string_view text, size_t& start) {
+    bool code = options_.kind == TokenizerOptions::Kind::Code;
+    start = text.size();
+    while (start > 0 && (code ? isWord(text[start - 1]) : !isSpace(text[start - 1]))) {
+        --start;
+    }
+    std::string word(text.substr(start));
+    if (code) {
+        for (char& c : word) {
+            c = toLower(c);
+        }
+    }
+    return word;
+}
@@ -0,0 +1,164 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// How documents and queries are split into terms. The choice is stored in
+// index.bin, so queries are always split the way their index was.
+struct TokenizerOptions {
+    enum class Kind : uint32_t {
+        Whitespace = 0,  // Whitespace-separated words as written (indexes before version 4)
+        Code = 1,        // Identifiers and numbers, lower-cased; punctuation separates
+    };
+
+    Kind kind = Kind::Code;
+    bool splitIdentifiers = true;  // Code: also index the parts of camelCase and snake_case names
+
+    bool operator==(const TokenizerOptions& other) const {
+        return kind == other.kind && splitIdentifiers == other.splitIdentifiers;
+    }
+    bool operator!=(const TokenizerOptions& other) const { return !(*this == other); }
+};
+
+// Splits text into terms without allocating once its buffers are warm.
+// One instance per thread.
+//
+// The Code tokenizer treats [A-Za-z0-9_] and every byte >= 0x80 as word
+// characters and scans for them 16 bytes at a time. `foo(bar.baz)` gives
+// foo, bar, baz. With splitIdentifiers, `getUserName` and `get_user_name`
+// also give get, user and name, at the same position as the whole word,
+// so phrases still line up and the document length counts each word once.
+class Tokenizer {
+public:
+    // Longer words (minified code, base64) are skipped by the Code tokenizer
+    static constexpr size_t MAX_TERM_LENGTH = 64;
+
+    explicit Tokenizer(const TokenizerOptions& options = TokenizerOptions()) : options_(options) {}
+
+    const TokenizerOptions& options() const { return options_; }
+
+    // Calls emit(std::string_view term, uint32_t position) for each term in
+    // order. Views are only valid during the call. Returns the number of
+    // positions, i.e. the document length.
+    template <typename Emit>
+    uint32_t tokenize(std::string_view text, Emit&& emit);
+
+    // Like tokenize(), but calls emit(std::string_view term, size_t offset,
+    // size_t length) with the bytes of the text each term came from, for
+    // highlighting matches
+    template <typename Emit>
+    void locate(std::string_view text, Emit&& emit);
+
+    // Only the word at each position, without identifier parts; for
+    // splitting query words and phrases
+    std::vector<std::string> terms(std::string_view text);
+
+    // Like terms(), but '*' and '?' count as word characters, for
+    // wildcard patterns; `get*Name` gives one pattern, get*name
+    std::vector<std::string> patternTerms(std::string_view text);
+
+    // The unfinished word at the end of `text`, lower-cased as terms are,
+    // for completion; empty if the text ends between words. `start` is
+    // set to where the word begins in the text.
+    std::string lastWord(std::string_view text, size_t& start);
+
+private:
+    // First byte at or after `i` that is (findWordStart) or isn't
+    // (findWordEnd) a word character, or whitespace when `space` is set;
+    // text.size() if there is none
+    static size_t findWordStart(std::string_view text, size_t i);
+    static size_t findWordEnd(std::string_view text, size_t i);
+    static size_t findSpace(std::string_view text, size_t i, bool space);
+
+    // Fills parts_ with the distinct camelCase / snake_case pieces of the
+    // word (offsets into it) that differ from the whole word
+    void splitIdentifier(std::string_view word);
+
+    TokenizerOptions options_;
+    std::string lowered_;
+    std::vector<std::pair<uint32_t, uint32_t>> parts_;  // Offset, length
+};
+
+template <typename Emit>
+uint32_t Tokenizer::tokenize(std::string_view text, Emit&& emit) {
+    uint32_t position = 0;
+
+    if (options_.kind == TokenizerOptions::Kind::Whitespace) {
+        for (size_t i = findSpace(text, 0, false); i < text.size(); i = findSpace(text, i, false)) {
+            size_t end = findSpace(text, i, true);
+            emit(text.substr(i, end - i), position++);
+            i = end;
+        }
+        return position;
+    }
+
+    for (size_t i = findWordStart(text, 0); i < text.size(); i = findWordStart(text, i)) {
+        size_t end = findWordEnd(text, i);
+        std::string_view word = text.substr(i, end - i);
+        i = end;
+        if (word.size() > MAX_TERM_LENGTH) {
+            continue;
+        }
+
+        lowered_.resize(word.size());
+        for (size_t k = 0; k < word.size(); ++k) {
+            char c = word[k];
+            lowered_[k] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+        }
+        std::string_view term(lowered_);
+        emit(term, position);
+
+        if (options_.splitIdentifiers) {
+            splitIdentifier(word);
+            for (const auto& part : parts_) {
+                emit(term.substr(part.first, part.second), position);
+            }
+        }
+        ++position;
+    }
+    return position;
+}
+
+template <typename Emit>
+void Tokenizer::locate(std::string_view text, Emit&& emit) {
+    if (options_.kind == TokenizerOptions::Kind::Whitespace) {
+        for (size_t i = findSpace(text, 0, false); i < text.size(); i = findSpace(text, i, false)) {
+            size_t end = findSpace(text, i, true);
+            emit(text.substr(i, end - i), i, end - i);
+            i = end;
+        }
+        return;
+    }
+
+    for (size_t i = findWordStart(text, 0); i < text.size(); i = findWordStart(text, i)) {
+        size_t start = i;
+        size_t end = findWordEnd(text, i);
+        std::string_view word = text.substr(start, end - start);
+        i = end;
+        if (word.size() > MAX_TERM_LENGTH) {
+            continue;
+        }
+
+        lowered_.resize(word.size());
+        for (size_t k = 0; k < word.size(); ++k) {
+            char c = word[k];
+            lowered_[k] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+        }
+        std::string_view term(lowered_);
+        emit(term, start, word.size());
+
+        if (options_.splitIdentifiers) {
+            splitIdentifier(word);
+            for (const auto& part : parts_) {
+                emit(term.substr(part.first, part.second), start + part.first, size_t(part.second));
+            }
+        }
+    }
+}
+
+#endif // TOKENIZER_H
@@ -0,0 +1,55 @@
+#ifndef TOP_K_H
+#define TOP_K_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded min-heap that keeps the k best (score, id) pairs seen so far.
+// Ties on score go to the smaller id so results are deterministic.
+// `candidates` is how many entries can be pushed at most; no more than
+// that is reserved, however large k is.
+template <typename Entry>
+class TopK {
+public:
+    TopK(size_t k, size_t candidates) : k_(k) { heap_.reserve(std::min(k, candidates)); }
+
+    bool full() const { return heap_.size() >= k_; }
+
+    // Score an entry must beat to be admitted (0 until the heap is full)
+    float threshold() const { return full() && k_ > 0 ? heap_.front().score : 0.0f; }
+
+    void push(const Entry& entry) {
+        if (k_ == 0) {
+            return;
+        }
+        if (!full()) {
+            heap_.push_back(entry);
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        } else if (better(entry, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), better);
+            heap_.back() = entry;
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        }
+    }
+
+    // Best first; leaves the heap empty
+    std::vector<Entry> take() {
+        std::sort(heap_.begin(), heap_.end(), better);
+        return std::move(heap_);
+    }
+
+private:
+    size_t k_;
+    std::vector<Entry> heap_;
+
+    static bool better(const Entry& a, const Entry& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.docId < b.docId;
+    }
+};
+
+#endif // TOP_K_H
@@ -0,0 +1,132 @@
+#include "trigrams.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// POSIX mapping headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace index_format;
+
+void TrigramCollector::collect(std::string_view text, std::vector<uint32_t>& keys) {
+    keys.clear();
+    if (text.size() < 3) {
+        return;
+    }
+
+    // Roll the key along the text instead of re-reading three bytes
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(text.data());
+    uint32_t key = foldTrigramByte(p[0]) << 8 | foldTrigramByte(p[1]);
+    for (size_t i = 2; i < text.size(); ++i) {
+        key = (key << 8 | foldTrigramByte(p[i])) & (TRIGRAM_KEYS - 1);
+        uint64_t bit = uint64_t(1) << (key & 63);
+        uint64_t& word = seen_[key >> 6];
+        if (!(word & bit)) {
+            word |= bit;
+            keys.push_back(key);
+        }
+    }
+
+    for (uint32_t seen : keys) {
+        seen_[seen >> 6] = 0;
+    }
+}
+
+MappedTrigrams::MappedTrigrams()
+    : data_(nullptr), size_(0), header_(nullptr), entries_(nullptr), listData_(nullptr) {}
+
+MappedTrigrams::~MappedTrigrams() {
+    close();
+}
+
+bool MappedTrigrams::open(const std::string& filename, const MappedIndex& index) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TrigramsHeader)) {
+        std::cerr << "Error: " << filename << " is too small to be a trigrams file" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Failed to mmap " << filename << std::endl;
+        return false;
+    }
+
+    data_ = static_cast<const char*>(mapping);
+    size_ = size;
+    header_ = reinterpret_cast<const TrigramsHeader*>(data_);
+
+    if (std::memcmp(header_->magic, TRIGRAMS_MAGIC, sizeof(TRIGRAMS_MAGIC)) != 0 ||
+        header_->version != TRIGRAMS_VERSION) {
+        std::cerr << "Error: " << filename << " is not a supported trigrams file" << std::endl;
+        close();
+        return false;
+    }
+    if (header_->indexFileSize != index.sizeBytes()) {
+        std::cerr << "Error: " << filename << " does not belong to the loaded index. "
+                  << "Please rebuild the index." << std::endl;
+        close();
+        return false;
+    }
+
+    uint64_t tableEnd = header_->tableOffset + uint64_t(header_->numTrigrams) * sizeof(TrigramEntry);
+    if (header_->fileSize != size_ || tableEnd > size_ || header_->dataOffset + header_->dataSize > size_) {
+        std::cerr << "Error: " << filename << " is truncated or corrupt" << std::endl;
+        close();
+        return false;
+    }
+
+    entries_ = reinterpret_cast<const TrigramEntry*>(data_ + header_->tableOffset);
+    listData_ = data_ + header_->dataOffset;
+
+    madvise(mapping, size_, MADV_RANDOM);
+    return true;
+}
+
+void MappedTrigrams::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    entries_ = nullptr;
+    listData_ = nullptr;
+}
+
+const TrigramEntry* MappedTrigrams::find(uint32_t key) const {
+    if (!entries_) {
+        return nullptr;
+    }
+    const TrigramEntry* end = entries_ + header_->numTrigrams;
+    const TrigramEntry* it = std::lower_bound(entries_, end, key,
+        [](const TrigramEntry& entry, uint32_t value) { return entry.trigram < value; });
+    return (it != end && it->trigram == key) ? it : nullptr;
+}
+
+void MappedTrigrams::docs(const TrigramEntry& entry, std::vector<uint32_t>& out) const {
+    out.clear();
+    out.reserve(entry.docCount);
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(listData_ + entry.dataOffset);
+    uint32_t docId = 0;
+    for (uint32_t i = 0; i < entry.docCount; ++i) {
+        uint32_t delta;
+        p = readVarint(p, delta);
+        docId += delta;
+        out.push_back(docId);
+    }
+}
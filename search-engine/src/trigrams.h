@@ -0,0 +1,72 @@
+#ifndef TRIGRAMS_H
+#define TRIGRAMS_H
+
+#include "index_format.h"
+#include "mapped_index.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Trigram keys: three bytes packed big-endian into 24 bits, ASCII letters
+// lower-cased. Folding case lets one lookup serve case-insensitive
+// patterns; candidates are verified against the files anyway.
+constexpr size_t TRIGRAM_KEYS = size_t(1) << 24;
+
+inline uint32_t foldTrigramByte(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+inline uint32_t trigramKey(const char* p) {
+    return foldTrigramByte(static_cast<unsigned char>(p[0])) << 16 |
+           foldTrigramByte(static_cast<unsigned char>(p[1])) << 8 |
+           foldTrigramByte(static_cast<unsigned char>(p[2]));
+}
+
+// Distinct trigrams of a document. Keeps a 2 MiB bitmap of keys already
+// seen and clears only the bits it set, so keep one per thread.
+class TrigramCollector {
+public:
+    TrigramCollector() : seen_(TRIGRAM_KEYS / 64) {}
+
+    // Replaces `keys` with the document's trigrams, in no particular order
+    void collect(std::string_view text, std::vector<uint32_t>& keys);
+
+private:
+    std::vector<uint64_t> seen_;
+};
+
+// Read-only view of trigrams.bin mapped into memory
+class MappedTrigrams {
+public:
+    MappedTrigrams();
+    ~MappedTrigrams();
+
+    MappedTrigrams(const MappedTrigrams&) = delete;
+    MappedTrigrams& operator=(const MappedTrigrams&) = delete;
+
+    // Map the file and check that it was written with `index`
+    bool open(const std::string& filename, const MappedIndex& index);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+    size_t sizeBytes() const { return size_; }
+
+    uint32_t numTrigrams() const { return header_ ? header_->numTrigrams : 0; }
+    const index_format::TrigramEntry& entryAt(uint32_t i) const { return entries_[i]; }
+
+    // Entry for a key, or nullptr if no document contains it
+    const index_format::TrigramEntry* find(uint32_t key) const;
+
+    // Sorted docIds of an entry
+    void docs(const index_format::TrigramEntry& entry, std::vector<uint32_t>& out) const;
+
+private:
+    const char* data_;
+    size_t size_;
+    const index_format::TrigramsHeader* header_;
+    const index_format::TrigramEntry* entries_;
+    const char* listData_;
+};
+
+#endif // TRIGRAMS_H
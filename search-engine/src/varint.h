@@ -0,0 +1,51 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <cstdint>
+#include <string>
+
+// LEB128 variable-length integers, shared by the on-disk encoders
+
+inline void appendVarint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Most deltas and frequencies fit in one or two bytes, so check those first
+inline const unsigned char* readVarint(const unsigned char* p, uint32_t& value) {
+    uint32_t byte = *p++;
+    if (byte < 0x80) {
+        value = byte;
+        return p;
+    }
+    uint32_t result = byte & 0x7F;
+    byte = *p++;
+    if (byte < 0x80) {
+        value = result | (byte << 7);
+        return p;
+    }
+    result |= (byte & 0x7F) << 7;
+    int shift = 14;
+    do {
+        byte = *p++;
+        result |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    value = result;
+    return p;
+}
+
+// Skip `count` varints without decoding them
+inline const unsigned char* skipVarints(const unsigned char* p, uint32_t count) {
+    while (count > 0) {
+        if (!(*p++ & 0x80)) {
+            --count;
+        }
+    }
+    return p;
+}
+
+#endif // VARINT_H
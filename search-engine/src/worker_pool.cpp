@@ -0,0 +1,122 @@
+#include "worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+WorkerPool::WorkerPool(unsigned numThreads, size_t maxQueued)
+    : maxQueued_(maxQueued), stopping_(false) {
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads_.reserve(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads_.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+bool WorkerPool::trySubmit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || tasks_.size() >= maxQueued_) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+    return true;
+}
+
+bool WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+    return true;
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void WorkerPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;  // Stopping and drained
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<bool(size_t)>& work) {
+    // Shared with the tasks, which may outlive this call; `work` is only
+    // used by tasks that registered as running before it returned
+    struct Loop {
+        const std::function<bool(size_t)>* work;
+        size_t count;
+        std::atomic<size_t> next{0};
+        std::atomic<bool> done{false};
+        std::mutex mutex;
+        std::condition_variable idle;
+        size_t running = 0;
+        bool closed = false;
+
+        void run() {
+            for (size_t i; !done.load(std::memory_order_relaxed) && (i = next++) < count;) {
+                if (!(*work)(i)) {
+                    done.store(true, std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+    auto loop = std::make_shared<Loop>();
+    loop->work = &work;
+    loop->count = count;
+
+    size_t helpers = std::min(threads_.size(), count > 0 ? count - 1 : 0);
+    for (size_t i = 0; i < helpers; ++i) {
+        submit([loop] {
+            {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                if (loop->closed) {
+                    return;
+                }
+                ++loop->running;
+            }
+            loop->run();
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            if (--loop->running == 0) {
+                loop->idle.notify_all();
+            }
+        });
+    }
+
+    loop->run();
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->closed = true;
+    loop->idle.wait(lock, [&] { return loop->running == 0; });
+}
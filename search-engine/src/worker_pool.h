@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads draining a bounded task queue. Submitting to a
+// full queue fails instead of blocking, so callers can shed load.
+class WorkerPool {
+public:
+    // numThreads == 0 uses every hardware thread
+    WorkerPool(unsigned numThreads, size_t maxQueued);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Queue a task. Returns false if the queue is full or the pool stopped.
+    bool trySubmit(std::function<void()> task);
+
+    // Queue a task even if the queue is full, for work that belongs to a
+    // request already accepted. Returns false if the pool stopped.
+    bool submit(std::function<void()> task);
+
+    // Run the tasks already queued, then join the threads
+    void stop();
+
+    // Calls work(i) for i = 0 .. count-1, claimed in order, on the calling
+    // thread and on tasks of this pool, until a call returns false. Returns
+    // once every call made has returned. It never waits for a task to
+    // start, so it is safe while the pool is busy or stopped: tasks that
+    // start too late find nothing left to do.
+    void parallelFor(size_t count, const std::function<bool(size_t)>& work);
+
+    size_t numThreads() const { return threads_.size(); }
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> tasks_;
+    size_t maxQueued_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,64 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdint>
+#include <iostream>
+
+// Just enough of a test framework for the unit tests: a failed CHECK
+// prints where it was and the test goes on, so one run shows every
+// failure; main returns checkResult().
+
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                        \
+    do {                                                                                        \
+        if (!(condition)) {                                                                     \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed"        \
+                      << std::endl;                                                             \
+            ++checkFailures();                                                                  \
+        }                                                                                       \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do {                                                                                        \
+        auto checkActual = (actual);                                                            \
+        auto checkExpected = (expected);                                                        \
+        if (!(checkActual == checkExpected)) {                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected    \
+                      << ") failed: " << checkActual << " != " << checkExpected << std::endl;   \
+            ++checkFailures();                                                                  \
+        }                                                                                       \
+    } while (0)
+
+inline int checkResult() {
+    if (checkFailures() > 0) {
+        std::cerr << checkFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Deterministic pseudo-random numbers (splitmix64), so a failure
+// reproduces on every platform
+class TestRandom {
+public:
+    explicit TestRandom(uint64_t seed) : state_(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, bound)
+    uint32_t below(uint32_t bound) { return static_cast<uint32_t>(next() % bound); }
+
+private:
+    uint64_t state_;
+};
+
+#endif // CHECK_H
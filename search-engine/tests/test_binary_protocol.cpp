@@ -0,0 +1,203 @@
+// Binary protocol: request frames against an independent encoder, the
+// malformed ones, and the response frames parsed back
+
+#include "binary_protocol.h"
+#include "check.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace binary_protocol;
+
+namespace {
+
+void put16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void put32(std::string& out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value >> 16));
+    put16(out, static_cast<uint16_t>(value));
+}
+
+uint32_t get16(const std::string& data, size_t at) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(data[at])) << 8 | static_cast<uint8_t>(data[at + 1]);
+}
+
+uint32_t get32(const std::string& data, size_t at) {
+    return get16(data, at) << 16 | get16(data, at + 2);
+}
+
+// Request payload as the protocol comment describes it
+std::string encodeBatch(const std::vector<Query>& queries, uint8_t version = VERSION) {
+    std::string out;
+    out.push_back(static_cast<char>(version));
+    put16(out, static_cast<uint16_t>(queries.size()));
+    for (const Query& query : queries) {
+        out.push_back(static_cast<char>(query.kind));
+        out.push_back(static_cast<char>(static_cast<int8_t>(query.fuzzy)));
+        put32(out, query.offset);
+        put32(out, query.limit);
+        put32(out, static_cast<uint32_t>(query.text.size()));
+        out += query.text;
+    }
+    return out;
+}
+
+std::string decodeError(const std::string& payload) {
+    std::vector<Query> queries;
+    std::string error;
+    CHECK(!decodeBatch(payload, queries, error));
+    return error;
+}
+
+void testRoundTrip() {
+    TestRandom random(21);
+    for (int round = 0; round < 200; ++round) {
+        std::vector<Query> queries(random.below(6));
+        for (Query& query : queries) {
+            query.kind = static_cast<Kind>(random.below(3));
+            query.fuzzy = static_cast<int>(random.below(4)) - 1;
+            query.offset = static_cast<uint32_t>(random.next());
+            query.limit = random.below(1000);
+            query.text.assign(random.below(300), 'q');
+            for (char& c : query.text) {
+                c = static_cast<char>(random.below(256));
+            }
+        }
+        std::string payload = encodeBatch(queries);
+
+        std::vector<Query> decoded;
+        std::string error;
+        CHECK(decodeBatch(payload, decoded, error));
+        CHECK_EQ(decoded.size(), queries.size());
+        for (size_t i = 0; i < decoded.size() && i < queries.size(); ++i) {
+            CHECK(decoded[i].kind == queries[i].kind);
+            CHECK_EQ(decoded[i].fuzzy, queries[i].fuzzy);
+            CHECK_EQ(decoded[i].offset, queries[i].offset);
+            CHECK_EQ(decoded[i].limit, queries[i].limit);
+            CHECK(decoded[i].text == queries[i].text);
+        }
+
+        // Every shorter payload is cut off somewhere
+        for (size_t length = 0; length < payload.size(); length += 1 + random.below(16)) {
+            CHECK_EQ(decodeError(payload.substr(0, length)), "Truncated frame");
+        }
+    }
+}
+
+void testMalformed() {
+    Query query;
+    query.text = "numpy";
+    CHECK_EQ(decodeError(encodeBatch({query}, 2)), "Unsupported protocol version 2");
+    CHECK_EQ(decodeError(encodeBatch({query}) + "x"), "Trailing bytes after the last query");
+
+    std::string payload = encodeBatch({query});
+    payload[3] = 3;
+    CHECK_EQ(decodeError(payload), "Unknown query kind 3");
+    payload = encodeBatch({query});
+    payload[4] = 3;
+    CHECK_EQ(decodeError(payload), "Invalid fuzzy edits 3");
+    payload[4] = static_cast<char>(-2);
+    CHECK_EQ(decodeError(payload), "Invalid fuzzy edits -2");
+
+    // A text length past the end of the frame, however large
+    payload = encodeBatch({query});
+    for (uint32_t length : {6u, 0x7FFFFFFFu, 0xFFFFFFFFu}) {
+        std::string bad = payload;
+        for (int i = 3; i >= 0; --i) {
+            bad[13 + i] = static_cast<char>(length >> (8 * (3 - i)));
+        }
+        CHECK_EQ(decodeError(bad), "Truncated frame");
+    }
+}
+
+// One response frame, parsed back
+struct Frame {
+    FrameType type;
+    uint16_t index;
+    std::string body;
+};
+
+std::vector<Frame> parseFrames(const std::string& data) {
+    std::vector<Frame> frames;
+    size_t at = 0;
+    while (at < data.size()) {
+        CHECK(data.size() - at >= 7);
+        uint32_t length = get32(data, at);
+        CHECK(length >= 3 && data.size() - at - 4 >= length);
+        frames.push_back({static_cast<FrameType>(data[at + 4]), static_cast<uint16_t>(get16(data, at + 5)),
+                          data.substr(at + 7, length - 3)});
+        at += 4 + length;
+    }
+    return frames;
+}
+
+void testResponses() {
+    std::string out;
+    appendBegin(out, 7, FLAG_FUZZY, 123456);
+    appendError(out, 8, "Missing ')'");
+    appendError(out, FRAME_ERROR_INDEX, std::string(70000, 'e'));
+
+    std::vector<std::pair<float, std::string>> results = {
+        {12.5f, "src/main.cpp"}, {0.0f, ""}, {-1.25e-7f, std::string(70000, 'n')}, {3.0f, "a b"}};
+    ResultsFrame frame;
+    frame.begin(out, 7);
+    for (const auto& result : results) {
+        frame.add(out, result.first, result.second);
+    }
+    frame.finish(out);
+    appendEnd(out, 9);
+
+    std::vector<Frame> frames = parseFrames(out);
+    CHECK_EQ(frames.size(), size_t(5));
+    if (frames.size() != 5) {
+        return;
+    }
+
+    CHECK(frames[0].type == FrameType::Begin);
+    CHECK_EQ(frames[0].index, 7);
+    CHECK_EQ(frames[0].body.size(), size_t(5));
+    CHECK_EQ(static_cast<uint8_t>(frames[0].body[0]), FLAG_FUZZY);
+    CHECK_EQ(get32(frames[0].body, 1), 123456u);
+
+    CHECK(frames[1].type == FrameType::Error);
+    CHECK_EQ(frames[1].index, 8);
+    CHECK_EQ(get16(frames[1].body, 0), 11u);
+    CHECK_EQ(frames[1].body.substr(2), "Missing ')'");
+
+    // Messages are cut to what a u16 length can say
+    CHECK_EQ(frames[2].index, FRAME_ERROR_INDEX);
+    CHECK_EQ(get16(frames[2].body, 0), 0xFFFFu);
+    CHECK_EQ(frames[2].body.size(), size_t(2 + 0xFFFF));
+
+    CHECK(frames[3].type == FrameType::Results);
+    CHECK_EQ(frames[3].index, 7);
+    const std::string& body = frames[3].body;
+    CHECK_EQ(get16(body, 0), results.size());
+    size_t at = 2;
+    for (const auto& result : results) {
+        uint32_t bits = get32(body, at);
+        float score;
+        std::memcpy(&score, &bits, sizeof(score));
+        CHECK_EQ(score, result.first);
+        uint32_t length = get16(body, at + 4);
+        CHECK(body.compare(at + 6, length, result.second, 0, 0xFFFF) == 0);
+        at += 6 + length;
+    }
+    CHECK_EQ(at, body.size());
+
+    CHECK(frames[4].type == FrameType::End);
+    CHECK_EQ(frames[4].index, 9);
+    CHECK(frames[4].body.empty());
+}
+
+} // namespace
+
+int main() {
+    testRoundTrip();
+    testMalformed();
+    testResponses();
+    return checkResult();
+}
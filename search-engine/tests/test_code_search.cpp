@@ -0,0 +1,193 @@
+// Substring and regex patterns: the trigram query must select every text
+// the pattern matches, and matching must agree with std::regex line by line
+
+#include "check.h"
+#include "code_search.h"
+#include "trigrams.h"
+#include <algorithm>
+#include <chrono>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Whether a text with these (sorted) trigram keys satisfies the query
+bool satisfies(const TrigramQuery& query, const std::vector<uint32_t>& keys) {
+    switch (query.type) {
+    case TrigramQuery::Type::All:
+        return true;
+    case TrigramQuery::Type::None:
+        return false;
+    case TrigramQuery::Type::Trigram:
+        return std::binary_search(keys.begin(), keys.end(), query.trigram);
+    case TrigramQuery::Type::And:
+        return std::all_of(query.children.begin(), query.children.end(),
+                           [&](const TrigramQuery& child) { return satisfies(child, keys); });
+    case TrigramQuery::Type::Or:
+        return std::any_of(query.children.begin(), query.children.end(),
+                           [&](const TrigramQuery& child) { return satisfies(child, keys); });
+    }
+    return true;
+}
+
+// The regex tried on each line on its own, without the literal prefilter
+bool regexMatchesSomeLine(const std::string& pattern, const std::string& text) {
+    std::regex regex(pattern, std::regex::ECMAScript);
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        size_t lineEnd = end > start && text[end - 1] == '\r' ? end - 1 : end;
+        if (std::regex_search(text.begin() + start, text.begin() + lineEnd, regex)) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+// Texts built from pieces of the patterns below, so that many match
+std::string randomText(TestRandom& random) {
+    static const std::vector<std::string> pieces = {
+        "def ", "foo", "_handler(", "bar", "abc", "abd", "e", "color", "colour", "Hello",
+        "hello", " world", "xx", "x", "yz", "get", "User", "Group", "Name", "import ",
+        "os", "sys", "class ", "Foo", "getUserName", "HELLO", "int", "3.14", "ab", "cde", "REQUESTS", "requests.get(",
+        " ", " ", "\n", "\n", "\r\n", "_", "(", "=", "a", "b", "c", "d",
+    };
+    std::string text;
+    uint32_t count = 1 + random.below(16);
+    for (uint32_t i = 0; i < count; ++i) {
+        text += pieces[random.below(static_cast<uint32_t>(pieces.size()))];
+    }
+    return text;
+}
+
+void testSubstrings() {
+    CodePattern pattern;
+    std::string error;
+    CHECK(!pattern.compile("", CodePattern::Mode::Substring, error));
+
+    // Too short for a trigram: every file is a candidate
+    CHECK(pattern.compile("ab", CodePattern::Mode::Substring, error));
+    CHECK(pattern.trigrams().type == TrigramQuery::Type::All);
+
+    CHECK(pattern.compile("abc", CodePattern::Mode::Substring, error));
+    CHECK(pattern.trigrams().type == TrigramQuery::Type::Trigram);
+    CHECK_EQ(pattern.trigrams().trigram, trigramKey("abc"));
+
+    // Keys fold case and are deduplicated
+    CHECK(pattern.compile("ABCabc", CodePattern::Mode::Substring, error));
+    CHECK(pattern.trigrams().type == TrigramQuery::Type::And);
+    CHECK_EQ(pattern.trigrams().children.size(), size_t(3));
+
+    TestRandom random(11);
+    TrigramCollector collector;
+    std::vector<uint32_t> keys;
+    for (const char* text : {"requests.get(", "Hello world", "xxyz", "_handler(", "abcde", "ab"}) {
+        CHECK(pattern.compile(text, CodePattern::Mode::Substring, error));
+        MatchDeadline deadline;
+        for (int i = 0; i < 500; ++i) {
+            std::string content = randomText(random);
+            bool expected = content.find(text) != std::string::npos;
+            CHECK_EQ(pattern.matches(content, deadline), expected);
+            collector.collect(content, keys);
+            std::sort(keys.begin(), keys.end());
+            if (expected) {
+                CHECK(satisfies(pattern.trigrams(), keys));
+            }
+        }
+    }
+}
+
+void testRegexes() {
+    const char* patterns[] = {
+        "def \\w+_handler\\(",
+        "foo|bar",
+        "(abc|abd)e",
+        "colou?r",
+        "[Hh]ello world",
+        "x{2,3}yz",
+        "get(User|Group)Name",
+        "ab.*cde",
+        "import (os|sys)$",
+        "^class [A-Z]\\w*",
+        "\\bint\\b",
+        "[0-9]+\\.[0-9]+",
+        "(ab)*cde",
+        "requests\\.get\\(",
+        "HELLO",
+        "a|bcd|xyz",
+        "e$",
+    };
+
+    TestRandom random(12);
+    TrigramCollector collector;
+    std::vector<uint32_t> keys;
+    for (const char* text : patterns) {
+        CodePattern pattern;
+        std::string error;
+        CHECK(pattern.compile(text, CodePattern::Mode::Regex, error));
+        MatchDeadline deadline;
+        int matched = 0;
+        for (int i = 0; i < 1000; ++i) {
+            std::string content = randomText(random);
+            bool expected = regexMatchesSomeLine(text, content);
+            bool actual = pattern.matches(content, deadline);
+            if (actual != expected) {
+                std::cerr << "pattern " << text << " on \"" << content << "\"" << std::endl;
+            }
+            CHECK_EQ(actual, expected);
+            collector.collect(content, keys);
+            std::sort(keys.begin(), keys.end());
+            if (expected) {
+                ++matched;
+                if (!satisfies(pattern.trigrams(), keys)) {
+                    std::cerr << "pattern " << text << " on \"" << content << "\"" << std::endl;
+                }
+                CHECK(satisfies(pattern.trigrams(), keys));
+            }
+        }
+        if (matched == 0) {
+            std::cerr << "pattern " << text << " matched none of the texts" << std::endl;
+        }
+        CHECK(matched > 0);
+    }
+
+    // The analysis must not over-constrain: literal-only patterns need
+    // all of their trigrams, nothing else
+    CodePattern pattern;
+    std::string error;
+    CHECK(pattern.compile("foo|bar", CodePattern::Mode::Regex, error));
+    CHECK(pattern.trigrams().type == TrigramQuery::Type::Or);
+    CHECK(pattern.compile("a.*", CodePattern::Mode::Regex, error));
+    CHECK(pattern.trigrams().type == TrigramQuery::Type::All);
+
+    CHECK(!pattern.compile("(abc", CodePattern::Mode::Regex, error));
+    CHECK_EQ(error.rfind("Invalid regex", 0), size_t(0));
+}
+
+void testDeadline() {
+    // Backtracks exponentially in the length of the run of letters
+    CodePattern pattern;
+    std::string error;
+    CHECK(pattern.compile("(\\w+\\s?)+=$", CodePattern::Mode::Regex, error));
+    std::string content = std::string(40, 'a') + "= x\n";
+
+    MatchDeadline deadline(std::chrono::milliseconds(20));
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!pattern.matches(content, deadline));
+    CHECK(deadline.passed());
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+}
+
+} // namespace
+
+int main() {
+    testSubstrings();
+    testRegexes();
+    testDeadline();
+    return checkResult();
+}
@@ -0,0 +1,89 @@
+// Levenshtein automaton against the dynamic-programming edit distance
+
+#include "check.h"
+#include "levenshtein.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Edit distances from `input` to every prefix of `term`
+std::vector<unsigned> distanceRow(const std::string& term, const std::string& input) {
+    std::vector<unsigned> row(term.size() + 1);
+    for (size_t j = 0; j <= term.size(); ++j) {
+        row[j] = static_cast<unsigned>(j);
+    }
+    for (size_t i = 1; i <= input.size(); ++i) {
+        std::vector<unsigned> next(term.size() + 1);
+        next[0] = static_cast<unsigned>(i);
+        for (size_t j = 1; j <= term.size(); ++j) {
+            unsigned substitute = row[j - 1] + (input[i - 1] == term[j - 1] ? 0 : 1);
+            next[j] = std::min({substitute, row[j] + 1, next[j - 1] + 1});
+        }
+        row = next;
+    }
+    return row;
+}
+
+std::string randomString(TestRandom& random, size_t maxLength, const std::string& alphabet) {
+    std::string text(random.below(static_cast<uint32_t>(maxLength + 1)), ' ');
+    for (char& c : text) {
+        c = alphabet[random.below(static_cast<uint32_t>(alphabet.size()))];
+    }
+    return text;
+}
+
+void testAgainstEditDistance() {
+    TestRandom random(3);
+    for (int round = 0; round < 3000; ++round) {
+        std::string term = randomString(random, 8, "abc");
+        std::string input = randomString(random, 10, "abcd");
+        unsigned maxEdits = random.below(LevenshteinAutomaton::MAX_EDITS + 1);
+        LevenshteinAutomaton automaton(term, maxEdits);
+
+        // Every prefix of the input, so canMatch is checked along the way
+        LevenshteinAutomaton::State state = automaton.start();
+        for (size_t length = 0; length <= input.size(); ++length) {
+            if (length > 0) {
+                state = automaton.step(state, static_cast<unsigned char>(input[length - 1]));
+            }
+            std::vector<unsigned> row = distanceRow(term, input.substr(0, length));
+            unsigned distance = row.back();
+            unsigned best = *std::min_element(row.begin(), row.end());
+
+            CHECK_EQ(automaton.isMatch(state), distance <= maxEdits);
+            CHECK_EQ(automaton.canMatch(state), best <= maxEdits);
+            if (distance <= maxEdits) {
+                CHECK_EQ(automaton.distance(state), distance);
+            }
+        }
+    }
+}
+
+void testLongTerm() {
+    std::string term(LevenshteinAutomaton::MAX_LENGTH, 'x');
+    term[10] = 'y';
+    LevenshteinAutomaton automaton(term, 2);
+
+    std::string input = term;
+    input[10] = 'z';
+    input.erase(30, 1);
+    LevenshteinAutomaton::State state = automaton.start();
+    for (char c : input) {
+        state = automaton.step(state, static_cast<unsigned char>(c));
+    }
+    CHECK(automaton.isMatch(state));
+    CHECK_EQ(automaton.distance(state), 2u);
+
+    state = automaton.step(automaton.step(state, 'z'), 'z');
+    CHECK(!automaton.isMatch(state));
+}
+
+} // namespace
+
+int main() {
+    testAgainstEditDistance();
+    testLongTerm();
+    return checkResult();
+}
@@ -0,0 +1,107 @@
+// Varint and block posting list codec: round trips, skip pointers and
+// block maxima against the uncompressed lists
+
+#include "bm25.h"
+#include "check.h"
+#include "posting_list.h"
+#include "varint.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+void testVarints() {
+    std::vector<uint32_t> values = {0, 1, 127, 128, 255, 16383, 16384, 2097151, 2097152,
+                                    268435455, 268435456, UINT32_MAX};
+    TestRandom random(1);
+    for (int i = 0; i < 1000; ++i) {
+        values.push_back(static_cast<uint32_t>(random.next() >> (random.below(32) + 32)));
+    }
+
+    std::string encoded;
+    for (uint32_t value : values) {
+        appendVarint(encoded, value);
+    }
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(encoded.data());
+    for (uint32_t expected : values) {
+        uint32_t value;
+        p = readVarint(p, value);
+        CHECK_EQ(value, expected);
+    }
+    CHECK(p == reinterpret_cast<const unsigned char*>(encoded.data()) + encoded.size());
+
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(encoded.data());
+    uint32_t value;
+    readVarint(skipVarints(begin, 5), value);
+    CHECK_EQ(value, values[5]);
+}
+
+void testPostingList(uint32_t docCount, uint64_t seed) {
+    TestRandom random(seed);
+    std::vector<Posting> postings;
+    uint32_t docId = random.below(3);
+    for (uint32_t i = 0; i < docCount; ++i) {
+        // Mostly small gaps, some large ones to exercise long varints
+        docId += 1 + (random.below(10) == 0 ? random.below(100000) : random.below(4));
+        uint32_t frequency = 1 + (random.below(20) == 0 ? random.below(5000) : random.below(3));
+        postings.push_back({docId, frequency});
+    }
+    uint32_t numDocs = docCount == 0 ? 1 : postings.back().docId + 1;
+    std::vector<float> norms(numDocs);
+    for (float& norm : norms) {
+        norm = bm25::lengthNorm(1 + random.below(2000), 300.0f);
+    }
+
+    std::string encoded;
+    float listMax = encodePostingList(postings, norms, encoded);
+
+    // Sequential decoding, with frequencies read for some postings only
+    PostingCursor cursor(encoded.data(), docCount);
+    CHECK_EQ(cursor.docCount(), docCount);
+    float expectedMax = 0.0f;
+    for (const Posting& posting : postings) {
+        CHECK_EQ(cursor.docId(), posting.docId);
+        if (posting.docId % 3 != 0) {
+            CHECK_EQ(cursor.frequency(), posting.frequency);
+        }
+        float tfNorm = bm25::tfNorm(posting.frequency, norms[posting.docId]);
+        expectedMax = std::max(expectedMax, tfNorm);
+        uint32_t blockLast;
+        CHECK(cursor.blockMaxAt(posting.docId, blockLast) >= tfNorm);
+        CHECK(blockLast >= posting.docId);
+        cursor.next();
+    }
+    CHECK(cursor.atEnd());
+    CHECK_EQ(listMax, expectedMax);
+
+    // Skipping to increasing targets lands where lower_bound does
+    for (int run = 0; run < 20; ++run) {
+        PostingCursor skipping(encoded.data(), docCount);
+        uint32_t target = 0;
+        while (true) {
+            target += random.below(run < 10 ? 50 : 5000);
+            skipping.advanceTo(target);
+            auto it = std::lower_bound(postings.begin(), postings.end(), target,
+                                       [](const Posting& posting, uint32_t value) { return posting.docId < value; });
+            if (it == postings.end()) {
+                CHECK(skipping.atEnd());
+                break;
+            }
+            CHECK_EQ(skipping.docId(), it->docId);
+            CHECK_EQ(skipping.frequency(), it->frequency);
+            target = it->docId;
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    testVarints();
+    for (uint32_t docCount : {0u, 1u, 2u, 127u, 128u, 129u, 256u, 1000u, 20000u}) {
+        testPostingList(docCount, docCount + 7);
+    }
+    return checkResult();
+}
@@ -0,0 +1,111 @@
+// Query parser, canonicalQuery and makeFuzzy
+
+#include "check.h"
+#include "query.h"
+#include <string>
+
+namespace {
+
+// Canonical form of the parsed text, or "error: ..." if it doesn't parse
+std::string canonical(const std::string& text) {
+    QueryNode query;
+    std::string error;
+    if (!parseQuery(text, TokenizerOptions(), query, error)) {
+        return "error: " + error;
+    }
+    return canonicalQuery(query);
+}
+
+std::string fuzzy(const std::string& text, unsigned maxEdits) {
+    QueryNode query;
+    std::string error;
+    if (!parseQuery(text, TokenizerOptions(), query, error)) {
+        return "error: " + error;
+    }
+    makeFuzzy(query, maxEdits);
+    return canonicalQuery(query);
+}
+
+void testOperators() {
+    CHECK_EQ(canonical("numpy"), "5:numpy");
+    CHECK_EQ(canonical("import numpy"), "(and 6:import 5:numpy)");
+    CHECK_EQ(canonical("import AND numpy"), canonical("import numpy"));
+    CHECK_EQ(canonical("(import) numpy"), canonical("import numpy"));
+    CHECK_EQ(canonical("numpy OR pandas"), "(or 5:numpy 6:pandas)");
+
+    // NOT binds tighter than AND, which binds tighter than OR
+    CHECK_EQ(canonical("a OR b c"), "(or 1:a (and 1:b 1:c))");
+    CHECK_EQ(canonical("(a OR b) c"), "(and (or 1:a 1:b) 1:c)");
+    CHECK_EQ(canonical("self AND NOT cls"), "(and 4:self (not 3:cls))");
+    CHECK_EQ(canonical("NOT a b"), "(and (not 1:a) 1:b)");
+
+    // Operators are upper case only
+    CHECK_EQ(canonical("a or b"), "(and 1:a 2:or 1:b)");
+}
+
+void testTerms() {
+    // Words go through the index's tokenizer
+    CHECK_EQ(canonical("Foo"), "3:foo");
+    CHECK_EQ(canonical("getUserName"), "11:getusername");
+    CHECK_EQ(canonical("os.path"), "(phrase 2:os 4:path)");
+    CHECK_EQ(canonical("\"from typing import\""), "(phrase 4:from 6:typing 6:import)");
+    CHECK_EQ(canonical("\"single\""), "6:single");
+
+    CHECK_EQ(canonical("num*"), "(wild 4:num*)");
+    CHECK_EQ(canonical("os.pa*"), "(and 2:os (wild 3:pa*))");
+
+    QueryNode query;
+    std::string error;
+    CHECK(parseQuery("\"a b\" c", TokenizerOptions(), query, error));
+    CHECK(queryHasPhrase(query));
+    CHECK(!queryNeedsExpansion(query));
+    CHECK(parseQuery("get?ame", TokenizerOptions(), query, error));
+    CHECK(!queryHasPhrase(query));
+    CHECK(queryNeedsExpansion(query));
+}
+
+void testErrors() {
+    CHECK_EQ(canonical(""), "error: Empty query");
+    CHECK_EQ(canonical("(a"), "error: Missing ')'");
+    CHECK_EQ(canonical("()"), "error: Unexpected ')'");
+    CHECK_EQ(canonical("AND"), "error: Unexpected 'AND'");
+    CHECK_EQ(canonical("a AND AND b"), "error: Unexpected 'AND'");
+    CHECK_EQ(canonical("a OR"), "error: Query ends with an operator");
+    CHECK_EQ(canonical("NOT"), "error: Query ends with an operator");
+    CHECK_EQ(canonical("\"abc"), "error: Missing closing '\"'");
+
+    // Nesting is limited so a hostile query can't exhaust the stack
+    std::string deep = std::string(256, '(') + "a" + std::string(256, ')');
+    CHECK_EQ(canonical(deep), "1:a");
+    CHECK_EQ(canonical("(" + deep + ")"), "error: Query nested too deeply");
+    std::string nots;
+    for (int i = 0; i < 100000; ++i) {
+        nots += "NOT ";
+    }
+    CHECK_EQ(canonical(nots + "a"), "error: Query nested too deeply");
+}
+
+void testFuzzy() {
+    // With 0 the allowed edits follow the term's length
+    CHECK_EQ(fuzzy("ab abcd abcdefg", 0), "(and 2:ab (fuzzy 1 4:abcd) (fuzzy 2 7:abcdefg))");
+    CHECK_EQ(fuzzy("ab abcd", 2), "(and (fuzzy 2 2:ab) (fuzzy 2 4:abcd))");
+
+    // NOT-ed terms stay exact, and phrases are left alone
+    CHECK_EQ(fuzzy("numpy AND NOT pandas", 1), "(and (fuzzy 1 5:numpy) (not 6:pandas))");
+    CHECK_EQ(fuzzy("\"from typing\"", 1), "(phrase 4:from 6:typing)");
+
+    QueryNode query;
+    std::string error;
+    CHECK(parseQuery("ab", TokenizerOptions(), query, error));
+    CHECK(!makeFuzzy(query, 0));
+}
+
+} // namespace
+
+int main() {
+    testOperators();
+    testTerms();
+    testErrors();
+    testFuzzy();
+    return checkResult();
+}
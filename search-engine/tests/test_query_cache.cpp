@@ -0,0 +1,131 @@
+// Query cache: generations, invalidation, the byte budget and the
+// frequency sketch behind admission
+
+#include "check.h"
+#include "query_cache.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::shared_ptr<const std::string> value(const std::string& text) {
+    return std::make_shared<const std::string>(text);
+}
+
+void testDisabled() {
+    QueryCache cache(0);
+    CHECK(!cache.enabled());
+    cache.insert("a", value("1"), cache.generation());
+    CHECK(cache.lookup("a") == nullptr);
+    CHECK_EQ(cache.stats().entries, size_t(0));
+}
+
+void testGenerations() {
+    QueryCache cache(1 << 20);
+    CHECK(cache.lookup("a") == nullptr);
+
+    uint64_t generation = cache.generation();
+    auto stored = value("results for a");
+    cache.insert("a", stored, generation);
+    CHECK(cache.lookup("a") == stored);
+    CHECK(cache.lookup("b") == nullptr);
+
+    // Replacing a key keeps one entry
+    auto replaced = value("new results for a");
+    cache.insert("a", replaced, generation);
+    CHECK(cache.lookup("a") == replaced);
+    CHECK_EQ(cache.stats().entries, size_t(1));
+
+    // invalidate() drops everything and bumps the generation
+    cache.invalidate();
+    CHECK(cache.generation() != generation);
+    CHECK(cache.lookup("a") == nullptr);
+    CHECK_EQ(cache.stats().entries, size_t(0));
+    CHECK_EQ(cache.stats().bytes, size_t(0));
+
+    // A query that started before the invalidation can't store its results
+    cache.insert("b", value("stale"), generation);
+    CHECK(cache.lookup("b") == nullptr);
+    CHECK_EQ(cache.stats().rejections, uint64_t(1));
+
+    cache.insert("b", value("fresh"), cache.generation());
+    CHECK(cache.lookup("b") != nullptr);
+
+    QueryCache::Stats stats = cache.stats();
+    CHECK_EQ(stats.inserts, uint64_t(3));
+    CHECK_EQ(stats.hits, uint64_t(3));
+    CHECK_EQ(stats.misses, uint64_t(4));
+}
+
+void testBudget() {
+    const size_t budget = 64 * 1024;
+    QueryCache cache(budget);
+    std::string text(1000, 'x');
+    for (int i = 0; i < 1000; ++i) {
+        cache.insert("query " + std::to_string(i), value(text), cache.generation());
+        CHECK(cache.stats().bytes <= budget);
+    }
+    QueryCache::Stats stats = cache.stats();
+    CHECK(stats.entries > 0);
+    CHECK(stats.evictions + stats.rejections > 0);
+
+    // An entry larger than a shard's share of the budget is never stored
+    cache.insert("huge", value(std::string(budget, 'x')), cache.generation());
+    CHECK(cache.lookup("huge") == nullptr);
+}
+
+void testConcurrentInvalidate() {
+    // Writers racing an invalidation: nothing computed before it may be
+    // found after it
+    QueryCache cache(1 << 20);
+    uint64_t before = cache.generation();
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&cache, before, t] {
+            for (int i = 0; i < 2000; ++i) {
+                cache.insert(std::to_string(t) + ":" + std::to_string(i), value("old"), before);
+            }
+        });
+    }
+    cache.invalidate();
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+        for (int i = 0; i < 2000; ++i) {
+            CHECK(cache.lookup(std::to_string(t) + ":" + std::to_string(i)) == nullptr);
+        }
+    }
+}
+
+void testSketch() {
+    // A count-min sketch never underestimates (before aging, up to its
+    // counters' maximum of 15)
+    FrequencySketch sketch(1024);
+    TestRandom random(5);
+    std::vector<uint32_t> counts(200);
+    for (int i = 0; i < 1500; ++i) {
+        uint32_t key = random.below(static_cast<uint32_t>(counts.size()));
+        ++counts[key];
+        sketch.record(key * 0x9e3779b97f4a7c15ull);
+    }
+    for (uint32_t key = 0; key < counts.size(); ++key) {
+        uint32_t estimate = sketch.estimate(key * 0x9e3779b97f4a7c15ull);
+        CHECK(estimate >= std::min<uint32_t>(counts[key], 15));
+    }
+    CHECK_EQ(sketch.estimate(12345), 0u);
+}
+
+} // namespace
+
+int main() {
+    testDisabled();
+    testGenerations();
+    testBudget();
+    testConcurrentInvalidate();
+    testSketch();
+    return checkResult();
+}
@@ -0,0 +1,311 @@
+// Ranked search against brute-force BM25: every query shape the searcher
+// has a fast path for (WAND, conjunctive block-max, matched-then-scored)
+// must return the same top results as scoring every document
+
+#include "bm25.h"
+#include "check.h"
+#include "indexer.h"
+#include "mapped_index.h"
+#include "query.h"
+#include "searcher.h"
+#include "tokenizer.h"
+#include "top_k.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t NUM_DOCS = 2000;
+constexpr uint32_t VOCABULARY = 60;
+
+// Lower-case letters only, so the tokenizer keeps each word whole
+std::string word(uint32_t rank) {
+    return std::string("q") + static_cast<char>('a' + rank / 26) + static_cast<char>('a' + rank % 26);
+}
+
+// Term ranks with a Zipf-like distribution: rank r about 1 / (r + 1)
+uint32_t zipfRank(TestRandom& random) {
+    static std::vector<double> cumulative;
+    if (cumulative.empty()) {
+        double sum = 0.0;
+        for (uint32_t rank = 0; rank < VOCABULARY; ++rank) {
+            sum += 1.0 / (rank + 1);
+            cumulative.push_back(sum);
+        }
+    }
+    double x = static_cast<double>(random.next() >> 11) / 9007199254740992.0 * cumulative.back();
+    return static_cast<uint32_t>(std::upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin()) %
+           VOCABULARY;
+}
+
+struct Corpus {
+    std::vector<std::map<std::string, uint32_t>> frequencies;  // By docId
+    std::vector<uint32_t> lengths;
+};
+
+// Every document scored by the definition of BM25
+class Oracle {
+public:
+    Oracle(const Corpus& corpus, const MappedIndex& index, const std::vector<uint64_t>* deleted)
+        : corpus_(corpus), index_(index), deleted_(deleted) {
+        // Deleted documents still count towards IDF, as in the index
+        for (const auto& frequencies : corpus_.frequencies) {
+            for (const auto& entry : frequencies) {
+                ++docCounts_[entry.first];
+            }
+        }
+    }
+
+    std::vector<uint32_t> match(const QueryNode& query) const {
+        std::vector<uint32_t> docs;
+        for (uint32_t docId = 0; docId < corpus_.lengths.size(); ++docId) {
+            if (!isDeleted(docId) && matches(query, docId)) {
+                docs.push_back(docId);
+            }
+        }
+        return docs;
+    }
+
+    // Matches, best first, ties by docId
+    std::vector<SearchResult> rank(const QueryNode& query) const {
+        std::vector<std::string> terms;
+        scoringTerms(query, terms);
+        std::vector<SearchResult> results;
+        for (uint32_t docId : match(query)) {
+            results.push_back({docId, score(terms, docId)});
+        }
+        std::sort(results.begin(), results.end(), [](const SearchResult& a, const SearchResult& b) {
+            return a.score != b.score ? a.score > b.score : a.docId < b.docId;
+        });
+        return results;
+    }
+
+    float score(const std::vector<std::string>& terms, uint32_t docId) const {
+        float total = 0.0f;
+        for (const auto& term : terms) {
+            auto it = corpus_.frequencies[docId].find(term);
+            if (it != corpus_.frequencies[docId].end()) {
+                float norm = bm25::lengthNorm(corpus_.lengths[docId], index_.avgDocLength());
+                total += bm25::termWeight(docCount(term), index_.numDocs()) * bm25::tfNorm(it->second, norm);
+            }
+        }
+        return total;
+    }
+
+    static void scoringTerms(const QueryNode& node, std::vector<std::string>& terms) {
+        if (node.type == QueryNode::Type::Term) {
+            if (std::find(terms.begin(), terms.end(), node.term) == terms.end()) {
+                terms.push_back(node.term);
+            }
+        } else if (node.type != QueryNode::Type::Not) {
+            for (const auto& child : node.children) {
+                scoringTerms(child, terms);
+            }
+        }
+    }
+
+private:
+    bool matches(const QueryNode& node, uint32_t docId) const {
+        switch (node.type) {
+        case QueryNode::Type::Term:
+            return corpus_.frequencies[docId].count(node.term) > 0;
+        case QueryNode::Type::And:
+            return std::all_of(node.children.begin(), node.children.end(),
+                               [&](const QueryNode& child) { return matches(child, docId); });
+        case QueryNode::Type::Or:
+            return std::any_of(node.children.begin(), node.children.end(),
+                               [&](const QueryNode& child) { return matches(child, docId); });
+        case QueryNode::Type::Not:
+            return !matches(node.children[0], docId);
+        default:
+            return false;
+        }
+    }
+
+    uint32_t docCount(const std::string& term) const {
+        auto it = docCounts_.find(term);
+        return it == docCounts_.end() ? 0 : it->second;
+    }
+
+    bool isDeleted(uint32_t docId) const {
+        return deleted_ && ((*deleted_)[docId / 64] >> (docId % 64) & 1);
+    }
+
+    const Corpus& corpus_;
+    const MappedIndex& index_;
+    const std::vector<uint64_t>* deleted_;
+    std::map<std::string, uint32_t> docCounts_;
+};
+
+// Random query text using the operators' precedence: terms, ANDs of
+// terms with NOT-ed ones, ORs and nested groups
+std::string randomQuery(TestRandom& random) {
+    auto term = [&random]() { return random.below(40) == 0 ? std::string("qzz") : word(zipfRank(random)); };
+    switch (random.below(6)) {
+    case 0:
+        return term();
+    case 1:
+        return term() + " OR " + term() + (random.below(2) ? " OR " + term() : "");
+    case 2:
+        return term() + " " + term() + (random.below(2) ? " " + term() : "");
+    case 3:
+        return term() + " " + (random.below(2) ? term() + " " : "") + "AND NOT " + term();
+    case 4:
+        return "(" + term() + " OR " + term() + ") " + term();
+    default:
+        return term() + " OR " + term() + " AND NOT " + term();
+    }
+}
+
+void compare(const Searcher& searcher, const Oracle& oracle, const std::string& text, size_t limit) {
+    QueryNode query;
+    std::string error;
+    if (!parseQuery(text, TokenizerOptions(), query, error)) {
+        std::cerr << "can't parse " << text << ": " << error << std::endl;
+        CHECK(false);
+        return;
+    }
+
+    int failures = checkFailures();
+    CHECK(searcher.match(query) == oracle.match(query));
+
+    std::vector<SearchResult> expected = oracle.rank(query);
+    std::vector<SearchResult> actual = searcher.search(query, limit);
+    CHECK_EQ(actual.size(), std::min(limit, expected.size()));
+
+    // Scores are summed in different orders, so near-ties may swap: the
+    // score at each rank must agree, and each result must be a match
+    // scored as the oracle scores it
+    std::vector<std::string> terms;
+    Oracle::scoringTerms(query, terms);
+    std::vector<uint32_t> matched = oracle.match(query);
+    for (size_t i = 0; i < actual.size() && i < expected.size(); ++i) {
+        float tolerance = 1e-5f * std::max(1.0f, expected[i].score);
+        CHECK(std::fabs(actual[i].score - expected[i].score) <= tolerance);
+        CHECK(std::binary_search(matched.begin(), matched.end(), actual[i].docId));
+        CHECK(std::fabs(actual[i].score - oracle.score(terms, actual[i].docId)) <= tolerance);
+        if (i > 0) {
+            CHECK(actual[i - 1].score >= actual[i].score);
+        }
+    }
+    if (checkFailures() != failures) {
+        std::cerr << "query " << text << " (" << canonicalQuery(query) << "), limit " << limit << std::endl;
+    }
+}
+
+void testTopK() {
+    TestRandom random(8);
+    for (size_t k : {size_t(0), size_t(1), size_t(5), size_t(100), size_t(1000)}) {
+        std::vector<SearchResult> all;
+        TopK<SearchResult> top(k, 500);
+        for (uint32_t docId = 0; docId < 500; ++docId) {
+            // Few distinct scores, so ties have to go to the smaller docId
+            SearchResult result{docId, static_cast<float>(random.below(20))};
+            all.push_back(result);
+            top.push(result);
+            if (top.full() && k > 0) {
+                std::vector<SearchResult> sorted = all;
+                std::nth_element(sorted.begin(), sorted.begin() + (k - 1), sorted.end(),
+                                 [](const SearchResult& a, const SearchResult& b) { return a.score > b.score; });
+                CHECK_EQ(top.threshold(), sorted[k - 1].score);
+            }
+        }
+        std::sort(all.begin(), all.end(), [](const SearchResult& a, const SearchResult& b) {
+            return a.score != b.score ? a.score > b.score : a.docId < b.docId;
+        });
+        all.resize(std::min(k, all.size()));
+        std::vector<SearchResult> taken = top.take();
+        CHECK_EQ(taken.size(), all.size());
+        for (size_t i = 0; i < taken.size() && i < all.size(); ++i) {
+            CHECK_EQ(taken[i].docId, all[i].docId);
+            CHECK_EQ(taken[i].score, all[i].score);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    testTopK();
+
+    namespace fs = std::filesystem;
+    fs::path directory = fs::temp_directory_path() / ("search_engine_test_" + std::to_string(::getpid()));
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    // Documents of very different lengths, so length normalization and
+    // the block maxima matter
+    TestRandom random(9);
+    Corpus corpus;
+    std::vector<std::string> paths;
+    Tokenizer tokenizer;
+    for (uint32_t docId = 0; docId < NUM_DOCS; ++docId) {
+        uint32_t words = 1 + (random.below(10) == 0 ? random.below(1500) : random.below(60));
+        std::string text;
+        for (uint32_t i = 0; i < words; ++i) {
+            text += word(zipfRank(random));
+            text += random.below(8) == 0 ? "\n" : " ";
+        }
+
+        std::map<std::string, uint32_t> frequencies;
+        uint32_t length = tokenizer.tokenize(text, [&frequencies](std::string_view term, uint32_t) {
+            ++frequencies[std::string(term)];
+        });
+        corpus.frequencies.push_back(std::move(frequencies));
+        corpus.lengths.push_back(length);
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "doc%05u.txt", docId);
+        paths.push_back((directory / name).string());
+        std::ofstream(paths.back()) << text;
+    }
+
+    BuildOptions options;
+    options.positions = false;
+    options.trigrams = false;
+    Indexer indexer;
+    indexer.buildIndex(paths, options);
+    std::string indexFile = (directory / "index.bin").string();
+    CHECK(indexer.saveIndexToFile(indexFile));
+
+    MappedIndex index;
+    CHECK(index.open(indexFile) && index.buildLookup());
+    CHECK_EQ(index.numDocs(), NUM_DOCS);
+    if (checkFailures() == 0) {
+        Searcher searcher(index, indexer.getDocuments());
+        Oracle oracle(corpus, index, nullptr);
+        for (int i = 0; i < 300; ++i) {
+            std::string text = randomQuery(random);
+            for (size_t limit : {size_t(1), size_t(10), size_t(1000)}) {
+                compare(searcher, oracle, text, limit);
+            }
+        }
+
+        // Every fifth document deleted, as an update leaves them
+        std::vector<uint64_t> deleted((NUM_DOCS + 63) / 64);
+        for (uint32_t docId = 0; docId < NUM_DOCS; docId += 5) {
+            deleted[docId / 64] |= uint64_t(1) << (docId % 64);
+        }
+        searcher.setDeleted(&deleted);
+        Oracle withDeletes(corpus, index, &deleted);
+        for (int i = 0; i < 100; ++i) {
+            std::string text = randomQuery(random);
+            for (size_t limit : {size_t(1), size_t(10), size_t(1000)}) {
+                compare(searcher, withDeletes, text, limit);
+            }
+        }
+    }
+
+    index.close();
+    fs::remove_all(directory);
+    return checkResult();
+}